@@ -12,6 +12,16 @@
 //array of zeros, used as source to default initialize CRC fields
 static uint8_t zeros[4] = {0, 0, 0, 0};
 
+static uint8_t* allocateWithNew(size_t size) {
+    return new uint8_t[size];
+}
+
+static void deallocateWithDelete(uint8_t* data, size_t size) {
+    delete[] data;
+}
+
+BlockDataAllocator blockDataAllocator = {allocateWithNew, deallocateWithDelete};
+
 void CanonicalBlock::toCbor(uint8_t** cbor, size_t& cborSize) {
 
     CborEncoder encoderExternal = CborEncoder();
@@ -111,10 +121,9 @@ void CanonicalBlock::setAge(uint64_t age) {
         uint8_t buf[10];
         cbor_encoder_init(encoder, buf, sizeof(buf), 0);
         cbor_encode_uint(encoder, age);
-        delete[] this->blockTypeSpecificData;
-        size_t actualSize = cbor_encoder_get_buffer_size(encoder, buf);
-        blockTypeSpecificData = new uint8_t[actualSize];
-        memcpy(blockTypeSpecificData, buf, actualSize);
+        // the data may be shared with copies of this block, so it is replaced instead of modified
+        setData(buf, cbor_encoder_get_buffer_size(encoder, buf));
+        delete encoder;
     }
 }
 
@@ -31,7 +31,7 @@ void EID::print() {
     return;
 }
 
-std::string EID::getURI() {
+std::string EID::getURI() const {
     switch (schemeCode) {
         // detect the URI scheme and decode accordingly
         case URI_SCHEME_DTN_ENCODED:
@@ -1,4 +1,5 @@
 #pragma once
+#include <memory>
 #include "EID.hpp"
 #include "cbor.h"
 #include "esp_log.h"
@@ -25,6 +26,19 @@ uint32_t calculateCRC(uint8_t crcType, const uint8_t* data, size_t dataSize);
 /// @return whether the CRC check passed
 bool checkCRC(uint8_t crcType, const uint8_t* data, size_t dataSize);
 
+/// @brief allocates and frees the block type specific data of canonical blocks.
+///        The default uses new[] and delete[], dtn7-esp replaces it to place the data with its BundleAllocator
+struct BlockDataAllocator {
+    /// @brief allocates size bytes, must not return nullptr for a size larger than 0
+    uint8_t* (*allocate)(size_t size);
+
+    /// @brief frees data returned by allocate, size is the size given on allocation
+    void (*deallocate)(uint8_t* data, size_t size);
+};
+
+/// @brief the allocator used for the block type specific data of canonical blocks, should only be replaced before any block is created
+extern BlockDataAllocator blockDataAllocator;
+
 /// @brief represents a generic canonical block
 class CanonicalBlock {
    public:
@@ -43,8 +57,11 @@ class CanonicalBlock {
     /// @brief stores the crc type of the block
     uint64_t crcType;
 
-    /// @brief stores the block type specific data on the heap
-    uint8_t* blockTypeSpecificData;
+    /// @brief owns the block type specific data. The data is never modified, copies of the block share it and only copy the reference, a block whose data changes gets a new buffer
+    std::shared_ptr<const uint8_t[]> dataBuffer;
+
+    /// @brief points to the block type specific data held by dataBuffer, nullptr if the block has no data
+    const uint8_t* blockTypeSpecificData;
 
     /// @brief stores the CRC
     uint8_t* CRC;
@@ -68,11 +85,61 @@ class CanonicalBlock {
         return;
     };
 
-    /// @brief Deletes the canonical block
-    ~CanonicalBlock() {
-        delete[] blockTypeSpecificData;
-        delete[] CRC;
-    };
+    /// @brief Deletes the canonical block, the data is freed once no copy of the block uses it anymore
+    ~CanonicalBlock() { delete[] CRC; };
+
+    /// @brief allocates a buffer for block type specific data with the blockDataAllocator, to be handed to adoptData
+    /// @param size size of the buffer
+    /// @return the buffer, nullptr if size is 0
+    static uint8_t* allocateData(size_t size) {
+        if (size == 0)
+            return nullptr;
+        return blockDataAllocator.allocate(size);
+    }
+
+    /// @brief frees a buffer returned by allocateData which was not handed to a block
+    /// @param data the buffer, may be nullptr
+    /// @param size size given on allocation
+    static void freeData(uint8_t* data, size_t size) {
+        if (data != nullptr)
+            blockDataAllocator.deallocate(data, size);
+    }
+
+    /// @brief takes ownership of a buffer as the block type specific data
+    /// @param data buffer returned by allocateData, must not be modified afterwards
+    /// @param size size of the data
+    void adoptData(uint8_t* data, size_t size) {
+        if (data != nullptr) {
+            // the deallocator is taken from the time of allocation, so the buffer is freed correctly even if the blockDataAllocator is replaced afterwards
+            void (*deallocate)(uint8_t*, size_t) = blockDataAllocator.deallocate;
+            dataBuffer = std::shared_ptr<const uint8_t[]>(
+                data, [deallocate, size](const uint8_t* buffer) {
+                    deallocate(const_cast<uint8_t*>(buffer), size);
+                });
+        }
+        else
+            dataBuffer.reset();
+        blockTypeSpecificData = data;
+        dataSize = size;
+    }
+
+    /// @brief replaces the block type specific data with a copy of the given data
+    /// @param data the new data
+    /// @param size size of the data
+    void setData(const uint8_t* data, size_t size) {
+        uint8_t* buffer = allocateData(size);
+        if (buffer != nullptr)
+            memcpy(buffer, data, size);
+        adoptData(buffer, size);
+    }
+
+    /// @brief uses the block type specific data of another block, without copying it
+    /// @param other the block to share the data with
+    void shareData(const CanonicalBlock& other) {
+        dataBuffer = other.dataBuffer;
+        blockTypeSpecificData = other.blockTypeSpecificData;
+        dataSize = other.dataSize;
+    }
 
     /// @brief generates an empty canonical block (not valid)
     CanonicalBlock() {
@@ -94,13 +161,12 @@ class CanonicalBlock {
     /// @param data pointer to the data for the new block, needs to point to at least size amount of memory
     /// @param crcType type of CRC for this block, 0 = no CRC, 1 = CRC16, 2 = CRC32C, see RFC9171 for more information on the different CRC types
     CanonicalBlock(uint64_t type, uint64_t num, size_t size, uint64_t flags,
-                   uint8_t* data, uint8_t crcType = CRC_TYPE_NOCRC)
+                   const uint8_t* data, uint8_t crcType = CRC_TYPE_NOCRC)
         : blockTypeCode(type),
           blockNumber(num),
           blockProcessingControlFlags(flags),
           dataSize(size) {
-        blockTypeSpecificData = new uint8_t[size];
-        memcpy(blockTypeSpecificData, data, size);
+        setData(data, size);
         crcSize = 0;
         this->crcType = crcType;
         ESP_LOGD("Canonical Block", "CRC type:%u", crcType);
@@ -128,14 +194,13 @@ class CanonicalBlock {
     /// @param flags uint64_t representing the blockProcessingControlFlags of the new block
     /// @param data pointer to the data for the new block, needs to point to at least size amount of memory
     /// @param crcType type of CRC for this block, 0 = no CRC, 1 = CRC16, 2 = CRC32C, see RFC9171 for more information on the different CRC types
-    CanonicalBlock(uint64_t type, size_t size, uint64_t flags, uint8_t* data,
-                   uint8_t crcType = CRC_TYPE_NOCRC)
+    CanonicalBlock(uint64_t type, size_t size, uint64_t flags,
+                   const uint8_t* data, uint8_t crcType = CRC_TYPE_NOCRC)
         : blockTypeCode(type),
           blockProcessingControlFlags(flags),
           dataSize(size) {
-        blockTypeSpecificData = new uint8_t[size];
+        setData(data, size);
         blockNumber = 0;
-        memcpy(blockTypeSpecificData, data, size);
         crcSize = 0;
         this->crcType = crcType;
         ESP_LOGD("Canonical Block", "CRC type:%u", crcType);
@@ -220,11 +285,10 @@ class CanonicalBlock {
         valid = true;
     }
 
-    /// @brief canonical block copy constructor
+    /// @brief canonical block copy constructor, the data is shared with the old block
     /// @param old
     CanonicalBlock(const CanonicalBlock& old) {
-        blockTypeSpecificData = new uint8_t[old.dataSize];
-        dataSize = old.dataSize;
+        shareData(old);
         blockTypeCode = old.blockTypeCode;
         blockNumber = old.blockNumber;
         blockProcessingControlFlags = old.blockProcessingControlFlags;
@@ -232,20 +296,17 @@ class CanonicalBlock {
         crcSize = old.crcSize;
         valid = old.valid;
         CRC = new uint8_t[crcSize];
-        memcpy(blockTypeSpecificData, old.blockTypeSpecificData, old.dataSize);
         memcpy(CRC, old.CRC, old.crcSize);
     }
 
-    /// @brief canonical block operator=
+    /// @brief canonical block operator=, the data is shared with the old block
     /// @param old
     /// @return
     CanonicalBlock& operator=(const CanonicalBlock& old) {
         if (this == &old)
             return *this;
 
-        delete[] blockTypeSpecificData;
-        blockTypeSpecificData = new uint8_t[old.dataSize];
-        dataSize = old.dataSize;
+        shareData(old);
         blockTypeCode = old.blockTypeCode;
         blockNumber = old.blockNumber;
         blockProcessingControlFlags = old.blockProcessingControlFlags;
@@ -254,7 +315,6 @@ class CanonicalBlock {
         valid = old.valid;
         delete[] CRC;
         CRC = new uint8_t[crcSize];
-        memcpy(blockTypeSpecificData, old.blockTypeSpecificData, old.dataSize);
         memcpy(CRC, old.CRC, old.crcSize);
         return *this;
     }
@@ -586,10 +646,7 @@ class PreviousNodeBlock : public CanonicalBlock {
         uint8_t buf[20 + previous.sspSize];
         cbor_encoder_init(encoder, buf, sizeof(buf), 0);
         previous.toCbor(encoder);
-        CanonicalBlock::dataSize = cbor_encoder_get_buffer_size(encoder, buf);
-        CanonicalBlock::blockTypeSpecificData =
-            new uint8_t[CanonicalBlock::dataSize];
-        memcpy(blockTypeSpecificData, buf, CanonicalBlock::dataSize);
+        setData(buf, cbor_encoder_get_buffer_size(encoder, buf));
 
         delete encoder;
     }
@@ -648,10 +705,7 @@ class BundleAgeBlock : public CanonicalBlock {
         cbor_encoder_init(encoder, buf, sizeof(buf), 0);
         cbor_encode_uint(encoder, age);
 
-        size_t actualSize = cbor_encoder_get_buffer_size(encoder, buf);
-        CanonicalBlock::blockTypeSpecificData = new uint8_t[actualSize];
-        memcpy(CanonicalBlock::blockTypeSpecificData, buf, actualSize);
-        dataSize = actualSize;
+        setData(buf, cbor_encoder_get_buffer_size(encoder, buf));
         delete encoder;
     }
 
@@ -713,10 +767,7 @@ class HopCountBlock : public CanonicalBlock {
         cbor_encode_uint(encoder2, hopLimit);
         cbor_encode_uint(encoder2, hopCount);
         cbor_encoder_close_container(encoder, encoder2);
-        size_t actualSize = cbor_encoder_get_buffer_size(encoder, buf);
-        blockTypeSpecificData = new uint8_t[actualSize];
-        memcpy(blockTypeSpecificData, buf, actualSize);
-        dataSize = actualSize;
+        setData(buf, cbor_encoder_get_buffer_size(encoder, buf));
         delete encoder;
         delete encoder2;
     }
@@ -741,7 +792,8 @@ class PayloadBlock : public CanonicalBlock {
     /// @param data
     /// @param size
     /// @param crcType  type of CRC for this block, 0 = no CRC, 1 = CRC16, 2 = CRC32C, see RFC9171 for more information on the different CRC types
-    PayloadBlock(uint8_t* data, size_t size, uint8_t crcType = CRC_TYPE_NOCRC)
+    PayloadBlock(const uint8_t* data, size_t size,
+                 uint8_t crcType = CRC_TYPE_NOCRC)
         : CanonicalBlock(1, 1, size, 0, data) {
 
         CanonicalBlock::crcType = crcType;
@@ -765,9 +817,9 @@ class PayloadBlock : public CanonicalBlock {
         valid = true;
     }
 
-    /// @brief primary block constructor from generic canonical block
+    /// @brief payload block constructor from generic canonical block
     /// @param canonicalBlock
-    PayloadBlock(CanonicalBlock& canonicalBlock)
+    PayloadBlock(const CanonicalBlock& canonicalBlock)
         : CanonicalBlock(canonicalBlock.blockTypeCode,
                          canonicalBlock.blockNumber,
                          canonicalBlock.blockProcessingControlFlags) {
@@ -789,12 +841,8 @@ class PayloadBlock : public CanonicalBlock {
             ESP_LOGE("Payload Block", "Unsupported CRC type: %llu", crcType);
         }
 
-        delete[] CanonicalBlock::blockTypeSpecificData;
-        CanonicalBlock::dataSize = canonicalBlock.dataSize;
-        CanonicalBlock::blockTypeSpecificData =
-            new uint8_t[canonicalBlock.dataSize];
-        memcpy(blockTypeSpecificData, canonicalBlock.blockTypeSpecificData,
-               canonicalBlock.dataSize);
+        // the payload is not copied, both blocks share it
+        shareData(canonicalBlock);
     }
 
     /// @brief Default constructor, not recommended to use, except you know what you are doing
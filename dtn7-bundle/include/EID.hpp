@@ -38,7 +38,7 @@ struct EID {
 
     /// @brief converts the EID object to a URI
     /// @return std::string containing the URI
-    std::string getURI();
+    std::string getURI() const;
 
     /// @brief generates an EID object from a std::String containing a URI. Do NOT pass a IPN URI which is not INT.INT, this will lead to runtime abort
     /// @param URI std::String containing a URI
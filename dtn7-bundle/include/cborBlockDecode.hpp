@@ -94,7 +94,7 @@ CanonicalBlock fromCborCanonical(CborValue * valueExt, size_t size)
         // Next block type: specific data, as a CBOR byte string
         if (cbor_value_is_byte_string(&value) && valid) {
             cbor_value_get_string_length(&value, &dataSize);
-            data = new uint8_t[dataSize];
+            data = CanonicalBlock::allocateData(dataSize);
             cbor_value_copy_byte_string(&value, data, &dataSize, &value);
         } else {
             ESP_LOGE("CanonicalBlockFromCbor", "Invalid cbor");
@@ -119,6 +119,8 @@ CanonicalBlock fromCborCanonical(CborValue * valueExt, size_t size)
                     ESP_LOGE("CanonicalBlockFromCbor", "Invalid cbor"); 
                     valid = false;
                     result.valid = false;
+                    CanonicalBlock::freeData(data, dataSize);
+                    delete[] CRClocal;
                     return result;
                     break;
                 }
@@ -133,6 +135,8 @@ CanonicalBlock fromCborCanonical(CborValue * valueExt, size_t size)
                     ESP_LOGE("CanonicalBlockFromCbor", "Invalid cbor");
                     valid = false;
                     result.valid = false;
+                    CanonicalBlock::freeData(data, dataSize);
+                    delete[] CRClocal;
                     return result;
                     break;
                 }
@@ -142,7 +146,10 @@ CanonicalBlock fromCborCanonical(CborValue * valueExt, size_t size)
 
     if (valid) {
         cbor_value_leave_container(valueExt, &value); // leave array containing creation timestamp
-        result = CanonicalBlock(type, number, dataSize, flags, data, crcType);
+        // the decoded data is handed to the block without copying it
+        result = CanonicalBlock(type, number, flags, crcType);
+        result.adoptData(data, dataSize);
+        data = nullptr;
     } else {
         result = CanonicalBlock();
     }
@@ -161,7 +168,7 @@ CanonicalBlock fromCborCanonical(CborValue * valueExt, size_t size)
     result.valid = valid;
 
 
-    if (data!= nullptr) delete[]data;
+    CanonicalBlock::freeData(data, dataSize);
     if (CRClocal!= nullptr) delete[]CRClocal;
 
     return result;
@@ -64,8 +64,9 @@ class BundleProtocolAgent {
 
     /// @brief Handles transmission of a new, locally generated Bundle
     /// @param bundle the bundle which is to be transmitted, allocated on the heap, as this pointer will later on be deleted!! just create a bundle* with new Bundle(...) and pass that pointer
+    /// @param priority optional, local storage priority of the bundle, used by the LowestPriority eviction policy, defaults to 0
     /// @return whether the transmission of the bundle to the received queue was successful.
-    bool bundleTransmission(Bundle* bundle);
+    bool bundleTransmission(Bundle* bundle, uint8_t priority = 0);
 
     /// @brief if the bundle with the given ID is stored for later transmission, it will be remove from storage. This effectively cancels any future retransmission attempts.
     /// The bundle is not removed from the processing queues, therefore if it currently resides in either the received or forwarding queue, or if it is currently beeing processed, the cancellation will fail.
@@ -76,8 +77,10 @@ class BundleProtocolAgent {
     /// @brief Handles the reception procedure described in RFC 9171 Section 5.6
     /// @param bundle the received bundle
     /// @param fromNode the sending node, if it is known
+    /// @param priority local storage priority of the bundle, only set for bundles created by this node, defaults to 0
     /// @return whether the reception was successful, could be false if i.e. the hop count defined in an eventual hop count block is exceeded, or if the bundle is deleted because of some processing control flags
-    bool bundleReception(Bundle* bundle, std::string fromNode = "none");
+    bool bundleReception(Bundle* bundle, std::string fromNode = "none",
+                         uint8_t priority = 0);
 
     /// @brief handles bundle Dispatching, as described in RFC9171 Section 5.3
     /// @param bundle bundle to dispatch
@@ -4,6 +4,7 @@
 #include <unordered_set>
 #include "CLA.hpp"
 #include "Data.hpp"
+#include "PeerAging.hpp"
 #include "dtn7-esp.hpp"
 
 /**
@@ -76,9 +77,12 @@ class BleCLA : public CLA {
     uint64_t lastSendTime = 0;
 
    public:
-    /// @brief store all currently known BLE peers, TODO age out of BLE peers
+    /// @brief store all currently known BLE peers, peers are aged out by peerAging
     std::unordered_set<BlePeer, BlePeerHasher> currentPeers;
 
+    /// @brief tracks the last seen time of the BLE peers, removes peers from currentPeers which were not seen for CONFIG_BLE_MAX_PEER_AGE ms
+    PeerAging peerAging;
+
     /// @brief returns the name of the CLA ("BLE CLA")
     /// @return std::string with the name of the CLA
     std::string getName() override;
@@ -111,7 +115,6 @@ class BleCLA : public CLA {
     void discoveredPeer(const uint type, const uint8_t val[6], char* name,
                         uint8_t nameLength);
 
-    /// @brief Task to periodically remove BLE peers which have not been seen, still TODO
-    /// @param arg
+    /// @brief removes BLE peers which have not been seen for longer than CONFIG_BLE_MAX_PEER_AGE, only the expired peers are looked at
     void cleanUpBlePeers();
 };
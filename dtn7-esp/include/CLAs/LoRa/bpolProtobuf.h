@@ -8,8 +8,12 @@
 #include <iostream>
 #include <sstream>
 #include "../proto-c/protocol.pb-c.h"
+#include "Clock.hpp"
+#include "SpatialGrid.hpp"
 #include "dtn7-esp.hpp"
 
+// largest packet LoraCLA::transmitData sends, the radio adds a 4 byte header to it
+#define BPOL_MAX_PACKET_SIZE 250
 
 /// @brief local debugging function, prints an array of bytes as hex
 /// @param array data to print
@@ -51,23 +55,24 @@ void decodeProtobuf(uint8_t* data, size_t datasize) {
 
             // check the Bundles validity
             if (received->valid) {
-                // attempt to get the sending node from storage. If it is already known the corresponding node object is returned, otherwise one is created
-                Node sender = DTN7::BPA->storage->getNode(
-                    std::string(packet->bundle_forward->sender));
-
-                // if the URI of the created or stored node is empty, update it to the now known URI
-                if (sender.URI == "none")
-                    sender.URI = std::string(packet->bundle_forward->sender);
-
-                // set the last seen time for the sending node
-                sender.setLastSeen();
-
-                // store the sender node in the list of known nodes
-                DTN7::BPA->storage->addNode(sender);
+                std::string senderURI =
+                    std::string(packet->bundle_forward->sender);
+
+                // if the sending node is already known, only its last seen time is updated in place
+                NodeId senderId = DTN7::BPA->storage->findNode(senderURI);
+                if (senderId == INVALID_NODE_ID ||
+                    !DTN7::BPA->storage->touchNode(senderId, DTN7::nowMs())) {
+                    // otherwise create the node, set its URI and last seen time and store it in the list of known nodes
+                    Node sender;
+                    sender.URI = senderURI;
+                    sender.setLastSeen();
+                    DTN7::BPA->storage->addNode(sender);
+                    DTN7::contactStarted(senderURI);
+                }
 
                 // create a received bundle containing the bundle and the URI of the sender
                 ReceivedBundle* recBundle =
-                    new ReceivedBundle(received, sender.URI);
+                    new ReceivedBundle(received, senderURI);
 
                 // send the Received bundle to the receiveQueue for further processing
                 xQueueSend(DTN7::BPA->receiveQueue, (void*)&recBundle,
@@ -87,39 +92,59 @@ void decodeProtobuf(uint8_t* data, size_t datasize) {
             Node sender = DTN7::BPA->storage->getNode(
                 std::string(packet->advertise->node_name));
             // if the URI of the created or stored node is empty, update it to the now known URI
-            if (sender.URI == "none")
+            bool newPeer = sender.URI == "none";
+            if (newPeer)
                 sender.URI = std::string(packet->advertise->node_name);
 
 #if CONFIG_useReceivedSet
-            // if usage of hashes of bundleIDs for reception confirmation is enabled in menuconfig, these hashes have to be read from the data
-            // field of the advertise message and inserted in the set of hashes received from this sender
-
-            // first find the corresponding entry in the data field
+            // if usage of bundle summaries is enabled in menuconfig, the summary of the bundles received or stored by the sender
+            // is read from the data field of the advertise message, it replaces the previously advertised one.
+            // If the sender left it out, or it is too full to be trusted, the previous one is discarded as well, so the forwarded to keys of the bundles are used instead
+            BundleSummary summary;
             for (int i = 0; i < packet->advertise->n_data; i++) {
-                if (strcmp(packet->advertise->data[i]->key, "BH") == 0) {
-                    // read bundlesHash from data map, this is a sting oh hashes delimited by ';'
-                    std::string bundlesHashes =
-                        std::string(packet->advertise->data[i]->value);
-
-                    // now split the string into the individual hashes for this a string stream is generated and split at the delimiter ';'
-                    std::stringstream hashesStream(bundlesHashes);
-                    std::string hashString;
-                    while (std::getline(hashesStream, hashString, ';')) {
-                        size_t hash = 0;
-                        std::stoul(hashString.c_str(), &hash);
-                        // add each hash to the received Hashes
-                        sender.receivedHashes.insert(hash);
-                    }
+                if (strcmp(packet->advertise->data[i]->key, "BF") == 0) {
+                    summary = BundleSummary::fromBase64(
+                        std::string(packet->advertise->data[i]->value));
+                    if (summary.empty())
+                        ESP_LOGW("decode proto",
+                                 "invalid bundle summary in advertise");
                 }
             }
+            if (!summary.empty() && summary.saturated()) {
+                ESP_LOGW("decode proto", "bundle summary in advertise saturated");
+                summary = BundleSummary();
+            }
+            sender.receivedSummary = std::move(summary);
 #endif
             // set the last seen time for the sending node
             sender.setLastSeen();
 
-            // ToDo Position: The advertise message can potentially contain position information. This would have to be decoded here
+            // if the sender advertised its position, it is stored with the node, the geographic router uses it. Positions outside the valid range are ignored
+            if (packet->advertise->position_case ==
+                    LORA__PROTOCOL__ADVERTISE__POSITION_LAT_LNG &&
+                packet->advertise->lat_lng != nullptr) {
+                if (isValidPosition(packet->advertise->lat_lng->lat,
+                                    packet->advertise->lat_lng->lng))
+                    sender.setPosition(packet->advertise->lat_lng->lat,
+                                       packet->advertise->lat_lng->lng);
+                else
+                    ESP_LOGW("decode proto", "invalid position in advertise");
+            }
 
             // store the sender node in the list of known nodes
             DTN7::BPA->storage->addNode(sender);
+
+            // forward the stored bundles a newly discovered peer has not received yet
+            if (newPeer)
+                DTN7::contactStarted(sender.URI);
+
+            // routing information advertised by the sender, e.g. delivery predictabilities, is handled by the router, after the encounter was registered
+            for (int i = 0; i < packet->advertise->n_data; i++) {
+                if (strcmp(packet->advertise->data[i]->key, "PR") == 0)
+                    DTN7::BPA->router->handleAdvertisement(
+                        sender.URI,
+                        std::string(packet->advertise->data[i]->value));
+            }
         } break;
         default:
             break;
@@ -186,41 +211,75 @@ void encodeAdvertisePacket(uint8_t** result, size_t* size) {
     // add position data structure to message
     advertise.no_pos = &pos;
 #endif
-    // initialize data map
-    advertise.n_data = 1;
-    advertise.data = (Lora__Protocol__Advertise__DataEntry**)malloc(
-        sizeof(Lora__Protocol__Advertise__DataEntry*) * advertise.n_data);
-    advertise.data[0] = (Lora__Protocol__Advertise__DataEntry*)malloc(
-        sizeof(Lora__Protocol__Advertise__DataEntry));
-    lora__protocol__advertise__data_entry__init(advertise.data[0]);
-
-    // add bundle hash key
-    advertise.data[0]->key = (char*)"BH";
+    // initialize data map, the entries only need to live until the message is packed
+    Lora__Protocol__Advertise__DataEntry entries[2];
+    Lora__Protocol__Advertise__DataEntry* entryPointers[2] = {&entries[0],
+                                                              &entries[1]};
+    for (Lora__Protocol__Advertise__DataEntry& entry : entries)
+        lora__protocol__advertise__data_entry__init(&entry);
+    advertise.data = entryPointers;
+    advertise.n_data = 0;
 
 #if CONFIG_useReceivedSet
-    // if usage of hashes of bundleIDs for reception confirmation is enabled in menuconfig, these hashes have to be stored in the data field of the advertise message
-
-    // first initialize string to store hashes
-    std::string bundlesHashes;
-
-    // insert hashes into string, separated by ';'
-    for (size_t hash : DTN7::localNode->receivedHashes) {
-        bundlesHashes.append(std::to_string(hash)).append(";");
+    // if usage of bundle summaries is enabled in menuconfig, the summary of the recently received bundles and of all stored bundles is added as base64, as the values of the data map are strings.
+    // Peers only forward the bundles missing from it to this node
+    BundleSummary receivedBundles = DTN7::receivedSummary->advertise();
+    BundleSummary bundleSummary = receivedBundles;
+    DTN7::BPA->storage->summarizeBundles(bundleSummary);
+
+    // with many stored bundles the summary would contain most IDs by chance and peers would skip bundles this node does not have. Then only the received bundles are advertised,
+    // if even these are too many the summary is left out, peers then fall back to the forwarded to keys of their bundles
+    if (bundleSummary.saturated())
+        bundleSummary = receivedBundles;
+    bool includeSummary = !bundleSummary.saturated();
+    std::string summary;
+    if (includeSummary) {
+        summary = bundleSummary.toBase64();
+        entries[advertise.n_data].key = (char*)"BF";
+        entries[advertise.n_data].value = (char*)summary.c_str();
+        advertise.n_data++;
     }
-
-    // ad string to corresponding field of advertise message
-    advertise.data[0]->value = (char*)bundlesHashes.c_str();
-
-    // clear set of received hashes of the local node
-    DTN7::localNode->receivedHashes.clear();
-#else
-    advertise.data[0]->value = (char*)"";
+    else
+        ESP_LOGW("BPoL", "bundle summary saturated, advertising without it");
 #endif
 
     // Set content to advertise message
     packet.content_case = LORA__PROTOCOL__PACKET__CONTENT_ADVERTISE;
     packet.advertise = &advertise;
 
+    // routing information of the router, e.g. delivery predictabilities, is only added if the router has any.
+    // If the advertisement would not fit into a single packet, the router is asked for shorter information until it fits, so the advertisement is not lost
+    std::string routing = DTN7::BPA->router->getAdvertisement();
+    while (!routing.empty()) {
+        entries[advertise.n_data].key = (char*)"PR";
+        entries[advertise.n_data].value = (char*)routing.c_str();
+        advertise.n_data++;
+        size_t packed = lora__protocol__packet__get_packed_size(&packet);
+        if (packed <= BPOL_MAX_PACKET_SIZE)
+            break;
+        advertise.n_data--;
+        size_t excess = packed - BPOL_MAX_PACKET_SIZE;
+        routing = excess < routing.size()
+                      ? DTN7::BPA->router->getAdvertisement(routing.size() -
+                                                            excess)
+                      : std::string();
+        ESP_LOGD("BPoL", "advertisement %u bytes too large, shortened routing "
+                 "information to %u characters",
+                 excess, routing.size());
+    }
+
+#if CONFIG_useReceivedSet
+    // with a long node name even the summary may not fit, it is then left out, so that peers still discover this node
+    if (includeSummary && routing.empty() &&
+        lora__protocol__packet__get_packed_size(&packet) >
+            BPOL_MAX_PACKET_SIZE) {
+        ESP_LOGW("BPoL",
+                 "advertisement too large, sending it without the summary of "
+                 "bundles");
+        advertise.n_data--;
+    }
+#endif
+
     // size of message
     size_t packet_length = lora__protocol__packet__get_packed_size(&packet);
     *result = new uint8_t[packet_length];
@@ -0,0 +1,162 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <vector>
+#include "sdkconfig.h"
+
+/**
+ * @file BundleAllocator.hpp
+ * @brief This file contains the BundleAllocator, which places large bundle buffers in external RAM (SPIRAM) if available, and the BundleBuffer type using it.
+ */
+
+/// @brief the memory pools the BundleAllocator can allocate from
+enum class MemoryPool : uint8_t {
+    /// @brief internal RAM, shared with the rest of the firmware
+    Internal = 0,
+    /// @brief external RAM (SPIRAM), if the board has it
+    External = 1
+};
+
+/// @brief provides the memory of the pools, replaced to simulate the pools, e.g. for tests on a host
+class MemoryBackend {
+   public:
+    virtual ~MemoryBackend() {};
+
+    /// @brief allocates memory from a pool
+    /// @param size number of bytes
+    /// @param pool the pool to allocate from
+    /// @return pointer to the memory, nullptr if the pool has no memory left
+    virtual void* allocate(size_t size, MemoryPool pool) = 0;
+
+    /// @brief frees memory allocated by allocate
+    virtual void deallocate(void* pointer) = 0;
+
+    /// @brief returns the pool a pointer was allocated from
+    virtual MemoryPool poolOf(const void* pointer) = 0;
+
+    /// @brief returns whether the pool exists
+    virtual bool available(MemoryPool pool) = 0;
+};
+
+/// @brief MemoryBackend using the ESP-IDF heap capabilities allocator, external RAM is used with MALLOC_CAP_SPIRAM
+class HeapCapsBackend : public MemoryBackend {
+   public:
+    void* allocate(size_t size, MemoryPool pool) override;
+    void deallocate(void* pointer) override;
+    MemoryPool poolOf(const void* pointer) override;
+    bool available(MemoryPool pool) override;
+};
+
+/// @brief Allocates the buffers of stored bundles. Buffers of at least CONFIG_ExternalAllocThreshold bytes are placed in external RAM, smaller ones in internal RAM, so that hot metadata stays in fast memory.
+///        If the preferred pool is not available or its limit is reached, the other pool is used.
+///        The memory used in each pool is counted and can be limited, storages use fits() and withinLimits() to decide whether bundles have to be removed.
+///        All methods are thread safe.
+class BundleAllocator {
+   private:
+    /// @brief the backend providing the memory
+    MemoryBackend* backend;
+
+    /// @brief bytes currently allocated in each pool
+    std::atomic<size_t> used[2];
+
+    /// @brief maximum bytes to allocate in each pool, 0 if not limited
+    size_t limits[2];
+
+    /// @brief buffers of at least this size are placed in external RAM
+    size_t externalThreshold;
+
+    /// @brief checks whether size bytes can be allocated in a pool without exceeding its limit
+    bool hasRoom(MemoryPool pool, size_t size);
+
+   public:
+    /// @brief creates an allocator
+    /// @param backend the backend providing the memory, not owned
+    /// @param internalLimit maximum bytes in internal RAM, 0 if not limited
+    /// @param externalLimit maximum bytes in external RAM, 0 if not limited
+    /// @param externalThreshold buffers of at least this size are placed in external RAM
+    BundleAllocator(MemoryBackend* backend, size_t internalLimit,
+                    size_t externalLimit, size_t externalThreshold);
+
+    /// @brief returns the allocator used for bundle buffers, configured in menuconfig
+    static BundleAllocator& instance();
+
+    /// @brief makes canonical blocks place their block type specific data, e.g. the payload, with instance(), so payloads of bundles held as objects are counted and placed like serialized bundles
+    static void useForBlockData();
+
+    /// @brief replaces the backend, must be called before any buffer is allocated, e.g. to simulate the pools on a host
+    /// @param backend the new backend, not owned
+    void setBackend(MemoryBackend* backend) { this->backend = backend; };
+
+    /// @brief returns the pool a buffer of the given size would be placed in
+    /// @param size number of bytes
+    /// @param pool set to the chosen pool
+    /// @return false if neither pool has room for the buffer
+    bool choosePool(size_t size, MemoryPool& pool);
+
+    /// @brief checks whether a buffer of the given size can be allocated without exceeding the pool limits
+    bool fits(size_t size);
+
+    /// @brief checks whether no pool exceeds its limit, allocations above the limits are served, storages then remove bundles until this holds again
+    /// @param released bytes per pool which are about to be freed and are not counted, may be nullptr
+    bool withinLimits(const size_t* released = nullptr);
+
+    /// @brief returns the pool a buffer was allocated from
+    MemoryPool poolOf(const void* pointer) { return backend->poolOf(pointer); };
+
+    /// @brief allocates a buffer, from the other pool if the chosen one is exhausted
+    /// @param size number of bytes
+    /// @return pointer to the buffer, nullptr if no memory is left in both pools
+    void* allocate(size_t size);
+
+    /// @brief frees a buffer allocated by allocate
+    /// @param pointer pointer to the buffer
+    /// @param size size given on allocation
+    void deallocate(void* pointer, size_t size);
+
+    /// @brief returns the bytes currently allocated in a pool
+    size_t usage(MemoryPool pool) { return used[(int)pool]; };
+
+    /// @brief returns the limit of a pool, 0 if not limited
+    size_t limit(MemoryPool pool) { return limits[(int)pool]; };
+
+    /// @brief changes the limit of a pool, already allocated buffers are not moved
+    /// @param pool the pool
+    /// @param limit maximum bytes, 0 if not limited
+    void setLimit(MemoryPool pool, size_t limit) { limits[(int)pool] = limit; };
+};
+
+/// @brief STL allocator using BundleAllocator::instance(), used for buffers of stored bundles
+template <typename T>
+class PoolAllocator {
+   public:
+    typedef T value_type;
+
+    PoolAllocator() {};
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {};
+
+    /// @brief allocates the buffer of a container, which can not handle a failed allocation. Like operator new without exceptions, this aborts if no memory is left in both pools
+    T* allocate(size_t n) {
+        void* pointer = BundleAllocator::instance().allocate(n * sizeof(T));
+        if (pointer == nullptr)
+            abort();
+        return (T*)pointer;
+    };
+    void deallocate(T* pointer, size_t n) {
+        BundleAllocator::instance().deallocate(pointer, n * sizeof(T));
+    };
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const {
+        return true;
+    };
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>&) const {
+        return false;
+    };
+};
+
+/// @brief byte buffer allocated by the BundleAllocator, used for serialized bundles
+typedef std::vector<uint8_t, PoolAllocator<uint8_t>> BundleBuffer;
@@ -0,0 +1,130 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+
+/**
+ * @file BundleSummary.hpp
+ * @brief This file contains the BundleSummary, a compact Bloom filter of bundle IDs which nodes advertise to tell their peers which bundles they have received.
+ */
+
+/// @brief number of bits set per bundle ID
+#define BUNDLE_SUMMARY_HASHES 4
+
+/// @brief highest estimated false positive rate of a summary which is still advertised or used, a fuller summary would make peers skip too many bundles
+#define BUNDLE_SUMMARY_MAX_FALSE_POSITIVES 0.01f
+
+/// @brief encodes binary data as base64, used for binary values in the data map of advertisements, which have to be strings
+/// @param data the data
+/// @param length number of bytes
+/// @return the base64 string, padded with '='
+std::string base64Encode(const uint8_t* data, size_t length);
+
+/// @brief decodes a string encoded by base64Encode
+/// @param encoded the base64 string
+/// @param result vector the decoded bytes are written to
+/// @return false if the string is not valid base64, the result is then empty
+bool base64Decode(const std::string& encoded, std::vector<uint8_t>& result);
+
+/// @brief A fixed size Bloom filter of bundle IDs, exchanged in advertisements instead of a list of hashes.
+///        The bit positions only depend on the bundle ID and the size of the filter, so a summary received from a peer with a different configured size can still be queried.
+///        A false positive makes a node assume that a peer has received a bundle it has not, false negatives do not occur.
+///        This class is NOT thread safe.
+class BundleSummary {
+   private:
+    /// @brief the bits of the filter, empty if the summary contains no information
+    std::vector<uint8_t> bits;
+
+    /// @brief computes the two base hashes of a bundle ID, all bit positions are derived from them by double hashing
+    static void baseHashes(const std::string& id, uint32_t& h1, uint32_t& h2);
+
+   public:
+    /// @brief creates an empty summary without bits, which contains no bundle ID
+    BundleSummary() {};
+
+    /// @brief creates a summary with all bits cleared
+    /// @param size size of the filter in bytes
+    explicit BundleSummary(size_t size) : bits(size, 0) {};
+
+    /// @brief creates a summary from its bits, as returned by data
+    /// @param data the bits
+    /// @param length size of the filter in bytes
+    BundleSummary(const uint8_t* data, size_t length)
+        : bits(data, data + length) {};
+
+    /// @brief inserts a bundle ID, does nothing if the summary has no bits
+    /// @param id the bundle ID
+    void insert(const std::string& id);
+
+    /// @brief checks whether a bundle ID was inserted
+    /// @param id the bundle ID
+    /// @return true if the ID (probably) was inserted, false if it definitely was not or the summary has no bits
+    bool contains(const std::string& id) const;
+
+    /// @brief adds all bundle IDs of another summary of the same size
+    /// @param other the summary to add
+    void merge(const BundleSummary& other);
+
+    /// @brief removes all bundle IDs, keeping the size
+    void clear();
+
+    /// @brief returns whether the summary has no bits
+    bool empty() const { return bits.empty(); };
+
+    /// @brief estimates the false positive rate from the fraction of set bits
+    /// @return the probability that contains returns true for an ID which was not inserted, 1 if the summary has no bits
+    float falsePositiveRate() const;
+
+    /// @brief returns whether the summary is too full to be used, see BUNDLE_SUMMARY_MAX_FALSE_POSITIVES
+    bool saturated() const {
+        return falsePositiveRate() > BUNDLE_SUMMARY_MAX_FALSE_POSITIVES;
+    };
+
+    /// @brief returns the bits of the filter
+    const std::vector<uint8_t>& data() const { return bits; };
+
+    /// @brief encodes the bits as base64, used as value in the data map of advertisements, which has to be a string
+    /// @return the base64 string
+    std::string toBase64() const;
+
+    /// @brief decodes a summary encoded by toBase64
+    /// @param encoded the base64 string
+    /// @return the summary, empty if the string is not valid base64
+    static BundleSummary fromBase64(const std::string& encoded);
+};
+
+/// @brief The summary of the bundles received by the local node, which is advertised to peers.
+///        Two generations are kept, each advertisement contains both and starts a new one, so every received bundle is advertised at least once and then forgotten, which keeps the false positive rate bounded.
+///        All methods are thread safe.
+class LocalBundleSummary {
+   private:
+    /// @brief bundles received since the last advertisement
+    BundleSummary current;
+
+    /// @brief bundles received before the last advertisement
+    BundleSummary previous;
+
+    /// @brief mutex protecting both generations
+    SemaphoreHandle_t mutex;
+
+   public:
+    /// @brief creates the summary
+    /// @param size size of the filter in bytes
+    LocalBundleSummary(size_t size = CONFIG_ReceivedSummarySize);
+    ~LocalBundleSummary();
+
+    LocalBundleSummary(const LocalBundleSummary&) = delete;
+    LocalBundleSummary& operator=(const LocalBundleSummary&) = delete;
+
+    /// @brief inserts the ID of a received bundle
+    /// @param id the bundle ID
+    void insert(const std::string& id);
+
+    /// @brief returns the summary to advertise, containing both generations, and starts a new generation
+    /// @return the summary
+    BundleSummary advertise();
+};
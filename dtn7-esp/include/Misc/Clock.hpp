@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+#include <sys/time.h>
+
+/**
+ * @file Clock.hpp
+ * @brief Provides the time source used throughout the BPA. All components read the current time through these helpers instead of calling gettimeofday directly,
+ * this allows replacing the time source, e.g. with a virtual clock. There is a single time source for the whole BPA, it is not a per-instance context.
+ */
+
+namespace DTN7 {
+
+/// @brief function type of a time source, must return the current time in microseconds
+typedef uint64_t (*ClockSource)();
+
+/// @brief the default time source, reads the system time via gettimeofday
+/// @return the current system time in microseconds
+inline uint64_t systemClock() {
+    struct timeval tv_now;
+    gettimeofday(&tv_now, NULL);
+    return ((uint64_t)tv_now.tv_sec * 1000000L + (uint64_t)tv_now.tv_usec);
+}
+
+/// @brief the time source currently in use, by default the system time
+inline ClockSource clockSource = systemClock;
+
+/// @brief replaces the time source used by the BPA, should be called before DTN7::setup
+/// @param source the new time source, if nullptr the system time is used again
+inline void setClockSource(ClockSource source) {
+    clockSource = source != nullptr ? source : systemClock;
+}
+
+/// @brief returns the current time in microseconds, as given by the current time source
+/// @return current time in microseconds
+inline uint64_t nowUs() {
+    return clockSource();
+}
+
+/// @brief returns the current time in milliseconds, as given by the current time source
+/// @return current time in milliseconds
+inline uint64_t nowMs() {
+    return clockSource() / 1000;
+}
+
+}  // namespace DTN7
@@ -2,6 +2,8 @@
 #include <set>
 #include <string>
 #include <vector>
+#include "BundleAllocator.hpp"
+#include "BundleSummary.hpp"
 #include "EID.hpp"
 #include "dtn7-bundle.hpp"
 
@@ -30,8 +32,8 @@ class Node {
     /// @brief time the Node was Last seen in ms
     uint64_t lastSeen = 0;
 #if CONFIG_useReceivedSet
-    /// @brief if enabled in menuconfig, the hashes of received bundles are stored here
-    std::set<size_t> receivedHashes;
+    /// @brief if enabled in menuconfig, the summary of the bundles the node has recently received or stores, as last advertised by the node. Replaced by each advertisement
+    BundleSummary receivedSummary;
 
     /// @brief if confirmation of bundle reception via bundle id hashes is enabled in menuconfig,
     /// this is used to store that this node has confirmed the reception of a specific bundle.
@@ -63,7 +65,7 @@ class Node {
     static std::string idFromBytes(uint8_t* data, size_t dataSize);
 
     /// @brief serializes a node object useful for storing node objects
-    /// @return std::vector containing the bytes of the serialized node object
+    /// @return std::vector containing the bytes of the serialized node object, empty if the node could not be serialized
     std::vector<uint8_t> serialize();
 
     /// @brief prints the node object
@@ -91,6 +93,9 @@ class ReceivedBundle {
     /// @brief identifier of the node from which the bundle was received
     std::string fromAddr;
 
+    /// @brief local storage priority of the bundle, set for bundles created by this node
+    uint8_t priority = 0;
+
     /// @brief constructor for the received bundle
     /// @param bundle Bundle to be contained
     /// @param fromIdentifier identifier of node it was received from
@@ -102,6 +107,23 @@ class ReceivedBundle {
 
 /// @brief this class stores additional info to bundles and the corresponding Bundle
 class BundleInfo {
+   private:
+    /// @brief writes the compact record of the BundleInfo object: a version byte, a fixed header with flags, counts and timestamps, one reference per forwarded to node and the CBOR encoded bundle
+    /// @param buffer buffer to encode into, of at least serializedSize bytes
+    /// @param bundleCbor the CBOR encoded bundle
+    /// @param bundleSize size of the CBOR encoded bundle
+    /// @return number of bytes written
+    size_t encode(uint8_t* buffer, const uint8_t* bundleCbor, size_t bundleSize);
+
+    /// @brief returns the exact size of the compact record
+    /// @param bundleSize size of the CBOR encoded bundle
+    size_t serializedSize(size_t bundleSize);
+
+    /// @brief reads a compact record written by encode
+    /// @param serialized pointer to the record
+    /// @param length length of the record
+    void decodeRecord(const uint8_t* serialized, size_t length);
+
    public:
     /// @brief whether the Bundle was locally delivered
     bool locallyDelivered = false;
@@ -115,13 +137,34 @@ class BundleInfo {
     /// @brief last system time the Bundle was broadcast
     uint64_t lastBroadcastTime = 0;
 
+    /// @brief number of copies of the bundle this node may still hand to other nodes, used by the SprayAndWaitRouter, 0 if it was not determined yet. Not transmitted with the bundle, which carries its own copy count block
+    uint16_t copies = 0;
+
+    /// @brief local storage priority of the bundle, bundles with a lower priority are removed first by the LowestPriority eviction policy. Set by Endpoint::send for bundles created by this node, received bundles have priority 0. Stored with the bundle, but not transmitted
+    uint8_t priority = 0;
+
+    /// @brief index of the static route matching the bundle's destination, -1 if none matches, cached by StaticRoutingTable::match. Not serialized
+    int32_t staticRoute = -1;
+
+    /// @brief version of the static routing table the cached static route was matched with, 0 if it was never matched. Not serialized
+    uint32_t staticRouteVersion = 0;
+
+    /// @brief whether this is a copy of a bundle leased from storage by Storage::leaseBatch, the bundle then is still stored and has to be committed, released or removed. Not serialized
+    bool leased = false;
+
     /// @brief the actual Bundle data
     Bundle bundle;
 
     /// @brief generates a BundleInfo object from a serialized BundleInfo Object, as created using BundleInfo::serialize.
+    /// BundleInfos serialized as CBOR by earlier versions can still be read.
     /// @param serialized
     BundleInfo(std::vector<uint8_t> serialized);
 
+    /// @brief generates a BundleInfo object from a serialized BundleInfo Object, without copying it first
+    /// @param serialized pointer to the serialized BundleInfo
+    /// @param length length of the serialized BundleInfo
+    BundleInfo(const uint8_t* serialized, size_t length);
+
     /// @brief generates a BundleInfo Object from a Bundle Object
     /// @param bundle
     BundleInfo(Bundle* bundle);
@@ -130,10 +173,28 @@ class BundleInfo {
 
     ~BundleInfo() {};
 
-    /// @brief serialization function for the bundle info class, used for storage
-    /// @return vector containing serialized BundleInfo object
+    /// @brief serialization function for the bundle info class, used for storage.
+    /// Forwarded to nodes are stored by reference (their URI and confirmed reception), so they do not contain EIDs, positions or received hashes after de-serializing.
+    /// @return vector of exactly the size of the serialized BundleInfo object
     std::vector<uint8_t> serialize();
 
+    /// @brief serializes the bundle info into a buffer allocated by the BundleAllocator, used by storages to place large bundles in external RAM
+    /// @return buffer containing serialized BundleInfo object
+    BundleBuffer serializeToBuffer();
+
+    /// @brief serializes only the metadata which changes while a bundle is stored: retention constraint, local delivery, forwarded to nodes, number of broadcasts, last broadcast time and number of copies
+    /// @return vector containing the serialized metadata
+    std::vector<uint8_t> serializeMetadata();
+
+    /// @brief overwrites the metadata of this object with metadata serialized by serializeMetadata
+    /// @param serialized pointer to the serialized metadata
+    /// @param length length of the serialized metadata
+    void updateMetadata(const uint8_t* serialized, size_t length);
+
+    /// @brief approximates the heap used by this object including the contained bundle, without serializing it
+    /// @return used memory in bytes
+    size_t memoryUsage();
+
     /// @brief function to set retention constraints
     /// @param constraint retention constraint to set, see Bundle class for definition of Retention constraints
     void setRetentionConstraint(uint constraint);
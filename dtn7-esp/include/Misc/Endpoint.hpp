@@ -1,10 +1,13 @@
 #pragma once
+#include <atomic>
+#include <functional>
 #include <vector>
 #include "BundleProtocolAgent.hpp"
 #include "EID.hpp"
 #include "dtn7-bundle.hpp"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 
 /**
@@ -14,21 +17,101 @@
 
 class BundleProtocolAgent;
 
+/// @brief metadata of a bundle delivered to an endpoint, taken from the bundles primary block
+struct DeliveryMetadata {
+    /// @brief creation time of the bundle in ms since the DTN epoch, 0 if the creating node had no accurate clock
+    uint64_t creationTime;
+
+    /// @brief sequence number of the bundles creation timestamp
+    uint64_t sequenceNumber;
+
+    /// @brief lifetime of the bundle in ms
+    uint64_t lifetime;
+
+    /// @brief bundle processing control flags of the bundle
+    uint64_t bundleProcessingControlFlags;
+
+    /// @brief time at which the bundle was received by this node, in ms
+    uint64_t receivedAt;
+};
+
+/// @brief read only view of a bundle delivered to an endpoint. Nothing is copied, all pointers and references are only valid during the callback invocation, copy anything that must be kept
+struct DeliveryView {
+    /// @brief pointer to the first byte of the bundles payload
+    const uint8_t* payload;
+
+    /// @brief size of the payload in bytes
+    size_t payloadSize;
+
+    /// @brief source EID of the bundle
+    const EID& source;
+
+    /// @brief destination EID of the bundle, if the same callback is used for multiple endpoints this identifies the invoking endpoint
+    const EID& destination;
+
+    /// @brief the full primary block of the bundle
+    const PrimaryBlock& primaryBlock;
+
+    /// @brief metadata of the bundle
+    DeliveryMetadata metadata;
+};
+
+/// @brief callback type receiving a DeliveryView, may capture state (e.g. a lambda with captures)
+typedef std::function<void(const DeliveryView&)> DeliveryCallback;
+
+/// @brief plain function callback type receiving a DeliveryView and the context pointer given when setting the callback
+typedef void (*DeliveryFunction)(const DeliveryView&, void*);
+
 /// @brief This Class represents an DTN endpoint, no differentiation of group/singleton endpoints is made.
 class Endpoint {
    private:
     /// @brief last time a bundle was created from this endpoint, in ms
     uint64_t lastCreationTime = 0;
 
-    /// @brief indicates whether the endpoint has a callback
-    bool hasCallback;
+    /// @brief indicates whether the endpoint has a callback, only changed under the inbox mutex, but atomic as the poll methods read it without the mutex
+    std::atomic<bool> hasCallback;
+
+    /// @brief the callback of the Endpoint, legacy callbacks set with setCallback are wrapped by an adapter
+    DeliveryCallback onDeliver;
+
+    /// @brief an entry of the endpoint inbox, stores the payload and primary block of a delivered bundle
+    struct InboxEntry {
+        /// @brief payload of the delivered bundle
+        std::vector<uint8_t> payload;
 
-    /// @brief the callback of the Endpoint arguments are std::vector<uint8_t> payload  ,std::string destination URI ,std::string Source URI, PrimaryBlock PrimaryBlock
-    void (*onReceive)(std::vector<uint8_t>, std::string, std::string,
-                      PrimaryBlock);
+        /// @brief primary block of the delivered bundle
+        PrimaryBlock primaryBlock;
+    };
 
-    /// @brief stores bundles to be polled from the endpoint, if nod callback is present
-    std::vector<Bundle> bundleBuffer;
+    /// @brief ring buffer storing delivered bundles to be polled from the endpoint, if no callback is present. Has CONFIG_EndpointInboxSize slots, which are allocated when the first bundle is queued
+    std::vector<InboxEntry> inbox;
+
+    /// @brief index of the oldest entry in the inbox
+    size_t inboxHead = 0;
+
+    /// @brief number of entries currently stored in the inbox
+    size_t inboxCount = 0;
+
+    /// @brief number of delivered bundles dropped because the inbox was full
+    uint32_t inboxDropped = 0;
+
+    /// @brief mutex protecting the inbox and the callback, the inbox is filled and the callback invoked by the bundle forwarder task, while the application task(s) read the inbox and change the callback
+    SemaphoreHandle_t inboxMutex;
+
+    /// @brief counting semaphore holding one count per inbox entry, tasks polling with a timeout block on it. Any number of tasks may poll concurrently, each delivered entry wakes one of them
+    SemaphoreHandle_t inboxAvailable = nullptr;
+
+    /// @brief creates the inbox mutex, the semaphore and the slots are only created when the endpoint is polled or a bundle is queued
+    void initInbox();
+
+    /// @brief returns the inbox semaphore, creating it on first use. Must be called while holding inboxMutex
+    SemaphoreHandle_t getInboxAvailable();
+
+    /// @brief removes the oldest entry from the inbox, waiting up to timeout ticks for one to be delivered
+    /// @param entry the entry the oldest inbox entry is swapped into
+    /// @param timeout maximum number of ticks to wait, 0 to return immediately, portMAX_DELAY to wait indefinitely
+    /// @return true if an entry was returned
+    bool popEntry(InboxEntry& entry, TickType_t timeout);
 
 #if CONFIG_AttachHopCountBlock
     /// @brief stores the hop limit used if a hop count block is configured to be attached
@@ -45,7 +128,20 @@ class Endpoint {
     uint64_t sequenceNum;
 
     /// @brief constructs an empty Endpoint object
-    Endpoint() { sequenceNum = 0; };
+    Endpoint() {
+        sequenceNum = 0;
+        hasCallback = false;
+        initInbox();
+    };
+
+    /// @brief Endpoints own their inbox mutex and are referenced by pointer from the BPA, therefore they must not be copied
+    Endpoint(const Endpoint&) = delete;
+
+    /// @brief Endpoints must not be copied
+    Endpoint& operator=(const Endpoint&) = delete;
+
+    /// @brief frees the inbox mutex and semaphore
+    ~Endpoint();
 
     /// @brief creates an endpoint with a specified address and the specified callback
     /// @param address URI of the new endpoint
@@ -54,6 +150,11 @@ class Endpoint {
              void (*onReceive)(std::vector<uint8_t>, std::string, std::string,
                                PrimaryBlock));
 
+    /// @brief creates an endpoint with a specified address and a view callback, which receives the delivered bundle without any copies being made
+    /// @param address URI of the new endpoint
+    /// @param onDeliver callback receiving a DeliveryView of the delivered bundle, WARNING: Callback is called from a different task! I must be thread safe!
+    Endpoint(std::string address, DeliveryCallback onDeliver);
+
     /// @brief creates an endpoint with a specified address without a callback
     /// @param address URI of the new endpoint
     Endpoint(std::string address);
@@ -63,21 +164,32 @@ class Endpoint {
     void setCallback(void (*onReceive)(std::vector<uint8_t>, std::string,
                                        std::string, PrimaryBlock));
 
+    /// @brief sets a view callback for the Endpoint, replacing any existing callback. The callback receives the delivered bundle without any copies being made
+    /// @param onDeliver callback receiving a DeliveryView of the delivered bundle, WARNING: Callback is called from a different task! I must be thread safe!
+    void setCallback(DeliveryCallback onDeliver);
+
+    /// @brief sets a view callback for the Endpoint using a plain function and a context pointer, replacing any existing callback
+    /// @param onDeliver function receiving a DeliveryView of the delivered bundle and the given context, WARNING: Callback is called from a different task! I must be thread safe!
+    /// @param context pointer passed unchanged to every invocation of onDeliver
+    void setCallback(DeliveryFunction onDeliver, void* context);
+
     /// @brief removes the callback from an endpoint
     void clearCallback();
 
     /// @brief Function called by the BPA if it receives a Bundle for the endpoint
-    /// @param bundle
-    void localBundleDelivery(Bundle bundle);
+    /// @param bundle the delivered bundle, only read during the call
+    void localBundleDelivery(const Bundle& bundle);
 
     /// @brief Function for sending data via the BundleProtocolAgent, the actual Bundle is created here, attaches BundleAgeBlock if Node does not have accurate Clock, if CONFIG_AttachHopCountBlock is true the hop count block is added here
     /// @param data the Payload to send, stored in a byte Vector
     /// @param destination destination EID of the Bundle
     /// @param anonymous optional ,whether to send the bundle anonymously, i.e. with dtn:none as sender id, defaults to false
     /// @param lifetime lifetime assigned to the generated bundle in ms, defaults to the value set in menuconfig
+    /// @param priority optional, local storage priority of the bundle, bundles with a lower priority are removed first by the LowestPriority eviction policy, defaults to 0. Not transmitted with the bundle
     /// @return whether the sending was successful
     bool send(std::vector<uint8_t> data, std::string destination,
-              bool anonymous = false, uint64_t lifetime = CONFIG_BundleTTL);
+              bool anonymous = false, uint64_t lifetime = CONFIG_BundleTTL,
+              uint8_t priority = 0);
 
     /// @brief Function for sending data via the BundleProtocolAgent, the actual Bundle is created here, attaches BundleAgeBlock if Node does not have accurate Clock, if CONFIG_AttachHopCountBlock is true the hop count block is added here
     /// @param data the Payload to send, should be a pointer to a array of uint8_t with the size passed in dataSize
@@ -85,36 +197,54 @@ class Endpoint {
     /// @param destination destination EID of the Bundle
     /// @param anonymous optional ,whether to send the bundle anonymously, i.e. with dtn:none as sender id, defaults to false
     /// @param lifetime lifetime assigned to the generated bundle in ms, defaults to the value set in menuconfig
+    /// @param priority optional, local storage priority of the bundle, bundles with a lower priority are removed first by the LowestPriority eviction policy, defaults to 0. Not transmitted with the bundle
     /// @return whether the sending was successful
     bool send(uint8_t* data, size_t dataSize, std::string destination,
-              bool anonymous = false, uint64_t lifetime = CONFIG_BundleTTL);
+              bool anonymous = false, uint64_t lifetime = CONFIG_BundleTTL,
+              uint8_t priority = 0);
 
     /// @brief Function for sending text via the BundleProtocolAgent, the actual Bundle is created here, attaches BundleAgeBlock if Node does not have accurate Clock, if CONFIG_AttachHopCountBlock is true the hop count block is added here
     /// @param text text to send
     /// @param destination  destination EID of the Bundle
     /// @param anonymous optional ,whether to send the bundle anonymously, i.e. with dtn:none as sender id, defaults to false
     /// @param lifetime lifetime assigned to the generated bundle in ms, defaults to the value set in menuconfig
+    /// @param priority optional, local storage priority of the bundle, bundles with a lower priority are removed first by the LowestPriority eviction policy, defaults to 0. Not transmitted with the bundle
     /// @return whether the sending was successful
     bool sendText(std::string text, std::string destination,
-                  bool anonymous = false, uint64_t lifetime = CONFIG_BundleTTL);
+                  bool anonymous = false, uint64_t lifetime = CONFIG_BundleTTL,
+                  uint8_t priority = 0);
 
     /// @brief poll the endpoint for newly received data, the data is written in to the corresponding fields, only the Payload of the first Bundle which was received since the last Poll is returned, call multiple times to receive multiple bundles
     /// @param data vector the received payload is written to
     /// @param source string to which the source URI is written to
     /// @param destination string to which the destination URI is written to
     /// @param PrimaryBlock Primary Block which will be overriden with the primary block of the received Bundle
+    /// @param timeout optional, maximum number of ticks to block until data is delivered, defaults to 0 (do not block), portMAX_DELAY blocks indefinitely. Several tasks may poll the same endpoint concurrently, each delivered bundle is returned to one of them
     /// @return true if data has been returned
     bool poll(std::vector<uint8_t>& data, std::string& source,
-              std::string& destination, PrimaryBlock& primaryBlock);
+              std::string& destination, PrimaryBlock& primaryBlock,
+              TickType_t timeout = 0);
 
     /// @brief poll the endpoint for newly received data, the first received payload is returned, only the Payload of the first Bundle which was received since the last Poll is returned, call multiple times to receive multiple bundles
-    /// @return a std::vector containing the bytes of the payload
-    std::vector<uint8_t> poll();
+    /// @param timeout optional, maximum number of ticks to block until data is delivered, defaults to 0 (do not block), portMAX_DELAY blocks indefinitely. Several tasks may poll the same endpoint concurrently, each delivered bundle is returned to one of them
+    /// @return a std::vector containing the bytes of the payload, empty if no data was available
+    std::vector<uint8_t> poll(TickType_t timeout = 0);
+
+    /// @brief poll the endpoint for multiple payloads at once, in the order they were received
+    /// @param maxCount maximum number of payloads to return
+    /// @param timeout optional, maximum number of ticks to block until at least one payload is delivered, defaults to 0 (do not block)
+    /// @return vector of up to maxCount payloads, empty if no data was available
+    std::vector<std::vector<uint8_t>> pollBatch(size_t maxCount,
+                                                TickType_t timeout = 0);
 
     /// @brief check whether data, which can be read using poll() is present
     /// @return true whether data can be read from this endpoint
     bool hasData();
 
+    /// @brief returns the number of delivered bundles that were dropped because the inbox was full
+    /// @return number of dropped bundles since the endpoint was created
+    uint32_t getDroppedCount();
+
     /// @brief operator== for endpoints, just compares the EID's scheme+SSP
     /// @param end
     /// @return
@@ -0,0 +1,98 @@
+#pragma once
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+/**
+ * @file PeerAging.hpp
+ * @brief This file contains the PeerAging class, which keeps track of when peers time out.
+ */
+
+/// @brief callback called for each peer which timed out
+/// @param key the key of the peer
+/// @param lastSeen the last seen time of the peer in ms, as known to the PeerAging object
+typedef std::function<void(const std::string& key, uint64_t lastSeen)>
+    PeerExpiredCallback;
+
+/// @brief Keeps track of the last seen time of peers and removes peers which were not seen for longer than a timeout.
+///        The peers are kept in a min-heap ordered by their last seen time, which, as all peers share the same timeout, is the same order as lastSeen + timeout.
+///        Each peer knows its position in the heap, so updating it on touch costs O(log n) and expiring only looks at the peers that actually timed out.
+///        All methods are thread safe, the expired callback is called without holding the internal mutex and may therefore call back into this object.
+class PeerAging {
+   private:
+    /// @brief a peer in the heap
+    struct Entry {
+        /// @brief key of the peer, i.e. its URI or name
+        std::string key;
+
+        /// @brief last time the peer was seen, in ms
+        uint64_t lastSeen;
+    };
+
+    /// @brief binary min-heap of all peers, ordered by lastSeen
+    std::vector<Entry> heap;
+
+    /// @brief position of each peer in the heap
+    std::unordered_map<std::string, size_t> positions;
+
+    /// @brief time in ms after which a peer which was not seen is expired
+    uint64_t timeout;
+
+    /// @brief called for each expired peer
+    PeerExpiredCallback onExpired;
+
+    /// @brief mutex protecting the heap and the positions
+    SemaphoreHandle_t mutex;
+
+    /// @brief swaps two heap entries and updates their positions
+    void swapEntries(size_t a, size_t b);
+
+    /// @brief moves an entry towards the root until the heap order is restored
+    void siftUp(size_t index);
+
+    /// @brief moves an entry towards the leaves until the heap order is restored
+    void siftDown(size_t index);
+
+    /// @brief removes the entry at the given position from the heap
+    void removeAt(size_t index);
+
+   public:
+    /// @brief creates a PeerAging object
+    /// @param timeout time in ms after which a peer which was not seen is expired
+    /// @param onExpired callback called for each expired peer
+    PeerAging(uint64_t timeout, PeerExpiredCallback onExpired);
+    ~PeerAging();
+
+    PeerAging(const PeerAging&) = delete;
+    PeerAging& operator=(const PeerAging&) = delete;
+
+    /// @brief adds a peer or updates the last seen time of a tracked peer. The last seen time is never moved backwards
+    /// @param key key of the peer
+    /// @param lastSeen time the peer was seen, in ms
+    void touch(const std::string& key, uint64_t lastSeen);
+
+    /// @brief stops tracking a peer, i.e. because it was removed by other means
+    /// @param key key of the peer
+    /// @return true if the peer was tracked
+    bool remove(const std::string& key);
+
+    /// @brief removes all peers which were not seen for longer than the timeout and calls the expired callback for each of them
+    /// @param now the current time in ms
+    /// @return the number of expired peers
+    size_t expire(uint64_t now);
+
+    /// @brief returns the time at which the next peer times out
+    /// @return time in ms, UINT64_MAX if no peer is tracked
+    uint64_t nextExpiry();
+
+    /// @brief changes the timeout, applies to all tracked peers
+    /// @param timeout the new timeout in ms
+    void setTimeout(uint64_t timeout);
+
+    /// @brief returns the number of tracked peers
+    size_t size();
+};
@@ -110,7 +110,7 @@ inline void encodeNodeArray(CborEncoder* encoder, std::vector<Node>& nodes) {
         std::vector<uint8_t> bytes = n.serialize();
 
         // encode serialized node as CBOR byte string
-        cbor_encode_byte_string(&encoderInternal, &bytes[0], bytes.size());
+        cbor_encode_byte_string(&encoderInternal, bytes.data(), bytes.size());
     }
 
     // close the CBOR array
@@ -206,56 +206,6 @@ inline Bundle* decodeBundle(CborValue* value) {
         return new Bundle();
 }
 
-/// @brief encodes a set of Hashes into a CBOR Array, can be decoded using decodeHashesSet.
-/// @param encoder the encoder onto which the hashes are to be written
-/// @param hashes the hashes to encode
-inline void encodeHashesSet(CborEncoder* encoder, std::set<size_t>& hashes) {
-    // create local CBOR encoder for use in the array
-    CborEncoder encoderInternal;
-
-    // create CBOR array
-    cbor_encoder_create_array(encoder, &encoderInternal, hashes.size());
-
-    // encode hashes
-    for (size_t hash : hashes) {
-        cbor_encode_uint(&encoderInternal, hash);
-    }
-    cbor_encoder_close_container(encoder, &encoderInternal);
-    return;
-}
-
-/// @brief decodes a set of Hashes from CBOR Array pointed to by the given CborValue. Such a CBOR array can be created using encodeHashesSet.
-/// @param value CBOR value to read from
-/// @return the set of Hashes encode in the CBOR Array
-inline std::set<size_t> decodeHashesSet(CborValue* value) {
-    // create result set
-    std::set<size_t> result;
-
-    // check whether CBOR value points to array
-    if (cbor_value_is_array(value)) {
-        // calculate array size
-        size_t numElems = 0;
-        cbor_value_get_array_length(value, &numElems);
-
-        // enter CBOR array
-        CborValue ArrayValue;
-        cbor_value_enter_container(value, &ArrayValue);
-
-        // decode elements from array
-        for (int i = 0; i < numElems; i++) {
-            // check whether array element is integer and add to result
-            if (cbor_value_is_unsigned_integer(&ArrayValue)) {
-                uint64_t hash = 0;
-                cbor_value_get_uint64(&ArrayValue, &hash);
-                result.insert((size_t)hash);
-            }
-        }
-        // For some reason it is not necessary to leave the CBOR array, uncommenting the following line may lead to errors
-        // cbor_value_leave_container(value ,&ArrayValue);
-    }
-    return result;
-}
-
 /// @brief base class for different hash functions to use in BPoL advertisements, to use a custom hash function a Class derived from this one must be provided and instantiated in dtn7-esp::setupClasses
 class HashWrapper {
    public:
@@ -0,0 +1,167 @@
+#pragma once
+#include <map>
+#include <unordered_map>
+#include "CLA.hpp"
+#include "Router.hpp"
+#include "Storage.hpp"
+#include "dtn7-bundle.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+/**
+ * @file ContactPlanRouter.hpp
+ * @brief This file contains the definitions for the ContactPlanRouter and its contacts.
+ */
+
+/// @brief a scheduled contact, during which the node "from" can send bundles to the node "to"
+struct Contact {
+    /// @brief identifier of the contact, assigned by the router
+    uint32_t id = 0;
+
+    /// @brief URI of the sending node
+    std::string from;
+
+    /// @brief URI of the receiving node
+    std::string to;
+
+    /// @brief time the contact opens in ms, in the time base of DTN7::nowMs()
+    uint64_t start = 0;
+
+    /// @brief time the contact closes in ms, in the time base of DTN7::nowMs()
+    uint64_t end = 0;
+
+    /// @brief transmission rate during the contact in bytes per second
+    uint32_t rate = 0;
+
+    /// @brief number of bytes of bundles scheduled into this contact
+    uint64_t booked = 0;
+
+    /// @brief returns the number of bytes which can be sent during the whole contact
+    uint64_t volume() const { return (end - start) * rate / 1000; }
+
+    /// @brief returns the number of bytes which are not scheduled yet
+    uint64_t remaining() const {
+        return booked < volume() ? volume() - booked : 0;
+    }
+};
+
+/// @brief  Contact plan router, forwarding bundles along scheduled contacts, e.g. gateways powered at fixed windows or data mules on timetables (cf. Contact Graph Routing).
+///         The contact plan lists the contacts between nodes with their start, end and rate. It can be loaded as text with loadContactPlan or extended contact by contact with addContact.
+///         For each bundle the route with the earliest arrival at its destination node is computed with Dijkstra's algorithm over the contacts, taking the volume still available in each contact into account. Routes are cached per destination node until the plan changes or their first contact can no longer carry the bundle.
+///         The bundle is scheduled into the first contact of its route, whose remaining volume is reduced by the size of the bundle, and is only sent once that contact has opened, to the next node of the route. It is then not kept, as only a single copy is forwarded along the route. A broadcast only counts as sent if the next node is a known peer, otherwise the bundle stays scheduled and is retried while the contact is open.
+///         While no contact of this node is open, stored bundles are only retried when the next contact opens, see nextRetry.
+///         Contact times use the clock of this node, contacts loaded before the clock is synchronized should use relative times.
+class ContactPlanRouter : public Router {
+   private:
+    /// @brief a bundle scheduled into a contact
+    struct Booking {
+        /// @brief identifier of the contact
+        uint32_t contact;
+
+        /// @brief size of the bundle in bytes
+        uint64_t size;
+    };
+
+    /// @brief a cached route to a destination node
+    struct Route {
+        /// @brief identifier of the first contact of the route
+        uint32_t firstContact;
+
+        /// @brief expected arrival at the destination node in ms
+        uint64_t arrival;
+    };
+
+    /// @brief pointer to the storage instance used
+    Storage* storage;
+
+    /// @brief the contacts of the plan which have not ended yet, ordered by their start
+    std::vector<Contact> contacts;
+
+    /// @brief identifier assigned to the next added contact
+    uint32_t nextContactId = 1;
+
+    /// @brief the bundles scheduled into contacts, keyed by the bundle ID
+    std::unordered_map<std::string, Booking> bookings;
+
+    /// @brief cached routes, keyed by the URI of the destination node, cleared whenever the plan changes
+    std::map<std::string, Route> routes;
+
+    /// @brief mutex protecting the contacts, bookings and cached routes
+    SemaphoreHandle_t mutex;
+
+    /// @brief removes all contacts which have ended, together with their bookings, the mutex must be held
+    /// @param now current time in ms
+    void removeEndedContacts(uint64_t now);
+
+    /// @brief returns the contact with the given identifier, the mutex must be held
+    /// @param id identifier of the contact
+    /// @return pointer to the contact, nullptr if it does not exist (anymore)
+    Contact* findContact(uint32_t id);
+
+    /// @brief computes the route with the earliest arrival at the node of a destination endpoint for a bundle of the given size, the mutex must be held
+    /// @param destination URI of the destination endpoint
+    /// @param size size of the bundle in bytes
+    /// @param now current time in ms
+    /// @param route reference the route is written to
+    /// @return whether a route was found
+    bool computeRoute(const std::string& destination, uint64_t size,
+                      uint64_t now, Route& route);
+
+    /// @brief returns the route to the node of a destination endpoint from the cache, if its first contact can still carry the bundle, or computes it, the mutex must be held
+    /// @param destination URI of the destination endpoint
+    /// @param size size of the bundle in bytes
+    /// @param now current time in ms
+    /// @param route reference the route is written to
+    /// @return whether a route was found
+    bool getRoute(const std::string& destination, uint64_t size,
+                  uint64_t now, Route& route);
+
+    /// @brief adds a contact, keeping the contacts ordered by their start, the mutex must be held
+    /// @param contact the contact, its identifier is assigned here
+    /// @return whether the contact was valid and the plan was not full
+    bool insertContact(Contact contact);
+
+   public:
+    /// @brief default constructor
+    ContactPlanRouter();
+
+    /// @brief generates a contact plan router
+    /// @param clas CLAs the router should use
+    /// @param storage storage class the router uses
+    ContactPlanRouter(std::vector<CLA*> clas, Storage* storage);
+
+    ~ContactPlanRouter();
+
+    /// @brief handles the forwarding of bundles as described in section 5.4 step 2 of RFC9171
+    /// @param bundle the bundle to forward
+    /// @param reasonCode a reference to a uint in which to store the reason code if the forwarding was unsuccessful
+    /// @return whether the bundle was forwarded to the next node of its route and does not need to be kept
+    bool handleForwarding(BundleInfo* bundle, uint& reasonCode) override;
+
+    /// @brief returns the start of the next contact of this node, or the default retry time while a contact of this node with scheduled bundles is open or no further contact is planned
+    /// @param now current time in ms
+    /// @return time of the next retry in ms
+    uint64_t nextRetry(uint64_t now) override;
+
+    /// @brief adds a contact to the plan
+    /// @param from URI of the sending node
+    /// @param to URI of the receiving node
+    /// @param start time the contact opens in ms, in the time base of DTN7::nowMs()
+    /// @param end time the contact closes in ms
+    /// @param rate transmission rate in bytes per second
+    /// @return whether the contact was added, false if it is invalid, has already ended or the plan is full
+    bool addContact(const std::string& from, const std::string& to,
+                    uint64_t start, uint64_t end, uint32_t rate);
+
+    /// @brief replaces the contact plan with one given as text.
+    ///         Each line describes a contact as "<start> <end> <from> <to> <rate>", with start and end in seconds of the clock of this node, or relative to the time of loading if prefixed with '+', and the rate in bytes per second. Empty lines and lines starting with '#' are ignored.
+    /// @param plan the contact plan
+    /// @return the number of contacts added, invalid lines are skipped
+    size_t loadContactPlan(const std::string& plan);
+
+    /// @brief removes all contacts and scheduled bundles
+    void clearContactPlan();
+
+    /// @brief returns a copy of the contacts which have not ended yet
+    std::vector<Contact> getContacts();
+};
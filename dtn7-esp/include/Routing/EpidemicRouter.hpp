@@ -15,9 +15,9 @@
 ///         By default, it is expected that all nodes which are currently in the list of known neighbors, as produced by the CLA's peer discovery mechanism, successfully receive a potential broadcast.
 ///
 ///         This assumption might be acceptable in some cases, but will not always be true. For this reason, an experimental feature is included in this routing strategy and the LoRa CLA which allows to check whether the transmissions were actually successful,
-///         and to detect whether a bundle was forwarded to a neighboring node by any other node. This mechanism uses a set of hashes of bundle IDs which are transmitted in the advertisement messages ,see the LoRa CLA.
+///         and to detect whether a bundle was forwarded to a neighboring node by any other node. This mechanism uses a compact summary (BundleSummary) of the IDs of the bundles each node received or stores, which is transmitted in the advertisement messages ,see the LoRa CLA.
 ///         If this feature is enabled, the nodes which are assumed to have received a given bundle are reevaluated at the start of the transmission attempt of the bundle and potentially removed from the list of nodes which have received the bundle,
-///         if the hash does not indicate a successful reception. The intervals in which bundles are evaluated for transmission, nodes advertise their presence and the time after which not recently seen nodes are removed from the known peers need to be adjusted to each other in order to have full benefit of this feature.
+///         if their summary does not indicate a successful reception. Bundles contained in the summary of a neighbor are not sent to it. The intervals in which bundles are evaluated for transmission, nodes advertise their presence and the time after which not recently seen nodes are removed from the known peers need to be adjusted to each other in order to have full benefit of this feature.
 ///         Furthermore, the overall benefit of this feature should be evaluated for the desired application.
 class EpidemicRouter : public Router {
    private:
@@ -45,6 +45,6 @@ class EpidemicRouter : public Router {
     /// @param forwardedTo the list of nodes which the bundle has been forwarded to
     /// @param bundleID the ID of the bundle
     /// @return true if the Node is in the forwarded to Vector and, if enabled, the reception of the BundleID was confirmed
-    bool checkForwardedTo(Node toCheck, std::vector<Node>& forwardedTo,
+    bool checkForwardedTo(const Node& toCheck, std::vector<Node>& forwardedTo,
                           std::string bundleID);
 };
\ No newline at end of file
@@ -0,0 +1,94 @@
+#pragma once
+#include <unordered_map>
+#include "CLA.hpp"
+#include "Router.hpp"
+#include "SpatialGrid.hpp"
+#include "Storage.hpp"
+#include "dtn7-bundle.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+/**
+ * @file GeoRouter.hpp
+ * @brief This file contains the definitions for the GeoRouter.
+ */
+
+/// @brief  Geographic router, forwarding bundles towards the last known position of their destination node, e.g. along linear deployments like pipelines.
+///         Positions are learned from the advertisements of the LoRa CLA in BPoL-compatible mode, which include the position of each node if enabled in menuconfig, or can be set for nodes with fixed positions with setPosition. The own position is taken from the local node, as updated by the GPS module.
+///         The known peers with a position are kept in a SpatialGrid, which is rebuilt whenever the known peers change. The last known position of every node is kept after it is no longer a peer, up to CONFIG_GeoMaxLocations nodes.
+///         Greedy forwarding: a bundle is sent to its destination if it is a known peer, otherwise to the peer nearest to its destination's position, if that peer is closer to it than this node. The bundle is then not kept, as only a single copy is forwarded.
+///         Recovery: if no peer is closer to the destination, or a position is unknown, the bundle is kept and, if enabled in menuconfig, forwarded to all peers which have not received it yet, like by the EpidemicRouter, until a closer peer or the destination is met.
+class GeoRouter : public Router {
+   private:
+    /// @brief the last known position of a node
+    struct Location {
+        /// @brief latitude in degrees
+        float lat;
+
+        /// @brief longitude in degrees
+        float lng;
+
+        /// @brief time the position was learned in ms, UINT64_MAX for positions set with setPosition
+        uint64_t updated;
+    };
+
+    /// @brief pointer to the storage instance used
+    Storage* storage;
+
+    /// @brief last known positions of nodes, keyed by the node URI
+    std::unordered_map<std::string, Location> locations;
+
+    /// @brief spatial index of the known peers with a position
+    SpatialGrid neighbors{CONFIG_GeoCellSize};
+
+    /// @brief version of the node table the spatial index was built from
+    uint32_t indexedVersion = UINT32_MAX;
+
+    /// @brief mutex protecting the positions and the spatial index
+    SemaphoreHandle_t mutex;
+
+    /// @brief rebuilds the spatial index from the known peers if they changed since it was built, and stores their positions, the mutex must be held
+    /// @param peers snapshot of the known peers
+    void updateIndex(const NodeSnapshot& peers);
+
+    /// @brief stores the last known position of a node, removing the oldest learned position if more than CONFIG_GeoMaxLocations are stored, the mutex must be held
+    void storeLocation(const std::string& nodeURI, const Location& location);
+
+    /// @brief sends a bundle to a single node, broadcast CLAs broadcast it
+    /// @param bundle the bundle to send
+    /// @param node the node
+    /// @param reason reference the reason code is written to
+    /// @return whether the bundle was sent
+    bool sendToNode(BundleInfo* bundle, Node& node, uint& reason);
+
+   public:
+    /// @brief default constructor
+    GeoRouter();
+
+    /// @brief generates a geographic router
+    /// @param clas CLAs the router should use
+    /// @param storage storage class the router uses
+    GeoRouter(std::vector<CLA*> clas, Storage* storage);
+
+    ~GeoRouter();
+
+    /// @brief handles the forwarding of bundles as described in section 5.4 step 2 of RFC9171
+    /// @param bundle the bundle to forward
+    /// @param reasonCode a reference to a uint in which to store the reason code if the forwarding was unsuccessful
+    /// @return whether the bundle was forwarded to its destination or a closer peer and does not need to be kept
+    bool handleForwarding(BundleInfo* bundle, uint& reasonCode) override;
+
+    /// @brief sets the position of a node, e.g. of a gateway in a fixed place which is not a peer. It is kept until changed and not replaced by advertised positions
+    /// @param nodeURI URI of the node
+    /// @param lat latitude in degrees
+    /// @param lng longitude in degrees
+    /// @return whether the position is valid and was set
+    bool setPosition(const std::string& nodeURI, float lat, float lng);
+
+    /// @brief returns the last known position of a node
+    /// @param nodeURI URI of the node
+    /// @param lat reference the latitude is written to
+    /// @param lng reference the longitude is written to
+    /// @return whether a position is known for the node
+    bool getPosition(const std::string& nodeURI, float& lat, float& lng);
+};
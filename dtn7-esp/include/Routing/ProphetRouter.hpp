@@ -0,0 +1,116 @@
+#pragma once
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include "CLA.hpp"
+#include "Router.hpp"
+#include "Storage.hpp"
+#include "dtn7-bundle.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+/**
+ * @file ProphetRouter.hpp
+ * @brief This file contains the definitions for the ProphetRouter.
+ */
+
+/// @brief version byte of the advertised predictability vector, version 1 hashed the node URIs as advertised instead of reducing them with nodeOf
+#define PROPHET_VECTOR_VERSION 2
+
+/// @brief  PRoPHET router, forwarding bundles along recurring contacts (cf. RFC6693).
+///         The router keeps a delivery predictability for each node it encountered directly or transitively. It increases on every encounter of a node, decays with time (aging) and is derived from the predictabilities advertised by encountered peers (transitivity).
+///         Nodes are identified by a 32 bit hash of their URI. The highest predictabilities are advertised as a compact binary vector, 5 bytes per node, which the LoRa CLA sends base64 encoded under the key "PR" of its advertisements.
+///         A bundle is forwarded to a peer if the peer is its destination, or if the peer advertised a higher predictability for the bundle's destination node than this node has. Bundles are kept until they were forwarded to their destination, or expire.
+///         Like the EpidemicRouter, this requires a peer discovery mechanism by the CLA. Peers which do not advertise predictabilities, e.g. those discovered by the BLE CLA, are only used for encounters and direct delivery.
+///         With broadcast CLAs, all known peers which have not received a bundle are expected to receive a broadcast, it is only sent if at least one of them is a suitable next hop.
+class ProphetRouter : public Router {
+   private:
+    /// @brief the predictabilities advertised by a peer, with the time they were received
+    struct PeerVector {
+        /// @brief time the vector was received in ms
+        uint64_t receivedAt;
+
+        /// @brief hash of the node URI and predictability quantized to 0-255
+        std::vector<std::pair<uint32_t, uint8_t>> entries;
+    };
+
+    /// @brief pointer to the storage instance used
+    Storage* storage;
+
+    /// @brief delivery predictabilities of this node, keyed by the hash of the node URI
+    std::unordered_map<uint32_t, float> predictabilities;
+
+    /// @brief the last predictability vector advertised by each peer, keyed by the hash of the peer URI
+    std::unordered_map<uint32_t, PeerVector> peerVectors;
+
+    /// @brief time the predictabilities were aged last in ms
+    uint64_t lastAging;
+
+    /// @brief mutex protecting the predictabilities and the peer vectors
+    SemaphoreHandle_t mutex;
+
+    /// @brief decays all predictabilities by gamma for each aging interval passed since the last aging, the mutex must be held
+    void age();
+
+    /// @brief removes the smallest predictabilities if more than CONFIG_ProphetMaxEntries are stored, the mutex must be held
+    void prune();
+
+    /// @brief returns the predictability advertised by a peer for a node, aged by the time since the vector was received, the mutex must be held
+    /// @param peer hash of the peer URI
+    /// @param node hash of the node URI
+    /// @return the predictability, 0 if the peer advertised none for the node
+    float peerPredictability(uint32_t peer, uint32_t node);
+
+   public:
+    /// @brief predictability of a node after it was encountered the first time, is initialized to a default value set in menuconfig, can be overridden at runtime
+    float pInit = CONFIG_ProphetPInit / 100.0f;
+
+    /// @brief scaling of predictabilities derived by transitivity, is initialized to a default value set in menuconfig, can be overridden at runtime
+    float beta = CONFIG_ProphetBeta / 100.0f;
+
+    /// @brief factor all predictabilities decay by in each aging interval, is initialized to a default value set in menuconfig, can be overridden at runtime
+    float gamma = CONFIG_ProphetGamma / 1000.0f;
+
+    /// @brief length of an aging interval in ms, is initialized to a default value set in menuconfig, can be overridden at runtime
+    uint64_t agingInterval = CONFIG_ProphetAgingInterval * 1000ULL;
+
+    /// @brief default constructor
+    ProphetRouter();
+
+    /// @brief generates a PRoPHET router
+    /// @param clas CLAs the router should use
+    /// @param storage storage class the router uses
+    ProphetRouter(std::vector<CLA*> clas, Storage* storage);
+
+    ~ProphetRouter();
+
+    /// @brief returns the hash identifying a node in the predictability vectors, the same on every node
+    /// @param nodeURI URI of the node or of an endpoint of the node, reduced to the node URI with nodeOf before hashing
+    static uint32_t hashURI(const std::string& nodeURI);
+
+    /// @brief handles the forwarding of bundles as described in section 5.4 step 2 of RFC9171
+    /// @param bundle the bundle to forward
+    /// @param reasonCode a reference to a uint in which to store the reason code if the forwarding was unsuccessful
+    /// @return whether the bundle was forwarded to its destination and does not need to be kept
+    bool handleForwarding(BundleInfo* bundle, uint& reasonCode) override;
+
+    /// @brief updates the predictability of an encountered peer
+    /// @param peerURI URI of the discovered peer
+    void contactStarted(const std::string& peerURI) override;
+
+    /// @brief returns the CONFIG_ProphetAdvertisedEntries highest predictabilities as base64 encoded vector, fewer if the vector would be longer than maxLength
+    /// @param maxLength maximum length of the encoded vector
+    /// @return the encoded vector, empty if no predictabilities are known or not even one fits
+    std::string getAdvertisement(size_t maxLength = SIZE_MAX) override;
+
+    /// @brief stores the predictability vector advertised by a peer and updates the transitive predictabilities
+    /// @param peerURI URI of the advertising peer
+    /// @param data the encoded vector
+    void handleAdvertisement(const std::string& peerURI,
+                             const std::string& data) override;
+
+    /// @brief returns the current delivery predictability of this node for a node
+    /// @param nodeURI URI of the node
+    /// @return the predictability between 0 and 1
+    float getPredictability(const std::string& nodeURI);
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include "CLA.hpp"
+#include "StaticRoutingTable.hpp"
 #include "Storage.hpp"
 #include "dtn7-bundle.hpp"
 
@@ -13,6 +14,25 @@ class Router {
    private:
     Storage* storage;
 
+    /// @brief forwards a bundle along a static route, over the route's CLA to its next hop. A broadcast only counts as forwarded if the next hop is a known peer, or the route has no next hop
+    /// @param bundle the bundle to forward
+    /// @param route the route matching the bundle's destination
+    /// @param reasonCode a reference to uint in which a reason code will be stored
+    /// @return whether the bundle was sent and does not need to be kept
+    bool forwardStatic(BundleInfo* bundle, const StaticRoute& route,
+                       uint& reasonCode);
+
+   protected:
+    /// @brief checks whether a destination endpoint belongs to a node, i.e. is the node's URI or one of its endpoints
+    /// @param nodeURI URI of the node
+    /// @param destination URI of the destination endpoint
+    static bool isDestinationNode(const std::string& nodeURI,
+                                  const std::string& destination);
+
+    /// @brief returns the URI of the node a destination endpoint belongs to, e.g. dtn://node0/ for dtn://node0/inbox. URIs of other schemes are returned unchanged
+    /// @param destination URI of the destination endpoint
+    static std::string nodeOf(const std::string& destination);
+
    public:
     /// @brief default constructor for the router base class, should never be called
     Router();
@@ -20,6 +40,9 @@ class Router {
     /// @brief Pointers to all stored CLA instances
     std::vector<CLA*> clas;
 
+    /// @brief static routes configured at runtime, bundles matching one of them are forwarded along it instead of by handleForwarding
+    StaticRoutingTable staticRoutes;
+
     virtual ~Router();
 
     /// @brief prepares bundle for forwarding, takes care off processing (cf. RFC 9171, 5.4 Bundle Forwarding Step 4)
@@ -31,6 +54,12 @@ class Router {
     /// @return a list of pointers to bundles which need to be handled, must be empty vector if bundles have been sent to queue
     std::vector<ReceivedBundle*> getNewBundles();
 
+    /// @brief forwards a bundle, called by the BundleProtocolAgent: bundles whose destination matches a static route are sent along it, all others are passed to handleForwarding
+    /// @param bundle the bundle to forward
+    /// @param reasonCode a reference to uint in which a reason reason code will be stored if the forwarding is not successful
+    /// @return whether the bundle was forwarded
+    bool forward(BundleInfo* bundle, uint& reasonCode);
+
     /// @brief Main bundle forwarding handling, cf. RFC9171Section 5.4 Step 2.
     ///         Decides to forward a bundle to potential receivers or to store the bundle.
     ///         Can use bundle deletion provided by BPA.
@@ -43,4 +72,33 @@ class Router {
     /// @param Bundle the bundle to send back
     /// @return whether the operation was successful
     virtual bool sendToPreviousNode(Bundle* bundle);
+
+    /// @brief Checks whether the router processes extension blocks of a type which is not supported by the BundleProtocolAgent itself, such blocks are then kept on reception regardless of their block processing control flags
+    /// @param blockTypeCode the type code of the block
+    /// @return whether the router processes blocks of this type, by default false
+    virtual bool supportsBlock(uint64_t blockTypeCode) { return false; };
+
+    /// @brief returns when the retry task should retry the stored bundles next, routers which know when their next contacts open can let bundles wait until then
+    /// @param now current time in ms
+    /// @return time of the next retry in ms, by default after the time between retries set in menuconfig
+    virtual uint64_t nextRetry(uint64_t now) {
+        return now + CONFIG_TimeBetweenStorageRetry * 1000ULL;
+    };
+
+    /// @brief called when a CLA discovers a new peer, routers which learn from encounters update their state here
+    /// @param peerURI URI of the discovered peer
+    virtual void contactStarted(const std::string& peerURI) {};
+
+    /// @brief returns routing information which CLAs with an advertisement mechanism include in their advertisements, must be safe to call from a CLA's task
+    /// @param maxLength maximum length of the returned string, routers shorten their information to fit, e.g. if the advertisement would not fit into a single packet
+    /// @return the routing information as a printable string, empty if the router has none or it does not fit
+    virtual std::string getAdvertisement(size_t maxLength = SIZE_MAX) {
+        return std::string();
+    };
+
+    /// @brief handles routing information advertised by a peer, as returned by the getAdvertisement of its router, must be safe to call from a CLA's task
+    /// @param peerURI URI of the advertising peer
+    /// @param data the advertised routing information
+    virtual void handleAdvertisement(const std::string& peerURI,
+                                     const std::string& data) {};
 };
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @file SpatialGrid.hpp
+ * @brief This file contains the SpatialGrid, a spatial index of node positions, and geographic helper functions.
+ */
+
+/// @brief returns the great circle distance between two positions
+/// @param lat1 latitude of the first position in degrees
+/// @param lng1 longitude of the first position in degrees
+/// @param lat2 latitude of the second position in degrees
+/// @param lng2 longitude of the second position in degrees
+/// @return the distance in meters
+double geoDistance(float lat1, float lng1, float lat2, float lng2);
+
+/// @brief checks whether a position is a valid position on the earth's surface, positions received from other nodes must be checked before they are used
+/// @param lat latitude in degrees
+/// @param lng longitude in degrees
+/// @return whether both coordinates are finite, the latitude in [-90, 90] and the longitude in [-180, 180]
+bool isValidPosition(float lat, float lng);
+
+/// @brief Spatial index of node positions, dividing the surface into a uniform grid of cells.
+///        Each node is stored in the cell containing its position, the nearest node to a point is found by searching the cells in rings around the point's cell, so only the nodes close to the point are looked at.
+///        The cells are a fixed number of degrees high and wide, their width in meters shrinks towards the poles, which is taken into account when searching.
+class SpatialGrid {
+   public:
+    /// @brief a node stored in the grid
+    struct Entry {
+        /// @brief URI of the node
+        std::string URI;
+
+        /// @brief latitude in degrees
+        float lat;
+
+        /// @brief longitude in degrees
+        float lng;
+    };
+
+   private:
+    /// @brief size of a cell in degrees
+    double cellDegrees;
+
+    /// @brief the nodes in each non-empty cell, keyed by the cell coordinates
+    std::unordered_map<uint64_t, std::vector<Entry>> cells;
+
+    /// @brief bounds of the cell coordinates of all nodes, limiting the search
+    int32_t minX = 0, maxX = 0, minY = 0, maxY = 0;
+
+    /// @brief number of stored nodes
+    size_t count = 0;
+
+    /// @brief returns the cell coordinates of a position
+    void cellOf(float lat, float lng, int32_t& x, int32_t& y) const;
+
+    /// @brief returns the key of a cell in the map of cells
+    static uint64_t key(int32_t x, int32_t y) {
+        return ((uint64_t)(uint32_t)x << 32) | (uint32_t)y;
+    }
+
+   public:
+    /// @brief creates an empty grid
+    /// @param cellSize height of a cell in meters
+    SpatialGrid(uint32_t cellSize);
+
+    /// @brief adds a node to the grid, nodes with an invalid position are not added
+    /// @param URI URI of the node
+    /// @param lat latitude in degrees
+    /// @param lng longitude in degrees
+    void insert(const std::string& URI, float lat, float lng);
+
+    /// @brief removes all nodes from the grid
+    void clear();
+
+    /// @brief returns the number of stored nodes
+    size_t size() const { return count; }
+
+    /// @brief finds the stored node nearest to a position
+    /// @param lat latitude in degrees
+    /// @param lng longitude in degrees
+    /// @param result reference the nearest node is written to
+    /// @param distance reference its distance in meters is written to
+    /// @return whether the grid contains any node and the position is valid
+    bool nearest(float lat, float lng, Entry& result, double& distance) const;
+};
@@ -0,0 +1,101 @@
+#pragma once
+#include <map>
+#include "CLA.hpp"
+#include "Router.hpp"
+#include "Storage.hpp"
+#include "dtn7-bundle.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+/**
+ * @file SprayAndWaitRouter.hpp
+ * @brief This file contains the definitions for the SprayAndWaitRouter and its copy count block.
+ */
+
+/// @brief block type code of the copy count block, taken from the range reserved for private and experimental use by RFC9171
+#define COPY_COUNT_BLOCK_TYPE 192
+
+/// @brief This block carries the number of copies of a bundle the receiving node may hand to other nodes.
+///        It is marked to be discarded by nodes which can not process it, so nodes using a different router forward the bundle without it.
+class CopyCountBlock : public CanonicalBlock {
+   public:
+    /// @brief constructs the copy count block, block number can be ignored if insertCanonicalBlock is to be used
+    /// @param copies the number of copies to store in the block
+    /// @param crcType  type of CRC for this block, 0 = no CRC, 1 = CRC16, 2 = CRC32C, see RFC9171 for more information on the different CRC types
+    /// @param blockNumber the block number of the block
+    CopyCountBlock(uint64_t copies, uint8_t crcType = CRC_TYPE_NOCRC,
+                   uint64_t blockNumber = 0);
+
+    /// @brief reads the number of copies from a copy count block
+    /// @param block the block, must have the type COPY_COUNT_BLOCK_TYPE
+    /// @param copies reference the number of copies is written to
+    /// @return whether the block contained a valid number of copies
+    static bool read(const CanonicalBlock& block, uint64_t& copies);
+};
+
+/// @brief  Binary Spray and Wait router.
+///         Each bundle starts with a budget of copies, determined by its destination when the bundle is forwarded the first time, and carries the number of copies the receiving node may hand on in a CopyCountBlock.
+///         On each contact with a known node which has not received the bundle yet, the node hands over half of its remaining copies (spray phase). Once only a single copy is left, the bundle is only forwarded to its destination (wait phase).
+///         Bundles are always forwarded directly if their destination is a known peer, other nodes receiving such a broadcast get no copies and drop the bundle.
+///         Like the EpidemicRouter, this requires a peer discovery mechanism by the CLA, as provided by the LoRa CLA in BPoL-compatible mode.
+///         A broadcast hands the same number of copies to every known neighbor which has not received the bundle yet, so it is only used while half of the remaining copies can be split between them, otherwise copies are only handed over via unicast CLAs.
+class SprayAndWaitRouter : public Router {
+   private:
+    /// @brief pointer to the storage instance used
+    Storage* storage;
+
+    /// @brief copy budgets configured for specific destination endpoints or nodes
+    std::map<std::string, uint16_t> budgets;
+
+    /// @brief mutex protecting the configured budgets
+    SemaphoreHandle_t budgetMutex;
+
+    /// @brief returns the number of copies a new bundle to the given destination starts with
+    /// @param destination URI of the destination endpoint
+    uint16_t copyBudget(const std::string& destination);
+
+    /// @brief reads the number of copies from the copy count block of a bundle
+    /// @param bundle the bundle
+    /// @param copies reference the number of copies is written to
+    /// @return whether the bundle has a valid copy count block
+    static bool readCopies(Bundle& bundle, uint64_t& copies);
+
+    /// @brief sets the number of copies carried by a bundle, adding a copy count block if it has none
+    /// @param bundle the bundle
+    /// @param copies number of copies the receiver may hand on
+    static void setCopies(Bundle* bundle, uint16_t copies);
+
+   public:
+    /// @brief number of copies a bundle starts with if no budget is configured for its destination, is initialized to a default value set in menuconfig, can be overridden at runtime
+    uint16_t defaultCopies = CONFIG_SprayCopies;
+
+    /// @brief default constructor
+    SprayAndWaitRouter();
+
+    /// @brief generates a spray and wait router
+    /// @param clas CLAs the router should use
+    /// @param storage storage class the router uses
+    SprayAndWaitRouter(std::vector<CLA*> clas, Storage* storage);
+
+    ~SprayAndWaitRouter();
+
+    /// @brief handles the forwarding of bundles as described in section 5.4 step 2 of RFC9171
+    /// @param bundle the bundle to forward
+    /// @param reasonCode a reference to a uint in which to store the reason code if the forwarding was unsuccessful
+    /// @return whether the bundle was forwarded to its destination and does not need to be kept
+    bool handleForwarding(BundleInfo* bundle, uint& reasonCode) override;
+
+    /// @brief the copy count block is processed by this router
+    /// @param blockTypeCode the type code of the block
+    /// @return whether the block is a copy count block
+    bool supportsBlock(uint64_t blockTypeCode) override;
+
+    /// @brief sets the number of copies bundles to a destination start with, bundles which are already forwarded keep their number of copies
+    /// @param destination URI of a destination endpoint, or of a node to set the budget of all its endpoints
+    /// @param copies number of copies, 1 to only forward bundles directly to their destination
+    void setCopyBudget(const std::string& destination, uint16_t copies);
+
+    /// @brief removes the copy budget set for a destination, bundles to it start with defaultCopies again
+    /// @param destination URI passed to setCopyBudget
+    void clearCopyBudget(const std::string& destination);
+};
@@ -0,0 +1,95 @@
+#pragma once
+#include <string>
+#include <utility>
+#include <vector>
+#include "Data.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+/**
+ * @file StaticRoutingTable.hpp
+ * @brief This file contains the definitions for the StaticRoutingTable and its routes.
+ */
+
+/// @brief a static route, forwarding bundles whose destination matches a pattern to a next hop over a CLA
+struct StaticRoute {
+    /// @brief pattern matched against the destination EID: a pattern ending with '*' matches all EIDs starting with the part before it, one ending with '/' all EIDs starting with it, e.g. all endpoints of a node, any other pattern only the EID itself
+    std::string pattern;
+
+    /// @brief URI of the node bundles are sent to, if empty bundles are only broadcast
+    std::string nextHop;
+
+    /// @brief name of the CLA used, as returned by CLA::getName(), if empty all CLAs may be used
+    std::string cla;
+};
+
+/// @brief  Table of static routes, configured at runtime and used for the bundles whose destination matches one of them, instead of the router's own forwarding decision.
+///         The patterns are compiled into a trie, so the route for a destination is found in time linear in the length of its EID, independent of the number of routes. If several patterns match, the longest one is used, an exact pattern takes precedence over a prefix pattern of the same length.
+///         The match is cached in the BundleInfo, until the table changes.
+class StaticRoutingTable {
+   private:
+    /// @brief a node of the trie, each node represents the prefix spelled by the characters on the path from the root
+    struct TrieNode {
+        /// @brief the next character of the prefix and the index of the child node
+        std::vector<std::pair<char, uint32_t>> children;
+
+        /// @brief index of the route whose pattern is exactly this prefix, -1 if there is none
+        int32_t exactRoute = -1;
+
+        /// @brief index of the route matching all EIDs starting with this prefix, -1 if there is none
+        int32_t prefixRoute = -1;
+    };
+
+    /// @brief the configured routes
+    std::vector<StaticRoute> routes;
+
+    /// @brief the trie compiled from the patterns, the root is the first node
+    std::vector<TrieNode> trie;
+
+    /// @brief incremented whenever the table changes, invalidating the matches cached in BundleInfos
+    uint32_t version = 1;
+
+    /// @brief mutex protecting the routes and the trie
+    SemaphoreHandle_t mutex;
+
+    /// @brief compiles the trie from the routes, the mutex must be held
+    void compile();
+
+    /// @brief returns the index of the route matching an EID, the mutex must be held
+    /// @param eid URI of the EID
+    /// @return index of the route, -1 if no route matches
+    int32_t lookup(const std::string& eid);
+
+   public:
+    StaticRoutingTable();
+
+    ~StaticRoutingTable();
+
+    /// @brief adds a route, replacing the route with the same pattern if there is one
+    /// @param pattern pattern matched against the destination EID of bundles, only a single '*' is allowed, at its end
+    /// @param nextHop URI of the node bundles are sent to, may be empty to only broadcast bundles over the given CLA
+    /// @param cla name of the CLA to use, empty to use any CLA
+    /// @return whether the route was valid and added
+    bool addRoute(const std::string& pattern, const std::string& nextHop,
+                  const std::string& cla);
+
+    /// @brief removes the route with the given pattern
+    /// @param pattern pattern passed to addRoute
+    /// @return whether a route was removed
+    bool removeRoute(const std::string& pattern);
+
+    /// @brief removes all routes
+    void clear();
+
+    /// @brief returns whether the table contains no routes
+    bool empty();
+
+    /// @brief finds the route for the destination of a bundle, using the match cached in the BundleInfo if the table did not change since
+    /// @param bundle the bundle, its cached match is updated
+    /// @param route reference the matching route is written to
+    /// @return whether a route matches the destination
+    bool match(BundleInfo* bundle, StaticRoute& route);
+
+    /// @brief returns a copy of the configured routes
+    std::vector<StaticRoute> getRoutes();
+};
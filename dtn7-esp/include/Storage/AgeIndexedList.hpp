@@ -0,0 +1,352 @@
+#pragma once
+#include <stdint.h>
+#include <iterator>
+#include <list>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "BundleQuery.hpp"
+#include "BundleSummary.hpp"
+
+/**
+ * @file AgeIndexedList.hpp
+ * @brief This file contains the AgeIndexedList container used by the in-memory storages to find their oldest bundle, the next bundle to evict, a bundle by its ID, or the bundles matching a query, without searching.
+ */
+
+/// @brief A list of stored bundles in insertion order, which additionally keeps an index of the bundles ordered by their reception time, an index ordered by their eviction rank and an index by bundle ID.
+///        The list order is used for retrying bundles (oldest inserted first), the age index is used to find the bundle with the oldest reception time,
+///        the rank index is used to find the next bundle to evict according to the eviction policy and the ID index is used to find, or remove a specific bundle.
+///        The BundleKeys of each element are indexed by destination and expiry time, so storages can return the bundles for an endpoint or the bundles expiring soon without reading them.
+///        Each element remembers its position in the age and rank index, therefore inserting costs O(log n), removing any element costs amortized O(1), as does a lookup by ID.
+///        This class is NOT thread safe, the owning storage has to ensure exclusive access.
+/// @tparam T type of the stored elements
+template <typename T>
+class AgeIndexedList {
+   private:
+    struct Entry;
+
+    /// @brief index of the elements, ordered by reception time or eviction rank, elements with equal keys are kept in insertion order
+    typedef std::multimap<uint64_t, typename std::list<Entry>::iterator>
+        AgeIndex;
+
+    /// @brief index of the elements by destination, the keys point to the destinations stored in the list entries, which do not move
+    typedef std::multimap<std::string_view, typename std::list<Entry>::iterator>
+        DestinationIndex;
+
+    /// @brief memory used by the list and index nodes of one element, excluding the memory owned by the stored value and the ID
+    static constexpr size_t ENTRY_MEMORY =
+        sizeof(Entry) + 2 * sizeof(void*) +  // list node
+        3 * (sizeof(typename AgeIndex::value_type) +
+             4 * sizeof(void*)) +  // tree nodes of the age, rank and expiry index
+        sizeof(typename DestinationIndex::value_type) +
+        4 * sizeof(void*) +  // tree node of the destination index
+        sizeof(std::pair<const std::string_view,
+                         typename std::list<Entry>::iterator>) +
+        2 * sizeof(void*);  // hash node, including the cached hash
+
+    /// @brief a list element, together with its ID and its position in the age index
+    struct Entry {
+        /// @brief the bundle ID of the element, the ID index refers to this string
+        std::string id;
+
+        /// @brief the stored element
+        T value;
+
+        /// @brief position of this element in the age index
+        typename AgeIndex::iterator agePosition;
+
+        /// @brief position of this element in the rank index
+        typename AgeIndex::iterator rankPosition;
+
+        /// @brief memory owned by the stored value, as given on insertion
+        size_t valueMemory;
+
+        /// @brief the queryable fields of the element
+        BundleKeys keys;
+
+        /// @brief position of this element in the destination index, end() if it has no destination
+        typename DestinationIndex::iterator destinationPosition;
+
+        /// @brief position of this element in the expiry index
+        typename AgeIndex::iterator expiryPosition;
+    };
+
+    /// @brief elements in insertion order
+    std::list<Entry> entries;
+
+    /// @brief elements ordered by reception time
+    AgeIndex byAge;
+
+    /// @brief elements ordered by eviction rank
+    AgeIndex byRank;
+
+    /// @brief elements ordered by destination
+    DestinationIndex byDestination;
+
+    /// @brief elements ordered by expiry time
+    AgeIndex byExpiry;
+
+    /// @brief elements by ID, the keys point to the IDs stored in the list entries, which do not move
+    std::unordered_map<std::string_view, typename std::list<Entry>::iterator>
+        byId;
+
+    /// @brief heap used by IDs which are too long to be stored inside the string object and by the stored values
+    size_t ownedMemory = 0;
+
+    /// @brief returns the heap used by an ID string
+    static size_t idHeapUsage(const std::string& id) {
+        return id.capacity() > std::string().capacity() ? id.capacity() + 1 : 0;
+    };
+
+   public:
+    /// @brief iterator over the stored elements in insertion order
+    class iterator {
+        friend class AgeIndexedList;
+        typename std::list<Entry>::iterator it;
+
+       public:
+        iterator(typename std::list<Entry>::iterator it) : it(it) {};
+        T& operator*() const { return it->value; };
+        T* operator->() const { return &it->value; };
+        iterator& operator++() {
+            ++it;
+            return *this;
+        };
+        bool operator==(const iterator& other) const { return it == other.it; };
+        bool operator!=(const iterator& other) const { return it != other.it; };
+
+        /// @brief returns the bundle ID of the element
+        const std::string& id() const { return it->id; };
+
+        /// @brief returns the queryable fields of the element
+        const BundleKeys& keys() const { return it->keys; };
+    };
+
+    /// @brief appends an element at the end of the list, an element with the same ID is replaced
+    /// @param id bundle ID of the element
+    /// @param value the element to store
+    /// @param receivedAt reception time of the element, used to determine the oldest element
+    /// @param rank eviction rank of the element, the element with the lowest rank is evicted first
+    /// @param valueMemory heap owned by the value, counted by memoryUsage()
+    /// @param keys the queryable fields of the element
+    /// @return iterator to the stored element
+    iterator push_back(std::string id, T value, uint64_t receivedAt,
+                       uint64_t rank, size_t valueMemory = 0,
+                       BundleKeys keys = BundleKeys()) {
+        erase(id);
+        entries.push_back({std::move(id), std::move(value), byAge.end(),
+                           byRank.end(), valueMemory, std::move(keys),
+                           byDestination.end(), byExpiry.end()});
+        auto last = std::prev(entries.end());
+        last->agePosition = byAge.emplace(receivedAt, last);
+        last->rankPosition = byRank.emplace(rank, last);
+        if (!last->keys.destination.empty())
+            last->destinationPosition = byDestination.emplace(
+                std::string_view(last->keys.destination), last);
+        last->expiryPosition = byExpiry.emplace(last->keys.expiresAt, last);
+        byId.emplace(std::string_view(last->id), last);
+        ownedMemory +=
+            idHeapUsage(last->id) + valueMemory + last->keys.heapUsage();
+        return iterator(last);
+    };
+
+    /// @brief appends an element at the end of the list, evicted oldest first. An element with the same ID is replaced
+    /// @param id bundle ID of the element
+    /// @param value the element to store
+    /// @param receivedAt reception time of the element, used to determine the oldest element and as eviction rank
+    /// @return iterator to the stored element
+    iterator push_back(std::string id, T value, uint64_t receivedAt) {
+        return push_back(std::move(id), std::move(value), receivedAt,
+                         receivedAt);
+    };
+
+    /// @brief returns the first element in insertion order
+    T& front() { return entries.front().value; };
+
+    /// @brief removes the first element in insertion order and returns it
+    /// @return the removed element
+    T pop_front() { return take(begin()); };
+
+    /// @brief returns the element with the oldest reception time
+    T& oldest() { return byAge.begin()->second->value; };
+
+    /// @brief returns the reception time of the oldest element, only valid if the list is not empty
+    uint64_t oldestTime() const { return byAge.begin()->first; };
+
+    /// @brief removes the element with the oldest reception time and returns it
+    /// @return the removed element
+    T pop_oldest() { return take(iterator(byAge.begin()->second)); };
+
+    /// @brief returns the element with the lowest eviction rank, which is evicted next
+    T& nextEvicted() { return byRank.begin()->second->value; };
+
+    /// @brief returns the lowest eviction rank, only valid if the list is not empty
+    uint64_t nextEvictedRank() const { return byRank.begin()->first; };
+
+    /// @brief removes the element with the lowest eviction rank and returns it
+    /// @return the removed element
+    T pop_evicted() { return take(iterator(byRank.begin()->second)); };
+
+    /// @brief looks up an element by its ID
+    /// @param id bundle ID of the element
+    /// @return iterator to the element, end() if it is not stored
+    iterator find(const std::string& id) {
+        auto found = byId.find(std::string_view(id));
+        return found == byId.end() ? end() : iterator(found->second);
+    };
+
+    /// @brief checks whether an element with the given ID is stored
+    /// @param id bundle ID of the element
+    bool contains(const std::string& id) const {
+        return byId.find(std::string_view(id)) != byId.end();
+    };
+
+    /// @brief appends the IDs of the elements whose destination starts with the given prefix, e.g. a node URI matches all endpoints of the node
+    /// @param prefix destination URI or prefix of it
+    /// @param result vector the IDs are appended to
+    /// @param limit maximum number of IDs in result
+    void findByDestination(const std::string& prefix,
+                           std::vector<std::string>& result,
+                           size_t limit) const {
+        for (auto it = byDestination.lower_bound(std::string_view(prefix));
+             it != byDestination.end() && result.size() < limit &&
+             it->first.substr(0, prefix.size()) == prefix;
+             ++it)
+            result.push_back(it->second->id);
+    };
+
+    /// @brief appends the IDs of the elements expiring before the given time, the soonest expiring first
+    /// @param time system time in ms
+    /// @param result vector the IDs are appended to
+    /// @param limit maximum number of IDs in result
+    void findExpiringBefore(uint64_t time, std::vector<std::string>& result,
+                            size_t limit) const {
+        for (auto it = byExpiry.begin(); it != byExpiry.end() &&
+                                         it->first < time &&
+                                         result.size() < limit;
+             ++it)
+            result.push_back(it->second->id);
+    };
+
+    /// @brief appends the IDs of the elements which were not forwarded to a node, in insertion order. This is not indexed, but only the unserialized keys are checked
+    /// @param nodeHash hash of the node URI, see BundleKeys::nodeHash
+    /// @param result vector the IDs are appended to
+    /// @param limit maximum number of IDs in result
+    void findNotForwardedTo(uint32_t nodeHash, std::vector<std::string>& result,
+                            size_t limit) const {
+        for (auto it = entries.begin();
+             it != entries.end() && result.size() < limit; ++it)
+            if (!it->keys.wasForwardedTo(nodeHash))
+                result.push_back(it->id);
+    };
+
+    /// @brief appends the IDs of the elements which are not contained in a summary, in insertion order
+    /// @param summary summary of the bundles a peer has, see BundleSummary
+    /// @param result vector the IDs are appended to
+    /// @param limit maximum number of IDs in result
+    void findMissingFrom(const BundleSummary& summary,
+                         std::vector<std::string>& result, size_t limit) const {
+        for (auto it = entries.begin();
+             it != entries.end() && result.size() < limit; ++it)
+            if (!summary.contains(it->id))
+                result.push_back(it->id);
+    };
+
+    /// @brief inserts the IDs of all elements into a summary
+    /// @param summary the summary
+    void summarize(BundleSummary& summary) const {
+        for (const auto& entry : entries)
+            summary.insert(entry.id);
+    };
+
+    /// @brief removes an element
+    /// @param position iterator to the element
+    /// @return iterator to the following element
+    iterator erase(iterator position) {
+        byAge.erase(position.it->agePosition);
+        byRank.erase(position.it->rankPosition);
+        if (position.it->destinationPosition != byDestination.end())
+            byDestination.erase(position.it->destinationPosition);
+        byExpiry.erase(position.it->expiryPosition);
+        byId.erase(std::string_view(position.it->id));
+        ownedMemory -= idHeapUsage(position.it->id) +
+                       position.it->valueMemory + position.it->keys.heapUsage();
+        return iterator(entries.erase(position.it));
+    };
+
+    /// @brief removes the element with the given ID
+    /// @param id bundle ID of the element
+    /// @return true if the element was stored
+    bool erase(const std::string& id) {
+        iterator position = find(id);
+        if (position == end())
+            return false;
+        erase(position);
+        return true;
+    };
+
+    /// @brief moves an element to the end of the list, e.g. after it was retried. Its position in the indexes does not change
+    /// @param position iterator to the element, stays valid
+    void move_to_back(iterator position) {
+        entries.splice(entries.end(), entries, position.it);
+    };
+
+    /// @brief replaces the queryable fields of an element, e.g. after it was forwarded to another node
+    /// @param position iterator to the element
+    /// @param keys the new queryable fields
+    void updateKeys(iterator position, BundleKeys keys) {
+        Entry& entry = *position.it;
+        if (entry.destinationPosition != byDestination.end())
+            byDestination.erase(entry.destinationPosition);
+        byExpiry.erase(entry.expiryPosition);
+        ownedMemory -= entry.keys.heapUsage();
+
+        entry.keys = std::move(keys);
+        entry.destinationPosition =
+            entry.keys.destination.empty()
+                ? byDestination.end()
+                : byDestination.emplace(
+                      std::string_view(entry.keys.destination), position.it);
+        entry.expiryPosition =
+            byExpiry.emplace(entry.keys.expiresAt, position.it);
+        ownedMemory += entry.keys.heapUsage();
+    };
+
+    /// @brief removes an element and returns it
+    /// @param position iterator to the element
+    /// @return the removed element
+    T take(iterator position) {
+        T result = std::move(position.it->value);
+        erase(position);
+        return result;
+    };
+
+    /// @brief returns an iterator to the first element in insertion order
+    iterator begin() { return iterator(entries.begin()); };
+
+    /// @brief returns an iterator past the last element
+    iterator end() { return iterator(entries.end()); };
+
+    /// @brief returns the number of stored elements
+    size_t size() const { return entries.size(); };
+
+    /// @brief returns whether no elements are stored
+    bool empty() const { return entries.empty(); };
+
+    /// @brief returns the memory used by the list, its indexes and the memory owned by the stored values, as given on insertion
+    size_t memoryUsage() const {
+        return entries.size() * ENTRY_MEMORY + ownedMemory +
+               byId.bucket_count() * sizeof(void*);
+    };
+
+    /// @brief returns the memory needed to add an element, excluding the memory owned by the value
+    /// @param id bundle ID of the element
+    /// @param keys the queryable fields of the element
+    static size_t entryMemory(const std::string& id,
+                              const BundleKeys& keys = BundleKeys()) {
+        return ENTRY_MEMORY + idHeapUsage(id) + keys.heapUsage();
+    };
+};
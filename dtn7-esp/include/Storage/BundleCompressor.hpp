@@ -0,0 +1,112 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+
+/**
+ * @file BundleCompressor.hpp
+ * @brief This file contains the BundleCompressor, which compresses serialized bundles kept in RAM with a small-window LZSS codec.
+ */
+
+/// @brief size of the LZSS window, matches can reach back this many bytes
+#define LZSS_WINDOW_SIZE 4096
+
+/// @brief shortest match encoded as a reference, shorter matches are stored as literals
+#define LZSS_MIN_MATCH 3
+
+/// @brief longest match encoded as a single reference
+#define LZSS_MAX_MATCH 18
+
+/// @brief whether the serialized storages compress bundles, as configured in menuconfig
+#if CONFIG_CompressSerializedBundles
+#define COMPRESS_SERIALIZED_BUNDLES true
+#else
+#define COMPRESS_SERIALIZED_BUNDLES false
+#endif
+
+/// @brief counters of a BundleCompressor, used to measure the compression ratio and its CPU cost
+struct CompressionStats {
+    /// @brief number of compressed bundles
+    uint32_t compressed = 0;
+
+    /// @brief number of bundles which were stored uncompressed, as compression did not make them smaller
+    uint32_t uncompressed = 0;
+
+    /// @brief bytes of all bundles given to compress
+    uint64_t inputBytes = 0;
+
+    /// @brief bytes of all results of compress, including the header
+    uint64_t outputBytes = 0;
+
+    /// @brief total time spent compressing in us
+    uint64_t compressTime = 0;
+
+    /// @brief number of decompressed bundles
+    uint32_t decompressed = 0;
+
+    /// @brief total time spent decompressing in us
+    uint64_t decompressTime = 0;
+
+    /// @brief returns the ratio between the original and the stored size of all bundles, 1 if no bundle was compressed
+    float ratio() const {
+        return outputBytes == 0 ? 1 : (float)inputBytes / outputBytes;
+    };
+};
+
+/// @brief Compresses serialized bundles with LZSS using a window of LZSS_WINDOW_SIZE bytes.
+///        Each compressor has its own dictionary, which is taken from the first bundle it compresses and never changes afterwards. As bundles stored by the same node share most of their structure, e.g. the CBOR headers, EIDs and node URIs, later bundles can reference it from their first byte.
+///        The compressed data starts with a header byte telling whether it is uncompressed, compressed, or compressed using the dictionary, so data which does not compress is stored with a single byte of overhead.
+///        compress and decompress can be called concurrently.
+class BundleCompressor {
+   private:
+    /// @brief the dictionary, empty until the first bundle was compressed
+    std::vector<uint8_t> dictionary;
+
+    /// @brief maximum size of the dictionary, 0 if no dictionary is used
+    size_t dictionarySize;
+
+    /// @brief set once the dictionary was taken, it is not changed afterwards and can be read without holding the mutex
+    bool dictionaryReady = false;
+
+    /// @brief whether bundles are compressed at all
+    bool enabled;
+
+    /// @brief counters of the compressor
+    CompressionStats stats;
+
+    /// @brief mutex protecting the counters and taking the dictionary
+    SemaphoreHandle_t mutex;
+
+   public:
+    /// @brief creates a compressor
+    /// @param enabled whether bundles are compressed, if false compress and decompress must not be called
+    /// @param dictionarySize maximum size of the dictionary, 0 to not use a dictionary
+    BundleCompressor(
+        bool enabled = COMPRESS_SERIALIZED_BUNDLES,
+        size_t dictionarySize = CONFIG_CompressionDictionarySize);
+    ~BundleCompressor();
+
+    BundleCompressor(const BundleCompressor&) = delete;
+    BundleCompressor& operator=(const BundleCompressor&) = delete;
+
+    /// @brief returns whether bundles are compressed, stores use the serialized bundles unchanged otherwise
+    bool isEnabled() const { return enabled; };
+
+    /// @brief compresses a serialized bundle
+    /// @param data the serialized bundle
+    /// @param length number of bytes
+    /// @return the compressed bundle, to be passed to decompress
+    std::vector<uint8_t> compress(const uint8_t* data, size_t length);
+
+    /// @brief restores a serialized bundle
+    /// @param data a result of compress
+    /// @param length number of bytes
+    /// @return the serialized bundle, empty if the data is corrupted
+    std::vector<uint8_t> decompress(const uint8_t* data, size_t length);
+
+    /// @brief returns the counters of the compressor
+    CompressionStats getStats();
+};
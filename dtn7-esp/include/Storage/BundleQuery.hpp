@@ -0,0 +1,41 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Data.hpp"
+
+/**
+ * @file BundleQuery.hpp
+ * @brief This file contains the BundleKeys, the fields of a stored bundle by which the storages can be queried without reading the bundle.
+ */
+
+/// @brief the fields of a stored bundle which are kept unserialized next to it, so that storages can answer queries without de-serializing or reading bundles
+struct BundleKeys {
+    /// @brief URI of the destination endpoint, empty if the bundle is not indexed by destination
+    std::string destination;
+
+    /// @brief estimated system time in ms at which the bundle expires
+    uint64_t expiresAt = UINT64_MAX;
+
+    /// @brief hashes of the URIs of the nodes the bundle was forwarded to, see nodeHash
+    std::vector<uint32_t> forwardedTo;
+
+    /// @brief creates empty keys, a bundle with these keys is not found by any query
+    BundleKeys() {};
+
+    /// @brief collects the keys of a bundle
+    /// @param bundle the bundle to be stored
+    BundleKeys(BundleInfo& bundle);
+
+    /// @brief hashes a node URI, 32 bit FNV-1a
+    /// @param uri URI of the node
+    static uint32_t nodeHash(const std::string& uri);
+
+    /// @brief checks whether the bundle was forwarded to a node
+    /// @param hash hash of the node URI, as returned by nodeHash
+    bool wasForwardedTo(uint32_t hash) const;
+
+    /// @brief returns the heap used by the keys
+    size_t heapUsage() const;
+};
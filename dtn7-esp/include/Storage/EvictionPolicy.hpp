@@ -0,0 +1,100 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "Data.hpp"
+#include "sdkconfig.h"
+
+/**
+ * @file EvictionPolicy.hpp
+ * @brief This file contains the eviction policies, which decide which bundles a storage removes first when it is full.
+ */
+
+/// @brief information about a stored bundle which eviction policies can use, collected when the bundle is stored
+struct BundleMetadata {
+    /// @brief memory or flash used to store the bundle, in bytes
+    size_t size;
+
+    /// @brief system time in ms the bundle was received
+    uint64_t receivedAt;
+
+    /// @brief estimated system time in ms at which the bundle expires
+    uint64_t expiresAt;
+
+    /// @brief number of times the bundle was broadcast or the number of nodes it was forwarded to, whichever is higher
+    uint32_t forwardCount;
+
+    /// @brief local storage priority of the bundle
+    uint8_t priority;
+
+    /// @brief collects the metadata of a bundle
+    /// @param bundle the bundle to be stored
+    /// @param size memory or flash needed to store the bundle, in bytes
+    BundleMetadata(BundleInfo& bundle, size_t size);
+};
+
+/// @brief Base class of the eviction policies. A policy assigns a rank to each bundle when it is stored, the bundle with the lowest rank is removed first.
+///        Bundles with the same rank are removed in the order they were stored.
+///        As the rank is calculated when a bundle is stored, the policy must only depend on the given metadata, not on the current time.
+class EvictionPolicy {
+   public:
+    virtual ~EvictionPolicy() {};
+
+    /// @brief calculates the eviction rank of a bundle
+    /// @param metadata metadata of the bundle
+    /// @return the rank, bundles with a lower rank are removed first
+    virtual uint64_t rank(const BundleMetadata& metadata) const = 0;
+
+    /// @brief returns the name of the policy, for logging
+    virtual const char* name() const = 0;
+
+    /// @brief creates the policy selected in menuconfig
+    /// @return pointer to a new policy on the heap
+    static EvictionPolicy* fromConfig();
+};
+
+/// @brief removes the bundle with the oldest reception time first
+class OldestFirstPolicy : public EvictionPolicy {
+   public:
+    uint64_t rank(const BundleMetadata& metadata) const override {
+        return metadata.receivedAt;
+    };
+    const char* name() const override { return "Oldest"; };
+};
+
+/// @brief removes the largest bundle first, which frees the most space per removed bundle
+class LargestFirstPolicy : public EvictionPolicy {
+   public:
+    uint64_t rank(const BundleMetadata& metadata) const override {
+        return UINT64_MAX - metadata.size;
+    };
+    const char* name() const override { return "Largest"; };
+};
+
+/// @brief removes the bundle that expires first, as it has the least time left to be delivered
+class SoonestExpiryPolicy : public EvictionPolicy {
+   public:
+    uint64_t rank(const BundleMetadata& metadata) const override {
+        return metadata.expiresAt;
+    };
+    const char* name() const override { return "SoonestExpiry"; };
+};
+
+/// @brief removes the bundle that was broadcast or forwarded most often first, as it most likely already reached other nodes
+class MostForwardedPolicy : public EvictionPolicy {
+   public:
+    uint64_t rank(const BundleMetadata& metadata) const override {
+        return UINT32_MAX - metadata.forwardCount;
+    };
+    const char* name() const override { return "MostForwarded"; };
+};
+
+/// @brief removes the bundle with the lowest priority first, bundles of the same priority are removed oldest first
+class LowestPriorityPolicy : public EvictionPolicy {
+   public:
+    uint64_t rank(const BundleMetadata& metadata) const override {
+        // the priority is placed above the reception time, which does not use the upper 8 bits
+        return ((uint64_t)metadata.priority << 56) |
+               (metadata.receivedAt & 0x00FFFFFFFFFFFFFF);
+    };
+    const char* name() const override { return "LowestPriority"; };
+};
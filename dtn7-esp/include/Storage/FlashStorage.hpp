@@ -1,9 +1,11 @@
 #pragma once
 #include <list>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include "Data.hpp"
+#include "SeenFilter.hpp"
 #include "Storage.hpp"
 #include "dtn7-bundle.hpp"
 #include "freertos/FreeRTOS.h"
@@ -18,13 +20,47 @@
  * @brief This file contains the definitions for the FlashStorage.
  */
 
-/// @brief class which stores bundles in the ESP32's flash, a custom partition table is to be used
+/// @brief counters of the flash operations of the FlashStorage, to measure the effect of write batching
+struct FlashWriteStats {
+    /// @brief number of flushes, each ending with one nvs_commit
+    uint32_t flushes = 0;
+
+    /// @brief number of blobs and key counters written to flash
+    uint32_t writes = 0;
+
+    /// @brief number of keys erased from flash
+    uint32_t erases = 0;
+
+    /// @brief number of writes and erases which were replaced by a later operation on the same key before being flushed, and therefore never reached the flash
+    uint32_t coalesced = 0;
+
+    /// @brief number of bytes written to flash
+    uint64_t bytesWritten = 0;
+
+    /// @brief total duration of all flushes in us
+    uint64_t flushTimeTotal = 0;
+
+    /// @brief duration of the longest flush in us
+    uint64_t flushTimeMax = 0;
+
+    /// @brief longest time in us a write was kept in memory before being flushed
+    uint64_t maxPendingAge = 0;
+};
+
+/// @brief class which stores bundles in the ESP32's flash, a custom partition table is to be used.
+///        By default, every storage operation is written to flash right away (write-through). If CONFIG_FlashCommitInterval is set, writes and erases are collected in memory and written together with a single nvs_commit once CONFIG_FlashWriteBatchSize operations are pending, or at the latest after CONFIG_FlashCommitInterval ms by a dedicated flush task
 class FlashStorage : public Storage {
-    /// @brief stores known Nodes, key is node address/identifier
-    std::unordered_map<std::string, Node> nodes;
+    /// @brief a write or erase of an NVS key which was not flushed yet
+    struct PendingWrite {
+        /// @brief whether the key is to be erased
+        bool erase = false;
 
-    /// @brief stores known Bundle Ids
-    std::set<std::string> bundle_ids;
+        /// @brief the blob to be written
+        std::vector<uint8_t> data;
+    };
+
+    /// @brief remembers the IDs of received bundles, bounded in size and forgets IDs after the bundle lifetime
+    SeenFilter seenIds;
 
     /// @brief the handle used to access the nvs flash storage
     nvs_handle_t flashHandle;
@@ -42,14 +78,104 @@ class FlashStorage : public Storage {
     /// @brief stores the first key that is used. See highestUsedKey. The lowest used key is required, as keys are not reused and the lowest key which is used is always incremented when a bundle is removed from storage.
     uint32_t lowestUsedKey = 0;
 
+    /// @brief maps the IDs of the stored bundles to the NVS key they are stored with
+    std::unordered_map<std::string, uint32_t> keysById;
+
+    /// @brief the NVS keys of the stored bundles in ascending order, the smallest is the key of the oldest bundle
+    std::set<uint32_t> liveKeys;
+
+    /// @brief maps the IDs of the leased bundles to their serialized metadata at the time they were leased, which is compared on commit to skip unchanged metadata
+    std::unordered_map<std::string, std::vector<uint8_t>> leases;
+
+    /// @brief the smallest key which may be leased next in the current retry cycle
+    uint32_t leaseCursor = 0;
+
+    /// @brief the highest used key when the current retry cycle began, bundles stored later are not retried in this cycle
+    uint32_t retryEndKey = 0;
+
     /// @brief mutex to handle shared access to bundles
     SemaphoreHandle_t bundlesMutex;
 
-    /// @brief mutex to handle shared access to nodes
-    SemaphoreHandle_t nodesMutex;
+    /// @brief writes and erases not flushed yet, only the last operation on each key is kept
+    std::unordered_map<std::string, PendingWrite> pending;
+
+    /// @brief whether the key range counters changed since the last flush
+    bool countersChanged = false;
+
+    /// @brief time in us at which the oldest pending operation was queued
+    int64_t pendingSince = 0;
+
+    /// @brief counters of the flash operations
+    FlashWriteStats stats;
+
+    /// @brief task flushing pending operations CONFIG_FlashCommitInterval ms after the oldest one was queued, nullptr if the interval is 0
+    TaskHandle_t flushTaskHandle = nullptr;
+
+    /// @brief remembers when the first operation was queued after a flush and wakes the flush task, must be called while holding bundlesMutex
+    void startPending();
+
+    /// @brief queues writing a blob, must be called while holding bundlesMutex
+    /// @param key NVS key of the blob
+    /// @param data the blob
+    void queueWrite(const std::string& key, std::vector<uint8_t> data);
+
+    /// @brief queues erasing a key, must be called while holding bundlesMutex
+    /// @param key the NVS key
+    void queueErase(const std::string& key);
+
+    /// @brief marks the key range counters as changed, they are written with the next flush if bundles are kept between restarts, must be called while holding bundlesMutex
+    void queueCounters();
+
+    /// @brief flushes the pending operations if CONFIG_FlashWriteBatchSize is reached, or always if CONFIG_FlashCommitInterval is 0 (write-through), must be called while holding bundlesMutex
+    void flushIfFull();
+
+    /// @brief writes all pending operations to flash and commits them, must be called while holding bundlesMutex
+    void flushPending();
+
+    /// @brief returns the number of NVS entries the pending writes will use, must be called while holding bundlesMutex
+    size_t pendingEntries();
+
+    /// @brief checks whether a blob is stored, including pending operations, must be called while holding bundlesMutex
+    /// @param key NVS key of the blob
+    bool blobStored(const std::string& key);
+
+    /// @brief task function of the flush task, sleeps until the oldest pending operation is CONFIG_FlashCommitInterval ms old and flushes the pending operations, waiting for the storage if it is busy
+    /// @param param the FlashStorage
+    static void flushTask(void* param);
+
+    /// @brief erases a bundle and its metadata from flash, must be called while holding bundlesMutex
+    /// @param key NVS key of the bundle
+    void eraseBundleKey(uint32_t key);
+
+    /// @brief removes a key whose bundle could not be written or read from the indexes, without accessing the flash, must be called while holding bundlesMutex
+    /// @param key NVS key of the bundle
+    void dropBundleKey(uint32_t key);
 
-    /// @brief mutex to handle shared access to bundleIDs
-    SemaphoreHandle_t bundleIdMutex;
+    /// @brief reads a blob from the pending operations or from flash, must be called while holding bundlesMutex
+    /// @param key NVS key of the blob
+    /// @return the blob, empty if it is not stored
+    std::vector<uint8_t> readBlob(const std::string& key);
+
+    /// @brief reads a bundle from flash and applies the metadata committed for it, must be called while holding bundlesMutex
+    /// @param key NVS key of the bundle
+    /// @param bundle the read bundle
+    /// @return false if no bundle is stored under the key
+    bool readBundle(uint32_t key, BundleInfo& bundle);
+
+    /// @brief returns the next live key of the current retry cycle and advances the cycle past it, must be called while holding bundlesMutex
+    /// @param key reference the key is written to
+    /// @return false if all bundles of the cycle were returned
+    bool nextRetryKey(uint32_t& key);
+
+    /// @brief shrinks the key range to the smallest live key after bundles were read or removed, queueing the counters if they changed, must be called while holding bundlesMutex
+    void updateKeyRange();
+
+    /// @brief reads all stored bundles once to recreate keysById, used if bundles are kept between restarts
+    void rebuildIndex();
+
+    /// @brief finds the key of the oldest stored bundle, the smallest of liveKeys, without accessing the flash, must be called while holding bundlesMutex
+    /// @return true if a stored bundle was found, oldestKey is then set to its key
+    bool findOldestKey();
 
    public:
     FlashStorage() {
@@ -58,8 +184,6 @@ class FlashStorage : public Storage {
                  "Custom Partition Table with Flash Storage!");
         // create the required mutexes for each type of stored data
         bundlesMutex = xSemaphoreCreateMutex();
-        nodesMutex = xSemaphoreCreateMutex();
-        bundleIdMutex = xSemaphoreCreateMutex();
 
         // initialize the flash
         esp_err_t err = nvs_flash_init();
@@ -75,6 +199,9 @@ class FlashStorage : public Storage {
         // In this case we need to find the key range in which the bundles are stored. This information is also stored in the flash and is read in the following.
         // The same goes for the information about which key belongs to the oldest stored bundle.
 #if CONFIG_KeepBetweenRestart
+        // the namespace has to be opened before the stored key range can be read
+        ESP_ERROR_CHECK(err);
+        nvs_open(BUNDLE_STORAGE_NAMESPACE, NVS_READWRITE, &flashHandle);
         err = nvs_get_u32(flashHandle, "HighestKey", &highestUsedKey);
         if (err == ESP_ERR_NVS_NOT_FOUND)
             highestUsedKey = 0;
@@ -84,34 +211,38 @@ class FlashStorage : public Storage {
         err = nvs_get_u32(flashHandle, "OldestKey", &oldestKey);
         if (err == ESP_ERR_NVS_NOT_FOUND)
             oldestKey = 0;
-
 #else
         // if no information is to be kept in between restarts, we erase the flash
         nvs_flash_erase();
         err = nvs_flash_init();
-#endif
         ESP_ERROR_CHECK(err);
         nvs_open(BUNDLE_STORAGE_NAMESPACE, NVS_READWRITE, &flashHandle);
-    }
-
-    ~FlashStorage() { nvs_close(flashHandle); }
-
-    /// @brief adds a node to the known nodes, if it is already present, it is overwritten
-    /// @param node node to store
-    void addNode(Node node) override;
+#endif
 
-    /// @brief removes a node from the list of known nodes
-    /// @param address
-    void removeNode(std::string address) override;
+        // pending operations are flushed by a separate task, NVS writes and erases take too long and need too much stack for the timer task.
+        // It is created before the index is rebuilt, so that erases queued while rebuilding wake it
+        if (CONFIG_FlashCommitInterval > 0)
+            xTaskCreate(flushTask, "FlashStorageFlush", 4 * 1024, this, 2,
+                        &flushTaskHandle);
 
-    /// @brief gets a previously stored node object from a given address/identifier
-    /// @param address
-    /// @return the previously stored node if it exists, otherwise an empty node object
-    Node getNode(std::string address) override;
+#if CONFIG_KeepBetweenRestart
+        // the bundle ID index is only kept in memory, recreate it from the stored bundles. The flush task may already run, so the mutex is needed
+        xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+        rebuildIndex();
+        flushIfFull();
+        xSemaphoreGive(bundlesMutex);
+#endif
+    }
 
-    /// @brief gets all known nodes
-    /// @return a vector containing all known nodes
-    std::vector<Node> getNodes() override;
+    ~FlashStorage() {
+        // the flush task is only deleted while it does not hold the mutex
+        xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+        if (flushTaskHandle != nullptr)
+            vTaskDelete(flushTaskHandle);
+        xSemaphoreGive(bundlesMutex);
+        flush();
+        nvs_close(flashHandle);
+    }
 
     /// @brief checks whether a bundleID was seen before
     /// @param bundleID std::string containing the BundleID to check
@@ -123,11 +254,26 @@ class FlashStorage : public Storage {
     /// @param node identifier of the node from which the Bundle was received
     void storeSeen(std::string bundleID) override;
 
-    /// @brief removes a Bundle from storage
+    /// @brief checks whether a bundleID was seen before and marks it as seen, using a single lock
+    /// @param bundleID std::string containing the BundleID to check
+    /// @return whether the bundle Id was seen before
+    bool checkAndStoreSeen(std::string bundleID) override;
+
+    /// @brief removes a Bundle from storage, its NVS key is found using the ID index
     /// @param bundleID BundleId of the bundle to remove
     /// @return true if the bundle was previously stored, otherwise false
     bool removeBundle(std::string bundleID) override;
 
+    /// @brief checks whether a bundle is currently stored, using the ID index without accessing the flash
+    /// @param bundleID BundleId of the bundle
+    /// @return true if the bundle is stored
+    bool containsBundle(std::string bundleID) override;
+
+    /// @brief reads a stored bundle from flash, its NVS key is found using the ID index
+    /// @param bundleID BundleId of the bundle
+    /// @return the stored bundle, or an empty BundleInfo object if it is not stored
+    BundleInfo getBundle(std::string bundleID) override;
+
     /// @brief stores a given bundle for later retransmission
     /// @param bundle bundle to store
     /// @return if other bundles were removed from storage in order to fit the new one, a vector of the removed bundles is returned
@@ -136,10 +282,37 @@ class FlashStorage : public Storage {
     /// @brief returns a portion previously delayed bundles, exact size can be configured in menuconfig, as a vector, called repeatedly when retrying bundles, starts with the oldest batch of bundles, only returns bundles up until to the point where the last bundle was stored when beginRetryCycle() was called
     std::vector<BundleInfo> getBundlesRetry() override;
 
+    /// @brief leases the next bundles of the current retry cycle, the bundles are read from flash but not erased
+    /// @param n maximum number of leased bundles
+    /// @return the leased bundles
+    std::vector<BundleInfo> leaseBatch(size_t n) override;
+
+    /// @brief leases a single stored bundle, nothing is written to flash
+    /// @param bundleID ID of the bundle
+    /// @param bundle set to the leased bundle
+    /// @return false if the bundle is not stored or already leased
+    bool leaseBundle(const std::string& bundleID, BundleInfo& bundle) override;
+
+    /// @brief ends the lease of a bundle, its metadata is written to a separate small NVS blob if it changed, the bundle itself is not rewritten
+    /// @param bundleID ID of the leased bundle
+    /// @param updated the bundle with the updated metadata
+    /// @return false if the bundle is not leased
+    bool commit(const std::string& bundleID, BundleInfo& updated) override;
+
+    /// @brief ends the lease of a bundle without writing to flash
+    /// @param bundleID ID of the leased bundle
+    void release(const std::string& bundleID) override;
+
     /// @brief deletes the oldest stored Bundle
     /// @return the Deleted Bundle
     BundleInfo deleteOldest() override;
 
+    /// @brief writes all pending operations to flash, should be called before critical events such as a restart or deep sleep
+    void flush() override;
+
+    /// @brief returns the counters of the flash operations
+    FlashWriteStats getWriteStats();
+
     /// @brief internally stores what the number of bundles was when it was called
     void beginRetryCycle() override;
 
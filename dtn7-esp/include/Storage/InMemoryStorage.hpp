@@ -1,10 +1,16 @@
 #pragma once
+#include <atomic>
 #include <list>
+#include <memory>
 #include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
+#include "AgeIndexedList.hpp"
+#include "BundleCompressor.hpp"
 #include "Data.hpp"
+#include "SeenFilter.hpp"
+#include "SlabStore.hpp"
 #include "Storage.hpp"
 #include "dtn7-bundle.hpp"
 #include "freertos/FreeRTOS.h"
@@ -21,54 +27,92 @@
  *              InMemoryStorageSerializedIA
  */
 
-/// @brief stores bundles, nodes and bundle ids in memory
+/// @brief Stores bundles, nodes and bundle ids in memory.
+///        The bundles are split into CONFIG_StorageShards shards by the hash of their ID, each with its own mutex, so operations on single bundles only wait for operations on the same shard.
+///        Operations spanning all bundles, like finding the oldest bundle or evicting, lock one shard at a time, so they do not block the reception of bundles for their whole duration.
+///        The seen filter is thread safe without a mutex, nodes are read through the shared snapshots of the NodeTable.
 class InMemoryStorage : public Storage {
-    /// @brief stores bundles, first value is BundleID
-    std::list<BundleInfo> bundles;
+    /// @brief a stored bundle together with the number of its insertion, used to keep the insertion order across shards
+    struct SequencedBundle {
+        uint32_t sequence;
+        BundleInfo bundle;
+    };
 
-    /// @brief stores known Nodes, key is node address/URI
-    std::unordered_map<std::string, Node> nodes;
+    /// @brief a part of the stored bundles, each bundle is stored in the shard selected by the hash of its ID
+    struct BundleShard {
+        /// @brief stores bundles in insertion order, indexed by their reception time and bundle ID
+        AgeIndexedList<SequencedBundle> bundles;
 
-    /// @brief stores known Bundle Ids
-    std::set<std::string> bundle_ids;
+        /// @brief mutex to handle shared access to the bundles of this shard
+        SemaphoreHandle_t mutex;
 
-    /// @brief mutex to handle shared access to bundles
-    SemaphoreHandle_t bundlesMutex;
+        /// @brief number of bundles of this shard still to be returned in the current retry cycle
+        size_t toReturn = 0;
+
+        /// @brief number of bundles and memory usage of this shard as last added to the totals of the storage
+        size_t countedBundles = 0;
+        size_t countedMemory = 0;
+    };
+
+    /// @brief the shards of the stored bundles
+    std::unique_ptr<BundleShard[]> shards;
+
+    /// @brief number of shards
+    size_t numShards;
+
+    /// @brief number of bundles stored in all shards
+    std::atomic<size_t> storedBundles{0};
+
+    /// @brief memory used by all shards
+    std::atomic<size_t> usedMemory{0};
 
-    /// @brief mutex to handle shared access to nodes
-    SemaphoreHandle_t nodesMutex;
+    /// @brief incremented for each stored bundle, gives the insertion order
+    std::atomic<uint32_t> nextSequence{0};
 
-    /// @brief mutex to handle shared access to bundleIDs
-    SemaphoreHandle_t bundleIdMutex;
+    /// @brief serializes storing bundles, so that concurrently stored bundles do not exceed the limits together. Does not block any other operation
+    SemaphoreHandle_t delayMutex;
+
+    /// @brief remembers the IDs of received bundles, bounded in size and forgets IDs after the bundle lifetime
+    SeenFilter seenIds;
+
+    /// @brief returns the shard a bundle is stored in
+    /// @param bundleID BundleId of the bundle
+    BundleShard& shardFor(const std::string& bundleID);
+
+    /// @brief adds the changes of the number of bundles and memory usage of a shard to the totals, must be called after changing a shard while still holding its mutex
+    /// @param shard the changed shard
+    void updateTotals(BundleShard& shard);
+
+    /// @brief finds the shard with the smallest key, locking one shard at a time. As the mutex is released afterwards, the shard may have changed when it is used
+    /// @param key sets the key of a shard and returns true, or returns false if the shard is not a candidate. Only called while holding the mutex of the shard
+    /// @param smallest set to the smallest key
+    /// @return the shard, nullptr if no shard is a candidate
+    BundleShard* findShard(bool (*key)(BundleShard&, uint64_t&),
+                           uint64_t& smallest);
+
+    /// @brief finds the shard containing the bundle with the lowest eviction rank
+    /// @param rank set to the lowest eviction rank
+    /// @return the shard, nullptr if no bundle is stored
+    BundleShard* nextEvictedShard(uint64_t& rank);
+
+    /// @brief removes the bundle with the lowest eviction rank of all shards
+    /// @param result reference the removed bundle is written to
+    /// @return false if no bundle was removed, because no bundle is stored or the shard was emptied concurrently
+    bool popEvicted(BundleInfo& result);
 
    private:
     /// @brief stores the limit of bundles allowed to be stored
     uint maxStoredBundles;
 
-   public:
-    InMemoryStorage() {
-        ESP_LOGI("InMemoryStorage Setup", "Setup InMemoryStorage");
-        maxStoredBundles = CONFIG_MaxStoredBundles;
-        bundlesMutex = xSemaphoreCreateMutex();
-        nodesMutex = xSemaphoreCreateMutex();
-        bundleIdMutex = xSemaphoreCreateMutex();
-    }
-    /// @brief adds a node to the known nodes, if it is already present, it is overwritten
-    /// @param node node to store
-    void addNode(Node node) override;
+    /// @brief number of bundles removed at once when the limit is reached
+    uint evictionBatchSize = CONFIG_EvictionBatchSize;
 
-    /// @brief removes a node from the list of known nodes
-    /// @param address
-    void removeNode(std::string address) override;
+    /// @brief maximum memory used by stored bundles and their indexes, 0 if not limited
+    size_t memoryBudget = CONFIG_StorageMemoryBudget;
 
-    /// @brief gets a previously stored node object from a given address/identifier
-    /// @param address
-    /// @return the previously stored node if it exists, otherwise an empty node object
-    Node getNode(std::string address) override;
-
-    /// @brief gets all known nodes
-    /// @return a vector containing all known nodes
-    std::vector<Node> getNodes() override;
+   public:
+    InMemoryStorage();
+    ~InMemoryStorage();
 
     /// @brief checks whether a bundleID was seen before
     /// @param bundleID std::string containing the BundleID to check
@@ -80,21 +124,68 @@ class InMemoryStorage : public Storage {
     /// @param node identifier of the node from which the Bundle was received
     void storeSeen(std::string bundleID) override;
 
-    /// @brief removes a Bundle from storage
+    /// @brief checks whether a bundleID was seen before and marks it as seen, using a single lock
+    /// @param bundleID std::string containing the BundleID to check
+    /// @return whether the bundle Id was seen before
+    bool checkAndStoreSeen(std::string bundleID) override;
+
+    /// @brief removes a Bundle from storage, found using the ID index
     /// @param bundleID BundleId of the bundle to remove
     /// @return true if the bundle was previously stored, otherwise false
     bool removeBundle(std::string bundleID) override;
 
-    /// @brief stores a given bundle for later retransmission
+    /// @brief checks whether a bundle is currently stored, using the ID index
+    /// @param bundleID BundleId of the bundle
+    /// @return true if the bundle is stored
+    bool containsBundle(std::string bundleID) override;
+
+    /// @brief returns a copy of a stored bundle, found using the ID index
+    /// @param bundleID BundleId of the bundle
+    /// @return the stored bundle, or an empty BundleInfo object if it is not stored
+    BundleInfo getBundle(std::string bundleID) override;
+
+    /// @brief finds the stored bundles whose destination starts with the given EID, using the destination index
+    /// @param destination destination EID, or a prefix of it
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesTo(const std::string& destination,
+                                           size_t limit = SIZE_MAX) override;
+
+    /// @brief finds the stored bundles which were not forwarded to a node yet, only the unserialized keys of the bundles are checked
+    /// @param nodeURI URI of the node
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesNotForwardedTo(
+        const std::string& nodeURI, size_t limit = SIZE_MAX) override;
+
+    /// @brief finds the stored bundles which are not contained in the summary a peer advertised, only the unserialized bundle IDs are checked
+    /// @param summary summary of the bundles the peer received or stores
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesMissingFrom(
+        const BundleSummary& summary, size_t limit = SIZE_MAX) override;
+
+    /// @brief inserts the IDs of all stored bundles into a summary
+    /// @param summary the summary
+    void summarizeBundles(BundleSummary& summary) override;
+
+    /// @brief finds the stored bundles expiring before the given time, using the expiry index
+    /// @param time system time in ms
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesExpiringBefore(
+        uint64_t time, size_t limit = SIZE_MAX) override;
+
+    /// @brief stores a given bundle for later retransmission. If the number of bundles, the memory budget or a BundleAllocator pool limit, which also counts the block data of the bundles, is exceeded, bundles are removed in batches according to the eviction policy
     /// @param bundle bundle to store
-    /// @return if other bundles were removed from storage in order to fit the new one, a vector of the removed bundles is returned
+    /// @return if other bundles were removed from storage in order to fit the new one, a vector of the removed bundles is returned. Contains the given bundle itself if it ranks below all stored bundles or exceeds the budget or a pool limit on its own
     std::vector<BundleInfo> delayBundle(BundleInfo* bundle) override;
 
     /// @brief returns a portion previously delayed bundles, exact size can be configured in menuconfig, as a vector, called repeatedly when retrying bundles, starts with the oldest batch of bundles, only returns bundles up until to the point where the last bundle was stored when beginRetryCycle() was called
     std::vector<BundleInfo> getBundlesRetry() override;
 
-    /// @brief deletes the oldest stored Bundle. This function looks at all stored bundles and compares the time each bundle was received at. This is very slow.
-    /// @return the Deleted Bundle
+    /// @brief deletes the stored bundle with the oldest reception time, found using the age index
+    /// @return the Deleted Bundle, an empty BundleInfo if no bundle is stored
     BundleInfo deleteOldest() override;
 
     /// @brief internally stores what the number of bundles was when it was called
@@ -102,61 +193,66 @@ class InMemoryStorage : public Storage {
 
     /// @brief returns whether there are still bundles to be returned in this retry
     bool hasBundlesToRetry() override;
+
+    /// @brief returns the approximate memory used by the stored bundle objects and their indexes
+    size_t memoryUsage() override;
 };
 
 /// @brief Stores bundles, nodes and bundle IDs in memory.
 ///         Bundles and nodes are serialized for storage. This reduces the space required to store bundles.
-///         The amount of memory which is used for bundle storage is limited indirectly, as a desired amount of heap which shall remain free can be set in menuconfig.
-///         If this limit is surpassed by storing another bundle the oldest bundles are removed from storage. How many bundles are removed can be configured in menuconfig.
-///         Note: removal is very slow due to some currently unknown problem.
+///         The memory used by the stored bundles and their indexes is limited by a budget, additionally a desired amount of heap which shall remain free can be set in menuconfig.
+///         If a limit is surpassed by storing another bundle, bundles are removed from storage according to the eviction policy. How many bundles are removed can be configured in menuconfig.
+///         The reception time of each bundle is kept in an index, so finding the oldest bundle does not require de-serializing the stored bundles.
+///         The serialized bundles are kept in the chunks of a SlabStore, so that storing and removing bundles of random sizes does not fragment the heap.
 class InMemoryStorageSerialized : public Storage {
-    /// @brief stored bundles.  First value is the bundle ID, second value is the serialized bundle info (byte vector)
-    std::list<std::pair<std::string, std::vector<uint8_t>>> bundles;
+    /// @brief stored bundles as references to their serialized bundle info in insertion order, indexed by their reception time and bundle ID
+    AgeIndexedList<SlabRef> bundles;
 
-    /// @brief known nodes, key is node address/identifier, value is vector of bytes representing serialized node
-    std::unordered_map<std::string, std::vector<uint8_t>> nodes;
+    /// @brief holds the serialized bundle info of the stored bundles, its slabs are placed in internal or external RAM by the BundleAllocator
+    SlabStore slabs;
 
-    /// @brief stores known Bundle Ids
-    std::set<std::string> bundle_ids;
+    /// @brief copies a bundle removed from the list out of the slab store and frees its chunks, bundlesMutex has to be held
+    /// @param ref reference to the serialized bundle info
+    /// @return the serialized bundle info
+    std::vector<uint8_t> release(SlabRef ref);
 
-    /// @brief mutex to handle shared access to bundles
-    SemaphoreHandle_t bundlesMutex;
+    /// @brief compresses the serialized bundles if enabled in menuconfig
+    BundleCompressor compressor;
 
-    /// @brief mutex to handle shared access to nodes
-    SemaphoreHandle_t nodesMutex;
+    /// @brief de-serializes a stored bundle, decompressing it first if compression is enabled
+    /// @param data the stored bundle
+    /// @param length number of bytes
+    BundleInfo restore(const uint8_t* data, size_t length);
 
-    /// @brief mutex to handle shared access to bundleIDs
-    SemaphoreHandle_t bundleIdMutex;
+    /// @brief remembers the IDs of received bundles, bounded in size and forgets IDs after the bundle lifetime
+    SeenFilter seenIds;
+
+    /// @brief mutex to handle shared access to bundles
+    SemaphoreHandle_t bundlesMutex;
 
     /// @brief defines how many bundles are maximally to be removed if there is not enough space to delay a bundle
     uint maxRemovedBundles = CONFIG_MaxRemovedBundles;
 
+    /// @brief number of bundles removed at once, before the limits are checked again
+    uint evictionBatchSize = CONFIG_EvictionBatchSize;
+
+    /// @brief maximum memory used by stored bundles and their indexes, 0 if not limited
+    size_t memoryBudget = CONFIG_StorageMemoryBudget;
+
+    /// @brief removes bundles in batches according to the eviction policy while storing a bundle of the given size would exceed the memory budget or a BundleAllocator pool limit, or leave less than CONFIG_TargetFreeHeap free. For the free heap at most maxRemovedBundles are removed
+    /// @param needed memory needed to store the new bundle, including its index entry
+    /// @param rank eviction rank of the new bundle, no bundles with a higher rank are removed to make space for it
+    /// @param rejected set to true if the new bundle should not be stored, because it ranks below all remaining bundles or does not fit into the budget. A bundle which would not fit even into an empty storage is rejected without removing any bundles
+    /// @return the removed bundles
+    std::vector<BundleInfo> evict(size_t needed, uint64_t rank, bool& rejected);
+
    public:
     InMemoryStorageSerialized() {
         ESP_LOGI("InMemoryStorageSerialized Setup",
                  "Setup InMemoryStorageSerialized");
         bundlesMutex = xSemaphoreCreateMutex();
-        nodesMutex = xSemaphoreCreateMutex();
-        bundleIdMutex = xSemaphoreCreateMutex();
     }
 
-    /// @brief adds a node to the known nodes, if it is already present, it is overwritten
-    /// @param node node to store
-    void addNode(Node node) override;
-
-    /// @brief removes a node from the list of known nodes
-    /// @param address
-    void removeNode(std::string address) override;
-
-    /// @brief gets a previously stored node object from a given address/identifier
-    /// @param address
-    /// @return the previously stored node if it exists, otherwise a empty node object
-    Node getNode(std::string address) override;
-
-    /// @brief gets all known nodes
-    /// @return a vector containing all known nodes
-    std::vector<Node> getNodes() override;
-
     /// @brief checks whether a bundleID was seen before
     /// @param bundleID std::string containing the BundleID to check
     /// @return whether the bundle Id was seen before
@@ -167,14 +263,61 @@ class InMemoryStorageSerialized : public Storage {
     /// @param node identifier of the node from which the Bundle was received
     void storeSeen(std::string bundleID) override;
 
-    /// @brief removes a Bundle from storage
+    /// @brief checks whether a bundleID was seen before and marks it as seen, using a single lock
+    /// @param bundleID std::string containing the BundleID to check
+    /// @return whether the bundle Id was seen before
+    bool checkAndStoreSeen(std::string bundleID) override;
+
+    /// @brief removes a Bundle from storage, found using the ID index
     /// @param bundleID BundleId of the bundle to remove
     /// @return true if the bundle was previously stored, otherwise false
     bool removeBundle(std::string bundleID) override;
 
+    /// @brief checks whether a bundle is currently stored, using the ID index
+    /// @param bundleID BundleId of the bundle
+    /// @return true if the bundle is stored
+    bool containsBundle(std::string bundleID) override;
+
+    /// @brief returns a copy of a stored bundle, found using the ID index
+    /// @param bundleID BundleId of the bundle
+    /// @return the stored bundle, or an empty BundleInfo object if it is not stored
+    BundleInfo getBundle(std::string bundleID) override;
+
+    /// @brief finds the stored bundles whose destination starts with the given EID, using the destination index
+    /// @param destination destination EID, or a prefix of it
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesTo(const std::string& destination,
+                                           size_t limit = SIZE_MAX) override;
+
+    /// @brief finds the stored bundles which were not forwarded to a node yet, only the unserialized keys of the bundles are checked
+    /// @param nodeURI URI of the node
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesNotForwardedTo(
+        const std::string& nodeURI, size_t limit = SIZE_MAX) override;
+
+    /// @brief finds the stored bundles which are not contained in the summary a peer advertised, only the unserialized bundle IDs are checked
+    /// @param summary summary of the bundles the peer received or stores
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesMissingFrom(
+        const BundleSummary& summary, size_t limit = SIZE_MAX) override;
+
+    /// @brief inserts the IDs of all stored bundles into a summary
+    /// @param summary the summary
+    void summarizeBundles(BundleSummary& summary) override;
+
+    /// @brief finds the stored bundles expiring before the given time, using the expiry index
+    /// @param time system time in ms
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesExpiringBefore(
+        uint64_t time, size_t limit = SIZE_MAX) override;
+
     /// @brief stores a given bundle for later retransmission
     /// @param bundle bundle to store
-    /// @return if other bundles were removed from storage in order to fit the new one, a vector of the removed bundles is returned
+    /// @return if other bundles were removed from storage in order to fit the new one, a vector of the removed bundles is returned. Contains the given bundle itself if it ranks below all stored bundles or exceeds the budget on its own
     std::vector<BundleInfo> delayBundle(BundleInfo* bundle) override;
 
     /// @brief Returns n previously delayed bundles as a vector.
@@ -182,8 +325,8 @@ class InMemoryStorageSerialized : public Storage {
     ///         Only returns bundles up until to the point where the last bundle was stored when beginRetryCycle() was called.
     std::vector<BundleInfo> getBundlesRetry() override;
 
-    /// @brief deletes the oldest stored bundle. This function de-serializes all stored bundles and comares all received at times, very slow, maybe due to some programming error
-    /// @return the Deleted Bundle
+    /// @brief deletes the stored bundle with the oldest reception time, found using the age index
+    /// @return the Deleted Bundle, an empty BundleInfo if no bundle is stored
     BundleInfo deleteOldest() override;
 
     /// @brief internally stores what the number of bundles was when it was called
@@ -191,62 +334,115 @@ class InMemoryStorageSerialized : public Storage {
 
     /// @brief returns whether there are still bundles to be returned in this retry
     bool hasBundlesToRetry() override;
+
+    /// @brief returns the memory used by the slabs holding the serialized bundles and by their indexes, including free chunks
+    size_t memoryUsage() override;
+
+    /// @brief returns the counters of the compression of the stored bundles, all 0 if compression is disabled
+    CompressionStats getCompressionStats() { return compressor.getStats(); };
 };
 
 /// @brief Stores bundles, nodes and bundle IDs in memory.
 ///        Bundles and nodes are serialized for storage. This reduces the space required to store bundles.
-///        The amount of memory which is used for bundle storage is limited indirectly, as a desired amount of heap which shall remain free can be set in menuconfig.
-///        If this limit is surpassed by storing another bundle the oldest bundles are removed from storage. How many bundles are removed can be configured in menuconfig.
-///        If this occurs it is very slow, maybe due to some unknown error.
-///        The improvement compared to InMemoryStorageSerialized is that the bundle age is stored unserialized together with their serialized form,
-///        to not require de-serialization to find the oldest bundle, at the cost of some space efficiency.
-///        This leads to a minor speed improvement if old bundles are removed.
+///        The memory used by the stored bundles and their indexes is limited by a budget, additionally a desired amount of heap which shall remain free can be set in menuconfig.
+///        If a limit is surpassed by storing another bundle, bundles are removed from storage according to the eviction policy. How many bundles are removed can be configured in menuconfig.
+///        The bundle age is stored unserialized in an index next to the serialized bundles, to not require de-serialization to find the oldest bundle.
+///        Since InMemoryStorageSerialized uses the same index, both now behave the same, this class is kept for configuration compatibility.
 class InMemoryStorageSerializedIA : public InMemoryStorage {
-    /* 
-     * Bundle list
-     * First value is the bundle ID.
-     * Second value is a pair, consisting of the serialized bundle info (byte vector) and the bundle reception time.
-     */
-    std::list<std::pair<std::string, std::pair<std::vector<uint8_t>, uint64_t>>>
-        bundles;
+    /// @brief stored bundles as serialized bundle info in insertion order, indexed by their reception time and bundle ID. The buffers are placed in internal or external RAM by the BundleAllocator
+    AgeIndexedList<BundleBuffer> bundles;
 
-    // stores known nodes, key is node address/identifier, value is node object
-    std::unordered_map<std::string, Node> nodes;
+    /// @brief compresses the serialized bundles if enabled in menuconfig
+    BundleCompressor compressor;
 
-    // stores known bundle IDs and node addresses from which bundle was last received
-    std::unordered_map<std::string, std::string> bundle_ids;
+    /// @brief de-serializes a stored bundle, decompressing it first if compression is enabled
+    /// @param data the stored bundle
+    /// @param length number of bytes
+    BundleInfo restore(const uint8_t* data, size_t length);
 
     /// @brief defines how many bundles are maximally to be removed if there is not enough space to delay a bundle
     uint maxRemovedBundles = CONFIG_MaxRemovedBundles;
 
-    /// @brief mutex to handle shared access to bundles
-    SemaphoreHandle_t bundlesMutex;
+    /// @brief number of bundles removed at once, before the limits are checked again
+    uint evictionBatchSize = CONFIG_EvictionBatchSize;
 
-    /// @brief mutex to handle shared access to nodes
-    SemaphoreHandle_t nodesMutex;
+    /// @brief maximum memory used by stored bundles and their indexes, 0 if not limited
+    size_t memoryBudget = CONFIG_StorageMemoryBudget;
 
-    /// @brief mutex to handle shared access to bundleIDs
-    SemaphoreHandle_t bundleIdMutex;
+    /// @brief removes bundles in batches according to the eviction policy while storing a bundle of the given size would exceed the memory budget or a BundleAllocator pool limit, or leave less than CONFIG_TargetFreeHeap free. For the free heap at most maxRemovedBundles are removed
+    /// @param needed memory needed to store the new bundle, including its index entry
+    /// @param rank eviction rank of the new bundle, no bundles with a higher rank are removed to make space for it
+    /// @param rejected set to true if the new bundle should not be stored, because it ranks below all remaining bundles or does not fit into the budget. A bundle which would not fit even into an empty storage is rejected without removing any bundles
+    /// @return the removed bundles
+    std::vector<BundleInfo> evict(size_t needed, uint64_t rank, bool& rejected);
+
+    /// @brief mutex to handle shared access to bundles
+    SemaphoreHandle_t bundlesMutex;
 
    public:
     InMemoryStorageSerializedIA() {
         ESP_LOGI("InMemoryStorageSerialized Setup",
                  "Setup InMemoryStorageSerializedIA");
         bundlesMutex = xSemaphoreCreateMutex();
-        nodesMutex = xSemaphoreCreateMutex();
-        bundleIdMutex = xSemaphoreCreateMutex();
     }
 
+    /// @brief removes a Bundle from storage, found using the ID index
+    /// @param bundleID BundleId of the bundle to remove
+    /// @return true if the bundle was previously stored, otherwise false
+    bool removeBundle(std::string bundleID) override;
+
+    /// @brief checks whether a bundle is currently stored, using the ID index
+    /// @param bundleID BundleId of the bundle
+    /// @return true if the bundle is stored
+    bool containsBundle(std::string bundleID) override;
+
+    /// @brief returns a copy of a stored bundle, found using the ID index
+    /// @param bundleID BundleId of the bundle
+    /// @return the stored bundle, or an empty BundleInfo object if it is not stored
+    BundleInfo getBundle(std::string bundleID) override;
+
+    /// @brief finds the stored bundles whose destination starts with the given EID, using the destination index
+    /// @param destination destination EID, or a prefix of it
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesTo(const std::string& destination,
+                                           size_t limit = SIZE_MAX) override;
+
+    /// @brief finds the stored bundles which were not forwarded to a node yet, only the unserialized keys of the bundles are checked
+    /// @param nodeURI URI of the node
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesNotForwardedTo(
+        const std::string& nodeURI, size_t limit = SIZE_MAX) override;
+
+    /// @brief finds the stored bundles which are not contained in the summary a peer advertised, only the unserialized bundle IDs are checked
+    /// @param summary summary of the bundles the peer received or stores
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesMissingFrom(
+        const BundleSummary& summary, size_t limit = SIZE_MAX) override;
+
+    /// @brief inserts the IDs of all stored bundles into a summary
+    /// @param summary the summary
+    void summarizeBundles(BundleSummary& summary) override;
+
+    /// @brief finds the stored bundles expiring before the given time, using the expiry index
+    /// @param time system time in ms
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesExpiringBefore(
+        uint64_t time, size_t limit = SIZE_MAX) override;
+
     /// @brief stores a given bundle for later retransmission
     /// @param bundle bundle to store
-    /// @return if other bundles were removed from storage in order to fit the new one, a vector of the removed bundles is returned
+    /// @return if other bundles were removed from storage in order to fit the new one, a vector of the removed bundles is returned. Contains the given bundle itself if it ranks below all stored bundles or exceeds the budget on its own
     std::vector<BundleInfo> delayBundle(BundleInfo* bundle) override;
 
     /// @brief returns a portion previously delayed bundles, exact size can be configured in menuconfig, as a vector, called repeatedly when retrying bundles, starts with the oldest batch of bundles, only returns bundles up until to the point where the last bundle was stored when beginRetryCycle() was called
     std::vector<BundleInfo> getBundlesRetry() override;
 
-    /// @brief deletes the oldest stored Bundle. This function iterates through all stored bundles and comares all received at times, very slow, maybe due to some programming error
-    /// @return the Deleted Bundle
+    /// @brief deletes the stored bundle with the oldest reception time, found using the age index
+    /// @return the Deleted Bundle, an empty BundleInfo if no bundle is stored
     BundleInfo deleteOldest() override;
 
     /// @brief internally stores what the number of bundles was when it was called
@@ -254,4 +450,10 @@ class InMemoryStorageSerializedIA : public InMemoryStorage {
 
     /// @brief returns whether there are still bundles to be returned in this retry
     bool hasBundlesToRetry() override;
+
+    /// @brief returns the memory used by the serialized bundles and their indexes
+    size_t memoryUsage() override;
+
+    /// @brief returns the counters of the compression of the stored bundles, all 0 if compression is disabled
+    CompressionStats getCompressionStats() { return compressor.getStats(); };
 };
\ No newline at end of file
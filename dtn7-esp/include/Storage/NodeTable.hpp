@@ -0,0 +1,129 @@
+#pragma once
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Data.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+/**
+ * @file NodeTable.hpp
+ * @brief This file contains the NodeTable class, which stores the known nodes for the storages.
+ */
+
+/// @brief stable handle of a node stored in a NodeTable. Stays valid until the node is removed, handles of removed nodes are never valid again
+typedef uint32_t NodeId;
+
+/// @brief NodeId returned if a node is not known
+#define INVALID_NODE_ID UINT32_MAX
+
+/// @brief immutable copy of all known nodes, shared between all readers until the set of nodes changes
+struct NodeSnapshot {
+    /// @brief version of the node table this snapshot was created from, only changes if nodes were added or removed or the position of a node changed
+    uint32_t version = 0;
+
+    /// @brief all nodes known when the snapshot was created
+    std::vector<Node> nodes;
+
+    /// @brief the NodeId of each node in nodes, at the same index
+    std::vector<NodeId> ids;
+};
+
+/// @brief pointer to a node snapshot, the snapshot stays valid as long as this pointer is held, even if the table is changed in the meantime
+typedef std::shared_ptr<const NodeSnapshot> NodeSnapshotPtr;
+
+/// @brief Stores the known nodes keyed by their URI and gives each of them a stable NodeId.
+///        Reading all nodes does not copy them: getSnapshot returns a shared, immutable snapshot, which is only rebuilt after nodes were added, changed or removed.
+///        Updating the last seen time of a node through touch, or through upsert with an otherwise unchanged node, is done in place and does not invalidate the snapshot, therefore lastSeen in a snapshot may be older than the stored value.
+///        All methods are thread safe.
+class NodeTable {
+   private:
+    /// @brief a slot of the table
+    struct Entry {
+        /// @brief the stored node
+        Node node;
+
+        /// @brief incremented each time the slot is freed, part of the NodeId so that handles of removed nodes become invalid. The slot is not reused once it reaches UINT16_MAX
+        uint16_t generation = 0;
+
+        /// @brief whether the slot currently holds a node
+        bool used = false;
+    };
+
+    /// @brief all slots, the lower 16 bits of a NodeId are the index into this vector
+    std::vector<Entry> entries;
+
+    /// @brief indices of unused slots, reused before the vector grows
+    std::vector<uint16_t> freeSlots;
+
+    /// @brief maps node URIs to their NodeId
+    std::unordered_map<std::string, NodeId> byUri;
+
+    /// @brief the current snapshot, nullptr if it has to be rebuilt
+    NodeSnapshotPtr snapshot;
+
+    /// @brief incremented whenever nodes are added or removed or the position of a node changes
+    uint32_t version = 0;
+
+    /// @brief mutex protecting all members
+    SemaphoreHandle_t mutex;
+
+    /// @brief returns the slot of a valid NodeId, must be called while holding the mutex
+    /// @return pointer to the slot, nullptr if the NodeId is not valid
+    Entry* entryFor(NodeId id);
+
+    /// @brief invalidates the snapshot after nodes changed, must be called while holding the mutex
+    /// @param moved whether nodes were added or removed or a position changed, which increments the version
+    void changed(bool moved);
+
+   public:
+    NodeTable();
+    ~NodeTable();
+
+    /// @brief adds a node to the table, if a node with the same URI is present it is overwritten and keeps its NodeId.
+    ///        If only the last seen time of a stored node changes, the snapshot is kept like with touch
+    ///        The last seen time of a stored node is never moved backwards, as the node to store may be a copy taken from an outdated snapshot
+    /// @param node the node to store
+    /// @return the NodeId of the stored node
+    NodeId upsert(const Node& node);
+
+    /// @brief removes the node with the given URI
+    /// @param uri URI of the node
+    /// @return true if the node was present
+    bool remove(const std::string& uri);
+
+    /// @brief looks up the NodeId of a node
+    /// @param uri URI of the node
+    /// @return NodeId of the node, INVALID_NODE_ID if it is not known
+    NodeId find(const std::string& uri);
+
+    /// @brief returns a copy of a stored node
+    /// @param uri URI of the node
+    /// @return the stored node, or an empty node object if it is not known
+    Node get(const std::string& uri);
+
+    /// @brief updates the last seen time of a node in place, statically added nodes (lastSeen UINT64_MAX) are not changed
+    /// @param id NodeId of the node
+    /// @param now current time in ms
+    /// @param uri if not nullptr, set to the URI of the node if its last seen time was updated, left unchanged for static nodes
+    /// @return false if the NodeId is not valid
+    bool touch(NodeId id, uint64_t now, std::string* uri = nullptr);
+
+    /// @brief returns the last seen time of a node without copying it
+    /// @param uri URI of the node
+    /// @return the last seen time in ms, 0 if the node is not known
+    uint64_t getLastSeen(const std::string& uri);
+
+    /// @brief returns copies of all stored nodes with their current last seen time
+    /// @return vector of all nodes
+    std::vector<Node> getAll();
+
+    /// @brief returns the current snapshot of all nodes, only creates a new one if the nodes changed since the last call
+    /// @return shared pointer to the snapshot
+    NodeSnapshotPtr getSnapshot();
+
+    /// @brief returns the number of stored nodes
+    size_t size();
+};
@@ -0,0 +1,285 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "AgeIndexedList.hpp"
+#include "Data.hpp"
+#include "SeenFilter.hpp"
+#include "Storage.hpp"
+#include "dtn7-bundle.hpp"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+
+/**
+ * @file PartitionStorage.hpp
+ * @brief This file contains the definitions for the PartitionStorage, a log-structured bundle storage on a raw flash partition.
+ */
+
+/// @brief Stores bundles in a raw data partition, which is used as a log.
+///        The partition starts with two checkpoint slots, the rest is divided into segments of CONFIG_PartitionStorageSegmentSectors flash sectors.
+///        Bundles are appended as records to the current head segment. Removing a bundle only clears the state byte of its record, which does not require an erase.
+///        If no free segment is left, the segment with the least live data is compacted: its remaining records are copied to the head and the segment is erased.
+///        If compacting does not free enough space, bundles are removed according to the eviction policy, whose rank is stored in each record.
+///        Retried bundles are leased and stay in their record. If the metadata of a bundle changed when its lease ends, e.g. because it was forwarded to another node, only a small metadata record is appended, which replaces the metadata stored with the bundle. A bundle whose metadata did not change is not written at all.
+///        The location of all records is kept in RAM, indexed by bundle ID and reception time, and is periodically written to a checkpoint slot.
+///        On boot only the records listed in the newest checkpoint and the records appended after it are read, instead of the whole partition. Each record contains the query keys of its bundle, so only the record headers and keys are read, the bundles are not de-serialized.
+///        The partition is memory mapped, so records are read directly from flash without intermediate reads.
+class PartitionStorage : public Storage {
+   private:
+    /// @brief location of a record in the partition
+    struct RecordLocation {
+        /// @brief index of the segment containing the record
+        uint16_t segment;
+
+        /// @brief offset of the record within the segment
+        uint32_t offset;
+
+        /// @brief size of the record in flash, including its header and padding
+        uint32_t size;
+
+        /// @brief segment of the newest metadata record of the bundle, UINT16_MAX if its metadata was never committed
+        uint16_t metaSegment = UINT16_MAX;
+
+        /// @brief offset of the metadata record within its segment
+        uint32_t metaOffset = 0;
+
+        /// @brief size of the metadata record in flash, including its header and padding
+        uint32_t metaSize = 0;
+    };
+
+    /// @brief remembers the IDs of received bundles, bounded in size and forgets IDs after the bundle lifetime
+    SeenFilter seenIds;
+
+    /// @brief the used data partition
+    const esp_partition_t* partition = nullptr;
+
+    /// @brief start of the memory mapped partition
+    const uint8_t* mapped = nullptr;
+
+    /// @brief handle of the memory mapping
+    esp_partition_mmap_handle_t mapHandle;
+
+    /// @brief size of a segment in bytes
+    uint32_t segmentSize;
+
+    /// @brief size of a checkpoint slot in bytes
+    uint32_t checkpointSize;
+
+    /// @brief number of segments
+    uint16_t segmentCount;
+
+    /// @brief locations of all stored bundles in the order they were written, indexed by bundle ID and reception time
+    AgeIndexedList<RecordLocation> records;
+
+    /// @brief sequence number of each segment, SEGMENT_FREE if the segment is free
+    std::vector<uint32_t> segmentSequence;
+
+    /// @brief number of bytes used by live records in each segment
+    std::vector<uint32_t> liveBytes;
+
+    /// @brief number of free segments
+    uint16_t freeSegments = 0;
+
+    /// @brief segment new records are appended to, segmentCount if no segment was opened yet
+    uint16_t headSegment;
+
+    /// @brief offset at which the next record is appended in the head segment
+    uint32_t headOffset = 0;
+
+    /// @brief sequence number given to the next opened segment
+    uint32_t nextSequence = 1;
+
+    /// @brief sequence number of the newest checkpoint
+    uint32_t checkpointSequence = 0;
+
+    /// @brief maps the IDs of the leased bundles to their serialized metadata at the time they were leased, which is compared on commit to skip unchanged metadata
+    std::unordered_map<std::string, std::vector<uint8_t>> leases;
+
+    /// @brief number of records written or removed since the last checkpoint
+    uint32_t changesSinceCheckpoint = 0;
+
+    /// @brief mutex to handle shared access to bundles
+    SemaphoreHandle_t bundlesMutex;
+
+    /// @brief returns a pointer to a location in the memory mapped partition
+    /// @param segment the segment
+    /// @param offset offset within the segment
+    const uint8_t* at(uint16_t segment, uint32_t offset) const;
+
+    /// @brief returns the offset of a segment within the partition
+    uint32_t segmentAddress(uint16_t segment) const;
+
+    /// @brief reads the segment headers and restores the index from the newest checkpoint and the records written after it
+    void mount();
+
+    /// @brief erases all segments and checkpoints which are in use, used if bundles are not kept between restarts
+    void format();
+
+    /// @brief reads all records of a segment starting at the given offset and adds the live ones of the given type to the index
+    /// @param type RECORD_BUNDLE or RECORD_METADATA, the metadata records are read after all bundle records, as they are matched to the bundles by ID
+    /// @return the offset after the last record of the segment
+    uint32_t scanSegment(uint16_t segment, uint32_t offset, uint8_t type);
+
+    /// @brief adds the bundle record at the given location to the index, if it is live
+    /// @return true if the record is live
+    bool indexRecord(uint16_t segment, uint32_t offset);
+
+    /// @brief assigns the metadata record at the given location to its stored bundle, if it is live, replacing an older metadata record
+    /// @return true if the record is live and its bundle is stored
+    bool indexMetadata(uint16_t segment, uint32_t offset);
+
+    /// @brief erases a free segment, writes its header and makes it the head
+    void openSegment();
+
+    /// @brief makes sure a record of the given size can be appended, by opening segments, compacting segments and removing bundles according to the eviction policy
+    /// @param size size of the record
+    /// @param rank eviction rank of the new bundle, no bundles with a higher rank are removed to make space for it
+    /// @param removed bundles removed to make space are added to this vector
+    /// @return false if the record can never fit, or the new bundle has the lowest rank
+    bool makeSpace(uint32_t size, uint64_t rank,
+                   std::vector<BundleInfo>& removed);
+
+    /// @brief copies the live records of a segment to the head and erases the segment
+    void compact(uint16_t segment);
+
+    /// @brief appends a record to the head segment, which must have enough space
+    /// @param keys the encoded query keys of the bundle
+    /// @param type RECORD_BUNDLE or RECORD_METADATA
+    /// @return the location of the written record
+    RecordLocation appendRecord(const std::string& id,
+                                const std::vector<uint8_t>& keys,
+                                const uint8_t* data, uint32_t length,
+                                uint64_t receivedAt, uint64_t rank,
+                                uint8_t type);
+
+    /// @brief clears the state of a record in flash and subtracts its size from the live bytes of its segment
+    void clearRecord(uint16_t segment, uint32_t offset, uint32_t size);
+
+    /// @brief marks the record of a bundle and its metadata record as removed in flash
+    void markRemoved(const RecordLocation& location);
+
+    /// @brief reads the bundle stored in a record and applies its committed metadata
+    BundleInfo readBundle(const RecordLocation& location) const;
+
+    /// @brief counts a change and writes a checkpoint if CONFIG_PartitionStorageCheckpointInterval changes happened since the last one
+    void changed();
+
+    /// @brief writes the current index to the older checkpoint slot
+    void writeCheckpoint();
+
+    /// @brief reads the newest valid checkpoint and adds the records listed in it to the index
+    /// @param headSegment set to the head segment at the time of the checkpoint
+    /// @param headSequence set to the sequence number of that head segment
+    /// @param headOffset set to the head offset at the time of the checkpoint
+    /// @return false if no valid checkpoint was found
+    bool loadCheckpoint(uint16_t& headSegment, uint32_t& headSequence,
+                        uint32_t& headOffset);
+
+   public:
+    /// @brief opens the partition labeled CONFIG_PartitionStorageLabel and restores the stored bundles if configured
+    PartitionStorage();
+    ~PartitionStorage();
+
+    /// @brief checks whether a bundleID was seen before
+    /// @param bundleID std::string containing the BundleID to check
+    /// @return whether the bundle Id was seen before
+    bool checkSeen(std::string bundleID) override;
+
+    /// @brief adds a BundleId to the known BundleIDs
+    /// @param bundleID bundleId to mark as seen
+    void storeSeen(std::string bundleID) override;
+
+    /// @brief checks whether a bundleID was seen before and marks it as seen, using a single lock
+    /// @param bundleID std::string containing the BundleID to check
+    /// @return whether the bundle Id was seen before
+    bool checkAndStoreSeen(std::string bundleID) override;
+
+    /// @brief removes a Bundle from storage by marking its record as removed
+    /// @param bundleID BundleId of the bundle to remove
+    /// @return true if the bundle was previously stored, otherwise false
+    bool removeBundle(std::string bundleID) override;
+
+    /// @brief checks whether a bundle is currently stored, using the ID index
+    /// @param bundleID BundleId of the bundle
+    /// @return true if the bundle is stored
+    bool containsBundle(std::string bundleID) override;
+
+    /// @brief reads a stored bundle directly from the memory mapped partition
+    /// @param bundleID BundleId of the bundle
+    /// @return the stored bundle, or an empty BundleInfo object if it is not stored
+    BundleInfo getBundle(std::string bundleID) override;
+
+    /// @brief finds the stored bundles whose destination starts with the given EID, using the destination index
+    /// @param destination destination EID, or a prefix of it
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesTo(const std::string& destination,
+                                           size_t limit = SIZE_MAX) override;
+
+    /// @brief finds the stored bundles which were not forwarded to a node yet, only the unserialized keys of the bundles are checked
+    /// @param nodeURI URI of the node
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesNotForwardedTo(
+        const std::string& nodeURI, size_t limit = SIZE_MAX) override;
+
+    /// @brief finds the stored bundles which are not contained in the summary a peer advertised, only the unserialized bundle IDs are checked
+    /// @param summary summary of the bundles the peer received or stores
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesMissingFrom(
+        const BundleSummary& summary, size_t limit = SIZE_MAX) override;
+
+    /// @brief inserts the IDs of all stored bundles into a summary
+    /// @param summary the summary
+    void summarizeBundles(BundleSummary& summary) override;
+
+    /// @brief finds the stored bundles expiring before the given time, using the expiry index
+    /// @param time system time in ms
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles
+    std::vector<std::string> findBundlesExpiringBefore(
+        uint64_t time, size_t limit = SIZE_MAX) override;
+
+    /// @brief appends a bundle to the log
+    /// @param bundle bundle to store
+    /// @return bundles removed to make space, contains the given bundle itself if it is too large to be stored or has the lowest eviction rank
+    std::vector<BundleInfo> delayBundle(BundleInfo* bundle) override;
+
+    /// @brief leases the next bundles of the current retry cycle, the bundles stay in their records and are moved to the end of the retry order in RAM, nothing is written to flash
+    /// @param n maximum number of leased bundles
+    /// @return the leased bundles
+    std::vector<BundleInfo> leaseBatch(size_t n) override;
+
+    /// @brief leases a single stored bundle, nothing is written to flash
+    /// @param bundleID ID of the bundle
+    /// @param bundle set to the leased bundle
+    /// @return false if the bundle is not stored or already leased
+    bool leaseBundle(const std::string& bundleID, BundleInfo& bundle) override;
+
+    /// @brief ends the lease of a bundle, a metadata record is appended if its metadata changed, the bundle record itself is not rewritten
+    /// @param bundleID ID of the leased bundle
+    /// @param updated the bundle with the updated metadata
+    /// @return false if the bundle is not leased
+    bool commit(const std::string& bundleID, BundleInfo& updated) override;
+
+    /// @brief ends the lease of a bundle without writing to flash
+    /// @param bundleID ID of the leased bundle
+    void release(const std::string& bundleID) override;
+
+    /// @brief returns a portion of the previously delayed bundles in the order they were written, exact size can be configured in menuconfig, only returns bundles up until to the point where the last bundle was stored when beginRetryCycle() was called
+    std::vector<BundleInfo> getBundlesRetry() override;
+
+    /// @brief deletes the bundle with the oldest reception time
+    /// @return the Deleted Bundle, an empty BundleInfo if no bundle is stored
+    BundleInfo deleteOldest() override;
+
+    /// @brief internally stores what the number of bundles was when it was called
+    void beginRetryCycle() override;
+
+    /// @brief returns whether there are still bundles to be returned in this retry
+    bool hasBundlesToRetry() override;
+};
@@ -0,0 +1,119 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include "sdkconfig.h"
+
+// the seen filter remembers bundle IDs for at least the lifetime of bundles, IDs of expired bundles do not need to be remembered
+#if CONFIG_IgnoreBundleTTL
+#define SEEN_FILTER_HORIZON CONFIG_OverrideBundleTTL
+#else
+#define SEEN_FILTER_HORIZON CONFIG_BundleTTL
+#endif
+
+/**
+ * @file SeenFilter.hpp
+ * @brief This file contains the SeenFilter class, a fixed size filter used by the storages to remember which bundle IDs were already received.
+ */
+
+/// @brief Fixed memory, expiring set of bundle IDs, implemented as a ring of Bloom filter generations.
+///        New IDs are always inserted into the current generation, lookups check all generations. After each rotation period the oldest generation is cleared and becomes the current one.
+///        An inserted ID is therefore remembered for at least (generations - 1) rotation periods, the rotation period is chosen such that this equals the configured retention horizon.
+///        If more IDs than expected are inserted in one period, the filter rotates early to keep the false positive rate bounded, which shortens the retention of the oldest IDs.
+///        A false positive means a new bundle is treated as a duplicate, false negatives only occur for IDs older than the retention horizon.
+///        All methods are thread safe without taking a lock: bits are set with atomic or operations, and only one caller at a time checks whether the generations have to be rotated, the others skip the check.
+///        A rotation clears the oldest generation before it becomes the current one, so concurrent inserts always go to a generation which is kept for the whole horizon.
+///        Two concurrent checkAndInsert calls for the same new ID may both return false, the storages call it from the reception task only.
+///        A lock free open addressing table of ID hashes would give exact answers, but needs at least 8 bytes per slot and free slots to stay fast, about three times the memory of the filter at the default false positive rate,
+///        and expiring IDs from it needs tombstones or a periodic rebuild, while the generations forget old IDs by clearing whole words. The filter is therefore kept, its fixed size also keeps its memory independent of the traffic.
+class SeenFilter {
+   private:
+    /// @brief bits of all generations, generation g occupies the words [g * wordsPerGeneration, (g + 1) * wordsPerGeneration)
+    std::unique_ptr<std::atomic<uint32_t>[]> bits;
+
+    /// @brief number of 32 bit words per generation
+    uint32_t wordsPerGeneration;
+
+    /// @brief number of bits per generation
+    uint32_t bitsPerGeneration;
+
+    /// @brief number of bits set per ID
+    uint8_t numHashes;
+
+    /// @brief number of generations
+    uint8_t generations;
+
+    /// @brief index of the generation new IDs are inserted into
+    std::atomic<uint8_t> current{0};
+
+    /// @brief number of IDs inserted into the current generation
+    std::atomic<uint32_t> currentCount{0};
+
+    /// @brief number of IDs a generation is dimensioned for
+    uint32_t generationCapacity;
+
+    /// @brief time in ms after which the generations are rotated
+    uint64_t rotationPeriod;
+
+    /// @brief time in ms at which the current generation was started, only accessed while holding rotating
+    uint64_t generationStart;
+
+    /// @brief set while a caller checks whether the generations have to be rotated
+    std::atomic_flag rotating = ATOMIC_FLAG_INIT;
+
+    /// @brief computes the two base hashes of an ID, all bit positions are derived from them by double hashing
+    /// @param id the ID to hash
+    /// @param h1 first base hash
+    /// @param h2 second base hash, always odd
+    static void baseHashes(const std::string& id, uint32_t& h1, uint32_t& h2);
+
+    /// @brief checks whether all bits of an ID are set in the given generation
+    bool containedIn(uint8_t generation, uint32_t h1, uint32_t h2) const;
+
+    /// @brief sets all bits of an ID in the current generation
+    void setBits(uint32_t h1, uint32_t h2);
+
+    /// @brief rotates the generations if the rotation period has passed or the current generation is full
+    void rotateIfNeeded();
+
+    /// @brief clears the oldest generation and makes it the current one, does not update generationStart. Must be called while holding rotating
+    void rotate();
+
+   public:
+    /// @brief creates the filter and allocates all of its memory
+    /// @param capacity number of IDs expected to be inserted within the retention horizon
+    /// @param falsePositivePPM targeted overall false positive rate in parts per million
+    /// @param generations number of generations, at least 2
+    /// @param horizonMs minimum time in ms an inserted ID is remembered
+    SeenFilter(uint32_t capacity, uint32_t falsePositivePPM,
+               uint8_t generations, uint64_t horizonMs);
+
+    /// @brief creates the filter with the parameters set in menuconfig, IDs are remembered for at least the bundle lifetime
+    SeenFilter()
+        : SeenFilter(CONFIG_SeenFilterCapacity, CONFIG_SeenFilterFalsePositivePPM,
+                     CONFIG_SeenFilterGenerations, SEEN_FILTER_HORIZON) {};
+
+    /// @brief checks whether an ID was inserted within the retention horizon
+    /// @param id the ID to check
+    /// @return true if the ID (probably) was inserted before, false if it definitely was not
+    bool contains(const std::string& id);
+
+    /// @brief inserts an ID into the current generation
+    /// @param id the ID to insert
+    void insert(const std::string& id);
+
+    /// @brief checks whether an ID was seen before and inserts it if not, hashes the ID only once
+    /// @param id the ID to check and insert
+    /// @return true if the ID was (probably) seen before, in this case it is not inserted again
+    bool checkAndInsert(const std::string& id);
+
+    /// @brief returns the memory used for the filter bits
+    /// @return size in bytes
+    size_t memoryUsage() const;
+
+    /// @brief returns the number of IDs inserted into the current generation
+    uint32_t currentGenerationCount() const {
+        return currentCount.load(std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,140 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "sdkconfig.h"
+
+/**
+ * @file SlabStore.hpp
+ * @brief This file contains the SlabStore, which stores serialized bundles in chained chunks of fixed size classes to avoid fragmenting the heap.
+ */
+
+/// @brief number of chunk size classes of the SlabStore
+#define SLAB_SIZE_CLASSES 3
+
+/// @brief handle marking the end of a chunk chain, or an empty SlabRef
+#define SLAB_NO_CHUNK UINT32_MAX
+
+/// @brief reference to data stored in a SlabStore
+struct SlabRef {
+    /// @brief handle of the first chunk of the chain
+    uint32_t first = SLAB_NO_CHUNK;
+
+    /// @brief number of stored bytes
+    uint32_t length = 0;
+};
+
+/// @brief Stores byte sequences in chunks of fixed size classes, which are taken from slabs of CONFIG_SlabChunksPerSlab chunks each. Data larger than one chunk is stored in a chain of chunks.
+///        As all chunks of a class have the same size, freed chunks can always be reused by later data, so the heap is not fragmented by bundles of random sizes being stored and removed.
+///        New chunks are taken from the fullest slab of their class, slabs which become empty are returned to the BundleAllocator unless they are the last free chunks of their class and the pool limits are kept.
+///        This class is NOT thread safe, the owning storage has to ensure exclusive access.
+class SlabStore {
+   private:
+    /// @brief a block of chunks of one size class
+    struct Slab {
+        /// @brief memory of the chunks, nullptr if the slab was released and its slot can be reused
+        uint8_t* memory = nullptr;
+
+        /// @brief number of free chunks
+        uint16_t freeCount = 0;
+
+        /// @brief index of the first free chunk, the free chunks are linked through their next field
+        uint32_t freeHead = SLAB_NO_CHUNK;
+    };
+
+    /// @brief the slabs of one chunk size
+    struct SizeClass {
+        /// @brief size of a chunk in bytes, including the next field
+        uint16_t chunkSize;
+
+        /// @brief slabs of this class, the index of a slab is part of the chunk handles and therefore never changes
+        std::vector<Slab> slabs;
+
+        /// @brief number of free chunks in all slabs of this class
+        size_t freeChunks = 0;
+    };
+
+    /// @brief the size classes, ordered from the smallest to the largest chunk
+    SizeClass classes[SLAB_SIZE_CLASSES];
+
+    /// @brief number of chunks per slab
+    uint16_t chunksPerSlab;
+
+    /// @brief bytes of all allocated slabs
+    size_t reservedBytes = 0;
+
+    /// @brief bytes of all used chunks
+    size_t usedBytes = 0;
+
+    /// @brief bytes of stored data
+    size_t storedBytes = 0;
+
+    /// @brief returns the bytes of data a chunk of the given class holds
+    size_t payload(uint8_t sizeClass) const {
+        return classes[sizeClass].chunkSize - sizeof(uint32_t);
+    };
+
+    /// @brief chooses the class of the next chunk in a chain. The smallest class holding the remaining data is used, unless its chunk would be less than half filled, then the next smaller class is chained instead
+    /// @param remaining number of bytes still to be stored
+    uint8_t nextClass(size_t remaining) const;
+
+    /// @brief returns a pointer to a chunk
+    uint8_t* chunk(uint32_t handle);
+
+    /// @brief takes a free chunk of a class, allocates a new slab if needed
+    /// @return the handle of the chunk, SLAB_NO_CHUNK if no memory for a new slab is left
+    uint32_t allocateChunk(uint8_t sizeClass);
+
+    /// @brief returns a chunk to its slab, the slab is released if it becomes empty and other chunks of its class are free or a BundleAllocator pool exceeds its limit
+    void freeChunk(uint32_t handle);
+
+    /// @brief returns the memory of an empty slab to the BundleAllocator, its slot can be reused
+    void releaseSlab(SizeClass& sizeClass, Slab& slab);
+
+   public:
+    /// @brief creates an empty store, slabs are only allocated when data is stored
+    /// @param chunksPerSlab number of chunks per slab
+    SlabStore(uint16_t chunksPerSlab = CONFIG_SlabChunksPerSlab);
+    ~SlabStore();
+
+    SlabStore(const SlabStore&) = delete;
+    SlabStore& operator=(const SlabStore&) = delete;
+
+    /// @brief stores data in a chain of chunks
+    /// @param data the data to store
+    /// @param length number of bytes
+    /// @param ref set to the reference to the stored data, has to be given to free() to release it
+    /// @return false if no memory for the chunks is left, nothing is stored then
+    bool store(const uint8_t* data, size_t length, SlabRef& ref);
+
+    /// @brief copies stored data into a vector
+    /// @param ref reference returned by store
+    /// @return the stored bytes
+    std::vector<uint8_t> read(const SlabRef& ref);
+
+    /// @brief frees the chunks of stored data
+    /// @param ref reference returned by store, reset to an empty reference
+    void free(SlabRef& ref);
+
+    /// @brief returns all empty slabs to the BundleAllocator, including the last free chunks of each class, used while a pool exceeds its limit
+    void releaseEmptySlabs();
+
+    /// @brief returns the bytes of chunks needed to store data of the given length
+    size_t chunkMemory(size_t length) const;
+
+    /// @brief returns the bytes of all allocated slabs
+    size_t reserved() const { return reservedBytes; };
+
+    /// @brief returns the bytes of all used chunks
+    size_t used() const { return usedBytes; };
+
+    /// @brief returns the bytes of stored data
+    size_t stored() const { return storedBytes; };
+
+    /// @brief returns the fraction of the allocated slab memory not holding data, caused by free chunks and partially filled chunks
+    /// @return fragmentation ratio between 0 and 1, 0 if no slab is allocated
+    float fragmentation() const {
+        return reservedBytes == 0 ? 0
+                                  : 1 - (float)storedBytes / reservedBytes;
+    };
+};
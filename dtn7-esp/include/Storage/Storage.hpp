@@ -1,14 +1,19 @@
 #pragma once
 #include <list>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include "Data.hpp"
+#include "EvictionPolicy.hpp"
+#include "NodeTable.hpp"
+#include "PeerAging.hpp"
 #include "dtn7-bundle.hpp"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "nvs.h"
 #include "nvs_flash.h"
+#include "sdkconfig.h"
 
 /**
  * @file Storage.hpp
@@ -16,32 +21,108 @@
  */
 
 /// @brief base class for storage implementations, access to derived classes needs to be thread safe!
+///        Known nodes are kept in a NodeTable by the base class, storages only need to override the node functions if they store nodes differently, in that case all of them have to be overridden.
 class Storage {
    protected:
     /// @brief stores how many bundle still need to be retried
-    uint16_t bundlesToReturn = 0;
+    size_t bundlesToReturn = 0;
+
+    /// @brief stores the known nodes, keyed by their URI
+    NodeTable nodeTable;
+
+    /// @brief tracks the last seen times of all non static known nodes, expired nodes are removed through removeNode
+    PeerAging nodeAging;
+
+    /// @brief decides which bundles are removed first if the storage is full
+    std::unique_ptr<EvictionPolicy> evictionPolicy;
 
    public:
     /// @brief base class representing Some kind of storage for bundles, all methods have to be thread safe!
-    Storage() {};
+    Storage()
+        : nodeAging((uint64_t)CONFIG_MaxPeerAge * 1000,
+                    [this](const std::string& uri, uint64_t lastSeen) {
+                        // only remove the node if it was not seen again after it expired
+                        if (nodeTable.getLastSeen(uri) <= lastSeen)
+                            removeNode(uri);
+                    }),
+          evictionPolicy(EvictionPolicy::fromConfig()) {};
     virtual ~Storage() {};
 
+    /// @brief replaces the eviction policy selected in menuconfig. Must be called before bundles are stored, as the rank of a bundle is calculated when it is stored
+    /// @param policy the new policy, ownership is taken by the storage
+    void setEvictionPolicy(EvictionPolicy* policy) {
+        evictionPolicy.reset(policy);
+    };
+
+    /// @brief returns the memory currently used by stored bundles and their indexes
+    /// @return used memory in bytes, 0 if the storage does not keep bundles in memory
+    virtual size_t memoryUsage() { return 0; };
+
     /// @brief adds a node to the known nodes, if it is already present, it is overwritten
     /// @param node node to store
-    virtual void addNode(Node node) = 0;
+    virtual void addNode(Node node) {
+        if (nodeTable.upsert(node) == INVALID_NODE_ID)
+            return;
+        // statically added nodes never expire
+        if (node.lastSeen == UINT64_MAX)
+            nodeAging.remove(node.URI);
+        else
+            nodeAging.touch(node.URI, node.lastSeen);
+    };
 
     /// @brief removes a node from the list of known nodes
-    /// @param address
-    virtual void removeNode(std::string address) = 0;
+    /// @param address URI of the node
+    virtual void removeNode(std::string address) {
+        nodeTable.remove(address);
+        nodeAging.remove(address);
+    };
 
-    /// @brief gets a previously stored node object from a given address/identifier
-    /// @param address
+    /// @brief gets a previously stored node object from a given address
+    /// @param address URI of the node
     /// @return the previously stored node if it exists, otherwise a empty node object
-    virtual Node getNode(std::string address) = 0;
+    virtual Node getNode(std::string address) {
+        return nodeTable.get(address);
+    };
 
-    /// @brief gets all known nodes
+    /// @brief gets copies of all known nodes, prefer getNodesSnapshot if the nodes are only read
     /// @return a vector containing all known nodes
-    virtual std::vector<Node> getNodes() = 0;
+    virtual std::vector<Node> getNodes() { return nodeTable.getAll(); };
+
+    /// @brief looks up the stable handle of a known node
+    /// @param address URI of the node
+    /// @return the NodeId of the node, INVALID_NODE_ID if it is not known
+    virtual NodeId findNode(std::string address) {
+        return nodeTable.find(address);
+    };
+
+    /// @brief updates the last seen time of a known node in place, without copying it
+    /// @param id NodeId of the node, as returned by findNode
+    /// @param now the current time in ms
+    /// @return false if the node is not known (anymore)
+    virtual bool touchNode(NodeId id, uint64_t now) {
+        std::string uri;
+        if (!nodeTable.touch(id, now, &uri))
+            return false;
+        // the URI is only set if the node is not static
+        if (!uri.empty())
+            nodeAging.touch(uri, now);
+        return true;
+    };
+
+    /// @brief removes all non static nodes which have not been seen for longer than the given age, only the expired nodes are looked at
+    /// @param now the current time in ms
+    /// @param maxAge the maximum age of a node in ms
+    /// @return the number of removed nodes
+    virtual size_t expireNodes(uint64_t now, uint64_t maxAge) {
+        nodeAging.setTimeout(maxAge);
+        return nodeAging.expire(now);
+    };
+
+    /// @brief returns a shared, immutable snapshot of all known nodes, which is only recreated if nodes were added, changed or removed. The last seen times in the snapshot may be outdated
+    /// @return pointer to the snapshot, valid as long as it is held
+    virtual NodeSnapshotPtr getNodesSnapshot() {
+        return nodeTable.getSnapshot();
+    };
 
     /// @brief checks whether a bundleID was seen before
     /// @param bundleID std::string containing the BundleID to check
@@ -53,11 +134,71 @@ class Storage {
     /// @param node identifier of the node from which the Bundle was received
     virtual void storeSeen(std::string bundleID) = 0;
 
+    /// @brief checks whether a bundleID was seen before and marks it as seen if not. Storages should override this to perform both steps under one lock
+    /// @param bundleID std::string containing the BundleID to check
+    /// @return whether the bundle Id was seen before
+    virtual bool checkAndStoreSeen(std::string bundleID) {
+        if (checkSeen(bundleID))
+            return true;
+        storeSeen(bundleID);
+        return false;
+    };
+
     /// @brief removes a Bundle from storage
     /// @param bundleID BundleId of the bundle to remove
     /// @return true if the bundle was previously stored, otherwise false
     virtual bool removeBundle(std::string bundleID) = 0;
 
+    /// @brief checks whether a bundle is currently stored, without reading it
+    /// @param bundleID BundleId of the bundle
+    /// @return true if the bundle is stored
+    virtual bool containsBundle(std::string bundleID) = 0;
+
+    /// @brief returns a copy of a stored bundle, the bundle stays in storage
+    /// @param bundleID BundleId of the bundle
+    /// @return the stored bundle, or an empty BundleInfo object if it is not stored
+    virtual BundleInfo getBundle(std::string bundleID) = 0;
+
+    /// @brief finds the stored bundles whose destination starts with the given EID, e.g. a node URI matches all endpoints of the node. Only the bundle IDs are returned, which can be passed to getBundle or removeBundle
+    /// @param destination destination EID, or a prefix of it
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles, always empty if the storage does not support queries
+    virtual std::vector<std::string> findBundlesTo(
+        const std::string& destination, size_t limit = SIZE_MAX) {
+        return std::vector<std::string>();
+    };
+
+    /// @brief finds the stored bundles which were not forwarded to a node yet, in the order they were stored
+    /// @param nodeURI URI of the node
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles, always empty if the storage does not support queries
+    virtual std::vector<std::string> findBundlesNotForwardedTo(
+        const std::string& nodeURI, size_t limit = SIZE_MAX) {
+        return std::vector<std::string>();
+    };
+
+    /// @brief finds the stored bundles which are not contained in the summary a peer advertised, i.e. the bundles the peer is missing, in the order they were stored
+    /// @param summary summary of the bundles the peer received or stores
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles, always empty if the storage does not support queries
+    virtual std::vector<std::string> findBundlesMissingFrom(
+        const BundleSummary& summary, size_t limit = SIZE_MAX) {
+        return std::vector<std::string>();
+    };
+
+    /// @brief inserts the IDs of all stored bundles into a summary, which is advertised to peers. Does nothing if the storage does not support queries
+    /// @param summary the summary
+    virtual void summarizeBundles(BundleSummary& summary) {};
+
+    /// @brief finds the stored bundles expiring before the given time, the soonest expiring first
+    /// @param time system time in ms
+    /// @param limit maximum number of returned IDs
+    /// @return the IDs of the matching bundles, always empty if the storage does not support queries
+    virtual std::vector<std::string> findBundlesExpiringBefore(
+        uint64_t time, size_t limit = SIZE_MAX) {
+        return std::vector<std::string>();
+    };
+
     /// @brief stores a given bundle for later retransmission
     /// @param bundle bundle to store
     /// @return if other bundles were removed from storage in order to fit the new one, a vector of the removed bundles is returned
@@ -66,10 +207,44 @@ class Storage {
     /// @brief returns a portion previously delayed bundles, exact size can be configured in menuconfig, as a vector, called repeatedly when retrying bundles, starts with the oldest batch of bundles, only returns bundles up until to the point where the last bundle was stored when beginRetryCycle() was called
     virtual std::vector<BundleInfo> getBundlesRetry() = 0;
 
+    /// @brief leases the next bundles of the current retry cycle. Leased bundles stay in storage and are marked with BundleInfo::leased, the lease of each has to be ended with commit, release or removeBundle, the bundle ID is the handle of the lease.
+    ///        Storages which do not support leases return the bundles of getBundlesRetry instead, these are removed from storage and not marked as leased
+    /// @param n maximum number of leased bundles, ignored by storages without lease support, which return CONFIG_RetryBatchSize bundles
+    /// @return the leased bundles
+    virtual std::vector<BundleInfo> leaseBatch(size_t n) {
+        return getBundlesRetry();
+    };
+
+    /// @brief leases a single stored bundle outside of the retry cycle, e.g. when forwarding to a new contact. The lease has to be ended like the leases of leaseBatch.
+    ///        Storages which do not support leases remove the bundle from storage instead and do not mark it as leased
+    /// @param bundleID ID of the bundle
+    /// @param bundle set to the leased or removed bundle
+    /// @return false if the bundle is not stored or already leased, e.g. by the retry task, it must then not be forwarded
+    virtual bool leaseBundle(const std::string& bundleID, BundleInfo& bundle) {
+        bundle = getBundle(bundleID);
+        // the bundle may have been taken by the retry task in the meantime
+        return removeBundle(bundleID);
+    };
+
+    /// @brief ends the lease of a bundle which stays stored for a later retry, only the mutable metadata of the bundle (retention constraint, local delivery, forwardedTo, broadcasts, copies) is written back
+    /// @param bundleID ID of the leased bundle
+    /// @param updated the bundle with the updated metadata
+    /// @return false if the bundle is not leased, e.g. because it was removed in the meantime
+    virtual bool commit(const std::string& bundleID, BundleInfo& updated) {
+        return false;
+    };
+
+    /// @brief ends the lease of a bundle without changing it
+    /// @param bundleID ID of the leased bundle
+    virtual void release(const std::string& bundleID) {};
+
     /// @brief deletes the oldest stored Bundle
     /// @return the Deleted Bundle
     virtual BundleInfo deleteOldest() = 0;
 
+    /// @brief writes all changes which the storage delays to flash, should be called before critical events such as a restart or deep sleep. Storages which do not delay writes do nothing
+    virtual void flush() {};
+
     /// @brief internally stores what the number of bundles was when it was called
     virtual void beginRetryCycle() = 0;
 
@@ -82,7 +257,7 @@ class Storage {
 class DummyStorage : public Storage {
    protected:
     /// @brief stores how many bundle still need to be retried
-    uint16_t bundlesToReturn = 0;
+    size_t bundlesToReturn = 0;
 
    public:
     /// @brief base class representing a storage for bundles. All methods have to be thread safe!
@@ -106,6 +281,29 @@ class DummyStorage : public Storage {
     /// @return a vector containing all known nodes
     std::vector<Node> getNodes() override { return std::vector<Node>(); };
 
+    /// @brief looks up the stable handle of a known node
+    /// @param address URI of the node
+    /// @return always INVALID_NODE_ID
+    NodeId findNode(std::string address) override { return INVALID_NODE_ID; };
+
+    /// @brief updates the last seen time of a known node
+    /// @param id NodeId of the node
+    /// @param now the current time in ms
+    /// @return always false
+    bool touchNode(NodeId id, uint64_t now) override { return false; };
+
+    /// @brief removes expired nodes
+    /// @param now the current time in ms
+    /// @param maxAge the maximum age of a node in ms
+    /// @return always 0
+    size_t expireNodes(uint64_t now, uint64_t maxAge) override { return 0; };
+
+    /// @brief returns a snapshot of all known nodes
+    /// @return an empty snapshot
+    NodeSnapshotPtr getNodesSnapshot() override {
+        return std::make_shared<const NodeSnapshot>();
+    };
+
     /// @brief checks whether a bundleID was seen before
     /// @param bundleID std::string containing the BundleID to check
     /// @return whether the bundle Id was seen before
@@ -116,11 +314,26 @@ class DummyStorage : public Storage {
     /// @param node identifier of the node from which the Bundle was received
     void storeSeen(std::string bundleID) override { return; };
 
+    /// @brief checks whether a bundleID was seen before and marks it as seen, nothing is stored
+    /// @param bundleID std::string containing the BundleID to check
+    /// @return always false
+    bool checkAndStoreSeen(std::string bundleID) override { return false; };
+
     /// @brief removes a Bundle from storage
     /// @param bundleID BundleId of the bundle to remove
     /// @return true if the bundle was previously stored, otherwise false
     bool removeBundle(std::string bundleID) override { return false; };
 
+    /// @brief checks whether a bundle is currently stored
+    /// @param bundleID BundleId of the bundle
+    /// @return always false
+    bool containsBundle(std::string bundleID) override { return false; };
+
+    /// @brief returns a copy of a stored bundle
+    /// @param bundleID BundleId of the bundle
+    /// @return always an empty BundleInfo object
+    BundleInfo getBundle(std::string bundleID) override { return BundleInfo(); };
+
     /// @brief Stores a given bundle for later retransmission.
     /// @param bundle bundle to store
     /// @return if other bundles were removed from storage in order to fit the new one, a vector of the removed bundles is returned
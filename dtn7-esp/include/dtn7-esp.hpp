@@ -3,6 +3,7 @@
 #include <vector>
 #include "BLE_CLA.hpp"
 #include "BundleProtocolAgent.hpp"
+#include "BundleSummary.hpp"
 #include "CLA.hpp"
 #include "Endpoint.hpp"
 #include "LoRaCLA.hpp"
@@ -44,9 +45,12 @@ extern TaskHandle_t bundleForwardHandel;
 /// @brief stores the Maximum Age Peers are allowed to have and not be removed from the list of known Peers
 extern int32_t maxPeerAge;
 
-/// @brief stores the HashWrapper Class used if BPoL is configured to use BundleID hashes in advertisements
+/// @brief stores the HashWrapper Class, available to applications. The bundle summaries in advertisements use their own hash, which has to be the same on all nodes
 extern HashWrapper* hasher;
 
+/// @brief summary of the bundles received by this node, advertised by the LoRa CLA if the use of bundle summaries for reception confirmation is enabled in menuconfig
+extern LocalBundleSummary* receivedSummary;
+
 /// @brief stores the global pointer to the BundleProtocolAgent Object, there may always be at most one
 extern BundleProtocolAgent* BPA;
 
@@ -87,6 +91,11 @@ void retryBundles(void* param);
 /// @brief task which periodically polls CLA's not using the queue system
 void pollClas(void* param);
 
+/// @brief called when a new peer is discovered, notifies the router of the contact, queries the storage for bundles destined to the peer or not yet forwarded to it, or missing from the summary it advertised if bundle summaries are enabled in menuconfig, and sends them to the forward queue, without waiting for the next retry.
+///        Bundles destined to the peer are forwarded first, at most CONFIG_ContactBatchSize bundles are forwarded. Forwarding does nothing if disabled in menuconfig or the storage does not support queries. Never blocks on the forward queue.
+/// @param nodeURI URI of the discovered peer
+void contactStarted(std::string nodeURI);
+
 /// @brief Initialise BundleProtocolAgent with the given URI as the local nodes URI, returns the central Endpoint of this node
 /// @param URI URI to be set as the local nodes URI
 /// @param onReceive Function Pointer to the function to be called when data for the local Endpoint is received, first argument of callback is bundle Payload as a byte vector, second is the destination endpoint URI, third is the Source Endpoint URI, forth is the Primary Block of the corresponding bundle, WARNING: Callback is called from a different task! I must be thread safe!
@@ -108,6 +117,12 @@ Endpoint* registerEndpoint(std::string URI,
                            void (*onReceive)(std::vector<uint8_t>, std::string,
                                              std::string, PrimaryBlock) = NULL);
 
+/// @brief Adds an endpoint with a view callback to the BundleProtocolAgent with the given URI, this function allocates memory, remember to delete the created endpoint, after unregistering it!!
+/// @param URI URI to be set as the endpoint URI
+/// @param onDeliver callback receiving a DeliveryView of each bundle delivered to the endpoint, WARNING: Callback is called from a different task! It must be thread safe!
+/// @return The Endpoint object that was created
+Endpoint* registerEndpoint(std::string URI, DeliveryCallback onDeliver);
+
 /// @brief unregisters an endpoint from the BUndleProtocolAgent
 /// @param URI URI of the Endpoint to unregister
 /// @return pointer to the unregistered endpoint, should be deleted if not intended to be registered again, if endpoint was not registered, it returns a null pointer
@@ -136,4 +151,45 @@ std::string uriFromMac();
 /// @brief adds the Node to the list of known Peers, with UINT64MAX as last seen value
 /// @param node node to add
 void addStaticPeer(Node node);
+
+/// @brief sets the number of copies bundles to a destination start with, only used by the Spray and Wait Router
+/// @param destination URI of a destination endpoint, or of a node to set the budget of all its endpoints
+/// @param copies number of copies, 1 to only forward bundles directly to their destination
+/// @return false if a different router is configured
+bool setCopyBudget(std::string destination, uint16_t copies);
+
+/// @brief adds a static route, bundles whose destination matches the pattern are forwarded to the next hop over the given CLA only, whichever router is configured. Replaces the route with the same pattern if there is one
+/// @param pattern pattern matched against the destination EID: ending with '*' to match all EIDs starting with the part before it, e.g. "dtn://gateway-*", ending with '/' to match a node and all its endpoints, otherwise only the EID itself. The longest matching pattern is used
+/// @param nextHop URI of the node bundles are sent to, may be empty to only broadcast bundles over the given CLA
+/// @param cla name of the CLA to use, as returned by CLA::getName(), e.g. "LoRa CLA", empty to use any CLA
+/// @return whether the route was valid and added
+bool addStaticRoute(std::string pattern, std::string nextHop,
+                    std::string cla = "");
+
+/// @brief removes a static route added with addStaticRoute
+/// @param pattern pattern of the route
+/// @return whether a route was removed
+bool removeStaticRoute(std::string pattern);
+
+/// @brief replaces the contact plan of the Contact Plan Router with one given as text, see ContactPlanRouter::loadContactPlan for its format
+/// @param plan the contact plan
+/// @return the number of contacts loaded, -1 if a different router is configured
+int loadContactPlan(std::string plan);
+
+/// @brief adds a contact to the contact plan of the Contact Plan Router
+/// @param from URI of the sending node
+/// @param to URI of the receiving node
+/// @param start time the contact opens in ms, in the time base of DTN7::nowMs()
+/// @param end time the contact closes in ms
+/// @param rate transmission rate in bytes per second
+/// @return whether the contact was added, false if it is invalid or a different router is configured
+bool addContact(std::string from, std::string to, uint64_t start, uint64_t end,
+                uint32_t rate);
+
+/// @brief sets the position of a node for the Geographic Router, e.g. of a gateway in a fixed place, it is not replaced by advertised positions
+/// @param nodeURI URI of the node
+/// @param lat latitude in degrees
+/// @param lng longitude in degrees
+/// @return false if a different router is configured or the position is invalid
+bool setNodePosition(std::string nodeURI, float lat, float lng);
 }  // namespace DTN7
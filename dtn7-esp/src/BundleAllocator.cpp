@@ -0,0 +1,136 @@
+#include "BundleAllocator.hpp"
+#include <stdlib.h>
+#include <algorithm>
+#include "Block.hpp"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_memory_utils.h"
+
+void* HeapCapsBackend::allocate(size_t size, MemoryPool pool) {
+    uint32_t caps = pool == MemoryPool::External
+                        ? MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT
+                        : MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    return heap_caps_malloc(size, caps);
+}
+
+void HeapCapsBackend::deallocate(void* pointer) {
+    heap_caps_free(pointer);
+}
+
+MemoryPool HeapCapsBackend::poolOf(const void* pointer) {
+    return esp_ptr_external_ram(pointer) ? MemoryPool::External
+                                         : MemoryPool::Internal;
+}
+
+bool HeapCapsBackend::available(MemoryPool pool) {
+    // boards without SPIRAM, or with SPIRAM not added to the heap, have no external pool
+    return pool == MemoryPool::Internal ||
+           heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0;
+}
+
+BundleAllocator::BundleAllocator(MemoryBackend* backend, size_t internalLimit,
+                                 size_t externalLimit,
+                                 size_t externalThreshold) {
+    this->backend = backend;
+    used[0] = 0;
+    used[1] = 0;
+    limits[(int)MemoryPool::Internal] = internalLimit;
+    limits[(int)MemoryPool::External] = externalLimit;
+    this->externalThreshold = externalThreshold;
+}
+
+BundleAllocator& BundleAllocator::instance() {
+    static HeapCapsBackend backend;
+    static BundleAllocator allocator(&backend, CONFIG_InternalPoolLimit,
+                                     CONFIG_ExternalPoolLimit,
+                                     CONFIG_ExternalAllocThreshold);
+    return allocator;
+}
+
+/// @brief allocates block type specific data, blocks can not handle a failed allocation, so like operator new without exceptions this aborts if no memory is left in both pools
+static uint8_t* allocateBlockData(size_t size) {
+    void* pointer = BundleAllocator::instance().allocate(size);
+    if (pointer == nullptr)
+        abort();
+    return (uint8_t*)pointer;
+}
+
+static void deallocateBlockData(uint8_t* data, size_t size) {
+    BundleAllocator::instance().deallocate(data, size);
+}
+
+void BundleAllocator::useForBlockData() {
+    blockDataAllocator = {allocateBlockData, deallocateBlockData};
+}
+
+bool BundleAllocator::hasRoom(MemoryPool pool, size_t size) {
+    size_t limit = limits[(int)pool];
+    return backend->available(pool) &&
+           (limit == 0 || used[(int)pool] + size <= limit);
+}
+
+bool BundleAllocator::choosePool(size_t size, MemoryPool& pool) {
+    // large buffers prefer external RAM, small ones internal RAM, the other pool is used if the preferred one is full
+    MemoryPool preferred = size >= externalThreshold ? MemoryPool::External
+                                                     : MemoryPool::Internal;
+    MemoryPool other = preferred == MemoryPool::External
+                           ? MemoryPool::Internal
+                           : MemoryPool::External;
+    if (hasRoom(preferred, size))
+        pool = preferred;
+    else if (hasRoom(other, size))
+        pool = other;
+    else
+        return false;
+    return true;
+}
+
+bool BundleAllocator::fits(size_t size) {
+    MemoryPool pool;
+    return choosePool(size, pool);
+}
+
+bool BundleAllocator::withinLimits(const size_t* released) {
+    for (int pool = 0; pool < 2; pool++) {
+        size_t usage = used[pool];
+        if (released != nullptr)
+            usage -= std::min(usage, released[pool]);
+        if (limits[pool] != 0 && usage > limits[pool])
+            return false;
+    }
+    return true;
+}
+
+void* BundleAllocator::allocate(size_t size) {
+    // the limits are enforced by the storages through fits() and withinLimits(), an allocation above the limits is still served
+    MemoryPool pool;
+    if (!choosePool(size, pool))
+        pool = backend->available(MemoryPool::External) &&
+                       size >= externalThreshold
+                   ? MemoryPool::External
+                   : MemoryPool::Internal;
+
+    void* pointer = backend->allocate(size, pool);
+    if (pointer == nullptr) {
+        // the pool itself is exhausted, try the other one
+        MemoryPool other = pool == MemoryPool::External
+                               ? MemoryPool::Internal
+                               : MemoryPool::External;
+        if (backend->available(other))
+            pointer = backend->allocate(size, other);
+    }
+    if (pointer == nullptr) {
+        ESP_LOGE("BundleAllocator::allocate",
+                 "out of memory, could not allocate %u bytes", size);
+        return nullptr;
+    }
+    used[(int)backend->poolOf(pointer)] += size;
+    return pointer;
+}
+
+void BundleAllocator::deallocate(void* pointer, size_t size) {
+    if (pointer == nullptr)
+        return;
+    used[(int)backend->poolOf(pointer)] -= size;
+    backend->deallocate(pointer);
+}
@@ -1,5 +1,6 @@
 #include "BundleProtocolAgent.hpp"
 #include <algorithm>
+#include "Clock.hpp"
 #include "Data.hpp"
 #include "dtn7-esp.hpp"
 #include "utils.hpp"
@@ -83,7 +84,8 @@ bool BundleProtocolAgent::unregisterEndpoint(Endpoint* endpoint) {
     return false;
 }
 
-bool BundleProtocolAgent::bundleTransmission(Bundle* bundle) {
+bool BundleProtocolAgent::bundleTransmission(Bundle* bundle,
+                                             uint8_t priority) {
     bundle->getID();
 
     // set the relevant retention constraint
@@ -92,6 +94,7 @@ bool BundleProtocolAgent::bundleTransmission(Bundle* bundle) {
     // create a received bundle object indication that the bundle originated from this node
     ReceivedBundle* recBundle =
         new ReceivedBundle(bundle, DTN7::localNode->URI);
+    recBundle->priority = priority;
 
     // send the bundle to the received queue
     return (xQueueSend(receiveQueue, (void*)&recBundle, portMAX_DELAY));
@@ -103,7 +106,8 @@ bool BundleProtocolAgent::cancelTransmission(std::string bundleID) {
 }
 
 bool BundleProtocolAgent::bundleReception(Bundle* bundle,
-                                          std::string fromNode) {
+                                          std::string fromNode,
+                                          uint8_t priority) {
     ESP_LOGI("bundleReception", "handling reception");
     // add relevant retention constraint
     bundle->retentionConstraint = RETENTION_CONSTRAINT_DISPATCH_PENDING;
@@ -115,7 +119,8 @@ bool BundleProtocolAgent::bundleReception(Bundle* bundle,
         // if canonical block is not of a supported type, check action space
         // list all explicitly supported block types
         if ((block.blockTypeCode != 6) && (block.blockTypeCode != 7) &&
-            (block.blockTypeCode != 10)) {
+            (block.blockTypeCode != 10) &&
+            !router->supportsBlock(block.blockTypeCode)) {
             // the block flags indicate what must happen in case the block is unsupported
             BlockProcessingFlags flags = block.getFlags();
 
@@ -182,13 +187,8 @@ bool BundleProtocolAgent::bundleReception(Bundle* bundle,
             uint64_t expirationTime =
                 bundle->primaryBlock.timestamp.creationTime + lifetime;
 
-            // get the current time
-            struct timeval tv_now;
-            gettimeofday(&tv_now, NULL);
-
-            // convert current time to ms
-            uint64_t currentTime = ((int64_t)tv_now.tv_sec * 1000L +
-                                    (int64_t)tv_now.tv_usec / 1000);
+            // get the current time in ms
+            uint64_t currentTime = DTN7::nowMs();
 
             // delete bundle if required
             if (expirationTime < currentTime) {
@@ -207,6 +207,7 @@ bool BundleProtocolAgent::bundleReception(Bundle* bundle,
 
     // create bundle info object
     BundleInfo* bundleInf = new BundleInfo(bundle);
+    bundleInf->priority = priority;
     delete bundle;
     if (fromNode !=
         "none")  // check if the sender node is known, i.e. the fromNode string is not none
@@ -249,7 +250,7 @@ bool BundleProtocolAgent::localBundleDelivery(BundleInfo* bundle) {
         if (endp->localEID.getURI() == bundle->bundle.getDest().getURI()) {
             // deliver the bundle
             endp->localBundleDelivery(
-                (bundle->bundle));  // pass bundle by value
+                bundle->bundle);  // pass bundle by reference, the endpoint copies only what it keeps
 
             // check whether this node is already listed in the nodes the bundle was forwarded to
             bool alreadyContained = false;
@@ -292,9 +293,9 @@ void BundleProtocolAgent::bundleForwarding(BundleInfo* bundle) {
     (if possible) or forward the bundle to some other node(s) for further forwarding.
 
     The manner in which this decision is made may depend on the scheme name in the destination endpoint
-    ID and/or on other state -> this is a routing choice, handled by router class
+    ID and/or on other state -> this is a routing choice, handled by router class, which first checks the static routes
     */
-    bool success = this->router->handleForwarding(bundle, reasonCode);
+    bool success = this->router->forward(bundle, reasonCode);
 
     // ->this function will return whether the bundle shall be stored for later reattempt of forwarding. This happens when the forwarding was not successful, but the reason codes do not indicate an overall failure
     // ->the CLA send functions are also called by router, no need to do anything with CLAs here
@@ -308,6 +309,13 @@ void BundleProtocolAgent::bundleForwarding(BundleInfo* bundle) {
             ESP_LOGI("bundleForwarding",
                      "No forwarding failure, delaying bundle");
 
+            // A leased bundle is still stored, only its updated metadata is written back. If it was removed from storage in the meantime, it is handled elsewhere and dropped here
+            if (bundle->leased) {
+                storage->commit(bundle->bundle.getID(), *bundle);
+                delete bundle;
+                return;
+            }
+
             // To enable this re-evaluation, we store the bundle using the storage class.
             // This might potentially remove other bundles from storage because of space constraints, they will be returned and processed
             std::vector<BundleInfo> removed = storage->delayBundle(bundle);
@@ -326,6 +334,9 @@ void BundleProtocolAgent::bundleForwarding(BundleInfo* bundle) {
         else {
             // forwarding failure, RFC9171 Section 5.4.2
             ESP_LOGI("bundleForwarding", "Forwarding failure");
+            // a leased bundle is still stored and is not retried anymore
+            if (bundle->leased)
+                storage->removeBundle(bundle->bundle.getID());
             bool wasForLocalEndpoint = false;
 
             // RFC9171 makes a distinction whether the bundle was for a local endpoint or not.
@@ -346,6 +357,8 @@ void BundleProtocolAgent::bundleForwarding(BundleInfo* bundle) {
     }
     else {
         ESP_LOGI("bundleForwarding", "Forwarding Success");
+        if (bundle->leased)
+            storage->removeBundle(bundle->bundle.getID());
 
         // forwarding was successful, we no longer need the bundle
         bundle->setRetentionConstraint(RETENTION_CONSTRAINT_NONE);
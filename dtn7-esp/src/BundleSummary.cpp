@@ -0,0 +1,176 @@
+#include "BundleSummary.hpp"
+#include <algorithm>
+
+// base64 alphabet, the value of each character is its index
+static const char base64Chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/// @brief returns the value of a base64 character, -1 if it is not part of the alphabet
+static int base64Value(char c) {
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 26;
+    if (c >= '0' && c <= '9')
+        return c - '0' + 52;
+    if (c == '+')
+        return 62;
+    if (c == '/')
+        return 63;
+    return -1;
+}
+
+void BundleSummary::baseHashes(const std::string& id, uint32_t& h1,
+                               uint32_t& h2) {
+    // 64 bit FNV-1a, the same on every node, unlike std::hash
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : id) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    h1 = (uint32_t)hash;
+    h2 = (uint32_t)(hash >> 32) | 1;  // odd step, so the probed bits do not repeat early
+}
+
+void BundleSummary::insert(const std::string& id) {
+    if (bits.empty())
+        return;
+    uint32_t h1, h2;
+    baseHashes(id, h1, h2);
+    size_t numBits = bits.size() * 8;
+    for (uint32_t i = 0; i < BUNDLE_SUMMARY_HASHES; i++) {
+        size_t bit = (h1 + i * h2) % numBits;
+        bits[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+bool BundleSummary::contains(const std::string& id) const {
+    if (bits.empty())
+        return false;
+    uint32_t h1, h2;
+    baseHashes(id, h1, h2);
+    size_t numBits = bits.size() * 8;
+    for (uint32_t i = 0; i < BUNDLE_SUMMARY_HASHES; i++) {
+        size_t bit = (h1 + i * h2) % numBits;
+        if ((bits[bit / 8] & (1 << (bit % 8))) == 0)
+            return false;
+    }
+    return true;
+}
+
+float BundleSummary::falsePositiveRate() const {
+    if (bits.empty())
+        return 1;
+    size_t set = 0;
+    for (uint8_t byte : bits)
+        set += __builtin_popcount(byte);
+
+    // an ID not inserted is reported as contained if all of its bits are set
+    float fill = (float)set / (bits.size() * 8);
+    float result = 1;
+    for (int i = 0; i < BUNDLE_SUMMARY_HASHES; i++)
+        result *= fill;
+    return result;
+}
+
+void BundleSummary::merge(const BundleSummary& other) {
+    if (bits.empty())
+        bits.assign(other.bits.size(), 0);
+    // bit positions depend on the size, summaries of different sizes can not be merged
+    if (other.bits.size() != bits.size())
+        return;
+    for (size_t i = 0; i < bits.size(); i++)
+        bits[i] |= other.bits[i];
+}
+
+void BundleSummary::clear() {
+    std::fill(bits.begin(), bits.end(), 0);
+}
+
+std::string base64Encode(const uint8_t* data, size_t length) {
+    std::string result;
+    result.reserve((length + 2) / 3 * 4);
+    for (size_t i = 0; i < length; i += 3) {
+        // each group of 3 bytes is encoded as 4 characters, missing bytes at the end are padded with '='
+        uint32_t group = data[i] << 16;
+        if (i + 1 < length)
+            group |= data[i + 1] << 8;
+        if (i + 2 < length)
+            group |= data[i + 2];
+        result.push_back(base64Chars[(group >> 18) & 0x3F]);
+        result.push_back(base64Chars[(group >> 12) & 0x3F]);
+        result.push_back(i + 1 < length ? base64Chars[(group >> 6) & 0x3F]
+                                        : '=');
+        result.push_back(i + 2 < length ? base64Chars[group & 0x3F] : '=');
+    }
+    return result;
+}
+
+bool base64Decode(const std::string& encoded, std::vector<uint8_t>& result) {
+    result.clear();
+    if (encoded.size() % 4 != 0)
+        return false;
+    result.reserve(encoded.size() / 4 * 3);
+    for (size_t i = 0; i < encoded.size(); i += 4) {
+        uint32_t group = 0;
+        int padding = 0;
+        for (size_t j = 0; j < 4; j++) {
+            char c = encoded[i + j];
+            // padding is only allowed in the last two characters of the last group
+            if (c == '=' && j >= 2 && i + 4 == encoded.size()) {
+                padding++;
+                group <<= 6;
+                continue;
+            }
+            int value = base64Value(c);
+            if (value < 0 || padding > 0) {
+                result.clear();
+                return false;
+            }
+            group = (group << 6) | value;
+        }
+        result.push_back((group >> 16) & 0xFF);
+        if (padding < 2)
+            result.push_back((group >> 8) & 0xFF);
+        if (padding < 1)
+            result.push_back(group & 0xFF);
+    }
+    return true;
+}
+
+std::string BundleSummary::toBase64() const {
+    return base64Encode(bits.data(), bits.size());
+}
+
+BundleSummary BundleSummary::fromBase64(const std::string& encoded) {
+    BundleSummary result;
+    base64Decode(encoded, result.bits);
+    return result;
+}
+
+LocalBundleSummary::LocalBundleSummary(size_t size)
+    : current(size), previous(size) {
+    mutex = xSemaphoreCreateMutex();
+}
+
+LocalBundleSummary::~LocalBundleSummary() {
+    vSemaphoreDelete(mutex);
+}
+
+void LocalBundleSummary::insert(const std::string& id) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    current.insert(id);
+    xSemaphoreGive(mutex);
+}
+
+BundleSummary LocalBundleSummary::advertise() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    BundleSummary result = current;
+    result.merge(previous);
+
+    // the bundles of the previous generation have been advertised twice now and are forgotten
+    std::swap(current, previous);
+    current.clear();
+    xSemaphoreGive(mutex);
+    return result;
+}
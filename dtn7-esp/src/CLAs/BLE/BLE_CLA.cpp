@@ -12,6 +12,7 @@
 #include <vector>
 #include "BLE_CLA.hpp"
 #include "BLEhandling.hpp"
+#include "Clock.hpp"
 
 extern "C" {
 #include "host/ble_gap.h"
@@ -40,7 +41,16 @@ bool BleCLA::checkCanAddress() {
     return true;
 }
 
-BleCLA::BleCLA(std::string localURI) {
+BleCLA::BleCLA(std::string localURI)
+    : peerAging(CONFIG_BLE_MAX_PEER_AGE,
+                [this](const std::string& name, uint64_t lastSeen) {
+                    // peers are compared by name only
+                    BlePeer expired;
+                    expired.name = name;
+                    currentPeers.erase(expired);
+                    ESP_LOGI("BLE CLA cleanUpBlePeers", "removed peer %s",
+                             name.c_str());
+                }) {
     // write Node URI + length in the buffer to make them accessible fom c
     strncpy(nodeURI, localURI.c_str(), localURI.length());
     uriLength = localURI.length();
@@ -185,12 +195,8 @@ bool BleCLA::send(Bundle* bundle, Node* destination) {
              destination->URI.c_str());
 
     // ensure that a sufficient gap exists between ble transmissions
-    // get current time
-    struct timeval tv_now;
-    gettimeofday(&tv_now, NULL);
-    // convert current time to us
-    uint64_t currentTime =
-        ((uint64_t)tv_now.tv_sec * 1000000L + (uint64_t)tv_now.tv_usec);
+    // get current time in us
+    uint64_t currentTime = DTN7::nowUs();
 
     ESP_LOGI("BLE CLA", "Time since Last send operation: %llu ms",
              (uint64_t)(currentTime - lastSendTime) / 1000);
@@ -202,10 +208,7 @@ bool BleCLA::send(Bundle* bundle, Node* destination) {
     }
 
     // get current time again,  in case it was delayed
-    gettimeofday(&tv_now, NULL);
-
-    lastSendTime =
-        ((uint64_t)tv_now.tv_sec * 1000000L + (uint64_t)tv_now.tv_usec);
+    lastSendTime = DTN7::nowUs();
 
     // get ble address of requested node
     ble_addr_t peerAddress = findPeer(destination);
@@ -228,12 +231,8 @@ void BleCLA::discoveredPeer(const uint type, const uint8_t val[6], char* name,
              val[5], val[4], val[3],
              val[2], val[1], val[0], nameLength, name);*/
 
-    // get current time
-    struct timeval tv_now;
-    gettimeofday(&tv_now, NULL);
-    // convert current time to us
-    uint64_t currentTime =
-        ((int64_t)tv_now.tv_sec * 1000000L + (int64_t)tv_now.tv_usec);
+    // get current time in us
+    uint64_t currentTime = DTN7::nowUs();
 
     // convert name of discovered peer to std string
     std::string peerName = std::string(name, name + nameLength);
@@ -249,46 +248,37 @@ void BleCLA::discoveredPeer(const uint type, const uint8_t val[6], char* name,
     peer.name = peerName;
     currentPeers.erase(peer);  //remove old entry of peer, if it exists, in order to update its last seen time
     this->currentPeers.insert(peer);
-    Node dtnNode = DTN7::BPA->storage->getNode(peerName);
-    if (dtnNode.identifier == "empty") {
+    peerAging.touch(peerName, DTN7::nowMs());
+    // if the node is already known, only update its last seen time in place
+    NodeId dtnNodeId = DTN7::BPA->storage->findNode(peerName);
+    if (dtnNodeId != INVALID_NODE_ID &&
+        DTN7::BPA->storage->touchNode(dtnNodeId, DTN7::nowMs()))
+        return;
 
 #if CONFIG_NOTIFY_RETRY_TASK
-        //the discovered node is new, notify the bundle retry task in order to check if we have bundles which should be delivered to it
-        xTaskNotifyGive(DTN7::storageRetryHandle);
+    //the discovered node is new, notify the bundle retry task in order to check if we have bundles which should be delivered to it
+    xTaskNotifyGive(DTN7::storageRetryHandle);
 #endif
-        dtnNode.identifier = peerName.substr(
-            6);  //set the identifier of the node to its URI, minus the dtn7 scheme part
-        ESP_LOGI("BLE peer Discovery", "Discovered new node, identifier: %s",
-                 dtnNode.identifier.c_str());
-    }
-    if (dtnNode.URI == "none")
-        dtnNode.URI = peerName;
+    Node dtnNode;
+    dtnNode.identifier = peerName.substr(
+        6);  //set the identifier of the node to its URI, minus the dtn7 scheme part
+    ESP_LOGI("BLE peer Discovery", "Discovered new node, identifier: %s",
+             dtnNode.identifier.c_str());
+    dtnNode.URI = peerName;
     dtnNode.setLastSeen();
     DTN7::BPA->storage->addNode(dtnNode);
     ESP_LOGI("BLE CLA", "Added Node: %s to known Nodes", dtnNode.URI.c_str());
+    // forward the stored bundles the new peer has not received yet, before the encounter ends
+    DTN7::contactStarted(dtnNode.URI);
     return;
 };
 
 void BleCLA::cleanUpBlePeers() {
     ESP_LOGI("BLE CLA cleanUpBlePeers", "Cleaning up old peers ...");
-    std::vector<BlePeer> toRemove;
-    for (BlePeer peer : this->currentPeers) {
-        // get current time
-        struct timeval tv_now;
-        gettimeofday(&tv_now, NULL);
-        // convert current time to us
-        uint64_t currentTime =
-            ((int64_t)tv_now.tv_sec * 1000000L + (int64_t)tv_now.tv_usec);
-        ESP_LOGI("BLE CLA cleanUpBlePeers", "peers age :%llu limit: %i",
-                 (currentTime - peer.last_seen) / 1000,
-                 CONFIG_BLE_MAX_PEER_AGE);
-
-        if (currentTime - peer.last_seen > CONFIG_BLE_MAX_PEER_AGE * 1000) {
-            toRemove.push_back(peer);
-        }
-    }
-    for (BlePeer remove : toRemove)
-        currentPeers.erase(remove);
+    // peers which timed out are removed from currentPeers by the expired callback
+    size_t removed = peerAging.expire(DTN7::nowMs());
+    ESP_LOGI("BLE CLA cleanUpBlePeers", "removed %u peers, limit: %i ms",
+             removed, CONFIG_BLE_MAX_PEER_AGE);
     return;
 }
 
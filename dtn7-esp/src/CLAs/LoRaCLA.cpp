@@ -3,6 +3,7 @@
 #if CONFIG_USE_LORA_CLA  // only compile if LoRa CLA is enabled, this allows the overall project to be installed on platforms which do not have the required spi resources for the lora CLA (ESP32-C3)
 
 #include <RadioLib.h>
+#include "Clock.hpp"
 #include "EspHal2.h"
 #include "LoRaCLA.hpp"
 #include "bpolProtobuf.h"
@@ -72,13 +73,8 @@ LoraCLA::LoraCLA(int8_t sck, int8_t miso, int8_t mosi, int8_t nss, int8_t dio0,
         // setup the ISR required for LoRa reception
         setupIsr();
 
-        // get the current time
-        struct timeval tv_now;
-        gettimeofday(&tv_now, NULL);
-
-        // convert the current time to us
-        uint64_t currentTime =
-            ((int64_t)tv_now.tv_sec * 1000000L + (int64_t)tv_now.tv_usec);
+        // get the current time in us
+        uint64_t currentTime = DTN7::nowUs();
 
         // define the start point of the duty cycle as the current time. This time will be increased after the duty cycle reference time interval to the then current time
         startOfDutyCycleTime = currentTime;
@@ -258,7 +254,7 @@ bool LoraCLA::transmitData(uint8_t* bundleData, size_t dataSize) {
 
     if (dataSize == 0)
         return false;  // return false if packet is empty
-    if (dataSize > 250)
+    if (dataSize > BPOL_MAX_PACKET_SIZE)
         return false;  // return false if packet is to large
 
     // take the mutex to calculate time on air
@@ -268,13 +264,8 @@ bool LoraCLA::transmitData(uint8_t* bundleData, size_t dataSize) {
         4);  // get time on air in microseconds, +4 is required due to header
     xSemaphoreGive(radioMutex);
 
-    // get current time
-    struct timeval tv_now;
-    gettimeofday(&tv_now, NULL);
-
-    // convert current time to us
-    uint64_t currentTime =
-        ((int64_t)tv_now.tv_sec * 1000000L + (int64_t)tv_now.tv_usec);
+    // get current time in us
+    uint64_t currentTime = DTN7::nowUs();
 
     // check whether to begin new reference time
     if ((currentTime - startOfDutyCycleTime) >
@@ -1,5 +1,6 @@
 #include "SerialCLA.hpp"
 #include "CLA.hpp"
+#include "Clock.hpp"
 #include "dtn7-esp.hpp"
 #include "esp_timer.h"
 
@@ -29,13 +30,8 @@ SerialCLA::SerialCLA(int baud, uint rx, uint tx) {
         .source_clk = UART_SCLK_DEFAULT,
     };
 
-    // get the current time
-    struct timeval tv_now;
-    gettimeofday(&tv_now, NULL);
-
-    // set the beginning of the transmission cycle
-    startOfCycle =
-        ((int64_t)tv_now.tv_sec * 1000000L + (int64_t)tv_now.tv_usec);
+    // set the beginning of the transmission cycle to the current time
+    startOfCycle = DTN7::nowUs();
 
     // enable UART
     ESP_ERROR_CHECK(uart_driver_install(uart_num, CONFIG_UART_BUF_SIZE, 0, 0,
@@ -114,11 +110,8 @@ bool SerialCLA::send(Bundle* bundle, Node* destination) {
     size_t cborSize;
     bundle->toCbor(&cbor, cborSize);
 
-    // get current time
-    struct timeval tv_now;
-    gettimeofday(&tv_now, NULL);
-    uint64_t currentTime =
-        ((int64_t)tv_now.tv_sec * 1000000L + (int64_t)tv_now.tv_usec);
+    // get current time in us
+    uint64_t currentTime = DTN7::nowUs();
 
     // check whether to begin new reference time
     if ((currentTime - startOfCycle) >
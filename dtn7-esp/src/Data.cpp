@@ -1,15 +1,237 @@
 #include "Data.hpp"
+#include <string.h>
+#include <algorithm>
+#include "Clock.hpp"
 #include "cbor.h"
 #include "esp_log.h"
 #include "helpers.h"
 
-BundleInfo::BundleInfo(std::vector<uint8_t> serialized) {
+/// @brief decodes the metadata fields, which are the first elements of a serialized BundleInfo and the only elements of serialized metadata
+/// @param info object to write the metadata to
+/// @param ArrayValue CBOR value pointing to the first element, advanced past the metadata
+static void decodeMetadata(BundleInfo* info, CborValue* ArrayValue) {
+    // Fixed CBOR structure: check that each element is of the expected type and decode it.
+    // Cannot handle if the expected structure is not followed!
+    if (cbor_value_is_unsigned_integer(ArrayValue)) {
+        uint64_t retentionConstraintLocal = 0;
+
+        cbor_value_get_uint64(ArrayValue,
+                              &retentionConstraintLocal);  // read value
+        cbor_value_advance(ArrayValue);  // move to next value
+        info->setRetentionConstraint((uint)retentionConstraintLocal);
+    }
+
+    if (cbor_value_is_boolean(ArrayValue)) {
+        cbor_value_get_boolean(ArrayValue,
+                               &info->locallyDelivered);  // read value
+        cbor_value_advance(ArrayValue);                   // move to next value
+    }
+
+    if (cbor_value_is_array(ArrayValue)) {
+        info->forwardedTo = decodeNodeArray(
+            ArrayValue);  // decode the array of nodes with corresponding function
+    }
+    else {
+        cbor_value_advance(ArrayValue);
+    }
+
+    if (cbor_value_is_unsigned_integer(ArrayValue)) {
+        uint64_t numOfBroadcastsLocal = 0;
+        cbor_value_get_uint64(ArrayValue,
+                              &numOfBroadcastsLocal);  // read value
+        cbor_value_advance(ArrayValue);                // move to next value
+        info->numOfBroadcasts = (uint)numOfBroadcastsLocal;
+    }
+
+    if (cbor_value_is_unsigned_integer(ArrayValue)) {
+        cbor_value_get_uint64(ArrayValue,
+                              &info->lastBroadcastTime);  // read value
+        cbor_value_advance(ArrayValue);                   // move to next value
+    }
+}
+
+// first byte of a compact BundleInfo record and of compact metadata. BundleInfos serialized by earlier versions start with a CBOR array header instead (0x88 or 0x87, metadata 0x85)
+#define BUNDLE_RECORD_VERSION 1
+#define BUNDLE_METADATA_VERSION 2
+
+// size of the fixed metadata header: flags, retention constraint, number of forwarded to nodes, number of broadcasts and last broadcast time
+#define METADATA_HEADER_SIZE 16
+
+// size of the fixed record header: version, metadata header, priority, received at time and bundle length
+#define RECORD_HEADER_SIZE (1 + METADATA_HEADER_SIZE + 1 + 8 + 4)
+
+// bits of the flags byte of the metadata header and of a node reference
+#define RECORD_FLAG_LOCALLY_DELIVERED 0x01
+#define RECORD_FLAG_HAS_COPIES 0x02
+#define NODE_FLAG_CONFIRMED_RECEPTION 0x01
+
+/// @brief writes an unsigned integer as little endian
+/// @return position after the written bytes
+static uint8_t* putUint(uint8_t* out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++)
+        *out++ = (value >> (8 * i)) & 0xFF;
+    return out;
+}
+
+/// @brief reads the fields of a compact record, remembers whether the record was too short
+struct RecordReader {
+    const uint8_t* position;
+    const uint8_t* end;
+    bool valid = true;
+
+    RecordReader(const uint8_t* data, size_t length)
+        : position(data), end(data + length) {};
+
+    /// @brief reads a little endian unsigned integer, 0 if the record is too short
+    uint64_t getUint(int bytes) {
+        if (end - position < bytes) {
+            valid = false;
+            return 0;
+        }
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; i++)
+            value |= (uint64_t)*position++ << (8 * i);
+        return value;
+    };
+
+    /// @brief skips a number of bytes, returns a pointer to them or nullptr if the record is too short
+    const uint8_t* getBytes(size_t length) {
+        if ((size_t)(end - position) < length) {
+            valid = false;
+            return nullptr;
+        }
+        const uint8_t* result = position;
+        position += length;
+        return result;
+    };
+};
+
+/// @brief returns the number of forwarded to nodes which fit into a record
+static size_t referenceCount(const BundleInfo* info) {
+    return std::min<size_t>(info->forwardedTo.size(), UINT16_MAX);
+}
+
+/// @brief returns the size of the mutable metadata without the version byte: the fixed header, the number of copies if set, followed by one reference per forwarded to node
+static size_t metadataSize(const BundleInfo* info) {
+    size_t result = METADATA_HEADER_SIZE + (info->copies != 0 ? 2 : 0);
+    for (size_t i = 0; i < referenceCount(info); i++)
+        result += 3 + std::min<size_t>(info->forwardedTo[i].URI.size(),
+                                       UINT16_MAX);
+    return result;
+}
+
+/// @brief writes the fixed metadata header, followed by the number of copies if it is set
+/// @return position after the written bytes
+static uint8_t* encodeMetadataHeader(const BundleInfo* info, uint8_t* out) {
+    uint8_t flags = 0;
+    if (info->locallyDelivered)
+        flags |= RECORD_FLAG_LOCALLY_DELIVERED;
+    if (info->copies != 0)
+        flags |= RECORD_FLAG_HAS_COPIES;
+    *out++ = flags;
+    *out++ = info->bundle.retentionConstraint;
+    out = putUint(out, referenceCount(info), 2);
+    out = putUint(out, info->numOfBroadcasts, 4);
+    out = putUint(out, info->lastBroadcastTime, 8);
+    if (info->copies != 0)
+        out = putUint(out, info->copies, 2);
+    return out;
+}
+
+/// @brief writes the references to the forwarded to nodes. A node is referenced by its URI, its EIDs, position and received hashes are not stored with the bundle, as they are kept by the node storage
+/// @return position after the written bytes
+static uint8_t* encodeNodeReferences(const BundleInfo* info, uint8_t* out) {
+    for (size_t i = 0; i < referenceCount(info); i++) {
+        const Node& node = info->forwardedTo[i];
+        uint8_t flags = 0;
+#if CONFIG_useReceivedSet
+        if (node.confirmedReception)
+            flags |= NODE_FLAG_CONFIRMED_RECEPTION;
+#endif
+        size_t length = std::min<size_t>(node.URI.size(), UINT16_MAX);
+        *out++ = flags;
+        out = putUint(out, length, 2);
+        memcpy(out, node.URI.data(), length);
+        out += length;
+    }
+    return out;
+}
+
+/// @brief the fields of the fixed metadata header
+struct MetadataHeader {
+    uint8_t flags;
+    uint8_t retentionConstraint;
+    size_t count;
+    uint numOfBroadcasts;
+    uint64_t lastBroadcastTime;
+    uint16_t copies;
+};
+
+/// @brief reads the fixed metadata header and the number of copies written by encodeMetadataHeader
+static MetadataHeader decodeMetadataHeader(RecordReader& reader) {
+    MetadataHeader header;
+    header.flags = reader.getUint(1);
+    header.retentionConstraint = reader.getUint(1);
+    header.count = reader.getUint(2);
+    header.numOfBroadcasts = reader.getUint(4);
+    header.lastBroadcastTime = reader.getUint(8);
+    // the number of copies is only stored if it is set, records without it were also written by earlier versions
+    header.copies =
+        header.flags & RECORD_FLAG_HAS_COPIES ? reader.getUint(2) : 0;
+    return header;
+}
+
+/// @brief reads the node references written by encodeNodeReferences and, if they are complete, writes them and the metadata header to a BundleInfo
+/// @param info object to write the metadata to, it is only changed if the metadata is complete
+/// @param header the metadata header read before
+/// @param reader reader positioned at the node references
+/// @return whether the metadata was complete
+static bool decodeCompactMetadata(BundleInfo* info, const MetadataHeader& header,
+                                  RecordReader& reader) {
+    std::vector<Node> forwardedTo;
+    forwardedTo.reserve(reader.valid ? header.count : 0);
+    for (size_t i = 0; i < header.count && reader.valid; i++) {
+        uint8_t nodeFlags = reader.getUint(1);
+        size_t length = reader.getUint(2);
+        const uint8_t* uri = reader.getBytes(length);
+        if (!reader.valid)
+            break;
+        Node node(std::string((const char*)uri, length));
+#if CONFIG_useReceivedSet
+        node.confirmedReception = nodeFlags & NODE_FLAG_CONFIRMED_RECEPTION;
+#else
+        (void)nodeFlags;
+#endif
+        forwardedTo.push_back(std::move(node));
+    }
+    if (!reader.valid)
+        return false;
+
+    info->locallyDelivered = header.flags & RECORD_FLAG_LOCALLY_DELIVERED;
+    info->setRetentionConstraint(header.retentionConstraint);
+    info->forwardedTo = std::move(forwardedTo);
+    info->numOfBroadcasts = header.numOfBroadcasts;
+    info->lastBroadcastTime = header.lastBroadcastTime;
+    info->copies = header.copies;
+    return true;
+}
+
+BundleInfo::BundleInfo(std::vector<uint8_t> serialized)
+    : BundleInfo(serialized.data(), serialized.size()) {}
+
+BundleInfo::BundleInfo(const uint8_t* serialized, size_t length) {
     // write to debug log
     ESP_LOGD("BundleInfo::deserialize", "deserializing BundleInfo");
+    if (length > 0 && serialized[0] == BUNDLE_RECORD_VERSION) {
+        decodeRecord(serialized, length);
+        return;
+    }
+
+    // BundleInfos stored by earlier versions are CBOR arrays
     // initialize CBOR parser and value pointer
     CborParser parser;
     CborValue value;
-    cbor_parser_init(&serialized[0], serialized.size(), 0, &parser, &value);
+    cbor_parser_init(serialized, length, 0, &parser, &value);
 
     // check whether the outer CBOR structure is an array
     if (cbor_value_is_array(&value)) {
@@ -19,42 +241,7 @@ BundleInfo::BundleInfo(std::vector<uint8_t> serialized) {
 
         // Fixed CBOR structure: check that each element is of the expected type and decode it.
         // Cannot handle if the expected structure is not followed!
-        if (cbor_value_is_unsigned_integer(&ArrayValue)) {
-            uint64_t retentionConstraintLocal = 0;
-
-            cbor_value_get_uint64(&ArrayValue,
-                                  &retentionConstraintLocal);  // read value
-            cbor_value_advance(&ArrayValue);  // move to next value
-            this->setRetentionConstraint((uint)retentionConstraintLocal);
-        }
-
-        if (cbor_value_is_boolean(&ArrayValue)) {
-            cbor_value_get_boolean(&ArrayValue,
-                                   &locallyDelivered);  // read value
-            cbor_value_advance(&ArrayValue);            // move to next value
-        }
-
-        if (cbor_value_is_array(&ArrayValue)) {
-            forwardedTo = decodeNodeArray(
-                &ArrayValue);  // decode the array of nodes with corresponding function
-        }
-        else {
-            cbor_value_advance(&ArrayValue);
-        }
-
-        if (cbor_value_is_unsigned_integer(&ArrayValue)) {
-            uint64_t numOfBroadcastsLocal = 0;
-            cbor_value_get_uint64(&ArrayValue,
-                                  &numOfBroadcastsLocal);  // read value
-            cbor_value_advance(&ArrayValue);               // move to next value
-            numOfBroadcasts = (uint)numOfBroadcastsLocal;
-        }
-
-        if (cbor_value_is_unsigned_integer(&ArrayValue)) {
-            cbor_value_get_uint64(&ArrayValue,
-                                  &lastBroadcastTime);  // read value
-            cbor_value_advance(&ArrayValue);            // move to next value
-        }
+        decodeMetadata(this, &ArrayValue);
 
         uint64_t receivedTime = 0;
         if (cbor_value_is_unsigned_integer(&ArrayValue)) {
@@ -68,6 +255,13 @@ BundleInfo::BundleInfo(std::vector<uint8_t> serialized) {
         bundle.receivedAt =
             receivedTime;  // update the bundles receivedAt time to the correct value
         delete intermediate;
+
+        // the priority was added later, bundles serialized before do not contain it
+        if (cbor_value_is_unsigned_integer(&ArrayValue)) {
+            uint64_t priorityLocal = 0;
+            cbor_value_get_uint64(&ArrayValue, &priorityLocal);
+            priority = (uint8_t)priorityLocal;
+        }
     }
 }
 
@@ -75,33 +269,109 @@ BundleInfo::BundleInfo(Bundle* bundle) {
     this->bundle = *bundle;
 }
 
-std::vector<uint8_t> BundleInfo::serialize() {
+void BundleInfo::decodeRecord(const uint8_t* serialized, size_t length) {
+    // the fixed part of the record is followed by the node references and the bundle
+    RecordReader reader(serialized + 1, length - 1);
+    MetadataHeader header = decodeMetadataHeader(reader);
+    uint8_t priorityLocal = reader.getUint(1);
+    uint64_t receivedTime = reader.getUint(8);
+    size_t bundleLength = reader.getUint(4);
+    if (!decodeCompactMetadata(this, header, reader)) {
+        ESP_LOGE("BundleInfo::deserialize", "truncated BundleInfo record");
+        return;
+    }
+    const uint8_t* bundleCbor = reader.getBytes(bundleLength);
+    if (!reader.valid) {
+        ESP_LOGE("BundleInfo::deserialize", "truncated BundleInfo record");
+        return;
+    }
+
+    // the bundle is decoded directly from the record, without copying it first
+    Bundle* intermediate = Bundle::fromCbor(bundleCbor, bundleLength);
+    bundle = *intermediate;
+    delete intermediate;
+    bundle.receivedAt = receivedTime;
+    priority = priorityLocal;
+}
+
+size_t BundleInfo::encode(uint8_t* out, const uint8_t* bundleCbor,
+                          size_t bundleSize) {
     ESP_LOGD("BundleInfo::serialize", "serializing BundleInfo");
+    uint8_t* start = out;
+    *out++ = BUNDLE_RECORD_VERSION;
+    out = encodeMetadataHeader(this, out);
+    *out++ = priority;
+    out = putUint(out, bundle.receivedAt, 8);
+    out = putUint(out, bundleSize, 4);
+    out = encodeNodeReferences(this, out);
+    memcpy(out, bundleCbor, bundleSize);
+    return out + bundleSize - start;
+}
 
-    // initialize encoder and buffer for encoder
-    CborEncoder encoder;
-    uint8_t buf[1000];
-    cbor_encoder_init(&encoder, buf, sizeof(buf), 0);
+size_t BundleInfo::serializedSize(size_t bundleSize) {
+    return RECORD_HEADER_SIZE - METADATA_HEADER_SIZE + metadataSize(this) +
+           bundleSize;
+}
 
-    // initialize an encoder for use in the array
-    CborEncoder encoderInternal;
+std::vector<uint8_t> BundleInfo::serialize() {
+    uint8_t* cbor = nullptr;
+    size_t cborSize = 0;
+    bundle.toCbor(&cbor, cborSize);
+
+    // the record is written into a buffer of exactly its size
+    std::vector<uint8_t> result(serializedSize(cborSize));
+    encode(result.data(), cbor, cborSize);
+    delete[] cbor;
+    return result;
+}
 
-    // create the array, with a fixed size of 7 elements and encode the values into it
-    cbor_encoder_create_array(&encoder, &encoderInternal, 7);
-    cbor_encode_uint(&encoderInternal, bundle.retentionConstraint);
-    cbor_encode_boolean(&encoderInternal, locallyDelivered);
-    encodeNodeArray(&encoderInternal, forwardedTo);
-    cbor_encode_uint(&encoderInternal, numOfBroadcasts);
-    cbor_encode_uint(&encoderInternal, lastBroadcastTime);
-    cbor_encode_uint(&encoderInternal, bundle.receivedAt);
-    encodeBundle(&encoderInternal, &bundle);
-
-    // finish the array
-    cbor_encoder_close_container(&encoder, &encoderInternal);
-
-    // get actual used data size
-    size_t dataSize = cbor_encoder_get_buffer_size(&encoder, buf);
-    return std::vector<uint8_t>(buf, buf + dataSize);
+BundleBuffer BundleInfo::serializeToBuffer() {
+    uint8_t* cbor = nullptr;
+    size_t cborSize = 0;
+    bundle.toCbor(&cbor, cborSize);
+    BundleBuffer result(serializedSize(cborSize));
+    encode(result.data(), cbor, cborSize);
+    delete[] cbor;
+    return result;
+}
+
+std::vector<uint8_t> BundleInfo::serializeMetadata() {
+    // the metadata is encoded like in a record, preceded by its own version byte
+    std::vector<uint8_t> result(1 + metadataSize(this));
+    result[0] = BUNDLE_METADATA_VERSION;
+    uint8_t* out = encodeMetadataHeader(this, result.data() + 1);
+    encodeNodeReferences(this, out);
+    return result;
+}
+
+void BundleInfo::updateMetadata(const uint8_t* serialized, size_t length) {
+    if (length > 0 && serialized[0] == BUNDLE_METADATA_VERSION) {
+        RecordReader reader(serialized + 1, length - 1);
+        MetadataHeader header = decodeMetadataHeader(reader);
+        if (!decodeCompactMetadata(this, header, reader))
+            ESP_LOGE("BundleInfo::updateMetadata", "truncated metadata");
+        return;
+    }
+
+    // metadata stored by earlier versions is a CBOR array
+    CborParser parser;
+    CborValue value;
+    cbor_parser_init(serialized, length, 0, &parser, &value);
+    if (!cbor_value_is_array(&value))
+        return;
+    CborValue ArrayValue;
+    cbor_value_enter_container(&value, &ArrayValue);
+    decodeMetadata(this, &ArrayValue);
+}
+
+size_t BundleInfo::memoryUsage() {
+    // the object itself, the forwarded to list and the block data, EID strings are not counted
+    size_t result = sizeof(BundleInfo) + forwardedTo.capacity() * sizeof(Node);
+    result += bundle.payloadBlock.dataSize + bundle.payloadBlock.crcSize;
+    result += bundle.extensionBlocks.capacity() * sizeof(CanonicalBlock);
+    for (const CanonicalBlock& block : bundle.extensionBlocks)
+        result += block.dataSize + block.crcSize;
+    return result;
 }
 
 void BundleInfo::setRetentionConstraint(uint constraint) {
@@ -137,7 +407,7 @@ Node::Node(std::vector<uint8_t> serialized) {
     // initialize CBOR Parser and Value Pointer
     CborParser parser;
     CborValue value;
-    cbor_parser_init(&serialized[0], serialized.size(), 0, &parser, &value);
+    cbor_parser_init(serialized.data(), serialized.size(), 0, &parser, &value);
 
     // check whether the outer CBOR structure is an array
     if (cbor_value_is_array(&value)) {
@@ -179,7 +449,15 @@ Node::Node(std::vector<uint8_t> serialized) {
 #if CONFIG_useReceivedSet
         if (cbor_value_is_boolean(&ArrayValue))
             cbor_value_get_boolean(&ArrayValue, &confirmedReception);
-        receivedHashes = decodeHashesSet(&ArrayValue);
+        // nodes serialized by earlier versions contain an array of hashes instead, which is ignored
+        if (cbor_value_is_byte_string(&ArrayValue)) {
+            size_t length = 0;
+            cbor_value_calculate_string_length(&ArrayValue, &length);
+            std::vector<uint8_t> bits(length);
+            cbor_value_copy_byte_string(&ArrayValue, bits.data(), &length,
+                                        &ArrayValue);
+            receivedSummary = BundleSummary(bits.data(), length);
+        }
 #endif
     }
 }
@@ -203,33 +481,56 @@ std::string Node::idFromBytes(uint8_t* data, size_t dataSize) {
     return s;
 }
 
-std::vector<uint8_t> Node::serialize() {
-    CborEncoder encoder;
-    uint8_t buf[1000];
-    cbor_encoder_init(&encoder, buf, sizeof(buf), 0);
+/// @brief encodes a node as CBOR array, stops writing when the buffer of the encoder is full, the encoder then reports the missing bytes
+/// @param encoder encoder to encode into
+/// @param node the node
+static void encodeNode(CborEncoder* encoder, Node& node) {
     CborEncoder encoderInternal;
     uint8_t arraySize =
-        hasPos
+        node.hasPos
             ? 7
             : 5;  // array size should be 5 if no position is stored, otherwise 7
 #if CONFIG_useReceivedSet
     arraySize += 2;
 #endif
-    cbor_encoder_create_array(&encoder, &encoderInternal, arraySize);
-    stringToCbor(&encoderInternal, identifier);
-    encodeEidArray(&encoderInternal, Eids);
-    stringToCbor(&encoderInternal, URI);
-    cbor_encode_uint(&encoderInternal, lastSeen);
-    cbor_encode_boolean(&encoderInternal, hasPos);
-    if (hasPos) {
-        cbor_encode_float(&encoderInternal, position.first);
-        cbor_encode_float(&encoderInternal, position.second);
+    cbor_encoder_create_array(encoder, &encoderInternal, arraySize);
+    stringToCbor(&encoderInternal, node.identifier);
+    encodeEidArray(&encoderInternal, node.Eids);
+    stringToCbor(&encoderInternal, node.URI);
+    cbor_encode_uint(&encoderInternal, node.lastSeen);
+    cbor_encode_boolean(&encoderInternal, node.hasPos);
+    if (node.hasPos) {
+        cbor_encode_float(&encoderInternal, node.position.first);
+        cbor_encode_float(&encoderInternal, node.position.second);
     }
 #if CONFIG_useReceivedSet
-    cbor_encode_boolean(&encoderInternal, confirmedReception);
-    encodeHashesSet(&encoderInternal, receivedHashes);
+    cbor_encode_boolean(&encoderInternal, node.confirmedReception);
+    cbor_encode_byte_string(&encoderInternal,
+                            node.receivedSummary.data().data(),
+                            node.receivedSummary.data().size());
 #endif
-    cbor_encoder_close_container(&encoder, &encoderInternal);
+    cbor_encoder_close_container(encoder, &encoderInternal);
+}
+
+std::vector<uint8_t> Node::serialize() {
+    CborEncoder encoder;
+    uint8_t buf[1000];
+    cbor_encoder_init(&encoder, buf, sizeof(buf), 0);
+    encodeNode(&encoder, *this);
+
+    // a node with many EIDs or a large summary does not fit into the buffer, it is encoded again into a buffer of exactly the size reported by the encoder
+    size_t missing = cbor_encoder_get_extra_bytes_needed(&encoder);
+    if (missing != 0) {
+        std::vector<uint8_t> result(sizeof(buf) + missing);
+        cbor_encoder_init(&encoder, result.data(), result.size(), 0);
+        encodeNode(&encoder, *this);
+        if (cbor_encoder_get_extra_bytes_needed(&encoder) != 0) {
+            ESP_LOGE("Node::serialize", "failed to serialize node %s",
+                     URI.c_str());
+            return std::vector<uint8_t>();
+        }
+        return result;
+    }
     size_t dataSize = cbor_encoder_get_buffer_size(
         &encoder,
         buf);  // due to a bug in the tinycbor implementation 'get size' does not work with arrays on the heap
@@ -246,10 +547,8 @@ void Node::print() {
         printf("Node has Position: Lat:%f, Lng:%f\n", position.first,
                position.second);
 #if CONFIG_useReceivedSet
-    printf("Node Has the Following received Hashes:\n");
-    for (size_t hash : receivedHashes) {
-        printf("%u\n", hash);
-    }
+    printf("Node has a summary of received bundles of %u bytes\n",
+           receivedSummary.data().size());
 #endif
     for (EID e : Eids) {
         printf("Endpoint:\n");
@@ -262,10 +561,7 @@ void Node::setLastSeen() {
     if (lastSeen == UINT64_MAX)
         return;  // if node is added staticly, do not override age
 
-    struct timeval tv_now;
-    gettimeofday(&tv_now, NULL);
-    lastSeen =
-        ((int64_t)tv_now.tv_sec * 1000L + (int64_t)tv_now.tv_usec / 1000);
+    lastSeen = DTN7::nowMs();
     return;
 }
 
@@ -1,9 +1,10 @@
 #include "Endpoint.hpp"
+#include "Clock.hpp"
 #include "dtn7-esp.hpp"
 #include "sdkconfig.h"
 
 bool Endpoint::send(uint8_t* data, size_t dataSize, std::string destination,
-                    bool anonymous, uint64_t lifetime) {
+                    bool anonymous, uint64_t lifetime, uint8_t priority) {
     // first check whether Endpoint is registered with BundleProtocolAgent
     if (BPA == nullptr) {
         ESP_LOGI("Endpoint send",
@@ -32,13 +33,8 @@ bool Endpoint::send(uint8_t* data, size_t dataSize, std::string destination,
 
         //first, check whether node clock is actually synchronized
         if (DTN7::clockSynced) {
-            // get current node time
-            struct timeval tv_now;
-            gettimeofday(&tv_now, NULL);
-
-            // convert to milliseconds
-            uint64_t currentTime = ((int64_t)tv_now.tv_sec * 1000L +
-                                    (int64_t)tv_now.tv_usec / 1000);
+            // get current node time in milliseconds
+            uint64_t currentTime = DTN7::nowMs();
 
             // if in the same millisecond a bundle was already created, increase sequence number of new bundle to allow for differentiation
             if (lastCreationTime == currentTime)
@@ -94,6 +90,9 @@ bool Endpoint::send(uint8_t* data, size_t dataSize, std::string destination,
         // Build Bundle with PrimaryBlock and payload dlock
         Bundle* b = new Bundle(&primary, &payload);
 
+        // the bundle library reads the system time, the reception time must use the time source of the BPA, as expiry and eviction compare it to DTN7::nowMs()
+        b->receivedAt = DTN7::nowMs();
+
         // Add configured extension blocks to bundle
 
         //if requrired (no accurate clock configured or not yet synchronized) attach bundle age block
@@ -106,132 +105,255 @@ bool Endpoint::send(uint8_t* data, size_t dataSize, std::string destination,
         b->insertCanonicalBlock(
             HopCountBlock(hopLimit, 0, CONFIG_canonicalCrcType));
 #endif
-        // Transmit bundle via BPA
-        return BPA->bundleTransmission(b);
+        // Transmit bundle via BPA, the priority is kept with the bundle while it is stored on this node
+        return BPA->bundleTransmission(b, priority);
     }
     return false;
 }
 
 bool Endpoint::sendText(std::string text, std::string destination,
-                        bool anonymous, uint64_t lifetime) {
+                        bool anonymous, uint64_t lifetime, uint8_t priority) {
     uint8_t data[text.size()];
     memcpy(data, text.c_str(), text.size());
-    return send(data, text.size(), destination, anonymous, lifetime);
+    return send(data, text.size(), destination, anonymous, lifetime, priority);
 }
 
 bool Endpoint::send(std::vector<uint8_t> data, std::string destination,
-                    bool anonymous, uint64_t lifetime) {
+                    bool anonymous, uint64_t lifetime, uint8_t priority) {
     // just call send function with relevant arguments (pointer to data contained in vector and vector size)
-    return send(data.data(), data.size(), destination, anonymous, lifetime);
+    return send(data.data(), data.size(), destination, anonymous, lifetime,
+                priority);
 };
 
 Endpoint::Endpoint(std::string address,
                    void (*onReceive)(std::vector<uint8_t>, std::string,
                                      std::string, PrimaryBlock)) {
-    hasCallback = true;
-    this->onReceive = onReceive;
+    initInbox();
+    setCallback(onReceive);
+    this->localEID = EID::fromUri(address);
+    sequenceNum = 0;
+}
+
+Endpoint::Endpoint(std::string address, DeliveryCallback onDeliver) {
+    initInbox();
+    setCallback(onDeliver);
     this->localEID = EID::fromUri(address);
     sequenceNum = 0;
 }
 
 Endpoint::Endpoint(std::string address) {
+    initInbox();
     hasCallback = false;
     this->localEID = EID::fromUri(address);
     sequenceNum = 0;
 }
 
+Endpoint::~Endpoint() {
+    vSemaphoreDelete(inboxMutex);
+    if (inboxAvailable != nullptr)
+        vSemaphoreDelete(inboxAvailable);
+}
+
+void Endpoint::initInbox() {
+    // the mutex also guards the callback, so it is always needed
+    inboxMutex = xSemaphoreCreateMutex();
+}
+
+SemaphoreHandle_t Endpoint::getInboxAvailable() {
+    if (inboxAvailable == nullptr)
+        inboxAvailable = xSemaphoreCreateCounting(CONFIG_EndpointInboxSize, 0);
+    return inboxAvailable;
+}
+
 void Endpoint::setCallback(void (*onReceive)(std::vector<uint8_t>, std::string,
                                              std::string, PrimaryBlock)) {
-    this->hasCallback = true;
-    this->onReceive = onReceive;
+    // wrap the legacy callback in an adapter, which creates the copies the legacy signature requires
+    setCallback([onReceive](const DeliveryView& view) {
+        onReceive(std::vector<uint8_t>(view.payload,
+                                       view.payload + view.payloadSize),
+                  view.destination.getURI(), view.source.getURI(),
+                  view.primaryBlock);
+    });
+    return;
+}
+
+void Endpoint::setCallback(DeliveryCallback onDeliver) {
+    // swap the callback under the mutex, the forwarder task copies it under the same mutex before invoking it. The previous callback is destroyed after the mutex is released
+    xSemaphoreTake(inboxMutex, portMAX_DELAY);
+    this->hasCallback = (bool)onDeliver;
+    this->onDeliver.swap(onDeliver);
+    xSemaphoreGive(inboxMutex);
+    return;
+}
+
+void Endpoint::setCallback(DeliveryFunction onDeliver, void* context) {
+    if (onDeliver == nullptr) {
+        clearCallback();
+        return;
+    }
+    setCallback([onDeliver, context](const DeliveryView& view) {
+        onDeliver(view, context);
+    });
     return;
 }
 
 void Endpoint::clearCallback() {
-    this->hasCallback = false;
-    this->onReceive = nullptr;
+    setCallback(DeliveryCallback());
 }
 
-void Endpoint::localBundleDelivery(Bundle bundle) {
-    std::vector<uint8_t> data(bundle.payloadBlock.blockTypeSpecificData,
-                              bundle.payloadBlock.blockTypeSpecificData +
-                                  bundle.payloadBlock.dataSize);
+void Endpoint::localBundleDelivery(const Bundle& bundle) {
     ESP_LOGI("Endpoint", "received Bundle");
 
-    // if Endpoint has a callback, call this callback with the relevant arguments
+    xSemaphoreTake(inboxMutex, portMAX_DELAY);
+
+    // if Endpoint has a callback, call this callback with a view of the bundle, no data is copied
     if (hasCallback) {
-        onReceive(data, bundle.primaryBlock.destEID.getURI(),
-                  bundle.primaryBlock.sourceEID.getURI(), bundle.primaryBlock);
+        // the callback is copied, so it stays valid while it runs even if it is replaced or cleared concurrently, it is not called with the mutex held
+        DeliveryCallback callback = onDeliver;
+        xSemaphoreGive(inboxMutex);
+
+        const PrimaryBlock& primary = bundle.primaryBlock;
+        DeliveryView view{
+            bundle.payloadBlock.blockTypeSpecificData,
+            bundle.payloadBlock.dataSize,
+            primary.sourceEID,
+            primary.destEID,
+            primary,
+            {primary.timestamp.creationTime, primary.timestamp.sequenceNumber,
+             primary.lifetime, primary.bundleProcessingControlFlags,
+             bundle.receivedAt}};
+        callback(view);
     }
-    // otherwise add the bundle to the buffer storing received bundles for this Endpoint
+    // otherwise add the bundle to the inbox storing received bundles for this Endpoint
     else {
-        bundleBuffer.push_back(bundle);
+        // endpoints with a callback never use the inbox, its slots are allocated for the first queued bundle
+        if (inbox.empty())
+            inbox.resize(CONFIG_EndpointInboxSize);
+        SemaphoreHandle_t available = getInboxAvailable();
+
+        // if the inbox is full, apply the configured overflow policy
+        bool full = inboxCount == inbox.size();
+        if (full) {
+            inboxDropped++;
+#if CONFIG_EndpointInboxDropNewest
+            xSemaphoreGive(inboxMutex);
+            ESP_LOGW("Endpoint", "inbox full, dropping received bundle");
+            return;
+#else
+            // drop the oldest entry, its slot is reused below
+            inboxHead = (inboxHead + 1) % inbox.size();
+            inboxCount--;
+            ESP_LOGW("Endpoint", "inbox full, dropping oldest bundle");
+#endif
+        }
+
+        // copy payload and primary block into the next free slot, the slots payload vector keeps its capacity
+        InboxEntry& slot = inbox[(inboxHead + inboxCount) % inbox.size()];
+        slot.payload.assign(bundle.payloadBlock.blockTypeSpecificData,
+                            bundle.payloadBlock.blockTypeSpecificData +
+                                bundle.payloadBlock.dataSize);
+        slot.primaryBlock = bundle.primaryBlock;
+        inboxCount++;
+
+        xSemaphoreGive(inboxMutex);
+
+        // count the new entry, waking a task blocked in poll if there is one. If the oldest entry was replaced, the number of entries did not change
+        if (!full)
+            xSemaphoreGive(available);
     }
     return;
 }
 
+bool Endpoint::popEntry(InboxEntry& entry, TickType_t timeout) {
+    // the semaphore may not exist yet if no bundle was queued so far
+    xSemaphoreTake(inboxMutex, portMAX_DELAY);
+    SemaphoreHandle_t available = getInboxAvailable();
+    xSemaphoreGive(inboxMutex);
+
+    // take one count of the semaphore, it reserves an entry for this task, so concurrent pollers never compete for the same one
+    if (xSemaphoreTake(available, timeout) != pdTRUE)
+        return false;
+
+    // swap the oldest entry out of its slot, this avoids copying the payload
+    xSemaphoreTake(inboxMutex, portMAX_DELAY);
+    InboxEntry& slot = inbox[inboxHead];
+    entry.payload.swap(slot.payload);
+    entry.primaryBlock = slot.primaryBlock;
+    inboxHead = (inboxHead + 1) % inbox.size();
+    inboxCount--;
+    xSemaphoreGive(inboxMutex);
+    return true;
+}
+
 bool Endpoint::poll(std::vector<uint8_t>& data, std::string& source,
-                    std::string& destination, PrimaryBlock& primaryBlock) {
+                    std::string& destination, PrimaryBlock& primaryBlock,
+                    TickType_t timeout) {
     // if the endpoint has a callback ther can be no bundles to be polled
     if (hasCallback)
         return false;
 
-    // check whether bundles are available to be polled
-    if (bundleBuffer.size() == 0) {
+    // get first bundle from inbox
+    InboxEntry entry;
+    if (!popEntry(entry, timeout))
         return false;
-    }
-    else {
-        // get first bundle from buffer
-        Bundle b = bundleBuffer.front();
-        bundleBuffer.erase(bundleBuffer.begin());
-
-        // move bundle payload to data vector
-        data.clear();
-        data.reserve(b.payloadBlock.dataSize);
-        std::copy(
-            b.payloadBlock.blockTypeSpecificData,
-            b.payloadBlock.blockTypeSpecificData + b.payloadBlock.dataSize,
-            std::back_inserter(data));
-
-        // set source of Bundle
-        source = b.getSource().getURI();
-
-        // set destination of Bundle
-        destination = b.getDest().getURI();
-
-        // set Primary Block
-        primaryBlock = b.primaryBlock;
-    }
+
+    // move bundle payload to data vector
+    data.swap(entry.payload);
+
+    // set source of Bundle
+    source = entry.primaryBlock.sourceEID.getURI();
+
+    // set destination of Bundle
+    destination = entry.primaryBlock.destEID.getURI();
+
+    // set Primary Block
+    primaryBlock = entry.primaryBlock;
     return true;
 }
 
-std::vector<uint8_t> Endpoint::poll() {
+std::vector<uint8_t> Endpoint::poll(TickType_t timeout) {
     // if the endpoint has a callback ther can be no bundles to be polled, return empty vector
     std::vector<uint8_t> result;
     if (hasCallback)
         return result;
 
-    // check whether bundles are available to be polled, if not return empty vector
-    if (bundleBuffer.size() == 0)
-        return result;
+    // get first bundle from inbox and move its payload to the result vector
+    InboxEntry entry;
+    if (popEntry(entry, timeout))
+        result.swap(entry.payload);
 
-    // get first bundle from buffer
-    Bundle b = bundleBuffer.front();
-    bundleBuffer.erase(bundleBuffer.begin());
+    // return result vector
+    return result;
+}
 
-    // move bundle payload to result vector
-    result.clear();
-    result.reserve(b.payloadBlock.dataSize);
-    std::copy(b.payloadBlock.blockTypeSpecificData,
-              b.payloadBlock.blockTypeSpecificData + b.payloadBlock.dataSize,
-              std::back_inserter(result));
+std::vector<std::vector<uint8_t>> Endpoint::pollBatch(size_t maxCount,
+                                                      TickType_t timeout) {
+    std::vector<std::vector<uint8_t>> result;
+    if (hasCallback || maxCount == 0)
+        return result;
 
-    // return result vector
+    // only wait for the first entry, afterwards return whatever is already present
+    InboxEntry entry;
+    while (result.size() < maxCount &&
+           popEntry(entry, result.empty() ? timeout : 0)) {
+        result.push_back(std::move(entry.payload));
+        entry.payload.clear();
+    }
     return result;
 }
 
 bool Endpoint::hasData() {
-    return (bundleBuffer.size() != 0);
+    xSemaphoreTake(inboxMutex, portMAX_DELAY);
+    bool result = (inboxCount != 0);
+    xSemaphoreGive(inboxMutex);
+    return result;
+}
+
+uint32_t Endpoint::getDroppedCount() {
+    xSemaphoreTake(inboxMutex, portMAX_DELAY);
+    uint32_t result = inboxDropped;
+    xSemaphoreGive(inboxMutex);
+    return result;
 }
 
 bool Endpoint::operator==(const Endpoint& endpoint) {
@@ -0,0 +1,132 @@
+#include "PeerAging.hpp"
+#include <utility>
+
+PeerAging::PeerAging(uint64_t timeout, PeerExpiredCallback onExpired) {
+    this->timeout = timeout;
+    this->onExpired = onExpired;
+    mutex = xSemaphoreCreateMutex();
+}
+
+PeerAging::~PeerAging() {
+    vSemaphoreDelete(mutex);
+}
+
+void PeerAging::swapEntries(size_t a, size_t b) {
+    std::swap(heap[a], heap[b]);
+    positions[heap[a].key] = a;
+    positions[heap[b].key] = b;
+}
+
+void PeerAging::siftUp(size_t index) {
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (heap[parent].lastSeen <= heap[index].lastSeen)
+            break;
+        swapEntries(parent, index);
+        index = parent;
+    }
+}
+
+void PeerAging::siftDown(size_t index) {
+    while (true) {
+        size_t smallest = index;
+        size_t left = 2 * index + 1;
+        size_t right = left + 1;
+        if (left < heap.size() && heap[left].lastSeen < heap[smallest].lastSeen)
+            smallest = left;
+        if (right < heap.size() &&
+            heap[right].lastSeen < heap[smallest].lastSeen)
+            smallest = right;
+        if (smallest == index)
+            break;
+        swapEntries(smallest, index);
+        index = smallest;
+    }
+}
+
+void PeerAging::removeAt(size_t index) {
+    positions.erase(heap[index].key);
+
+    // move the last entry into the freed position and restore the heap order from there
+    size_t last = heap.size() - 1;
+    if (index != last) {
+        heap[index] = std::move(heap[last]);
+        positions[heap[index].key] = index;
+    }
+    heap.pop_back();
+    if (index < heap.size()) {
+        siftUp(index);
+        siftDown(index);
+    }
+}
+
+void PeerAging::touch(const std::string& key, uint64_t lastSeen) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    auto it = positions.find(key);
+    if (it == positions.end()) {
+        // new peer, append it and move it to its position
+        heap.push_back({key, lastSeen});
+        positions[key] = heap.size() - 1;
+        siftUp(heap.size() - 1);
+    }
+    else if (lastSeen > heap[it->second].lastSeen) {
+        // the peer only gets younger, therefore it can only move towards the leaves
+        heap[it->second].lastSeen = lastSeen;
+        siftDown(it->second);
+    }
+    xSemaphoreGive(mutex);
+}
+
+bool PeerAging::remove(const std::string& key) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    auto it = positions.find(key);
+    bool found = it != positions.end();
+    if (found)
+        removeAt(it->second);
+    xSemaphoreGive(mutex);
+    return found;
+}
+
+size_t PeerAging::expire(uint64_t now) {
+    std::vector<Entry> expired;
+
+    // the oldest peer is always at the root, pop peers until one has not timed out
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    while (!heap.empty() && now > heap[0].lastSeen &&
+           now - heap[0].lastSeen > timeout) {
+        expired.push_back(std::move(heap[0]));
+        positions.erase(expired.back().key);
+        heap[0] = std::move(heap.back());
+        heap.pop_back();
+        if (!heap.empty()) {
+            positions[heap[0].key] = 0;
+            siftDown(0);
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    // call the callbacks without holding the mutex, so they can touch or remove peers
+    for (const Entry& entry : expired)
+        onExpired(entry.key, entry.lastSeen);
+    return expired.size();
+}
+
+uint64_t PeerAging::nextExpiry() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    uint64_t result = heap.empty() ? UINT64_MAX : heap[0].lastSeen + timeout;
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+void PeerAging::setTimeout(uint64_t timeout) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    this->timeout = timeout;
+    xSemaphoreGive(mutex);
+}
+
+size_t PeerAging::size() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    size_t result = heap.size();
+    xSemaphoreGive(mutex);
+    return result;
+}
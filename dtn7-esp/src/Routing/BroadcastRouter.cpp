@@ -2,6 +2,7 @@
 #include <list>
 #include <vector>
 #include "CLA.hpp"
+#include "Clock.hpp"
 #include "Router.hpp"
 #include "dtn7-esp.hpp"
 #include "statusReportCodes.hpp"
@@ -30,11 +31,12 @@ bool SimpleBroadcastRouter::handleForwarding(BundleInfo* bundleInf,
     uint reason = BundleStatusReportReasonCodes::
         NO_TIMELY_CONTACT_WITH_NEXT_NODE_ON_ROUTE;
 
-    // check all nodes which are known and try to send the bundle directly to them
-    for (Node node : storage->getNodes()) {
+    // check all nodes which are known and try to send the bundle directly to them, the snapshot is shared and not copied
+    NodeSnapshotPtr peers = storage->getNodesSnapshot();
+    for (const Node& node : peers->nodes) {
         // first check whether forwarding to a node has already happened
         bool alreadyForwarded = false;
-        for (Node forwardedTo : bundleInf->forwardedTo) {
+        for (const Node& forwardedTo : bundleInf->forwardedTo) {
             if (forwardedTo.URI == node.URI)
                 alreadyForwarded = true;
         }
@@ -51,12 +53,13 @@ bool SimpleBroadcastRouter::handleForwarding(BundleInfo* bundleInf,
             if (cla->checkCanAddress()) {
                 ESP_LOGI("SimpleBroadcastRouter",
                          "found Clas which can address");
-                // attempt to send to the node
-                bool success = cla->send(preparedBundle, &node);
+                // attempt to send to the node, the CLA gets a copy as the snapshot must not be modified
+                Node destination = node;
+                bool success = cla->send(preparedBundle, &destination);
 
                 // if successful, add node to forwarded to and move to next node
                 if (success) {
-                    bundleInf->forwardedTo.push_back(node);
+                    bundleInf->forwardedTo.push_back(destination);
                     break;  // bundle is now forwarded to this node, no additional CLAs need to be tried
                 }
                 else {
@@ -66,13 +69,8 @@ bool SimpleBroadcastRouter::handleForwarding(BundleInfo* bundleInf,
             }
         }
     }
-    // get current time
-    struct timeval tv_now;
-    gettimeofday(&tv_now, NULL);
-
-    // convert time to ms
-    uint64_t currentTime =
-        ((int64_t)tv_now.tv_sec * 1000L + (int64_t)tv_now.tv_usec / 1000);
+    // get current time in ms
+    uint64_t currentTime = DTN7::nowMs();
 
     // check whether the bundle was broadcasted to recently, if not, attempt to broadcast it
     if ((currentTime - (bundleInf->lastBroadcastTime)) >
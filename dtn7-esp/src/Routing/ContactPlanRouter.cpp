@@ -0,0 +1,439 @@
+#include "ContactPlanRouter.hpp"
+#include <stdlib.h>
+#include <algorithm>
+#include <sstream>
+#include <vector>
+#include "CLA.hpp"
+#include "Clock.hpp"
+#include "dtn7-esp.hpp"
+#include "statusReportCodes.hpp"
+
+/// @brief returns the time a bundle of the given size is completely sent during a contact, if the sending node can start using the contact at the given time
+/// @return the time in ms, UINT64_MAX if the contact can not carry the bundle
+static uint64_t transmissionEnd(const Contact& contact, uint64_t from,
+                                uint64_t size) {
+    if (contact.rate == 0 || contact.remaining() < size)
+        return UINT64_MAX;
+    uint64_t begin = std::max(from, contact.start);
+    uint64_t end =
+        begin + (size * 1000 + contact.rate - 1) / contact.rate;  // round up
+    return end <= contact.end ? end : UINT64_MAX;
+}
+
+/// @brief parses a time of the contact plan in seconds, relative to base if prefixed with '+'
+/// @param token the time as written in the plan
+/// @param base time of loading the plan in ms
+/// @param result reference the time in ms is written to
+/// @return whether the token is a valid time
+static bool parseTime(const std::string& token, uint64_t base,
+                      uint64_t& result) {
+    bool relative = !token.empty() && token[0] == '+';
+    const char* begin = token.c_str() + (relative ? 1 : 0);
+    char* end = nullptr;
+    if (*begin < '0' || *begin > '9')
+        return false;
+    uint64_t seconds = strtoull(begin, &end, 10);
+    if (*end != '\0')
+        return false;
+    result = seconds * 1000 + (relative ? base : 0);
+    return true;
+}
+
+ContactPlanRouter::ContactPlanRouter() {
+    mutex = xSemaphoreCreateMutex();
+}
+
+ContactPlanRouter::ContactPlanRouter(std::vector<CLA*> clas,
+                                     Storage* storage) {
+    this->clas = clas;
+    this->storage = storage;
+    mutex = xSemaphoreCreateMutex();
+}
+
+ContactPlanRouter::~ContactPlanRouter() {
+    vSemaphoreDelete(mutex);
+}
+
+bool ContactPlanRouter::handleForwarding(BundleInfo* bundle,
+                                         uint& reasonCode) {
+    std::string destination = bundle->bundle.getDest().getURI();
+
+    // bundles to this node have been delivered locally, they are not forwarded any further
+    if (isDestinationNode(DTN7::localNode->URI, destination)) {
+        reasonCode = BundleStatusReportReasonCodes::NO_ADDITIONAL_INFORMATION;
+        return true;
+    }
+
+    std::string id = bundle->bundle.getID();
+    uint64_t now = DTN7::nowMs();
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    removeEndedContacts(now);
+
+    // a bundle scheduled during an earlier attempt keeps its contact, otherwise it is scheduled into the first contact of its route
+    Contact* contact = nullptr;
+    auto booking = bookings.find(id);
+    if (booking != bookings.end()) {
+        contact = findContact(booking->second.contact);
+    }
+    else {
+        // the size is only determined once, when the bundle is scheduled
+        uint8_t* cbor = nullptr;
+        size_t cborSize = 0;
+        bundle->bundle.toCbor(&cbor, cborSize);
+        delete[] cbor;
+
+        Route route;
+        if (getRoute(destination, cborSize, now, route)) {
+            contact = findContact(route.firstContact);
+            contact->booked += cborSize;
+            bookings[id] = {contact->id, cborSize};
+            ESP_LOGI("ContactPlanRouter",
+                     "scheduled bundle into contact %lu with %s, expected "
+                     "arrival at destination: %llu",
+                     (unsigned long)contact->id, contact->to.c_str(),
+                     route.arrival);
+        }
+    }
+
+    // without a route the bundle is kept until the plan changes
+    if (contact == nullptr) {
+        xSemaphoreGive(mutex);
+        ESP_LOGI("ContactPlanRouter", "no route to %s", destination.c_str());
+        reasonCode =
+            BundleStatusReportReasonCodes::NO_KNOWN_ROUTE_TO_DESTINATION_FROM_HERE;
+        return false;
+    }
+
+    // the bundle waits for its contact to open, nextRetry wakes the retry task then
+    if (contact->start > now) {
+        ESP_LOGD("ContactPlanRouter", "waiting for contact %lu, opens in %llu ms",
+                 (unsigned long)contact->id, contact->start - now);
+        xSemaphoreGive(mutex);
+        reasonCode = BundleStatusReportReasonCodes::
+            NO_TIMELY_CONTACT_WITH_NEXT_NODE_ON_ROUTE;
+        return false;
+    }
+    std::string nextHop = contact->to;
+    xSemaphoreGive(mutex);
+
+    // the next node is taken from the known peers if it was discovered, so addressable CLAs have its addressing information
+    Node next(nextHop);
+    bool nextHopKnown = false;
+    NodeSnapshotPtr peers = storage->getNodesSnapshot();
+    for (const Node& n : peers->nodes) {
+        if (n.URI == nextHop) {
+            next = n;
+            nextHopKnown = true;
+            break;
+        }
+    }
+
+    // a broadcast can only be expected to reach the next hop if it is a known peer, otherwise the bundle is still broadcast but stays scheduled
+    bool broadcast = false;
+
+    // initialize reason code for return value
+    uint reason =
+        BundleStatusReportReasonCodes::NO_TIMELY_CONTACT_WITH_NEXT_NODE_ON_ROUTE;
+    bool sent = false;
+
+    // prepare the bundle for transmission as late as possible
+    Bundle* preparedBundle = prepareForSend(&bundle->bundle);
+    for (CLA* cla : clas) {
+        if (!cla->checkCanAddress()) {
+            if (cla->send(preparedBundle)) {
+                bundle->lastBroadcastTime = DTN7::nowMs();
+                bundle->numOfBroadcasts += 1;
+                reason = BundleStatusReportReasonCodes::
+                    FORWARDED_OVER_UNIDIRECTIONAL_LINK;
+                broadcast = true;
+                sent = nextHopKnown;
+            }
+            else
+                reason = BundleStatusReportReasonCodes::TRAFFIC_PARED;
+        }
+        else if (cla->send(preparedBundle, &next)) {
+            sent = true;
+        }
+        if (sent)
+            break;
+    }
+
+    // clean up heap
+    delete preparedBundle;
+
+    if (broadcast && !sent) {
+        ESP_LOGI("ContactPlanRouter", "next hop %s not in range",
+                 nextHop.c_str());
+        reason = BundleStatusReportReasonCodes::
+            NO_TIMELY_CONTACT_WITH_NEXT_NODE_ON_ROUTE;
+    }
+
+    // write the reason code to the reference passed to this function
+    reasonCode = reason;
+
+    // a bundle which could not be sent stays scheduled, it is retried while the contact is open
+    if (!sent)
+        return false;
+
+    ESP_LOGI("ContactPlanRouter", "forwarded to %s", nextHop.c_str());
+    bundle->forwardedTo.push_back(next);
+
+    // the volume used by the bundle stays booked
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bookings.erase(id);
+    xSemaphoreGive(mutex);
+    return true;
+}
+
+uint64_t ContactPlanRouter::nextRetry(uint64_t now) {
+    uint64_t fallback = Router::nextRetry(now);
+    const std::string& local = DTN7::localNode->URI;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    removeEndedContacts(now);
+
+    // bundles scheduled into an open contact were not sent yet, they are retried after the default interval
+    bool pending = false;
+    for (const auto& booking : bookings) {
+        Contact* contact = findContact(booking.second.contact);
+        if (contact != nullptr && contact->start <= now) {
+            pending = true;
+            break;
+        }
+    }
+
+    // the contacts are ordered by their start, the first future one of this node is the next
+    uint64_t result = UINT64_MAX;
+    for (const Contact& c : contacts) {
+        if (c.start > now && c.from == local) {
+            result = c.start;
+            break;
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    if (pending || result == UINT64_MAX)
+        return std::min(result, fallback);
+    return result;
+}
+
+bool ContactPlanRouter::addContact(const std::string& from,
+                                   const std::string& to, uint64_t start,
+                                   uint64_t end, uint32_t rate) {
+    Contact contact;
+    contact.from = from;
+    contact.to = to;
+    contact.start = start;
+    contact.end = end;
+    contact.rate = rate;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    removeEndedContacts(DTN7::nowMs());
+    bool added = end > DTN7::nowMs() && insertContact(contact);
+    xSemaphoreGive(mutex);
+
+    if (!added)
+        ESP_LOGW("ContactPlanRouter", "contact from %s to %s not added",
+                 from.c_str(), to.c_str());
+    return added;
+}
+
+size_t ContactPlanRouter::loadContactPlan(const std::string& plan) {
+    uint64_t now = DTN7::nowMs();
+    size_t added = 0;
+    size_t lineNumber = 0;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    contacts.clear();
+    bookings.clear();
+    routes.clear();
+
+    std::istringstream lines(plan);
+    std::string line;
+    while (std::getline(lines, line)) {
+        lineNumber++;
+        std::istringstream tokens(line);
+        std::vector<std::string> fields;
+        std::string token;
+        while (tokens >> token)
+            fields.push_back(token);
+
+        // skip empty lines and comments
+        if (fields.empty() || fields[0][0] == '#')
+            continue;
+
+        Contact contact;
+        char* rateEnd = nullptr;
+        bool valid = fields.size() == 5 &&
+                     parseTime(fields[0], now, contact.start) &&
+                     parseTime(fields[1], now, contact.end);
+        if (valid) {
+            contact.from = fields[2];
+            contact.to = fields[3];
+            unsigned long rate = strtoul(fields[4].c_str(), &rateEnd, 10);
+            contact.rate = std::min<unsigned long>(rate, UINT32_MAX);
+            valid = *rateEnd == '\0';
+        }
+
+        // contacts which have already ended are skipped silently, plans may cover the past
+        if (valid && contact.end <= now)
+            continue;
+        if (valid && insertContact(contact))
+            added++;
+        else
+            ESP_LOGW("ContactPlanRouter", "skipping line %u of contact plan",
+                     lineNumber);
+    }
+    xSemaphoreGive(mutex);
+
+    ESP_LOGI("ContactPlanRouter", "loaded contact plan with %u contacts",
+             added);
+    return added;
+}
+
+void ContactPlanRouter::clearContactPlan() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    contacts.clear();
+    bookings.clear();
+    routes.clear();
+    xSemaphoreGive(mutex);
+}
+
+std::vector<Contact> ContactPlanRouter::getContacts() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    removeEndedContacts(DTN7::nowMs());
+    std::vector<Contact> result = contacts;
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+void ContactPlanRouter::removeEndedContacts(uint64_t now) {
+    bool removed = false;
+    for (auto it = contacts.begin(); it != contacts.end();) {
+        if (it->end > now) {
+            it++;
+            continue;
+        }
+        // bundles scheduled into an ended contact are scheduled again on their next attempt
+        for (auto b = bookings.begin(); b != bookings.end();) {
+            if (b->second.contact == it->id)
+                b = bookings.erase(b);
+            else
+                b++;
+        }
+        it = contacts.erase(it);
+        removed = true;
+    }
+
+    // cached routes may use an ended contact after their first one
+    if (removed)
+        routes.clear();
+}
+
+Contact* ContactPlanRouter::findContact(uint32_t id) {
+    for (Contact& c : contacts)
+        if (c.id == id)
+            return &c;
+    return nullptr;
+}
+
+bool ContactPlanRouter::computeRoute(const std::string& destination,
+                                     uint64_t size, uint64_t now,
+                                     Route& route) {
+    const std::string& local = DTN7::localNode->URI;
+    size_t n = contacts.size();
+
+    // Dijkstra's algorithm with the contacts as vertices: the earliest time a bundle has been sent over each contact, and the first contact of the route leading to it
+    std::vector<uint64_t> arrival(n, UINT64_MAX);
+    std::vector<size_t> first(n, n);
+    std::vector<bool> visited(n, false);
+
+    // the contacts of this node can be used from now on
+    for (size_t i = 0; i < n; i++) {
+        if (contacts[i].from == local) {
+            arrival[i] = transmissionEnd(contacts[i], now, size);
+            first[i] = i;
+        }
+    }
+
+    while (true) {
+        // select the contact with the earliest arrival not visited yet
+        size_t best = n;
+        for (size_t i = 0; i < n; i++)
+            if (!visited[i] && arrival[i] != UINT64_MAX &&
+                (best == n || arrival[i] < arrival[best]))
+                best = i;
+        if (best == n)
+            return false;
+        visited[best] = true;
+        const Contact& contact = contacts[best];
+
+        // the first contact reaching the destination which is selected has the earliest arrival
+        if (isDestinationNode(contact.to, destination)) {
+            route.firstContact = contacts[first[best]].id;
+            route.arrival = arrival[best];
+            return true;
+        }
+
+        // routes never lead back through this node
+        if (contact.to == local)
+            continue;
+
+        // the bundle can continue over any later contact of the node it arrived at
+        for (size_t j = 0; j < n; j++) {
+            if (visited[j] || contacts[j].from != contact.to)
+                continue;
+            uint64_t end = transmissionEnd(contacts[j], arrival[best], size);
+            if (end < arrival[j]) {
+                arrival[j] = end;
+                first[j] = first[best];
+            }
+        }
+    }
+}
+
+bool ContactPlanRouter::getRoute(const std::string& destination, uint64_t size,
+                                 uint64_t now, Route& route) {
+    std::string node = nodeOf(destination);
+
+    // a cached route is used as long as its first contact can carry the bundle
+    auto cached = routes.find(node);
+    if (cached != routes.end()) {
+        Contact* firstContact = findContact(cached->second.firstContact);
+        if (firstContact != nullptr &&
+            transmissionEnd(*firstContact, now, size) != UINT64_MAX) {
+            route = cached->second;
+            return true;
+        }
+        routes.erase(cached);
+    }
+
+    if (!computeRoute(destination, size, now, route))
+        return false;
+
+    // the cache is bounded by the size of the plan
+    if (routes.size() >= CONFIG_ContactPlanMaxContacts)
+        routes.clear();
+    routes[node] = route;
+    return true;
+}
+
+bool ContactPlanRouter::insertContact(Contact contact) {
+    if (contact.from.empty() || contact.to.empty() ||
+        contact.end <= contact.start || contact.rate == 0 ||
+        contacts.size() >= CONFIG_ContactPlanMaxContacts)
+        return false;
+    contact.id = nextContactId++;
+    contact.booked = 0;
+
+    // keep the contacts ordered by their start
+    auto position = std::upper_bound(
+        contacts.begin(), contacts.end(), contact.start,
+        [](uint64_t start, const Contact& c) { return start < c.start; });
+    contacts.insert(position, contact);
+
+    // routes may use the new contact
+    routes.clear();
+    return true;
+}
@@ -2,6 +2,7 @@
 #include <list>
 #include <vector>
 #include "CLA.hpp"
+#include "Clock.hpp"
 #include "dtn7-esp.hpp"
 #include "statusReportCodes.hpp"
 
@@ -13,13 +14,13 @@ EpidemicRouter::EpidemicRouter(std::vector<CLA*> clas, Storage* storage) {
 }
 
 bool EpidemicRouter::handleForwarding(BundleInfo* bundle, uint& reasonCode) {
-    // get known peers from storage
-    std::vector<Node> peers = storage->getNodes();
+    // get a snapshot of the known peers from storage, the nodes are not copied
+    NodeSnapshotPtr peers = storage->getNodesSnapshot();
 
     ESP_LOGI("EpidemicRouter",
              "handleForwarding, number of CLAs in Routers Cla list:%u, number "
              "of known Peers:%u",
-             this->clas.size(), peers.size());
+             this->clas.size(), peers->nodes.size());
 
     // initialize reason code for return value
     uint reason = BundleStatusReportReasonCodes::
@@ -29,7 +30,7 @@ bool EpidemicRouter::handleForwarding(BundleInfo* bundle, uint& reasonCode) {
     std::vector<Node> toForward;
 
     // check if we have peers which have not been forwarded this bundle
-    for (Node n : peers) {
+    for (const Node& n : peers->nodes) {
         if (!checkForwardedTo(n, bundle->forwardedTo, bundle->bundle.getID()))
             toForward.push_back(
                 n);  // if this node has been not already forwarded this bundle, add it to the nodes which shall receive it
@@ -41,9 +42,6 @@ bool EpidemicRouter::handleForwarding(BundleInfo* bundle, uint& reasonCode) {
 
     // only if there are known nodes which have not been forwarded this bundle a forwarding attempt is undertaken. Because of this, a neighbor discovery mechanism is required for this routing strategy
     if (toForward.size() != 0) {
-        // initialize struct to later get the current time
-        struct timeval tv_now;
-
         // initialize boolean in order to keep track whether any CLA has successfully broadcast the bundle
         bool successfulBroadcast = false;
 
@@ -59,12 +57,8 @@ bool EpidemicRouter::handleForwarding(BundleInfo* bundle, uint& reasonCode) {
             if (!cla->checkCanAddress()) {
                 // task the CLA with sending the bundle, and if this is successful update the broadcast time and the status code of the bundle
                 if (cla->send(preparedBundle)) {
-                    // get the current time
-                    gettimeofday(&tv_now, NULL);
-
-                    // convert current time to ms
-                    uint64_t currentTime = ((int64_t)tv_now.tv_sec * 1000L +
-                                            (int64_t)tv_now.tv_usec / 1000);
+                    // get the current time in ms
+                    uint64_t currentTime = DTN7::nowMs();
 
                     // update the last broadcast time of the bundle, this updating has no direct use, but can be helpfull for debugging purposes
                     bundle->lastBroadcastTime = currentTime;
@@ -121,31 +115,14 @@ bool EpidemicRouter::handleForwarding(BundleInfo* bundle, uint& reasonCode) {
     return bundle->forwardedTo.size() >= CONFIG_NumOfForwards;
 }
 
-bool EpidemicRouter::checkForwardedTo(Node toCheck,
+bool EpidemicRouter::checkForwardedTo(const Node& toCheck,
                                       std::vector<Node>& forwardedTo,
                                       std::string bundleID) {
-    // if the use of bundleID hashes is enabled, these are checked here
+    // if the use of received bundle summaries is enabled, these are checked here
 #if CONFIG_useReceivedSet
 
-    size_t idHash = DTN7::hasher->hash(bundleID);
-
-    // first check whether this bundles bundleID has was already marked as received by this node
-    if (toCheck.receivedHashes.contains(idHash)) {
-        toCheck.confirmedReception =
-            true;  // bundle was apparently forwarded to this node, not by this node, but this is not relevant, therefore add to list of forwarded to nodes and set confirmed reception to true
-
-        // update the forwarded to list of the bundle to include this node
-        forwardedTo.push_back(toCheck);
-
-        // remove the hash from the received hashes of this node, as this information is now conveyed by the confirmed reception field and the space used by the hash can be saved.
-        toCheck.receivedHashes.erase(idHash);
-
-        // re-add the modified node to storage
-        DTN7::BPA->storage->addNode(toCheck);
-        ESP_LOGI("checkForwardedTo", "already revived from checked node");
-        // no need to check anything else, return true
-        return true;
-    }
+    // the summary advertised by the node tells which bundles it has, so only the bundles missing from it are sent
+    bool received = toCheck.receivedSummary.contains(bundleID);
 #endif
 
     bool forwardedToThis = false;
@@ -163,8 +140,8 @@ bool EpidemicRouter::checkForwardedTo(Node toCheck,
             if (forwarded.confirmedReception)
                 return true;
 
-            // if the node which is checked does not have this bundleID in its confirmed BundleIDs, it was not forwarded to this node, therefor remove from forwarded to and return false
-            if (!(toCheck.receivedHashes.contains(idHash))) {
+            // if the summary of the checked node does not contain this bundleID, it was not received by this node, therefor remove from forwarded to and return false
+            if (!received) {
                 forwardedTo.erase(forwardedTo.begin() + index);
                 ESP_LOGI(
                     "checkForwardedTo",
@@ -172,20 +149,27 @@ bool EpidemicRouter::checkForwardedTo(Node toCheck,
                 return false;
             }
 
-            else {
-                // the hash of this bundleId was contained, therfore mark it as confirmed, changes value in vector, as it is used as a reference
-                forwarded.confirmedReception = true;
-
-                // remove the hash from the received hashes of this node, as this information is now conveyed by the confirmed reception field and the space used by the hash can be saved.
-                toCheck.receivedHashes.erase(idHash);
-
-                // re-add the modified node to storage
-                DTN7::BPA->storage->addNode(toCheck);
-            }
+            // the bundleId was contained, therfore mark it as confirmed, changes value in vector, as it is used as a reference
+            forwarded.confirmedReception = true;
 #endif
             break;
         }
         index++;
     }
+
+#if CONFIG_useReceivedSet
+    if (!forwardedToThis && received) {
+        // the checked node belongs to a shared snapshot, modify a copy
+        Node updated = toCheck;
+        updated.confirmedReception =
+            true;  // bundle was apparently forwarded to this node, not by this node, but this is not relevant, therefore add to list of forwarded to nodes and set confirmed reception to true
+
+        // update the forwarded to list of the bundle to include this node, the summary is not needed there
+        updated.receivedSummary = BundleSummary();
+        forwardedTo.push_back(updated);
+        ESP_LOGI("checkForwardedTo", "already received by checked node");
+        return true;
+    }
+#endif
     return forwardedToThis;
 }
@@ -0,0 +1,262 @@
+#include "GeoRouter.hpp"
+#include <vector>
+#include "CLA.hpp"
+#include "Clock.hpp"
+#include "dtn7-esp.hpp"
+#include "statusReportCodes.hpp"
+
+GeoRouter::GeoRouter() {
+    mutex = xSemaphoreCreateMutex();
+}
+
+GeoRouter::GeoRouter(std::vector<CLA*> clas, Storage* storage) {
+    this->clas = clas;
+    this->storage = storage;
+    mutex = xSemaphoreCreateMutex();
+}
+
+GeoRouter::~GeoRouter() {
+    vSemaphoreDelete(mutex);
+}
+
+bool GeoRouter::handleForwarding(BundleInfo* bundle, uint& reasonCode) {
+    std::string destination = bundle->bundle.getDest().getURI();
+
+    // bundles to this node have been delivered locally, they are not forwarded any further
+    if (isDestinationNode(DTN7::localNode->URI, destination)) {
+        reasonCode = BundleStatusReportReasonCodes::NO_ADDITIONAL_INFORMATION;
+        return true;
+    }
+
+    // if the destination has already received the bundle, it does not need to be kept
+    for (const Node& n : bundle->forwardedTo) {
+        if (isDestinationNode(n.URI, destination)) {
+            reasonCode =
+                BundleStatusReportReasonCodes::NO_ADDITIONAL_INFORMATION;
+            return true;
+        }
+    }
+
+    // get a snapshot of the known peers from storage, the nodes are not copied
+    NodeSnapshotPtr peers = storage->getNodesSnapshot();
+
+    // initialize reason code for return value
+    uint reason = BundleStatusReportReasonCodes::
+        NO_TIMELY_CONTACT_WITH_NEXT_NODE_ON_ROUTE;
+
+    // the destination is in range, forward the bundle directly
+    for (const Node& n : peers->nodes) {
+        if (isDestinationNode(n.URI, destination)) {
+            Node dest = n;
+            if (sendToNode(bundle, dest, reason)) {
+                ESP_LOGI("GeoRouter", "forwarded directly to %s",
+                         dest.URI.c_str());
+                bundle->forwardedTo.push_back(dest);
+                reasonCode = reason;
+                return true;
+            }
+            break;
+        }
+    }
+
+    // greedy forwarding: the peer nearest to the destination's last known position is the next hop, if it is closer than this node
+    std::string nextHop;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    updateIndex(*peers);
+    auto target = locations.find(nodeOf(destination));
+    if (target != locations.end() && DTN7::localNode->hasPos) {
+        SpatialGrid::Entry nearest;
+        double distance;
+        double ownDistance = geoDistance(
+            DTN7::localNode->position.first, DTN7::localNode->position.second,
+            target->second.lat, target->second.lng);
+        if (neighbors.nearest(target->second.lat, target->second.lng, nearest,
+                              distance) &&
+            distance < ownDistance) {
+            nextHop = nearest.URI;
+            ESP_LOGI("GeoRouter",
+                     "next hop %s, %.0f m from destination, own distance: "
+                     "%.0f m",
+                     nextHop.c_str(), distance, ownDistance);
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    if (!nextHop.empty()) {
+        for (const Node& n : peers->nodes) {
+            if (n.URI != nextHop)
+                continue;
+            Node next = n;
+            if (sendToNode(bundle, next, reason)) {
+                bundle->forwardedTo.push_back(next);
+                reasonCode = reason;
+                return true;
+            }
+            break;
+        }
+    }
+
+#if CONFIG_GeoFallbackFlood
+    // recovery: no peer is closer to the destination, the bundle is forwarded to all peers which have not received it yet, and kept until a closer peer is met
+    std::vector<Node> notForwarded;
+    for (const Node& n : peers->nodes) {
+        bool forwarded = false;
+        for (const Node& f : bundle->forwardedTo) {
+            if (f.URI == n.URI) {
+                forwarded = true;
+                break;
+            }
+        }
+        if (!forwarded)
+            notForwarded.push_back(n);
+    }
+
+    if (notForwarded.size() != 0) {
+        ESP_LOGI("GeoRouter", "no closer peer, forwarding to %u peers",
+                 notForwarded.size());
+        bool successfulBroadcast = false;
+
+        // prepare the bundle for transmission as late as possible
+        Bundle* preparedBundle = prepareForSend(&bundle->bundle);
+
+        for (CLA* cla : clas) {
+            if (!cla->checkCanAddress()) {
+                if (cla->send(preparedBundle)) {
+                    bundle->lastBroadcastTime = DTN7::nowMs();
+                    bundle->numOfBroadcasts += 1;
+                    reason = BundleStatusReportReasonCodes::
+                        FORWARDED_OVER_UNIDIRECTIONAL_LINK;
+                    successfulBroadcast = true;
+                }
+                else
+                    reason = BundleStatusReportReasonCodes::TRAFFIC_PARED;
+            }
+            else {
+                for (Node dest : notForwarded) {
+                    if (cla->send(preparedBundle, &dest))
+                        bundle->forwardedTo.push_back(dest);
+                }
+            }
+        }
+
+        // clean up heap
+        delete preparedBundle;
+
+        // it is expected that all known nodes are in range and have received a broadcast, if one was carried out
+        if (successfulBroadcast) {
+            for (const Node& n : notForwarded) {
+                bool added = false;
+                for (const Node& f : bundle->forwardedTo) {
+                    if (f.URI == n.URI) {
+                        added = true;
+                        break;
+                    }
+                }
+                if (!added)
+                    bundle->forwardedTo.push_back(n);
+            }
+        }
+    }
+#endif
+
+    // write the reason code to the reference passed to this function
+    reasonCode = reason;
+
+    // the bundle is kept until a closer peer or the destination is met
+    return false;
+}
+
+bool GeoRouter::setPosition(const std::string& nodeURI, float lat, float lng) {
+    if (!isValidPosition(lat, lng)) {
+        ESP_LOGW("GeoRouter", "invalid position for %s: %f, %f",
+                 nodeURI.c_str(), lat, lng);
+        return false;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    locations[nodeURI] = {lat, lng, UINT64_MAX};
+    xSemaphoreGive(mutex);
+    return true;
+}
+
+bool GeoRouter::getPosition(const std::string& nodeURI, float& lat,
+                            float& lng) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    auto found = locations.find(nodeURI);
+    bool result = found != locations.end();
+    if (result) {
+        lat = found->second.lat;
+        lng = found->second.lng;
+    }
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+void GeoRouter::updateIndex(const NodeSnapshot& peers) {
+    if (peers.version == indexedVersion)
+        return;
+    indexedVersion = peers.version;
+
+    uint64_t now = DTN7::nowMs();
+    neighbors.clear();
+    for (const Node& n : peers.nodes) {
+        if (!n.hasPos || !isValidPosition(n.position.first, n.position.second))
+            continue;
+        neighbors.insert(n.URI, n.position.first, n.position.second);
+        storeLocation(n.URI, {n.position.first, n.position.second, now});
+    }
+    ESP_LOGD("GeoRouter", "indexed %u of %u peers", neighbors.size(),
+             peers.nodes.size());
+}
+
+void GeoRouter::storeLocation(const std::string& nodeURI,
+                              const Location& location) {
+    // positions set with setPosition are not replaced
+    auto existing = locations.find(nodeURI);
+    if (existing != locations.end()) {
+        if (existing->second.updated != UINT64_MAX)
+            existing->second = location;
+        return;
+    }
+    locations[nodeURI] = location;
+
+    // the oldest learned position is removed, positions set with setPosition are kept
+    if (locations.size() > CONFIG_GeoMaxLocations) {
+        auto oldest = locations.end();
+        for (auto it = locations.begin(); it != locations.end(); it++)
+            if (it->second.updated != UINT64_MAX &&
+                (oldest == locations.end() ||
+                 it->second.updated < oldest->second.updated))
+                oldest = it;
+        if (oldest != locations.end())
+            locations.erase(oldest);
+    }
+}
+
+bool GeoRouter::sendToNode(BundleInfo* bundle, Node& node, uint& reason) {
+    bool sent = false;
+
+    // prepare the bundle for transmission as late as possible
+    Bundle* preparedBundle = prepareForSend(&bundle->bundle);
+    for (CLA* cla : clas) {
+        if (!cla->checkCanAddress()) {
+            if (cla->send(preparedBundle)) {
+                bundle->lastBroadcastTime = DTN7::nowMs();
+                bundle->numOfBroadcasts += 1;
+                reason = BundleStatusReportReasonCodes::
+                    FORWARDED_OVER_UNIDIRECTIONAL_LINK;
+                sent = true;
+            }
+            else
+                reason = BundleStatusReportReasonCodes::TRAFFIC_PARED;
+        }
+        else if (cla->send(preparedBundle, &node)) {
+            sent = true;
+        }
+        if (sent)
+            break;
+    }
+
+    // clean up heap
+    delete preparedBundle;
+    return sent;
+}
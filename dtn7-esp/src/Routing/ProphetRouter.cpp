@@ -0,0 +1,330 @@
+#include "ProphetRouter.hpp"
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "BundleSummary.hpp"
+#include "CLA.hpp"
+#include "Clock.hpp"
+#include "dtn7-esp.hpp"
+#include "statusReportCodes.hpp"
+
+// size of an entry of the advertised vector: the hash of the node URI and the quantized predictability
+#define PROPHET_ENTRY_SIZE 5
+
+// predictabilities below this value are removed, they would be advertised as 0
+#define PROPHET_MIN_PREDICTABILITY (1.0f / 512)
+
+ProphetRouter::ProphetRouter() {
+    lastAging = DTN7::nowMs();
+    mutex = xSemaphoreCreateMutex();
+}
+
+ProphetRouter::ProphetRouter(std::vector<CLA*> clas, Storage* storage) {
+    this->clas = clas;
+    this->storage = storage;
+    lastAging = DTN7::nowMs();
+    mutex = xSemaphoreCreateMutex();
+}
+
+ProphetRouter::~ProphetRouter() {
+    vSemaphoreDelete(mutex);
+}
+
+uint32_t ProphetRouter::hashURI(const std::string& nodeURI) {
+    // peers advertise their URI with or without trailing '/', destinations are endpoints below the node, so all are reduced to the node URI first
+    // 32 bit FNV-1a, the same on every node, unlike std::hash
+    uint32_t hash = 2166136261UL;
+    for (unsigned char c : nodeOf(nodeURI)) {
+        hash ^= c;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+bool ProphetRouter::handleForwarding(BundleInfo* bundle, uint& reasonCode) {
+    std::string destination = bundle->bundle.getDest().getURI();
+
+    // bundles to this node have been delivered locally, they are not forwarded any further
+    if (isDestinationNode(DTN7::localNode->URI, destination)) {
+        reasonCode = BundleStatusReportReasonCodes::NO_ADDITIONAL_INFORMATION;
+        return true;
+    }
+
+    // if the destination has already received the bundle, it does not need to be kept
+    for (const Node& n : bundle->forwardedTo) {
+        if (isDestinationNode(n.URI, destination)) {
+            reasonCode =
+                BundleStatusReportReasonCodes::NO_ADDITIONAL_INFORMATION;
+            return true;
+        }
+    }
+
+    // get a snapshot of the known peers from storage, the nodes are not copied
+    NodeSnapshotPtr peers = storage->getNodesSnapshot();
+
+    // initialize reason code for return value
+    uint reason = BundleStatusReportReasonCodes::
+        NO_TIMELY_CONTACT_WITH_NEXT_NODE_ON_ROUTE;
+
+    // peers which have not been forwarded this bundle, and those among them which are better carriers towards the destination than this node
+    std::vector<Node> notForwarded;
+    std::vector<Node> toForward;
+    bool toDestination = false;
+    uint32_t destinationHash = hashURI(destination);
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    age();
+    auto own = predictabilities.find(destinationHash);
+    float ownPredictability = own == predictabilities.end() ? 0 : own->second;
+    for (const Node& n : peers->nodes) {
+        bool forwarded = false;
+        for (const Node& f : bundle->forwardedTo) {
+            if (f.URI == n.URI) {
+                forwarded = true;
+                break;
+            }
+        }
+        if (forwarded)
+            continue;
+        notForwarded.push_back(n);
+
+        if (isDestinationNode(n.URI, destination)) {
+            toDestination = true;
+            toForward.push_back(n);
+        }
+        else if (peerPredictability(hashURI(n.URI), destinationHash) >
+                 ownPredictability) {
+            toForward.push_back(n);
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    ESP_LOGI("ProphetRouter",
+             "handleForwarding, own predictability: %.3f, number of known "
+             "Peers:%u, better carriers:%u",
+             ownPredictability, peers->nodes.size(), toForward.size());
+
+    // only if a known node is the destination or a better carrier a forwarding attempt is undertaken
+    if (toForward.size() != 0) {
+        // initialize boolean in order to keep track whether any CLA has successfully broadcast the bundle
+        bool successfulBroadcast = false;
+
+        // prepare the bundle for transmission as late as possible
+        Bundle* preparedBundle = prepareForSend(&bundle->bundle);
+
+        for (CLA* cla : clas) {
+            if (!cla->checkCanAddress()) {
+                if (cla->send(preparedBundle)) {
+                    bundle->lastBroadcastTime = DTN7::nowMs();
+                    bundle->numOfBroadcasts += 1;
+                    reason = BundleStatusReportReasonCodes::
+                        FORWARDED_OVER_UNIDIRECTIONAL_LINK;
+                    successfulBroadcast = true;
+                }
+                else {
+                    reason = BundleStatusReportReasonCodes::TRAFFIC_PARED;
+                }
+            }
+            else {
+                // non broadcast CLAs only forward the bundle to the better carriers
+                for (Node dest : toForward) {
+                    if (cla->send(preparedBundle, &dest))
+                        bundle->forwardedTo.push_back(dest);
+                }
+            }
+        }
+
+        // clean up heap
+        delete preparedBundle;
+
+        // it is expected that all known nodes are in range and have received a broadcast, if one was carried out
+        if (successfulBroadcast) {
+            for (const Node& n : notForwarded) {
+                bool added = false;
+                for (const Node& f : bundle->forwardedTo) {
+                    if (f.URI == n.URI) {
+                        added = true;
+                        break;
+                    }
+                }
+                if (!added)
+                    bundle->forwardedTo.push_back(n);
+            }
+        }
+    }
+
+    // write the reason code to the reference passed to this function
+    reasonCode = reason;
+
+    // the bundle is kept until it was forwarded to its destination
+    if (toDestination) {
+        for (const Node& n : bundle->forwardedTo) {
+            if (isDestinationNode(n.URI, destination)) {
+                ESP_LOGI("ProphetRouter", "forwarded to destination %s",
+                         n.URI.c_str());
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ProphetRouter::contactStarted(const std::string& peerURI) {
+    uint32_t peer = hashURI(peerURI);
+    if (peer == hashURI(DTN7::localNode->URI))
+        return;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    age();
+    // the predictability of an encountered node increases towards 1
+    float& p = predictabilities[peer];
+    p = p + (1 - p) * pInit;
+    prune();
+    xSemaphoreGive(mutex);
+
+    ESP_LOGD("ProphetRouter", "encountered %s, predictability: %.3f",
+             peerURI.c_str(), getPredictability(peerURI));
+}
+
+std::string ProphetRouter::getAdvertisement(size_t maxLength) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    age();
+    std::vector<std::pair<uint32_t, float>> entries(predictabilities.begin(),
+                                                    predictabilities.end());
+    xSemaphoreGive(mutex);
+    if (entries.empty())
+        return std::string();
+
+    // only the highest predictabilities are advertised, so the vector fits into a single advertisement. Base64 encodes every started 3 bytes as 4 characters
+    size_t count =
+        std::min<size_t>(entries.size(), CONFIG_ProphetAdvertisedEntries);
+    while (count > 0 &&
+           (1 + count * PROPHET_ENTRY_SIZE + 2) / 3 * 4 > maxLength)
+        count--;
+    if (count == 0)
+        return std::string();
+    std::partial_sort(entries.begin(), entries.begin() + count, entries.end(),
+                      [](const std::pair<uint32_t, float>& a,
+                         const std::pair<uint32_t, float>& b) {
+                          return a.second > b.second;
+                      });
+
+    // the vector starts with its version, followed by the hash of each node as 32 bit little endian and its predictability quantized to a byte
+    std::vector<uint8_t> vector;
+    vector.reserve(1 + count * PROPHET_ENTRY_SIZE);
+    vector.push_back(PROPHET_VECTOR_VERSION);
+    for (size_t i = 0; i < count; i++) {
+        for (int j = 0; j < 4; j++)
+            vector.push_back((entries[i].first >> (8 * j)) & 0xFF);
+        vector.push_back((uint8_t)lroundf(entries[i].second * 255));
+    }
+    return base64Encode(vector.data(), vector.size());
+}
+
+void ProphetRouter::handleAdvertisement(const std::string& peerURI,
+                                        const std::string& data) {
+    std::vector<uint8_t> vector;
+    if (!base64Decode(data, vector) || vector.empty() ||
+        vector[0] != PROPHET_VECTOR_VERSION ||
+        (vector.size() - 1) % PROPHET_ENTRY_SIZE != 0) {
+        ESP_LOGW("ProphetRouter", "invalid predictability vector from %s",
+                 peerURI.c_str());
+        return;
+    }
+
+    PeerVector received;
+    received.receivedAt = DTN7::nowMs();
+    for (size_t i = 1; i < vector.size(); i += PROPHET_ENTRY_SIZE) {
+        uint32_t node = vector[i] | (vector[i + 1] << 8) |
+                        (vector[i + 2] << 16) | ((uint32_t)vector[i + 3] << 24);
+        received.entries.push_back({node, vector[i + 4]});
+    }
+
+    uint32_t peer = hashURI(peerURI);
+    uint32_t local = hashURI(DTN7::localNode->URI);
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    age();
+
+    // transitivity: nodes the peer is likely to meet can be reached through the peer
+    auto toPeer = predictabilities.find(peer);
+    if (toPeer != predictabilities.end()) {
+        for (const auto& entry : received.entries) {
+            if (entry.first == local || entry.first == peer)
+                continue;
+            float transitive = toPeer->second * (entry.second / 255.0f) * beta;
+            if (transitive < PROPHET_MIN_PREDICTABILITY)
+                continue;
+            float& p = predictabilities[entry.first];
+            p = std::max(p, transitive);
+        }
+    }
+
+    // only the last vector of each peer is kept, the oldest one is removed if too many peers are known
+    peerVectors[peer] = std::move(received);
+    if (peerVectors.size() > CONFIG_ProphetMaxEntries) {
+        auto oldest = peerVectors.begin();
+        for (auto it = peerVectors.begin(); it != peerVectors.end(); it++)
+            if (it->second.receivedAt < oldest->second.receivedAt)
+                oldest = it;
+        peerVectors.erase(oldest);
+    }
+    prune();
+    xSemaphoreGive(mutex);
+}
+
+float ProphetRouter::getPredictability(const std::string& nodeURI) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    age();
+    auto found = predictabilities.find(hashURI(nodeURI));
+    float result = found == predictabilities.end() ? 0 : found->second;
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+void ProphetRouter::age() {
+    uint64_t now = DTN7::nowMs();
+    if (agingInterval == 0 || now < lastAging + agingInterval)
+        return;
+    uint64_t intervals = (now - lastAging) / agingInterval;
+    lastAging += intervals * agingInterval;
+
+    float factor = powf(gamma, (float)intervals);
+    for (auto it = predictabilities.begin(); it != predictabilities.end();) {
+        it->second *= factor;
+        // predictabilities which would be advertised as 0 are forgotten
+        if (it->second < PROPHET_MIN_PREDICTABILITY)
+            it = predictabilities.erase(it);
+        else
+            it++;
+    }
+}
+
+void ProphetRouter::prune() {
+    while (predictabilities.size() > CONFIG_ProphetMaxEntries) {
+        auto smallest = predictabilities.begin();
+        for (auto it = predictabilities.begin(); it != predictabilities.end();
+             it++)
+            if (it->second < smallest->second)
+                smallest = it;
+        predictabilities.erase(smallest);
+    }
+}
+
+float ProphetRouter::peerPredictability(uint32_t peer, uint32_t node) {
+    auto found = peerVectors.find(peer);
+    if (found == peerVectors.end())
+        return 0;
+    for (const auto& entry : found->second.entries) {
+        if (entry.first != node)
+            continue;
+        // the advertised predictability has aged since it was received, like the own ones
+        float result = entry.second / 255.0f;
+        if (agingInterval > 0)
+            result *= powf(gamma, (float)((DTN7::nowMs() -
+                                           found->second.receivedAt) /
+                                          agingInterval));
+        return result;
+    }
+    return 0;
+}
@@ -2,6 +2,7 @@
 #include <list>
 #include <vector>
 #include "CLA.hpp"
+#include "Clock.hpp"
 #include "dtn7-esp.hpp"
 #include "statusReportCodes.hpp"
 
@@ -40,13 +41,8 @@ Bundle* Router::prepareForSend(Bundle* bundle) {
 
     // if present, update the bundle age block
     if (result->hasBundleAge) {
-        // get current time
-        struct timeval tv_now;
-        gettimeofday(&tv_now, NULL);
-
-        // convert current time to ms
-        uint64_t currentTime =
-            ((int64_t)tv_now.tv_sec * 1000L + (int64_t)tv_now.tv_usec / 1000);
+        // get current time in ms
+        uint64_t currentTime = DTN7::nowMs();
 
         result->increaseAge(currentTime - (bundle->receivedAt));
     }
@@ -59,6 +55,110 @@ Bundle* Router::prepareForSend(Bundle* bundle) {
     return result;
 }
 
+bool Router::forward(BundleInfo* bundle, uint& reasonCode) {
+    StaticRoute route;
+
+    // bundles to this node are always left to the router, which handles bundles that were delivered locally
+    if (isDestinationNode(DTN7::localNode->URI,
+                          bundle->bundle.getDest().getURI()) ||
+        !staticRoutes.match(bundle, route))
+        return handleForwarding(bundle, reasonCode);
+    return forwardStatic(bundle, route, reasonCode);
+}
+
+bool Router::forwardStatic(BundleInfo* bundle, const StaticRoute& route,
+                           uint& reasonCode) {
+    // the next hop is taken from the known peers if it was discovered, so addressable CLAs have its addressing information
+    Node next(route.nextHop);
+    bool nextHopKnown = false;
+    if (!route.nextHop.empty()) {
+        NodeSnapshotPtr peers = DTN7::BPA->storage->getNodesSnapshot();
+        for (const Node& n : peers->nodes) {
+            if (n.URI == route.nextHop) {
+                next = n;
+                nextHopKnown = true;
+                break;
+            }
+        }
+    }
+
+    // a broadcast can only be expected to reach the next hop if it is a known peer, otherwise the bundle is still broadcast but kept and retried
+    bool broadcastReachesNextHop = route.nextHop.empty() || nextHopKnown;
+    bool broadcast = false;
+
+    // initialize reason code for return value
+    uint reason =
+        BundleStatusReportReasonCodes::NO_TIMELY_CONTACT_WITH_NEXT_NODE_ON_ROUTE;
+    bool sent = false;
+
+    // prepare the bundle for transmission as late as possible
+    Bundle* preparedBundle = prepareForSend(&bundle->bundle);
+
+    // only the CLA of the route is used, no attempts are made on other links
+    for (CLA* cla : clas) {
+        if (!route.cla.empty() && cla->getName() != route.cla)
+            continue;
+        if (!cla->checkCanAddress()) {
+            if (cla->send(preparedBundle)) {
+                bundle->lastBroadcastTime = DTN7::nowMs();
+                bundle->numOfBroadcasts += 1;
+                reason = BundleStatusReportReasonCodes::
+                    FORWARDED_OVER_UNIDIRECTIONAL_LINK;
+                broadcast = true;
+                sent = broadcastReachesNextHop;
+            }
+            else
+                reason = BundleStatusReportReasonCodes::TRAFFIC_PARED;
+        }
+        else if (!route.nextHop.empty() && cla->send(preparedBundle, &next)) {
+            sent = true;
+        }
+        if (sent)
+            break;
+    }
+
+    // clean up heap
+    delete preparedBundle;
+
+    if (broadcast && !sent) {
+        ESP_LOGI("Router", "next hop %s of static route %s not in range",
+                 route.nextHop.c_str(), route.pattern.c_str());
+        reason = BundleStatusReportReasonCodes::
+            NO_TIMELY_CONTACT_WITH_NEXT_NODE_ON_ROUTE;
+    }
+
+    ESP_LOGI("Router", "static route %s: %s", route.pattern.c_str(),
+             sent ? "forwarded" : "not forwarded");
+
+    // write the reason code to the reference passed to this function
+    reasonCode = reason;
+    if (sent && !route.nextHop.empty())
+        bundle->forwardedTo.push_back(next);
+
+    // a bundle which was sent along its static route is not kept, otherwise it is retried later
+    return sent;
+}
+
+bool Router::isDestinationNode(const std::string& nodeURI,
+                               const std::string& destination) {
+    if (nodeURI.empty() ||
+        destination.compare(0, nodeURI.size(), nodeURI) != 0)
+        return false;
+    // the node URI has to be followed by a path separator, so "dtn://node1" does not match "dtn://node10/"
+    return destination.size() == nodeURI.size() || nodeURI.back() == '/' ||
+           destination[nodeURI.size()] == '/';
+}
+
+std::string Router::nodeOf(const std::string& destination) {
+    // dtn URIs name the node in their authority, the endpoints of a node are paths below it
+    if (destination.compare(0, 6, "dtn://") != 0)
+        return destination;
+    size_t end = destination.find('/', 6);
+    if (end == std::string::npos)
+        return destination + "/";
+    return destination.substr(0, end + 1);
+}
+
 std::vector<ReceivedBundle*> Router::getNewBundles() {
     // create a vector for the result
     std::vector<ReceivedBundle*> result;
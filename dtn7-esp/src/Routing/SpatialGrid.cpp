@@ -0,0 +1,130 @@
+#include "SpatialGrid.hpp"
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+
+// mean earth radius in meters
+#define EARTH_RADIUS 6371000.0
+
+// length of a degree of latitude in meters
+#define METERS_PER_DEGREE (EARTH_RADIUS * M_PI / 180)
+
+double geoDistance(float lat1, float lng1, float lat2, float lng2) {
+    // haversine formula
+    double phi1 = lat1 * M_PI / 180;
+    double phi2 = lat2 * M_PI / 180;
+    double dPhi = phi2 - phi1;
+    double dLambda = (lng2 - lng1) * M_PI / 180;
+    double a = sin(dPhi / 2) * sin(dPhi / 2) +
+               cos(phi1) * cos(phi2) * sin(dLambda / 2) * sin(dLambda / 2);
+    return 2 * EARTH_RADIUS * atan2(sqrt(a), sqrt(1 - a));
+}
+
+bool isValidPosition(float lat, float lng) {
+    // comparisons with NaN are false, so non-finite values are checked explicitly
+    return isfinite(lat) && isfinite(lng) && lat >= -90 && lat <= 90 &&
+           lng >= -180 && lng <= 180;
+}
+
+SpatialGrid::SpatialGrid(uint32_t cellSize) {
+    cellDegrees = std::max<uint32_t>(cellSize, 1) / METERS_PER_DEGREE;
+}
+
+void SpatialGrid::cellOf(float lat, float lng, int32_t& x, int32_t& y) const {
+    x = (int32_t)floor(lng / cellDegrees);
+    y = (int32_t)floor(lat / cellDegrees);
+}
+
+void SpatialGrid::insert(const std::string& URI, float lat, float lng) {
+    // the cell of an invalid position can not be computed
+    if (!isValidPosition(lat, lng))
+        return;
+
+    int32_t x, y;
+    cellOf(lat, lng, x, y);
+    cells[key(x, y)].push_back({URI, lat, lng});
+
+    if (count == 0) {
+        minX = maxX = x;
+        minY = maxY = y;
+    }
+    else {
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+    }
+    count++;
+}
+
+void SpatialGrid::clear() {
+    cells.clear();
+    count = 0;
+}
+
+bool SpatialGrid::nearest(float lat, float lng, Entry& result,
+                          double& distance) const {
+    if (count == 0 || !isValidPosition(lat, lng))
+        return false;
+
+    int32_t cx, cy;
+    cellOf(lat, lng, cx, cy);
+
+    // the narrowest cell which may be searched limits how far away unsearched nodes are at least, cells are narrowest at the latitude furthest from the equator
+    double maxLat = std::min(
+        89.0, std::max({fabs((double)lat), fabs(minY * cellDegrees),
+                        fabs((maxY + 1) * cellDegrees)}));
+    double cellMeters =
+        cellDegrees * METERS_PER_DEGREE * cos(maxLat * M_PI / 180);
+
+    // the search ends at the ring enclosing all nodes, the grid does not wrap around at 180 degrees longitude
+    int32_t lastRing = std::max({abs(cx - minX), abs(cx - maxX),
+                                 abs(cy - minY), abs(cy - maxY)});
+
+    // all valid positions lie within this many cells of each other
+    lastRing = std::min(lastRing, (int32_t)ceil(360 / cellDegrees) + 1);
+
+    bool found = false;
+    auto check = [&](const std::vector<Entry>& entries) {
+        for (const Entry& entry : entries) {
+            double d = geoDistance(lat, lng, entry.lat, entry.lng);
+            if (!found || d < distance) {
+                result = entry;
+                distance = d;
+                found = true;
+            }
+        }
+    };
+
+    // number of cells looked up, once it exceeds the number of non-empty cells, checking every node directly is cheaper than searching further rings
+    size_t lookups = 0;
+    for (int32_t ring = 0; ring <= lastRing; ring++) {
+        // nodes in this and all further rings are at least this far away, as the position can be anywhere in its cell
+        if (found && (ring - 1) * cellMeters > distance)
+            break;
+
+        if (lookups > cells.size()) {
+            for (const auto& cell : cells)
+                check(cell.second);
+            break;
+        }
+
+        for (int32_t y = std::max(cy - ring, minY);
+             y <= std::min(cy + ring, maxY); y++) {
+            // only the cells on the border of the ring are searched, the inner ones were searched before
+            bool border = y == cy - ring || y == cy + ring;
+            int32_t step = border ? 1 : 2 * ring;
+            int32_t x = border ? std::max(cx - ring, minX) : cx - ring;
+            int32_t lastX = border ? std::min(cx + ring, maxX) : cx + ring;
+            for (; x <= lastX; x += std::max(step, 1)) {
+                if (x < minX || x > maxX)
+                    continue;
+                lookups++;
+                auto cell = cells.find(key(x, y));
+                if (cell != cells.end())
+                    check(cell->second);
+            }
+        }
+    }
+    return found;
+}
@@ -0,0 +1,280 @@
+#include "SprayAndWaitRouter.hpp"
+#include <algorithm>
+#include <vector>
+#include "CLA.hpp"
+#include "Clock.hpp"
+#include "dtn7-esp.hpp"
+#include "statusReportCodes.hpp"
+
+CopyCountBlock::CopyCountBlock(uint64_t copies, uint8_t crcType,
+                               uint64_t blockNumber)
+    : CanonicalBlock(COPY_COUNT_BLOCK_TYPE, blockNumber, 0, crcType) {
+    // nodes which do not use spray and wait forward the bundle without the block
+    setFlag(BLOCK_FLAG_DISCARD_CANT_BE_PROCESSED);
+
+    CborEncoder encoder;
+    uint8_t buf[sizeof(uint64_t) + 1];
+    cbor_encoder_init(&encoder, buf, sizeof(buf), 0);
+    cbor_encode_uint(&encoder, copies);
+    setData(buf, cbor_encoder_get_buffer_size(&encoder, buf));
+}
+
+bool CopyCountBlock::read(const CanonicalBlock& block, uint64_t& copies) {
+    if (block.blockTypeCode != COPY_COUNT_BLOCK_TYPE ||
+        block.blockTypeSpecificData == nullptr)
+        return false;
+    CborParser parser;
+    CborValue value;
+    if (cbor_parser_init(block.blockTypeSpecificData, block.dataSize, 0,
+                         &parser, &value) != CborNoError ||
+        !cbor_value_is_unsigned_integer(&value))
+        return false;
+    return cbor_value_get_uint64(&value, &copies) == CborNoError;
+}
+
+SprayAndWaitRouter::SprayAndWaitRouter() {
+    budgetMutex = xSemaphoreCreateMutex();
+}
+
+SprayAndWaitRouter::SprayAndWaitRouter(std::vector<CLA*> clas,
+                                       Storage* storage) {
+    this->clas = clas;
+    this->storage = storage;
+    budgetMutex = xSemaphoreCreateMutex();
+}
+
+SprayAndWaitRouter::~SprayAndWaitRouter() {
+    vSemaphoreDelete(budgetMutex);
+}
+
+bool SprayAndWaitRouter::handleForwarding(BundleInfo* bundle,
+                                          uint& reasonCode) {
+    std::string destination = bundle->bundle.getDest().getURI();
+
+    // bundles to this node have been delivered locally, they are not forwarded any further
+    if (isDestinationNode(DTN7::localNode->URI, destination)) {
+        reasonCode = BundleStatusReportReasonCodes::NO_ADDITIONAL_INFORMATION;
+        return true;
+    }
+
+    // if the destination has already received the bundle, it does not need to be kept
+    for (const Node& n : bundle->forwardedTo) {
+        if (isDestinationNode(n.URI, destination)) {
+            reasonCode =
+                BundleStatusReportReasonCodes::NO_ADDITIONAL_INFORMATION;
+            return true;
+        }
+    }
+
+    // the number of copies is determined when the bundle is forwarded the first time: received bundles carry it in their copy count block, other bundles start with the budget of their destination
+    if (bundle->copies == 0) {
+        uint64_t carried = 0;
+        if (readCopies(bundle->bundle, carried)) {
+            // a bundle carrying no copies was only sent to another node for direct delivery and is dropped
+            if (carried == 0) {
+                ESP_LOGI("SprayAndWaitRouter",
+                         "bundle without copies, not forwarding it");
+                reasonCode =
+                    BundleStatusReportReasonCodes::NO_ADDITIONAL_INFORMATION;
+                return true;
+            }
+            bundle->copies = std::min<uint64_t>(carried, UINT16_MAX);
+        }
+        else {
+            bundle->copies = copyBudget(destination);
+        }
+    }
+
+    // get a snapshot of the known peers from storage, the nodes are not copied
+    NodeSnapshotPtr peers = storage->getNodesSnapshot();
+
+    ESP_LOGI("SprayAndWaitRouter",
+             "handleForwarding, copies: %u, number of known Peers:%u",
+             bundle->copies, peers->nodes.size());
+
+    // initialize reason code for return value
+    uint reason = BundleStatusReportReasonCodes::
+        NO_TIMELY_CONTACT_WITH_NEXT_NODE_ON_ROUTE;
+
+    // look for the destination among the known peers, and for peers which can receive copies while the bundle is in the spray phase
+    const Node* destinationPeer = nullptr;
+    std::vector<Node> toSpray;
+    for (const Node& n : peers->nodes) {
+        if (isDestinationNode(n.URI, destination)) {
+            destinationPeer = &n;
+            continue;
+        }
+        if (bundle->copies <= 1)
+            continue;
+        bool forwarded = false;
+        for (const Node& f : bundle->forwardedTo) {
+            if (f.URI == n.URI) {
+                forwarded = true;
+                break;
+            }
+        }
+        if (!forwarded)
+            toSpray.push_back(n);
+    }
+
+    // the destination is in range, forward the bundle directly, in any phase
+    if (destinationPeer != nullptr) {
+        Node dest = *destinationPeer;
+        bool delivered = false;
+
+        // prepare the bundle for transmission as late as possible, other nodes receiving a broadcast get no copies
+        Bundle* preparedBundle = prepareForSend(&bundle->bundle);
+        setCopies(preparedBundle, 0);
+        for (CLA* cla : clas) {
+            if (!cla->checkCanAddress()) {
+                if (cla->send(preparedBundle)) {
+                    bundle->lastBroadcastTime = DTN7::nowMs();
+                    bundle->numOfBroadcasts += 1;
+                    reason = BundleStatusReportReasonCodes::
+                        FORWARDED_OVER_UNIDIRECTIONAL_LINK;
+                    delivered = true;
+                }
+                else
+                    reason = BundleStatusReportReasonCodes::TRAFFIC_PARED;
+            }
+            else if (cla->send(preparedBundle, &dest)) {
+                delivered = true;
+            }
+            if (delivered)
+                break;
+        }
+        delete preparedBundle;
+
+        if (delivered) {
+            ESP_LOGI("SprayAndWaitRouter", "forwarded directly to %s",
+                     dest.URI.c_str());
+            bundle->forwardedTo.push_back(dest);
+            reasonCode = reason;
+            return true;
+        }
+    }
+
+    // spray phase: hand over half of the remaining copies to peers which do not have the bundle yet
+    if (!toSpray.empty()) {
+        std::vector<bool> sprayed(toSpray.size(), false);
+
+        // prepare the bundle for transmission as late as possible
+        Bundle* preparedBundle = prepareForSend(&bundle->bundle);
+
+        for (CLA* cla : clas) {
+            if (bundle->copies <= 1)
+                break;
+
+            if (!cla->checkCanAddress()) {
+                // a broadcast reaches all neighbors with the same copy count block, so half of the copies are split between them
+                // if there are fewer copies to hand over than neighbors, each receiver would still take a copy, so the broadcast is skipped and only unicast CLAs spray to a subset of the neighbors
+                uint16_t share = bundle->copies / 2 / toSpray.size();
+                if (share == 0)
+                    continue;
+                setCopies(preparedBundle, share);
+                if (cla->send(preparedBundle)) {
+                    bundle->copies -= share * toSpray.size();
+                    bundle->lastBroadcastTime = DTN7::nowMs();
+                    bundle->numOfBroadcasts += 1;
+                    reason = BundleStatusReportReasonCodes::
+                        FORWARDED_OVER_UNIDIRECTIONAL_LINK;
+
+                    // it is expected that all known nodes are in range and have received the broadcast
+                    std::fill(sprayed.begin(), sprayed.end(), true);
+                }
+                else
+                    reason = BundleStatusReportReasonCodes::TRAFFIC_PARED;
+            }
+            else {
+                // binary spray: each node which is sent the bundle receives half of the remaining copies
+                for (size_t i = 0; i < toSpray.size(); i++) {
+                    if (sprayed[i] || bundle->copies <= 1)
+                        continue;
+                    uint16_t share = bundle->copies / 2;
+                    setCopies(preparedBundle, share);
+                    if (cla->send(preparedBundle, &toSpray[i])) {
+                        bundle->copies -= share;
+                        sprayed[i] = true;
+                    }
+                }
+            }
+        }
+
+        // clean up heap
+        delete preparedBundle;
+
+        // nodes which received copies are not sprayed again
+        for (size_t i = 0; i < toSpray.size(); i++)
+            if (sprayed[i])
+                bundle->forwardedTo.push_back(toSpray[i]);
+    }
+
+    // write the reason code to the reference passed to this function
+    reasonCode = reason;
+
+    // informational logging
+    ESP_LOGI("SprayAndWaitRouter",
+             "%u copies left, forwarded to %u nodes, with %u broadcasts",
+             bundle->copies, bundle->forwardedTo.size(),
+             bundle->numOfBroadcasts);
+
+    // the bundle is kept until it was forwarded to its destination
+    return false;
+}
+
+bool SprayAndWaitRouter::supportsBlock(uint64_t blockTypeCode) {
+    return blockTypeCode == COPY_COUNT_BLOCK_TYPE;
+}
+
+void SprayAndWaitRouter::setCopyBudget(const std::string& destination,
+                                       uint16_t copies) {
+    xSemaphoreTake(budgetMutex, portMAX_DELAY);
+    // a bundle needs at least one copy to be forwarded to its destination
+    budgets[destination] = std::max<uint16_t>(copies, 1);
+    xSemaphoreGive(budgetMutex);
+}
+
+void SprayAndWaitRouter::clearCopyBudget(const std::string& destination) {
+    xSemaphoreTake(budgetMutex, portMAX_DELAY);
+    budgets.erase(destination);
+    xSemaphoreGive(budgetMutex);
+}
+
+uint16_t SprayAndWaitRouter::copyBudget(const std::string& destination) {
+    uint16_t result = std::max<uint16_t>(defaultCopies, 1);
+    xSemaphoreTake(budgetMutex, portMAX_DELAY);
+    // a budget set for the endpoint takes precedence over one set for its node
+    auto exact = budgets.find(destination);
+    if (exact != budgets.end()) {
+        result = exact->second;
+    }
+    else {
+        for (const auto& budget : budgets) {
+            if (isDestinationNode(budget.first, destination)) {
+                result = budget.second;
+                break;
+            }
+        }
+    }
+    xSemaphoreGive(budgetMutex);
+    return result;
+}
+
+bool SprayAndWaitRouter::readCopies(Bundle& bundle, uint64_t& copies) {
+    for (const CanonicalBlock& block : bundle.extensionBlocks)
+        if (block.blockTypeCode == COPY_COUNT_BLOCK_TYPE)
+            return CopyCountBlock::read(block, copies);
+    return false;
+}
+
+void SprayAndWaitRouter::setCopies(Bundle* bundle, uint16_t copies) {
+    // replace an existing block, keeping its number and CRC type
+    for (CanonicalBlock& block : bundle->extensionBlocks) {
+        if (block.blockTypeCode == COPY_COUNT_BLOCK_TYPE) {
+            block = CopyCountBlock(copies, block.crcType, block.blockNumber);
+            return;
+        }
+    }
+    bundle->insertCanonicalBlock(
+        CopyCountBlock(copies, CONFIG_canonicalCrcType));
+}
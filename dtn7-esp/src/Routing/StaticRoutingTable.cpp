@@ -0,0 +1,158 @@
+#include "StaticRoutingTable.hpp"
+#include "esp_log.h"
+
+StaticRoutingTable::StaticRoutingTable() {
+    mutex = xSemaphoreCreateMutex();
+    trie.emplace_back();
+}
+
+StaticRoutingTable::~StaticRoutingTable() {
+    vSemaphoreDelete(mutex);
+}
+
+bool StaticRoutingTable::addRoute(const std::string& pattern,
+                                  const std::string& nextHop,
+                                  const std::string& cla) {
+    // a wildcard is only supported at the end of the pattern
+    size_t wildcard = pattern.find('*');
+    if (wildcard != std::string::npos && wildcard != pattern.size() - 1) {
+        ESP_LOGW("StaticRoutingTable", "invalid pattern %s", pattern.c_str());
+        return false;
+    }
+    if (pattern.empty() || (nextHop.empty() && cla.empty())) {
+        ESP_LOGW("StaticRoutingTable",
+                 "a route needs a pattern and a next hop or CLA");
+        return false;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bool replaced = false;
+    for (StaticRoute& route : routes) {
+        if (route.pattern == pattern) {
+            route.nextHop = nextHop;
+            route.cla = cla;
+            replaced = true;
+            break;
+        }
+    }
+    if (!replaced)
+        routes.push_back({pattern, nextHop, cla});
+    compile();
+    xSemaphoreGive(mutex);
+    return true;
+}
+
+bool StaticRoutingTable::removeRoute(const std::string& pattern) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bool removed = false;
+    for (auto it = routes.begin(); it != routes.end(); it++) {
+        if (it->pattern == pattern) {
+            routes.erase(it);
+            removed = true;
+            break;
+        }
+    }
+    if (removed)
+        compile();
+    xSemaphoreGive(mutex);
+    return removed;
+}
+
+void StaticRoutingTable::clear() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    routes.clear();
+    compile();
+    xSemaphoreGive(mutex);
+}
+
+bool StaticRoutingTable::empty() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bool result = routes.empty();
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+bool StaticRoutingTable::match(BundleInfo* bundle, StaticRoute& route) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    // the destination is only matched again if the table changed since the cached match
+    if (bundle->staticRouteVersion != version) {
+        bundle->staticRoute = lookup(bundle->bundle.getDest().getURI());
+        bundle->staticRouteVersion = version;
+    }
+    bool found = bundle->staticRoute >= 0;
+    if (found)
+        route = routes[bundle->staticRoute];
+    xSemaphoreGive(mutex);
+    return found;
+}
+
+std::vector<StaticRoute> StaticRoutingTable::getRoutes() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    std::vector<StaticRoute> result = routes;
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+void StaticRoutingTable::compile() {
+    trie.clear();
+    trie.emplace_back();
+
+    for (size_t i = 0; i < routes.size(); i++) {
+        const std::string& pattern = routes[i].pattern;
+        bool wildcard = pattern.back() == '*';
+        size_t length = wildcard ? pattern.size() - 1 : pattern.size();
+
+        // follow the path of the pattern, adding the missing nodes
+        uint32_t node = 0;
+        for (size_t j = 0; j < length; j++) {
+            uint32_t next = 0;
+            for (const auto& child : trie[node].children) {
+                if (child.first == pattern[j]) {
+                    next = child.second;
+                    break;
+                }
+            }
+            if (next == 0) {
+                next = trie.size();
+                trie[node].children.push_back({pattern[j], next});
+                trie.emplace_back();
+            }
+            node = next;
+        }
+
+        // patterns ending with '/' cover all endpoints below them, like node URIs
+        if (wildcard || pattern.back() == '/')
+            trie[node].prefixRoute = i;
+        else
+            trie[node].exactRoute = i;
+    }
+
+    // all cached matches are outdated now, 0 is the version of BundleInfos which were never matched
+    if (++version == 0)
+        version = 1;
+}
+
+int32_t StaticRoutingTable::lookup(const std::string& eid) {
+    // the longest prefix pattern seen while walking down the trie matches, unless the whole EID matches an exact pattern
+    int32_t result = -1;
+    uint32_t node = 0;
+    for (char c : eid) {
+        if (trie[node].prefixRoute >= 0)
+            result = trie[node].prefixRoute;
+        uint32_t next = 0;
+        for (const auto& child : trie[node].children) {
+            if (child.first == c) {
+                next = child.second;
+                break;
+            }
+        }
+        if (next == 0)
+            return result;
+        node = next;
+    }
+    if (trie[node].exactRoute >= 0)
+        return trie[node].exactRoute;
+    if (trie[node].prefixRoute >= 0)
+        return trie[node].prefixRoute;
+    return result;
+}
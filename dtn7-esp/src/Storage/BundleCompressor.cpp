@@ -0,0 +1,220 @@
+#include "BundleCompressor.hpp"
+#include <string.h>
+#include <algorithm>
+#include "esp_timer.h"
+
+// header bytes of the compressed data
+#define COMPRESSION_NONE 0
+#define COMPRESSION_LZSS 1
+#define COMPRESSION_LZSS_DICTIONARY 2
+
+// size of the header: the header byte and the original length as 32 bit little endian
+#define COMPRESSION_HEADER_SIZE 5
+
+// number of buckets of the match finder's hash table
+#define LZSS_HASH_SIZE 1024
+
+// maximum number of earlier positions compared when searching a match
+#define LZSS_MAX_CHAIN 16
+
+/// @brief hashes the 3 bytes starting at a position, the shortest match
+static inline uint16_t hashAt(const uint8_t* p) {
+    return ((p[0] << 6) ^ (p[1] << 3) ^ p[2]) & (LZSS_HASH_SIZE - 1);
+}
+
+BundleCompressor::BundleCompressor(bool enabled, size_t dictionarySize) {
+    this->enabled = enabled;
+    // a match can only reach back one window, a larger dictionary could not be referenced
+    this->dictionarySize = std::min<size_t>(dictionarySize, LZSS_WINDOW_SIZE);
+    mutex = xSemaphoreCreateMutex();
+}
+
+BundleCompressor::~BundleCompressor() {
+    vSemaphoreDelete(mutex);
+}
+
+std::vector<uint8_t> BundleCompressor::compress(const uint8_t* data,
+                                                size_t length) {
+    int64_t start = esp_timer_get_time();
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    size_t dictionaryLength = dictionaryReady ? dictionary.size() : 0;
+    xSemaphoreGive(mutex);
+
+    // matches are searched in the dictionary followed by the data
+    std::vector<uint8_t> window;
+    window.reserve(dictionaryLength + length);
+    if (dictionaryLength > 0)
+        window.insert(window.end(), dictionary.begin(), dictionary.end());
+    window.insert(window.end(), data, data + length);
+    size_t total = window.size();
+
+    // the match finder keeps the last position of each hash and, for each position in the window, the distance to the previous position with the same hash
+    std::vector<int32_t> head(LZSS_HASH_SIZE, -1);
+    std::vector<uint16_t> previous(LZSS_WINDOW_SIZE, 0);
+    auto insert = [&](size_t pos) {
+        if (pos + LZSS_MIN_MATCH > total)
+            return;
+        uint16_t hash = hashAt(&window[pos]);
+        int32_t last = head[hash];
+        previous[pos % LZSS_WINDOW_SIZE] =
+            last >= 0 && pos - last < LZSS_WINDOW_SIZE ? pos - last : 0;
+        head[hash] = pos;
+    };
+    for (size_t pos = 0; pos < dictionaryLength; pos++)
+        insert(pos);
+
+    std::vector<uint8_t> result;
+    result.reserve(COMPRESSION_HEADER_SIZE + length);
+    result.push_back(dictionaryLength > 0 ? COMPRESSION_LZSS_DICTIONARY
+                                          : COMPRESSION_LZSS);
+    for (int i = 0; i < 4; i++)
+        result.push_back((length >> (8 * i)) & 0xFF);
+
+    // every group of 8 literals or matches is preceded by a flag byte, a set bit marks a match
+    size_t flagIndex = 0;
+    int flagCount = 8;
+    size_t pos = dictionaryLength;
+    while (pos < total && result.size() <= length) {
+        if (flagCount == 8) {
+            flagIndex = result.size();
+            result.push_back(0);
+            flagCount = 0;
+        }
+
+        // find the longest match among the last positions with the same hash
+        size_t bestLength = 0;
+        size_t bestDistance = 0;
+        if (pos + LZSS_MIN_MATCH <= total) {
+            size_t maxLength = std::min<size_t>(LZSS_MAX_MATCH, total - pos);
+            int32_t candidate = head[hashAt(&window[pos])];
+            for (int chain = 0; candidate >= 0 && chain < LZSS_MAX_CHAIN &&
+                                pos - candidate <= LZSS_WINDOW_SIZE;
+                 chain++) {
+                size_t matchLength = 0;
+                while (matchLength < maxLength &&
+                       window[candidate + matchLength] ==
+                           window[pos + matchLength])
+                    matchLength++;
+                if (matchLength > bestLength) {
+                    bestLength = matchLength;
+                    bestDistance = pos - candidate;
+                    if (matchLength == maxLength)
+                        break;
+                }
+                uint16_t distance = previous[candidate % LZSS_WINDOW_SIZE];
+                if (distance == 0)
+                    break;
+                candidate -= distance;
+            }
+        }
+
+        if (bestLength >= LZSS_MIN_MATCH) {
+            // a match is stored as 12 bit distance and 4 bit length
+            result[flagIndex] |= 1 << flagCount;
+            result.push_back((bestDistance - 1) & 0xFF);
+            result.push_back((((bestDistance - 1) >> 8) << 4) |
+                             (bestLength - LZSS_MIN_MATCH));
+            for (size_t i = 0; i < bestLength; i++)
+                insert(pos + i);
+            pos += bestLength;
+        }
+        else {
+            result.push_back(window[pos]);
+            insert(pos);
+            pos++;
+        }
+        flagCount++;
+    }
+
+    // data which does not get smaller is stored uncompressed
+    bool compressed = pos >= total && result.size() < length + 1;
+    if (!compressed) {
+        result.clear();
+        result.push_back(COMPRESSION_NONE);
+        result.insert(result.end(), data, data + length);
+    }
+    result.shrink_to_fit();
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    // the first bundle becomes the dictionary, it is never changed afterwards as stored bundles reference it
+    if (!dictionaryReady && dictionarySize > 0 && length > 0) {
+        dictionary.assign(data, data + std::min(length, dictionarySize));
+        dictionaryReady = true;
+    }
+    if (compressed)
+        stats.compressed++;
+    else
+        stats.uncompressed++;
+    stats.inputBytes += length;
+    stats.outputBytes += result.size();
+    stats.compressTime += esp_timer_get_time() - start;
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+std::vector<uint8_t> BundleCompressor::decompress(const uint8_t* data,
+                                                  size_t length) {
+    if (length == 0)
+        return std::vector<uint8_t>();
+    if (data[0] == COMPRESSION_NONE)
+        return std::vector<uint8_t>(data + 1, data + length);
+    if (data[0] > COMPRESSION_LZSS_DICTIONARY ||
+        length < COMPRESSION_HEADER_SIZE)
+        return std::vector<uint8_t>();
+
+    int64_t start = esp_timer_get_time();
+    // data compressed with the dictionary was stored after the dictionary was taken, which does not change anymore
+    size_t dictionaryLength =
+        data[0] == COMPRESSION_LZSS_DICTIONARY ? dictionary.size() : 0;
+    uint32_t original = 0;
+    for (int i = 0; i < 4; i++)
+        original |= (uint32_t)data[1 + i] << (8 * i);
+    // a match of 2 bytes yields at most LZSS_MAX_MATCH bytes, a larger length can only be read from corrupted data
+    if (original > (size_t)length * LZSS_MAX_MATCH / 2)
+        return std::vector<uint8_t>();
+
+    std::vector<uint8_t> result;
+    result.reserve(original);
+    size_t i = COMPRESSION_HEADER_SIZE;
+    while (result.size() < original && i < length) {
+        uint8_t flags = data[i++];
+        for (int bit = 0; bit < 8 && result.size() < original; bit++) {
+            if (!(flags & (1 << bit))) {
+                if (i >= length)
+                    return std::vector<uint8_t>();
+                result.push_back(data[i++]);
+                continue;
+            }
+            if (i + 1 >= length)
+                return std::vector<uint8_t>();
+            size_t distance = (data[i] | ((data[i + 1] >> 4) << 8)) + 1;
+            size_t matchLength = (data[i + 1] & 0x0F) + LZSS_MIN_MATCH;
+            i += 2;
+            if (distance > result.size() + dictionaryLength)
+                return std::vector<uint8_t>();
+            // the match may overlap the bytes it produces, so it is copied byte by byte
+            for (size_t k = 0; k < matchLength; k++) {
+                size_t index = dictionaryLength + result.size() - distance;
+                uint8_t value = index < dictionaryLength
+                                    ? dictionary[index]
+                                    : result[index - dictionaryLength];
+                result.push_back(value);
+            }
+        }
+    }
+    if (result.size() != original)
+        return std::vector<uint8_t>();
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    stats.decompressed++;
+    stats.decompressTime += esp_timer_get_time() - start;
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+CompressionStats BundleCompressor::getStats() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    CompressionStats result = stats;
+    xSemaphoreGive(mutex);
+    return result;
+}
@@ -0,0 +1,34 @@
+#include "BundleQuery.hpp"
+#include <algorithm>
+#include "EvictionPolicy.hpp"
+
+BundleKeys::BundleKeys(BundleInfo& bundle) {
+    destination = bundle.bundle.primaryBlock.destEID.getURI();
+    // the expiry is estimated the same way as for the eviction policies
+    expiresAt = BundleMetadata(bundle, 0).expiresAt;
+    forwardedTo.reserve(bundle.forwardedTo.size());
+    for (const Node& node : bundle.forwardedTo)
+        forwardedTo.push_back(nodeHash(node.URI));
+}
+
+uint32_t BundleKeys::nodeHash(const std::string& uri) {
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : uri) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool BundleKeys::wasForwardedTo(uint32_t hash) const {
+    return std::find(forwardedTo.begin(), forwardedTo.end(), hash) !=
+           forwardedTo.end();
+}
+
+size_t BundleKeys::heapUsage() const {
+    size_t result = forwardedTo.capacity() * sizeof(uint32_t);
+    // short destinations are stored inside the string object
+    if (destination.capacity() > std::string().capacity())
+        result += destination.capacity() + 1;
+    return result;
+}
@@ -0,0 +1,37 @@
+#include "EvictionPolicy.hpp"
+#include <algorithm>
+#include "esp_log.h"
+
+BundleMetadata::BundleMetadata(BundleInfo& bundle, size_t size) {
+    this->size = size;
+    receivedAt = bundle.bundle.receivedAt;
+    priority = bundle.priority;
+    forwardCount = std::max<uint32_t>(bundle.numOfBroadcasts,
+                                      bundle.forwardedTo.size());
+
+    // the lifetime left at reception, the age from the bundle age block is the time the bundle spent at previous nodes
+    uint64_t lifetime = bundle.bundle.primaryBlock.lifetime;
+#if CONFIG_IgnoreBundleTTL
+    lifetime = CONFIG_OverrideBundleTTL;
+#endif
+    if (bundle.bundle.hasBundleAge)
+        lifetime -= std::min(lifetime, bundle.bundle.getAge());
+    expiresAt = receivedAt + lifetime;
+}
+
+EvictionPolicy* EvictionPolicy::fromConfig() {
+    EvictionPolicy* policy;
+#if CONFIG_EvictionPolicy_Largest
+    policy = new LargestFirstPolicy();
+#elif CONFIG_EvictionPolicy_SoonestExpiry
+    policy = new SoonestExpiryPolicy();
+#elif CONFIG_EvictionPolicy_MostForwarded
+    policy = new MostForwardedPolicy();
+#elif CONFIG_EvictionPolicy_LowestPriority
+    policy = new LowestPriorityPolicy();
+#else
+    policy = new OldestFirstPolicy();
+#endif
+    ESP_LOGI("EvictionPolicy", "using eviction policy: %s", policy->name());
+    return policy;
+}
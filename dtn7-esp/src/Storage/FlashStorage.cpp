@@ -1,86 +1,338 @@
 #include "FlashStorage.hpp"
+#include <algorithm>
 #include <sstream>
 #include "Storage.hpp"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 
-void FlashStorage::addNode(Node node) {
-    // just add node to the nodes map, use semaphore to ensure thread safety
-    xSemaphoreTake(nodesMutex, portMAX_DELAY);
-    nodes[node.URI] = node;
-    xSemaphoreGive(nodesMutex);
-    return;
+bool FlashStorage::checkSeen(std::string bundleID) {
+    ESP_LOGD("FlashStorage::checkSeen", "checking bundle ID: %s",
+             bundleID.c_str());
+    // check whether the bundle id is contained in the seen filter, which is thread safe without a mutex
+    return seenIds.contains(bundleID);
 }
 
-void FlashStorage::removeNode(std::string address) {
-    // just remove node from the nodes map, use semaphore to ensure thread safety
-    xSemaphoreTake(nodesMutex, portMAX_DELAY);
-    ESP_LOGD("FlashStorage:removeNode", "removing node : %s", address.c_str());
-    nodes.erase(address);
-    xSemaphoreGive(nodesMutex);
+void FlashStorage::storeSeen(std::string bundleID) {
+    ESP_LOGD("FlashStorage::storeSeen", "storing bundle ID: %s",
+             bundleID.c_str());
+
+    // insert bundleID into the seen filter
+    seenIds.insert(bundleID);
+    ESP_LOGI("FlashStorage::storeSeen",
+             "stored bundle ID: %s ,number of Ids in current generation: %u",
+             bundleID.c_str(), seenIds.currentGenerationCount());
     return;
 }
 
-Node FlashStorage::getNode(std::string address) {
-    // get the node from the nodes map, use semaphore to ensure thread safety
-    xSemaphoreTake(nodesMutex, portMAX_DELAY);
-    Node result = nodes[address];
-
-    // if the node is contained but does not have a URI, clean it up from storage
-    if (result.URI == "none")
-        nodes.erase(address);
-    xSemaphoreGive(nodesMutex);
+bool FlashStorage::checkAndStoreSeen(std::string bundleID) {
+    // check and insert the bundle id, hashing it once
+    bool result = seenIds.checkAndInsert(bundleID);
+    ESP_LOGD("FlashStorage::checkAndStoreSeen", "bundle ID: %s, seen: %d",
+             bundleID.c_str(), result);
     return result;
 }
 
-std::vector<Node> FlashStorage::getNodes() {
-    ESP_LOGI("FlashStorage::getNodes()", "getting nodes");
-    // get all nodes from the nodes map, use semaphore to ensure thread safety
-    xSemaphoreTake(nodesMutex, portMAX_DELAY);
-    std::vector<Node> result;
+void FlashStorage::rebuildIndex() {
+    ESP_LOGI("FlashStorage::rebuildIndex", "indexing bundles %lu to %lu",
+             lowestUsedKey, highestUsedKey);
+    for (uint32_t key = lowestUsedKey; key <= highestUsedKey; key++) {
+        // keys of removed bundles are not present in flash
+        size_t required_size = 0;
+        if (nvs_get_blob(flashHandle, std::to_string(key).c_str(), NULL,
+                         &required_size) != ESP_OK ||
+            required_size == 0)
+            continue;
+
+        std::vector<uint8_t> cbor(required_size);
+        nvs_get_blob(flashHandle, std::to_string(key).c_str(), cbor.data(),
+                     &required_size);
+        // a bundle stored twice keeps its newer copy, like in delayBundle
+        std::string bundleID = BundleInfo(cbor).bundle.getID();
+        auto existing = keysById.find(bundleID);
+        if (existing != keysById.end())
+            eraseBundleKey(existing->second);
+        keysById[bundleID] = key;
+        liveKeys.insert(key);
+    }
+    ESP_LOGI("FlashStorage::rebuildIndex", "found %u stored bundles",
+             keysById.size());
+}
+
+/// @brief returns the NVS key of the metadata committed for a bundle
+/// @param key NVS key of the bundle
+static std::string metadataKey(uint32_t key) {
+    return "m" + std::to_string(key);
+}
+
+/// @brief returns the number of NVS entries used by a blob: 2 entries overhead and 1 per 32 bytes
+static size_t blobEntries(size_t length) {
+    return 2 + (length / 32) + 1;
+}
+
+void FlashStorage::startPending() {
+    if (!pending.empty() || countersChanged)
+        return;
+    pendingSince = esp_timer_get_time();
+
+    // the flush task sleeps while nothing is pending
+    if (flushTaskHandle != nullptr)
+        xTaskNotifyGive(flushTaskHandle);
+}
+
+void FlashStorage::queueWrite(const std::string& key,
+                              std::vector<uint8_t> data) {
+    startPending();
+    PendingWrite& write = pending[key];
+    if (write.erase || !write.data.empty())
+        stats.coalesced++;
+    write.erase = false;
+    write.data = std::move(data);
+}
+
+void FlashStorage::queueErase(const std::string& key) {
+    startPending();
+    PendingWrite& write = pending[key];
+    // a blob which was written and erased before being flushed never reaches the flash
+    if (!write.data.empty())
+        stats.coalesced++;
+    write.erase = true;
+    write.data.clear();
+}
+
+void FlashStorage::queueCounters() {
+#if CONFIG_KeepBetweenRestart
+    startPending();
+    if (countersChanged)
+        stats.coalesced++;
+    countersChanged = true;
+#endif
+}
+
+void FlashStorage::flushIfFull() {
+    // without a commit interval, batching is disabled and each storage operation is written right away
+    if (CONFIG_FlashCommitInterval == 0 ||
+        pending.size() >= CONFIG_FlashWriteBatchSize)
+        flushPending();
+}
+
+void FlashStorage::flushPending() {
+    if (pending.empty() && !countersChanged)
+        return;
+    int64_t start = esp_timer_get_time();
+
+    // erases first, to free the entries needed by the writes
+    for (auto& [key, write] : pending)
+        if (write.erase &&
+            nvs_erase_key(flashHandle, key.c_str()) == ESP_OK)
+            stats.erases++;
+    bool dropped = false;
+    for (auto& [key, write] : pending) {
+        if (write.erase)
+            continue;
+        esp_err_t err = nvs_set_blob(flashHandle, key.c_str(),
+                                     write.data.data(), write.data.size());
+        if (err != ESP_OK) {
+            // a bundle which could not be written is removed from the indexes, so it is neither retried nor evicted. If only its metadata could not be written, the metadata stored with the bundle remains valid
+            ESP_LOGE("FlashStorage::flush", "writing key %s failed: %s",
+                     key.c_str(), esp_err_to_name(err));
+            if (key[0] != 'm') {
+                dropBundleKey(strtoul(key.c_str(), nullptr, 10));
+                dropped = true;
+            }
+            continue;
+        }
+        stats.writes++;
+        stats.bytesWritten += write.data.size();
+    }
+
+    if (dropped)
+        updateKeyRange();
 
-    // use a map iterator to iterate through all stored elements
-    for (std::unordered_map<std::string, Node>::iterator it = nodes.begin();
-         it != nodes.end(); ++it) {
-        result.push_back(it->second);
+    // the key range is written after the bundles, so that a restart during the flush never reads keys which were not written
+#if CONFIG_KeepBetweenRestart
+    if (countersChanged) {
+        nvs_set_u32(flashHandle, "HighestKey", highestUsedKey);
+        nvs_set_u32(flashHandle, "LowestKey", lowestUsedKey);
+        nvs_set_u32(flashHandle, "OldestKey", oldestKey);
+        stats.writes += 3;
+        stats.bytesWritten += 3 * sizeof(uint32_t);
     }
-    xSemaphoreGive(nodesMutex);
+#endif
+    nvs_commit(flashHandle);
+    pending.clear();
+    countersChanged = false;
+
+    int64_t end = esp_timer_get_time();
+    stats.flushes++;
+    stats.flushTimeTotal += end - start;
+    stats.flushTimeMax = std::max<uint64_t>(stats.flushTimeMax, end - start);
+    stats.maxPendingAge =
+        std::max<uint64_t>(stats.maxPendingAge, start - pendingSince);
+}
+
+size_t FlashStorage::pendingEntries() {
+    size_t result = 0;
+    for (auto& [key, write] : pending)
+        if (!write.erase)
+            result += blobEntries(write.data.size());
     return result;
 }
 
-bool FlashStorage::checkSeen(std::string bundleID) {
-    ESP_LOGD("FlashStorage::checkSeen", "checking bundle ID: %s",
-             bundleID.c_str());
-    bool result = false;
-    // use semaphore to ensure thread safety
-    xSemaphoreTake(bundleIdMutex, portMAX_DELAY);
+bool FlashStorage::blobStored(const std::string& key) {
+    auto write = pending.find(key);
+    if (write != pending.end())
+        return !write->second.erase;
+    size_t required_size = 0;
+    return nvs_get_blob(flashHandle, key.c_str(), NULL, &required_size) ==
+           ESP_OK;
+}
+
+void FlashStorage::flushTask(void* param) {
+    FlashStorage* storage = (FlashStorage*)param;
+    int64_t interval = (int64_t)CONFIG_FlashCommitInterval * 1000;
+    TickType_t wait = portMAX_DELAY;
+    while (true) {
+        // woken when the first operation is queued, or when the oldest one is due
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        // the flush waits for the storage if it is busy, so no operation is kept much longer than the commit interval
+        xSemaphoreTake(storage->bundlesMutex, portMAX_DELAY);
+        wait = portMAX_DELAY;
+        if (!storage->pending.empty() || storage->countersChanged) {
+            int64_t age = esp_timer_get_time() - storage->pendingSince;
+            if (age >= interval)
+                storage->flushPending();
+            else {
+                // sleep until the oldest pending operation is due, rounded up to whole ticks
+                uint32_t remaining = (interval - age + 999) / 1000;
+                wait = std::max<TickType_t>(
+                    (remaining + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS,
+                    1);
+            }
+        }
+        xSemaphoreGive(storage->bundlesMutex);
+    }
+}
+
+void FlashStorage::flush() {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    flushPending();
+    xSemaphoreGive(bundlesMutex);
+}
 
-    // if the bundle id is found, i.e. the result of find is not bundles end, the bundle id is already contained
-    result = !(bundle_ids.find(bundleID) == bundle_ids.end());
-    xSemaphoreGive(bundleIdMutex);
+FlashWriteStats FlashStorage::getWriteStats() {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    FlashWriteStats result = stats;
+    xSemaphoreGive(bundlesMutex);
     return result;
 }
 
-void FlashStorage::storeSeen(std::string bundleID) {
-    ESP_LOGD("FlashStorage::storeSeen", "storing bundle ID: %s",
-             bundleID.c_str());
+void FlashStorage::eraseBundleKey(uint32_t key) {
+    liveKeys.erase(key);
+    queueErase(std::to_string(key));
+    // most bundles never had their metadata committed, their metadata key does not need to be erased
+    if (blobStored(metadataKey(key)))
+        queueErase(metadataKey(key));
+}
 
-    // insert bundleID into set, use semaphore to ensure thread safety
-    xSemaphoreTake(bundleIdMutex, portMAX_DELAY);
-    bundle_ids.insert(bundleID);
-    ESP_LOGI("FlashStorage::storeSeen",
-             "stored bundle ID: %s ,number of stored Ids: %u", bundleID.c_str(),
-             bundle_ids.size());
-    xSemaphoreGive(bundleIdMutex);
-    return;
+void FlashStorage::dropBundleKey(uint32_t key) {
+    liveKeys.erase(key);
+    for (auto it = keysById.begin(); it != keysById.end(); ++it)
+        if (it->second == key) {
+            leases.erase(it->first);
+            keysById.erase(it);
+            break;
+        }
+}
+
+std::vector<uint8_t> FlashStorage::readBlob(const std::string& key) {
+    // pending operations are newer than the flash contents
+    auto write = pending.find(key);
+    if (write != pending.end())
+        return write->second.data;
+
+    size_t required_size = 0;
+    if (nvs_get_blob(flashHandle, key.c_str(), NULL, &required_size) !=
+            ESP_OK ||
+        required_size == 0)
+        return std::vector<uint8_t>();
+    std::vector<uint8_t> blob(required_size);
+    nvs_get_blob(flashHandle, key.c_str(), blob.data(), &required_size);
+    return blob;
+}
+
+bool FlashStorage::readBundle(uint32_t key, BundleInfo& bundle) {
+    std::vector<uint8_t> cbor = readBlob(std::to_string(key));
+    if (cbor.empty())
+        return false;
+    bundle = BundleInfo(cbor);
+
+    // metadata committed after the bundle was written replaces the metadata stored with it
+    std::vector<uint8_t> metadata = readBlob(metadataKey(key));
+    if (!metadata.empty())
+        bundle.updateMetadata(metadata.data(), metadata.size());
+    return true;
+}
+
+bool FlashStorage::findOldestKey() {
+    // removed bundles leave gaps in the key range, the set of live keys skips them without probing the flash
+    if (liveKeys.empty())
+        return false;
+    oldestKey = *liveKeys.begin();
+    return true;
 }
 
 bool FlashStorage::removeBundle(std::string bundleID) {
-    ESP_LOGE(" FlashStorage::removeBundle", "removeBundle not implemented!");
-    return false;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+
+    // the NVS key of the bundle is found using the ID index, the flash is not searched
+    auto it = keysById.find(bundleID);
+    if (it == keysById.end()) {
+        xSemaphoreGive(bundlesMutex);
+        return false;
+    }
+    ESP_LOGD("FlashStorage::removeBundle", "removing bundle %s, key: %lu",
+             bundleID.c_str(), it->second);
+    eraseBundleKey(it->second);
+    keysById.erase(it);
+    // removing a leased bundle ends its lease
+    leases.erase(bundleID);
+    flushIfFull();
+
+    xSemaphoreGive(bundlesMutex);
+    return true;
+}
+
+bool FlashStorage::containsBundle(std::string bundleID) {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bool result = keysById.find(bundleID) != keysById.end();
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+BundleInfo FlashStorage::getBundle(std::string bundleID) {
+    std::vector<uint8_t> cbor;
+    std::vector<uint8_t> metadata;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    auto it = keysById.find(bundleID);
+    if (it != keysById.end()) {
+        // read the bundle stored with the indexed key and the metadata committed for it
+        cbor = readBlob(std::to_string(it->second));
+        metadata = readBlob(metadataKey(it->second));
+    }
+    xSemaphoreGive(bundlesMutex);
+
+    // de-serialize after releasing the mutex
+    if (cbor.empty())
+        return BundleInfo();
+    BundleInfo result(cbor);
+    if (!metadata.empty())
+        result.updateMetadata(metadata.data(), metadata.size());
+    return result;
 }
 
 std::vector<BundleInfo> FlashStorage::delayBundle(BundleInfo* bundle) {
@@ -101,12 +353,20 @@ std::vector<BundleInfo> FlashStorage::delayBundle(BundleInfo* bundle) {
              "= (%u), AllEntries = (%u), Required Entries For This:%u",
              nvs_stats.used_entries, nvs_stats.free_entries,
              nvs_stats.available_entries, nvs_stats.total_entries,
-             (2 + (serialized.size() / 32) + 1));
+             blobEntries(serialized.size()));
 
-    // Check that the flash has enough space to store the bundle. Total entries needed for blob: 2(overhead) + 1 pro 32 byte.
+    // Check that the flash has enough space to store the bundle and the pending writes. Total entries needed for blob: 2(overhead) + 1 pro 32 byte.
     // For some reason, the last 35 available entries are not used; this is checked here to, with some safety buffer
     while (nvs_stats.available_entries - 40 <
-           (2 + (serialized.size() / 32) + 1)) {
+               blobEntries(serialized.size()) + pendingEntries() &&
+           !keysById.empty()) {
+        // pending erases only free their entries once flushed, flush them before removing further bundles
+        if (!pending.empty()) {
+            flushPending();
+            nvs_get_stats(NULL, &nvs_stats);
+            continue;
+        }
+
         // as long as not enough space is available, we remove the oldest bundle from the storage. As this requires the mutex for bundles,
         // we have to release that here in order to avoid a deadlock
         xSemaphoreGive(bundlesMutex);
@@ -123,9 +383,17 @@ std::vector<BundleInfo> FlashStorage::delayBundle(BundleInfo* bundle) {
     // For this purpose an integer is used which has to be incremented for each ne stored bundle.
     highestUsedKey++;
 
-    // write the bundle to flash
-    nvs_set_blob(flashHandle, std::to_string(highestUsedKey).c_str(),
-                 &serialized[0], serialized.size());
+    // queue writing the bundle to flash
+    queueWrite(std::to_string(highestUsedKey), std::move(serialized));
+    liveKeys.insert(highestUsedKey);
+
+    // remember the key of the bundle in the ID index, if the same bundle was already stored, its old copy is removed
+    std::string bundleID = bundle->bundle.getID();
+    auto existing = keysById.find(bundleID);
+    if (existing != keysById.end())
+        eraseBundleKey(existing->second);
+    keysById[bundleID] = highestUsedKey;
+    leases.erase(bundleID);
 
     // If this bundle is older than the currently stored oldest bundle, meaning it has been received by this node earlier, set it as the oldest bundle.
     // Therefore, update the information about the oldest stored bundle.
@@ -138,17 +406,13 @@ std::vector<BundleInfo> FlashStorage::delayBundle(BundleInfo* bundle) {
 
     // If configured in menuconfig, the flash storage is able to keep its information between restarts.
     // To facilitate this it is required that information about the location of the bundles in flash is also stored in flash.
-    // Therefore we need to store the information about the used keys.
-#if CONFIG_KeepBetweenRestart
-    nvs_set_u32(flashHandle, "HighestKey", highestUsedKey);
-    nvs_set_u32(flashHandle, "LowestKey", lowestUsedKey);
-    nvs_set_u32(flashHandle, "OldestKey", oldestKey);
+    // Therefore we need to store the information about the used keys, which is written with the next flush.
+    queueCounters();
 
-#endif
-    // the NVS storage might do some caching, with nvs_commit() it finishes the flash operations
-    nvs_commit(flashHandle);
+    // the writes are only flushed once enough are collected, or by the flush timer
+    flushIfFull();
 
-    // all flash operations finished, release the mutex
+    // all flash operations queued, release the mutex
     xSemaphoreGive(bundlesMutex);
 
     return result;
@@ -164,118 +428,176 @@ std::vector<BundleInfo> FlashStorage::getBundlesRetry() {
     xSemaphoreTake(bundlesMutex, portMAX_DELAY);
 
     // get as many bundles as configured in menuconfig
-    for (int i = 0; result.size() < CONFIG_RetryBatchSize; i++) {
-        // if no bundles which have not been retired in this retry cycle are present, stop the operation
-        if (bundlesToReturn == 0)
+    while (result.size() < CONFIG_RetryBatchSize) {
+        // the next stored bundle of this retry cycle, bundles stored after the cycle began have larger keys and are not retried
+        uint32_t key;
+        if (!nextRetryKey(key))
             break;
 
-        // Read the size of memory space required for blob
-        size_t required_size = 0;
-        nvs_get_blob(flashHandle, std::to_string(lowestUsedKey).c_str(), NULL,
-                     &required_size);
+        // Read previously saved bundle if available
+        BundleInfo bundle;
+        if (readBundle(key, bundle)) {
+            // add the bundle to bundles read from flash and remove it from the ID index
+            result.push_back(bundle);
+            auto indexed = keysById.find(result.back().bundle.getID());
+            if (indexed != keysById.end() && indexed->second == key)
+                keysById.erase(indexed);
+        }
 
-        // Read previously saved blob if available
-        uint8_t cbor[required_size];
-        if (required_size > 0) {
-            // read the data from flash
-            nvs_get_blob(flashHandle, std::to_string(lowestUsedKey).c_str(),
-                         cbor, &required_size);
+        // remove the data from the flash, as it will be stored with a different key if it is re-inserted ore not at all if the forwarding is successful after this retry.
+        eraseBundleKey(key);
+    }
 
-            // remove the data from the flash, as it will be stored with a different key if it is re-inserted ore not at all if the forwarding is successful after this retry.
-            nvs_erase_key(flashHandle, std::to_string(lowestUsedKey).c_str());
+    // the key range shrinks to the remaining bundles
+    updateKeyRange();
+    flushIfFull();
 
-            // add the bundle to bundles read from flash
-            result.push_back(
-                BundleInfo(std::vector(cbor, cbor + required_size)));
-        }
+    // all flash operations queued, release the mutex
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
 
-        if (lowestUsedKey == oldestKey) {
-            // in case the now removed bundle was the oldest, the one following it becomes the oldest
-            oldestKey++;
+std::vector<BundleInfo> FlashStorage::leaseBatch(size_t n) {
+    ESP_LOGI("FlashStorage::leaseBatch", "leasing bundles from flash");
+    std::vector<BundleInfo> result;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+
+    uint32_t key;
+    while (result.size() < n && nextRetryKey(key)) {
+        BundleInfo bundle;
+        if (!readBundle(key, bundle)) {
+            // a key without a bundle is not live, it is not leased again
+            dropBundleKey(key);
+            continue;
         }
 
-        // the lowest used key now needs to point to the next stored bundle
-        lowestUsedKey++;
+        // bundles leased in the last cycle are still being forwarded
+        std::string bundleID = bundle.bundle.getID();
+        if (leases.find(bundleID) != leases.end())
+            continue;
 
-        // decrease the number of bundles which needs to be read in this batch
-        bundlesToReturn--;
+        // the bundle stays in flash, only its metadata is kept to detect changes on commit
+        bundle.leased = true;
+        leases[bundleID] = bundle.serializeMetadata();
+        result.push_back(bundle);
     }
 
-    // If configured in menuconfig, the flash storage is able to keep its information between restarts.
-    // To facilitate this it is required that information about the location of the bundles in flash is also stored in flash.
-    // Therefore we need to store the information about the used keys.
-#if CONFIG_KeepBetweenRestart
-    nvs_set_u32(flashHandle, "HighestKey", highestUsedKey);
-    nvs_set_u32(flashHandle, "LowestKey", lowestUsedKey);
-    nvs_set_u32(flashHandle, "OldestKey", oldestKey);
-#endif
-    // the NVS storage might do some caching, with nvs_commit() it finishes the flash operations
-    nvs_commit(flashHandle);
+    // the key range is only written if it changed, leasing does not write to flash otherwise
+    updateKeyRange();
+    flushIfFull();
 
-    // all flash operations finished, release the mutex
     xSemaphoreGive(bundlesMutex);
     return result;
 }
 
-inline bool isXolder(uint64_t xTime, uint64_t xNum, uint64_t yTime,
-                     uint64_t yNum) {
-    // if the time of x is unknown
-    if (xTime == 0) {
-        // and the time of y is unknown
-        if (yTime == 0) {
-            // decide only according to sequence number. THis decision has nothing todo with the actual age
-            return xNum < yNum;
-        }
-        else {
-            // if x has no accurate clock it is preferred
-            return false;
-        }
+bool FlashStorage::leaseBundle(const std::string& bundleID,
+                               BundleInfo& bundle) {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    auto it = keysById.find(bundleID);
+    bool result = it != keysById.end() &&
+                  leases.find(bundleID) == leases.end() &&
+                  readBundle(it->second, bundle);
+    if (result) {
+        // the bundle stays in flash, only its metadata is kept to detect changes on commit
+        bundle.leased = true;
+        leases[bundleID] = bundle.serializeMetadata();
+    }
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+bool FlashStorage::nextRetryKey(uint32_t& key) {
+    if (bundlesToReturn == 0)
+        return false;
+
+    // removed bundles leave gaps in the key range, the set of live keys skips them without probing the flash
+    auto next = liveKeys.lower_bound(leaseCursor);
+    if (next == liveKeys.end() || *next > retryEndKey) {
+        bundlesToReturn = 0;
+        return false;
     }
-    else if (yTime == 0) {
-        // if y has no accurate clock it is preferred
-        return true;
+    key = *next;
+    leaseCursor = key + 1;
+    bundlesToReturn--;
+    return true;
+}
+
+void FlashStorage::updateKeyRange() {
+    // without stored bundles the range is empty, it starts after the highest used key
+    uint32_t lowest = liveKeys.empty() ? highestUsedKey + 1 : *liveKeys.begin();
+    if (lowest == lowestUsedKey && oldestKey >= lowestUsedKey)
+        return;
+    lowestUsedKey = lowest;
+    if (oldestKey < lowestUsedKey)
+        oldestKey = lowestUsedKey;
+    queueCounters();
+}
+
+bool FlashStorage::commit(const std::string& bundleID, BundleInfo& updated) {
+    std::vector<uint8_t> metadata = updated.serializeMetadata();
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+
+    // the lease ends in any case, a bundle which was removed meanwhile is not stored again
+    auto lease = leases.find(bundleID);
+    auto indexed = keysById.find(bundleID);
+    if (lease == leases.end() || indexed == keysById.end()) {
+        if (lease != leases.end())
+            leases.erase(lease);
+        xSemaphoreGive(bundlesMutex);
+        return false;
     }
-    // if both x and y have have the same  creation time, decide according to sequence number. This decision has nothing to do with the actual age
-    else if (xTime == yTime) {
-        return xNum < yNum;
+
+    // only changed metadata is written, into a small blob next to the bundle
+    if (metadata != lease->second) {
+        ESP_LOGD("FlashStorage::commit", "committing metadata of %s, key: %lu",
+                 bundleID.c_str(), indexed->second);
+        queueWrite(metadataKey(indexed->second), std::move(metadata));
+        flushIfFull();
     }
-    // if both x and y have information about the creation time this decision is simple, just compare the creation times
-    else
-        return xTime < yTime;
+    leases.erase(lease);
+
+    xSemaphoreGive(bundlesMutex);
+    return true;
+}
+
+void FlashStorage::release(const std::string& bundleID) {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    leases.erase(bundleID);
+    xSemaphoreGive(bundlesMutex);
 }
 
 BundleInfo FlashStorage::deleteOldest() {
     ESP_LOGI("DelayBundle FlashStorage", "Deleting oldest bundle from flash");
-    // first get the size required to read the oldest bundle
-    size_t required_size = 0;
-    nvs_get_blob(flashHandle, std::to_string(oldestKey).c_str(), NULL,
-                 &required_size);
-
-    // create accordingly sized buffer
-    uint8_t cbor[required_size];
-    if (required_size > 0) {
-        // read the bundle from flash
-        nvs_get_blob(flashHandle, std::to_string(oldestKey).c_str(), cbor,
-                     &required_size);
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
 
-        // and remove the key
-        nvs_erase_key(flashHandle, std::to_string(oldestKey).c_str());
+    // skip keys of bundles which were removed, if no bundle is stored there is nothing to delete
+    if (!findOldestKey()) {
+        xSemaphoreGive(bundlesMutex);
+        return BundleInfo();
     }
 
-    // If this function is called during a retry cycle, we can detect this by checking whether there are bundles to be returned (bundlesToReturn != 0).
-    // If the previously oldest key was not the lowest key (lowestUsedKey != oldestKey), this means that the oldest bundle had already been re-inserted into storage.
-    // This means that the first bundle to have been retried, which is propably the oldest, will have the lowest key after the bundles beeing retried in this retry cycle (lowestUsedKey+bundlesToReturn)
-    if (bundlesToReturn != 0 && lowestUsedKey != oldestKey &&
-        lowestUsedKey + bundlesToReturn < highestUsedKey) {
-        // we expect the oldest bundle to have already been retried, therefore, it should probably be the one after the end of the bundles beeing retried
-        oldestKey = lowestUsedKey + bundlesToReturn;
-    }
+    // read the bundle from flash and remove the key
+    BundleInfo result;
+    if (readBundle(oldestKey, result))
+        eraseBundleKey(oldestKey);
     else {
-        oldestKey++;  // we expect the next oldest bundle just to be the next one
+        // a key without a bundle is dropped, otherwise it would be found as the oldest again
+        ESP_LOGW("DelayBundle FlashStorage", "no bundle stored with key %lu",
+                 oldestKey);
+        dropBundleKey(oldestKey);
     }
 
-    // retrun the bundles which have been read from storage
-    return BundleInfo(std::vector(cbor, cbor + required_size));
+    // the next oldest bundle is the one with the next live key
+    if (!liveKeys.empty())
+        oldestKey = *liveKeys.begin();
+
+    // remove the bundle from the ID index and return it, a leased bundle loses its lease
+    keysById.erase(result.bundle.getID());
+    leases.erase(result.bundle.getID());
+    queueCounters();
+    flushIfFull();
+    xSemaphoreGive(bundlesMutex);
+    return result;
 }
 
 void FlashStorage::beginRetryCycle() {
@@ -283,7 +605,11 @@ void FlashStorage::beginRetryCycle() {
     xSemaphoreTake(bundlesMutex, portMAX_DELAY);
 
     // all bundles which are stored at the moment should be retried, calculate how many this is
-    bundlesToReturn = highestUsedKey - lowestUsedKey + 1;
+    bundlesToReturn = liveKeys.size();
+
+    // leasing starts at the lowest key and ends at the key of the last bundle stored now, bundles which are still leased from the last cycle are skipped
+    leaseCursor = lowestUsedKey;
+    retryEndKey = highestUsedKey;
 
     // release mutex
     xSemaphoreGive(bundlesMutex);
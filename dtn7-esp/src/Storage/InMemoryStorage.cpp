@@ -1,172 +1,388 @@
 #include "InMemoryStorage.hpp"
+#include <algorithm>
+#include <functional>
 #include <iterator>
 #include <sstream>
+#include "BundleAllocator.hpp"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
-void InMemoryStorage::addNode(Node node) {
-    // just add node to the nodes map, use semaphore to ensure thread safety
-    xSemaphoreTake(nodesMutex, portMAX_DELAY);
-    nodes[node.identifier] = node;
-    xSemaphoreGive(nodesMutex);
-    return;
+InMemoryStorage::InMemoryStorage() {
+    ESP_LOGI("InMemoryStorage Setup", "Setup InMemoryStorage");
+    maxStoredBundles = CONFIG_MaxStoredBundles;
+    numShards = std::max(CONFIG_StorageShards, 1);
+    shards.reset(new BundleShard[numShards]);
+    for (size_t i = 0; i < numShards; i++)
+        shards[i].mutex = xSemaphoreCreateMutex();
+    delayMutex = xSemaphoreCreateMutex();
 }
 
-void InMemoryStorage::removeNode(std::string address) {
-    // just remove node from the nodes map, use semaphore to ensure thread safety
-    xSemaphoreTake(nodesMutex, portMAX_DELAY);
-    nodes.erase(address);
-    xSemaphoreGive(nodesMutex);
+InMemoryStorage::~InMemoryStorage() {
+    for (size_t i = 0; i < numShards; i++)
+        vSemaphoreDelete(shards[i].mutex);
+    vSemaphoreDelete(delayMutex);
 }
 
-/// @brief gets the nodes object to a given Address, if it was seen before, otherwise returns a empty node object
-/// @param address
-/// @return
-Node InMemoryStorage::getNode(std::string address) {
-    // get the node from the nodes map, use semaphore to ensure thread safety
-    xSemaphoreTake(nodesMutex, portMAX_DELAY);
-    Node result = nodes[address];
+/// @brief adds the block data of a bundle to the bytes used in each pool of the BundleAllocator
+/// @param bundle the bundle
+/// @param usage bytes per pool the block data is added to
+static void addPoolUsage(const Bundle& bundle, size_t* usage) {
+    BundleAllocator& allocator = BundleAllocator::instance();
+    if (bundle.payloadBlock.blockTypeSpecificData != nullptr)
+        usage[(int)allocator.poolOf(bundle.payloadBlock.blockTypeSpecificData)] +=
+            bundle.payloadBlock.dataSize;
+    for (const CanonicalBlock& block : bundle.extensionBlocks)
+        if (block.blockTypeSpecificData != nullptr)
+            usage[(int)allocator.poolOf(block.blockTypeSpecificData)] +=
+                block.dataSize;
+}
 
-    // if the node is contained but does not have a URI, clean it up from storage
-    if (result.URI == "none")
-        nodes.erase(address);
-    xSemaphoreGive(nodesMutex);
-    return result;
+InMemoryStorage::BundleShard& InMemoryStorage::shardFor(
+    const std::string& bundleID) {
+    return shards[std::hash<std::string>{}(bundleID) % numShards];
 }
 
-std::vector<Node> InMemoryStorage::getNodes() {
-    ESP_LOGI("InMemoryStorage::getNodes()", "getting nodes");
-    // get all nodes from the nodes map, use semaphore to ensure thread safety
-    xSemaphoreTake(nodesMutex, portMAX_DELAY);
-    std::vector<Node> result;
+void InMemoryStorage::updateTotals(BundleShard& shard) {
+    size_t bundles = shard.bundles.size();
+    size_t memory = shard.bundles.memoryUsage();
+    // unsigned wrap around adds negative changes correctly
+    storedBundles += bundles - shard.countedBundles;
+    usedMemory += memory - shard.countedMemory;
+    shard.countedBundles = bundles;
+    shard.countedMemory = memory;
+}
 
-    // use a map iterator to iterate through all stored elements
-    for (std::unordered_map<std::string, Node>::iterator it = nodes.begin();
-         it != nodes.end(); ++it) {
-        result.push_back(it->second);
+InMemoryStorage::BundleShard* InMemoryStorage::findShard(
+    bool (*key)(BundleShard&, uint64_t&), uint64_t& smallest) {
+    BundleShard* result = nullptr;
+    for (size_t i = 0; i < numShards; i++) {
+        uint64_t shardKey;
+        xSemaphoreTake(shards[i].mutex, portMAX_DELAY);
+        bool candidate = key(shards[i], shardKey);
+        xSemaphoreGive(shards[i].mutex);
+        if (candidate && (result == nullptr || shardKey < smallest)) {
+            result = &shards[i];
+            smallest = shardKey;
+        }
     }
-
-    // release mutex
-    xSemaphoreGive(nodesMutex);
     return result;
 }
 
+InMemoryStorage::BundleShard* InMemoryStorage::nextEvictedShard(
+    uint64_t& rank) {
+    return findShard(
+        [](BundleShard& candidate, uint64_t& key) {
+            if (candidate.bundles.empty())
+                return false;
+            key = candidate.bundles.nextEvictedRank();
+            return true;
+        },
+        rank);
+}
+
+bool InMemoryStorage::popEvicted(BundleInfo& result) {
+    uint64_t rank;
+    BundleShard* shard = nextEvictedShard(rank);
+    if (shard == nullptr)
+        return false;
+
+    // the shard may have been emptied since it was found, then nothing is removed
+    xSemaphoreTake(shard->mutex, portMAX_DELAY);
+    bool removed = !shard->bundles.empty();
+    if (removed) {
+        result = shard->bundles.pop_evicted().bundle;
+        updateTotals(*shard);
+    }
+    xSemaphoreGive(shard->mutex);
+    return removed;
+}
+
 bool InMemoryStorage::checkSeen(std::string bundleID) {
     ESP_LOGD("InMemoryStorage::checkSeen", "checking bundle ID: %s",
              bundleID.c_str());
-    bool result = false;
-    // use semaphore to ensure thread safety
-    xSemaphoreTake(bundleIdMutex, portMAX_DELAY);
-
-    // if the bundle id is found, i.e. the result of find is not bundles end, the bundle id is already contained
-    result = !(bundle_ids.find(bundleID) == bundle_ids.end());
-
-    // release mutex
-    xSemaphoreGive(bundleIdMutex);
-    return result;
+    // check whether the bundle id is contained in the seen filter, which is thread safe without a mutex
+    return seenIds.contains(bundleID);
 }
 
 void InMemoryStorage::storeSeen(std::string bundleID) {
     ESP_LOGD("InMemoryStorage::storeSeen", "storing bundle ID: %s",
              bundleID.c_str());
-    size_t estimatedSize = sizeof(std::string);
-    // insert bundleID into set, use semaphore to ensure thread safety
-    xSemaphoreTake(bundleIdMutex, portMAX_DELAY);
-    bundle_ids.insert(bundleID);
+    // insert bundleID into the seen filter
+    seenIds.insert(bundleID);
     ESP_LOGI("InMemoryStorage::storeSeen",
-             "stored bundle ID: %s ,number of stored Ids: %u, estimated size "
-             "of this Storage entry:%u",
-             bundleID.c_str(), bundle_ids.size(), estimatedSize);
-    xSemaphoreGive(bundleIdMutex);
+             "stored bundle ID: %s ,number of Ids in current generation: %u, "
+             "size of seen filter:%u",
+             bundleID.c_str(), seenIds.currentGenerationCount(),
+             seenIds.memoryUsage());
     return;
 }
 
+bool InMemoryStorage::checkAndStoreSeen(std::string bundleID) {
+    // check and insert the bundle id, hashing it once
+    bool result = seenIds.checkAndInsert(bundleID);
+    ESP_LOGD("InMemoryStorage::checkAndStoreSeen", "bundle ID: %s, seen: %d",
+             bundleID.c_str(), result);
+    return result;
+}
+
 bool InMemoryStorage::removeBundle(std::string bundleID) {
-    // get the mutex tro ensure that no other thread operates on the stored bundles
-    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
-
-    // iterate through all stored bundles and compare the bundleIDs
-    for (auto it = bundles.begin(); it != bundles.end();) {
-        if ((*it).bundle.getID() == bundleID) {
-            // if the desired bundle is found, remove it
-            it = bundles.erase(it);
-            break;
-        }
-        it++;
+    // only the shard of the bundle is locked, the bundle is found using its ID index
+    BundleShard& shard = shardFor(bundleID);
+    xSemaphoreTake(shard.mutex, portMAX_DELAY);
+    bool result = shard.bundles.erase(bundleID);
+    updateTotals(shard);
+    xSemaphoreGive(shard.mutex);
+    return result;
+}
+
+bool InMemoryStorage::containsBundle(std::string bundleID) {
+    BundleShard& shard = shardFor(bundleID);
+    xSemaphoreTake(shard.mutex, portMAX_DELAY);
+    bool result = shard.bundles.contains(bundleID);
+    xSemaphoreGive(shard.mutex);
+    return result;
+}
+
+BundleInfo InMemoryStorage::getBundle(std::string bundleID) {
+    BundleInfo result;
+    BundleShard& shard = shardFor(bundleID);
+    xSemaphoreTake(shard.mutex, portMAX_DELAY);
+    auto it = shard.bundles.find(bundleID);
+    if (it != shard.bundles.end())
+        result = it->bundle;
+    xSemaphoreGive(shard.mutex);
+    return result;
+}
+
+std::vector<std::string> InMemoryStorage::findBundlesTo(
+    const std::string& destination, size_t limit) {
+    std::vector<std::string> result;
+    for (size_t i = 0; i < numShards && result.size() < limit; i++) {
+        xSemaphoreTake(shards[i].mutex, portMAX_DELAY);
+        shards[i].bundles.findByDestination(destination, result, limit);
+        xSemaphoreGive(shards[i].mutex);
+    }
+    return result;
+}
+
+std::vector<std::string> InMemoryStorage::findBundlesNotForwardedTo(
+    const std::string& nodeURI, size_t limit) {
+    uint32_t nodeHash = BundleKeys::nodeHash(nodeURI);
+
+    // each shard returns its matches in insertion order, they are merged by their sequence number
+    std::vector<std::pair<uint32_t, std::string>> matches;
+    for (size_t i = 0; i < numShards; i++) {
+        std::vector<std::string> ids;
+        xSemaphoreTake(shards[i].mutex, portMAX_DELAY);
+        shards[i].bundles.findNotForwardedTo(nodeHash, ids, limit);
+        for (std::string& id : ids)
+            matches.emplace_back(shards[i].bundles.find(id)->sequence,
+                                 std::move(id));
+        xSemaphoreGive(shards[i].mutex);
     }
+    std::sort(matches.begin(), matches.end());
 
-    // release the mutex
-    xSemaphoreGive(bundlesMutex);
-    return false;
+    std::vector<std::string> result;
+    for (size_t i = 0; i < matches.size() && i < limit; i++)
+        result.push_back(std::move(matches[i].second));
+    return result;
+}
+
+std::vector<std::string> InMemoryStorage::findBundlesMissingFrom(
+    const BundleSummary& summary, size_t limit) {
+    // each shard returns its matches in insertion order, they are merged by their sequence number
+    std::vector<std::pair<uint32_t, std::string>> matches;
+    for (size_t i = 0; i < numShards; i++) {
+        std::vector<std::string> ids;
+        xSemaphoreTake(shards[i].mutex, portMAX_DELAY);
+        shards[i].bundles.findMissingFrom(summary, ids, limit);
+        for (std::string& id : ids)
+            matches.emplace_back(shards[i].bundles.find(id)->sequence,
+                                 std::move(id));
+        xSemaphoreGive(shards[i].mutex);
+    }
+    std::sort(matches.begin(), matches.end());
+
+    std::vector<std::string> result;
+    for (size_t i = 0; i < matches.size() && i < limit; i++)
+        result.push_back(std::move(matches[i].second));
+    return result;
+}
+
+void InMemoryStorage::summarizeBundles(BundleSummary& summary) {
+    for (size_t i = 0; i < numShards; i++) {
+        xSemaphoreTake(shards[i].mutex, portMAX_DELAY);
+        shards[i].bundles.summarize(summary);
+        xSemaphoreGive(shards[i].mutex);
+    }
 }
 
-/// @brief Stores a bundle, if there isn't sufficient space, the oldest stored bundle is removed from Storage, and returned in a Vector
+std::vector<std::string> InMemoryStorage::findBundlesExpiringBefore(uint64_t time,
+                                                          size_t limit) {
+    // each shard returns its matches soonest expiring first, they are merged by their expiry time
+    std::vector<std::pair<uint64_t, std::string>> matches;
+    for (size_t i = 0; i < numShards; i++) {
+        std::vector<std::string> ids;
+        xSemaphoreTake(shards[i].mutex, portMAX_DELAY);
+        shards[i].bundles.findExpiringBefore(time, ids, limit);
+        for (std::string& id : ids)
+            matches.emplace_back(shards[i].bundles.find(id).keys().expiresAt,
+                                 std::move(id));
+        xSemaphoreGive(shards[i].mutex);
+    }
+    std::sort(matches.begin(), matches.end());
+
+    std::vector<std::string> result;
+    for (size_t i = 0; i < matches.size() && i < limit; i++)
+        result.push_back(std::move(matches[i].second));
+    return result;
+}
+
+/// @brief Stores a bundle, if there isn't sufficient space, bundles are removed from Storage according to the eviction policy, and returned in a Vector
 /// @param bundle the Bundle to be stored
-/// @return a Vector containing the bundle which was deleted to make space for the new bundle
+/// @return a Vector containing the bundles which were deleted to make space for the new bundle
 std::vector<BundleInfo> InMemoryStorage::delayBundle(BundleInfo* bundle) {
     std::vector<BundleInfo> result;
-    ESP_LOGI("delay Bundle", "stored Bundles: %u, max Stored Bundles:%u",
-             bundles.size(), maxStoredBundles);
+    std::string id = bundle->bundle.getID();
+    size_t bundleMemory = bundle->memoryUsage();
+    BundleKeys keys(*bundle);
+    size_t needed = bundleMemory + AgeIndexedList<SequencedBundle>::entryMemory(
+                                       id, keys);
+    uint64_t rank = evictionPolicy->rank(BundleMetadata(*bundle, bundleMemory));
 
-    // take bundles mutex because the size() method of bundles is used
-    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    // only one bundle is stored at a time, so that the limits are checked against the final totals. The shards are only locked while a bundle is removed or added
+    xSemaphoreTake(delayMutex, portMAX_DELAY);
+    ESP_LOGI("delay Bundle",
+             "stored Bundles: %u, max Stored Bundles:%u, used memory: %u",
+             storedBundles.load(), maxStoredBundles, usedMemory.load());
 
-    // check if it is allowed to store an additional bundle and if not delete the oldest one
-    if (bundles.size() >= maxStoredBundles) {
-        // we have to give bundles mutex, as delete oldest needs it to function
-        xSemaphoreGive(bundlesMutex);
-        result.push_back(deleteOldest());
+    // check if it is allowed to store an additional bundle and if not remove bundles according to the eviction policy.
+    // A whole batch is removed, so that the following bundles can be stored without removing bundles again.
+    // The block data is placed by the BundleAllocator, so bundles are also removed while a pool exceeds its limit, the data of removed bundles is freed once they are returned and is not counted.
+    // A bundle exceeding the budget or a pool limit on its own can never be stored, no bundles are removed for it
+    BundleAllocator& allocator = BundleAllocator::instance();
+    size_t incoming[2] = {0, 0};
+    size_t released[2] = {0, 0};
+    addPoolUsage(bundle->bundle, incoming);
+    bool rejected = memoryBudget != 0 && needed > memoryBudget;
+    for (MemoryPool pool : {MemoryPool::Internal, MemoryPool::External})
+        if (allocator.limit(pool) != 0 &&
+            incoming[(int)pool] > allocator.limit(pool))
+            rejected = true;
+    while (!rejected && storedBundles > 0) {
+        bool full = storedBundles >= maxStoredBundles ||
+                    (memoryBudget != 0 && usedMemory + needed > memoryBudget) ||
+                    !allocator.withinLimits(released);
+        if (!full && result.size() % evictionBatchSize == 0)
+            break;
 
-        // retake bundles Mutex after delete oldest has finished
-        xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+        // the new bundle would be the next to be evicted, so it is not stored
+        uint64_t nextRank;
+        if (full && nextEvictedShard(nextRank) != nullptr && nextRank > rank) {
+            rejected = true;
+            break;
+        }
+
+        // only bundles which were actually removed are returned, eviction stops if the shard was emptied concurrently, which freed space itself
+        BundleInfo evicted;
+        if (!popEvicted(evicted))
+            break;
+        addPoolUsage(evicted.bundle, released);
+        result.push_back(std::move(evicted));
+    }
+    if ((memoryBudget != 0 && usedMemory + needed > memoryBudget) ||
+        !allocator.withinLimits(released))
+        rejected = true;
+    if (!result.empty())
+        ESP_LOGI("delay Bundle", "removed %u bundles", result.size());
+
+    // insert the bundle into the list of its shard, indexed by its reception time and eviction rank
+    if (!rejected) {
+        BundleShard& shard = shardFor(id);
+        xSemaphoreTake(shard.mutex, portMAX_DELAY);
+        uint64_t receivedAt = bundle->bundle.receivedAt;
+        shard.bundles.push_back(id, SequencedBundle{nextSequence++, *bundle},
+                                receivedAt, rank, bundleMemory,
+                                std::move(keys));
+        updateTotals(shard);
+        xSemaphoreGive(shard.mutex);
     }
-    // insert the bundle into the list of stored bundles
-    bundles.insert(bundles.end(), *bundle);
 
-    // release the mutex
-    xSemaphoreGive(bundlesMutex);
+    xSemaphoreGive(delayMutex);
+
+    if (rejected) {
+        ESP_LOGW("delay Bundle", "bundle not stored, storage is full");
+        result.push_back(*bundle);
+    }
     return result;
 }
 
 std::vector<BundleInfo> InMemoryStorage::getBundlesRetry() {
     std::vector<BundleInfo> result;
-    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
     for (int i = 0; i < CONFIG_RetryBatchSize; i++) {
         if (bundlesToReturn == 0)
             break;
-        result.push_back(bundles.front());
-        bundles.pop_front();
-        bundlesToReturn--;
+
+        // return the bundles of all shards in the order they were stored
+        uint64_t sequence;
+        BundleShard* shard = findShard(
+            [](BundleShard& candidate, uint64_t& key) {
+                if (candidate.toReturn == 0 || candidate.bundles.empty())
+                    return false;
+                key = candidate.bundles.front().sequence;
+                return true;
+            },
+            sequence);
+        if (shard == nullptr) {
+            bundlesToReturn = 0;
+            break;
+        }
+
+        xSemaphoreTake(shard->mutex, portMAX_DELAY);
+        if (shard->toReturn > 0 && !shard->bundles.empty()) {
+            result.push_back(shard->bundles.pop_front().bundle);
+            shard->toReturn--;
+            bundlesToReturn--;
+            updateTotals(*shard);
+        }
+        xSemaphoreGive(shard->mutex);
     }
-    xSemaphoreGive(bundlesMutex);
     return result;
 }
 
 BundleInfo InMemoryStorage::deleteOldest() {
-    ESP_LOGI("InMemoryStorage::deleteOldest()", "taking bundlesMutex");
-    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
-    ESP_LOGI("InMemoryStorage::deleteOldest()", "got bundlesMutex");
-    auto oldest = bundles.begin();
-    uint64_t oldestTime = (*oldest).bundle.receivedAt;
-    for (auto it = bundles.begin(); it != bundles.end(); it++) {
-        uint64_t currentAge = (*it).bundle.receivedAt;
-        if (currentAge < oldestTime) {
-            oldest = it;
-            oldestTime = currentAge;
-        }
-        vTaskDelay(1);  // needed to avoid watchdog
+    // the age index of each shard directly yields its oldest bundle, only one shard is locked at a time
+    BundleInfo result;
+    uint64_t oldestTime;
+    BundleShard* shard = findShard(
+        [](BundleShard& candidate, uint64_t& key) {
+            if (candidate.bundles.empty())
+                return false;
+            key = candidate.bundles.oldestTime();
+            return true;
+        },
+        oldestTime);
+    if (shard == nullptr)
+        return result;
+
+    xSemaphoreTake(shard->mutex, portMAX_DELAY);
+    if (!shard->bundles.empty()) {
+        result = shard->bundles.pop_oldest().bundle;
+        updateTotals(*shard);
     }
-    BundleInfo result = *oldest;
-    bundles.erase(oldest);
-    xSemaphoreGive(bundlesMutex);  // give bundles mutex
-    ESP_LOGI("InMemoryStorage::deleteOldest()", "released bundlesMutex");
+    xSemaphoreGive(shard->mutex);
     return result;
 }
 
 void InMemoryStorage::beginRetryCycle() {
-    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
-    bundlesToReturn = bundles.size();
-    xSemaphoreGive(bundlesMutex);
+    size_t total = 0;
+    for (size_t i = 0; i < numShards; i++) {
+        xSemaphoreTake(shards[i].mutex, portMAX_DELAY);
+        shards[i].toReturn = shards[i].bundles.size();
+        total += shards[i].toReturn;
+        xSemaphoreGive(shards[i].mutex);
+    }
+    bundlesToReturn = total;
     return;
 }
 
@@ -174,18 +390,7 @@ bool InMemoryStorage::hasBundlesToRetry() {
     return (bundlesToReturn != 0);
 }
 
-inline bool isXolder(uint64_t xTime, uint64_t xNum, uint64_t yTime,
-                     uint64_t yNum) {
-    if (xTime == 0) {
-        if (yTime == 0)
-            return xNum < yNum;
-        else
-            return false;  // if x has no accurate clock it is preferred
-    }
-    else if (yTime == 0)
-        return true;  // if y has no accurate clock it is preferred
-    else if (xTime == yTime)
-        return xNum < yNum;
-    else
-        return xTime < yTime;
+size_t InMemoryStorage::memoryUsage() {
+    return usedMemory;
 }
+
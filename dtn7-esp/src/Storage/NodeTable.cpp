@@ -0,0 +1,202 @@
+#include "NodeTable.hpp"
+#include "esp_log.h"
+
+NodeTable::NodeTable() {
+    mutex = xSemaphoreCreateMutex();
+}
+
+NodeTable::~NodeTable() {
+    vSemaphoreDelete(mutex);
+}
+
+NodeTable::Entry* NodeTable::entryFor(NodeId id) {
+    if (id == INVALID_NODE_ID)
+        return nullptr;
+    uint16_t index = id & 0xFFFF;
+    if (index >= entries.size())
+        return nullptr;
+    Entry& entry = entries[index];
+    if (!entry.used || entry.generation != (id >> 16))
+        return nullptr;
+    return &entry;
+}
+
+void NodeTable::changed(bool moved) {
+    if (moved)
+        version++;
+    snapshot = nullptr;
+}
+
+/// @brief checks whether two nodes differ in more than their last seen time
+static bool differs(const Node& a, const Node& b) {
+    if (a.identifier != b.identifier || a.Eids.size() != b.Eids.size() ||
+        a.hasPos != b.hasPos || a.position != b.position)
+        return true;
+    for (size_t i = 0; i < a.Eids.size(); i++)
+        if (a.Eids[i].getURI() != b.Eids[i].getURI())
+            return true;
+#if CONFIG_useReceivedSet
+    if (a.receivedSummary.data() != b.receivedSummary.data())
+        return true;
+#endif
+    return false;
+}
+
+NodeId NodeTable::upsert(const Node& node) {
+    // nodes without URI can not be looked up again, do not store them
+    if (node.URI == "none")
+        return INVALID_NODE_ID;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    // if the node is already known, overwrite it in its slot
+    auto it = byUri.find(node.URI);
+    if (it != byUri.end()) {
+        NodeId id = it->second;
+        Node& stored = entries[id & 0xFFFF].node;
+        uint64_t lastSeen = stored.lastSeen;
+        // a refresh of the last seen time is done in place like touch, the snapshot is only rebuilt if the node itself changed, and the version only increases if its position changed
+        bool modified = differs(stored, node);
+        bool moved =
+            stored.hasPos != node.hasPos || stored.position != node.position;
+        stored = node;
+        if (lastSeen != UINT64_MAX && node.lastSeen != UINT64_MAX &&
+            lastSeen > node.lastSeen)
+            stored.lastSeen = lastSeen;
+        if (modified)
+            changed(moved);
+        xSemaphoreGive(mutex);
+        return id;
+    }
+
+    // otherwise use a free slot, or append a new one
+    uint16_t index;
+    if (!freeSlots.empty()) {
+        index = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    else if (entries.size() < 0xFFFF) {
+        index = entries.size();
+        entries.emplace_back();
+    }
+    else {
+        xSemaphoreGive(mutex);
+        ESP_LOGE("NodeTable", "node table full, cannot add node %s",
+                 node.URI.c_str());
+        return INVALID_NODE_ID;
+    }
+
+    Entry& entry = entries[index];
+    entry.node = node;
+    entry.used = true;
+    NodeId id = ((NodeId)entry.generation << 16) | index;
+    byUri[node.URI] = id;
+    changed(true);
+    xSemaphoreGive(mutex);
+    return id;
+}
+
+bool NodeTable::remove(const std::string& uri) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    auto it = byUri.find(uri);
+    if (it == byUri.end()) {
+        xSemaphoreGive(mutex);
+        return false;
+    }
+
+    // free the slot, increasing the generation invalidates all handles to the removed node. A slot whose generation would wrap around is retired, so that an old handle can never become valid again
+    uint16_t index = it->second & 0xFFFF;
+    Entry& entry = entries[index];
+    entry.used = false;
+    entry.node = Node();
+    if (entry.generation < UINT16_MAX) {
+        entry.generation++;
+        freeSlots.push_back(index);
+    }
+    byUri.erase(it);
+    changed(true);
+    xSemaphoreGive(mutex);
+    return true;
+}
+
+NodeId NodeTable::find(const std::string& uri) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    auto it = byUri.find(uri);
+    NodeId result = (it == byUri.end()) ? INVALID_NODE_ID : it->second;
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+Node NodeTable::get(const std::string& uri) {
+    Node result;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    auto it = byUri.find(uri);
+    if (it != byUri.end())
+        result = entries[it->second & 0xFFFF].node;
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+bool NodeTable::touch(NodeId id, uint64_t now, std::string* uri) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    Entry* entry = entryFor(id);
+    if (entry != nullptr && entry->node.lastSeen != UINT64_MAX) {
+        entry->node.lastSeen = now;
+        if (uri != nullptr)
+            *uri = entry->node.URI;
+    }
+    xSemaphoreGive(mutex);
+    return entry != nullptr;
+}
+
+uint64_t NodeTable::getLastSeen(const std::string& uri) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    auto it = byUri.find(uri);
+    uint64_t result =
+        (it == byUri.end()) ? 0 : entries[it->second & 0xFFFF].node.lastSeen;
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+std::vector<Node> NodeTable::getAll() {
+    std::vector<Node> result;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    result.reserve(byUri.size());
+    for (Entry& entry : entries) {
+        if (entry.used)
+            result.push_back(entry.node);
+    }
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+NodeSnapshotPtr NodeTable::getSnapshot() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    // only rebuild the snapshot if nodes were changed since it was created
+    if (snapshot == nullptr) {
+        std::shared_ptr<NodeSnapshot> created =
+            std::make_shared<NodeSnapshot>();
+        created->version = version;
+        created->nodes.reserve(byUri.size());
+        created->ids.reserve(byUri.size());
+        for (uint16_t i = 0; i < entries.size(); i++) {
+            if (entries[i].used) {
+                created->nodes.push_back(entries[i].node);
+                created->ids.push_back(((NodeId)entries[i].generation << 16) |
+                                       i);
+            }
+        }
+        snapshot = created;
+    }
+    NodeSnapshotPtr result = snapshot;
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+size_t NodeTable::size() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    size_t result = byUri.size();
+    xSemaphoreGive(mutex);
+    return result;
+}
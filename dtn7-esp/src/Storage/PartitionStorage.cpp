@@ -0,0 +1,1002 @@
+#include "PartitionStorage.hpp"
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+
+// size of a flash sector, the smallest unit that can be erased
+#define SECTOR_SIZE 4096
+
+// marks the beginning of a segment which is in use
+#define SEGMENT_MAGIC 0x47535444  // "DTSG"
+
+// marks the beginning of a checkpoint
+#define CHECKPOINT_MAGIC 0x50435444  // "DTCP"
+
+// marks the beginning of a record
+#define RECORD_MAGIC 0xB7D7
+
+// record states, flash bits can only be cleared without an erase, therefore each state is reached by clearing bits of the previous one
+#define RECORD_PENDING 0xFF  // written, but not yet complete
+#define RECORD_LIVE 0xFE     // complete and stored
+#define RECORD_REMOVED 0x00  // removed, space is reclaimed by compaction
+
+// record types, the type of bundle records is left erased
+#define RECORD_BUNDLE 0xFF    // a bundle, including its metadata at the time it was stored
+#define RECORD_METADATA 0xFE  // metadata committed for a bundle, replaces the metadata stored with it
+
+// metadata segment of a bundle whose metadata was never committed
+#define NO_METADATA UINT16_MAX
+
+// sequence number of a free segment
+#define SEGMENT_FREE UINT32_MAX
+
+/// @brief header at the beginning of each used segment
+struct SegmentHeader {
+    /// @brief SEGMENT_MAGIC
+    uint32_t magic;
+
+    /// @brief incremented for each opened segment, orders the segments in the log
+    uint32_t sequence;
+};
+
+/// @brief header of each stored record, followed by the bundle ID, the query keys of the bundle and the serialized bundle info or metadata
+struct RecordHeader {
+    /// @brief reception time of the bundle
+    uint64_t receivedAt;
+
+    /// @brief eviction rank of the bundle, calculated by the eviction policy when it was stored
+    uint64_t rank;
+
+    /// @brief length of the serialized bundle info or metadata
+    uint32_t length;
+
+    /// @brief RECORD_MAGIC
+    uint16_t magic;
+
+    /// @brief one of RECORD_PENDING, RECORD_LIVE, RECORD_REMOVED
+    uint8_t state;
+
+    /// @brief one of RECORD_BUNDLE, RECORD_METADATA
+    uint8_t type;
+
+    /// @brief length of the bundle ID
+    uint16_t idLength;
+
+    /// @brief length of the encoded query keys, see encodeKeys
+    uint16_t keysLength;
+
+    /// @brief unused, left erased
+    uint32_t reserved3;
+};
+
+/// @brief header of a checkpoint, followed by one CheckpointEntry per stored bundle
+struct CheckpointHeader {
+    /// @brief CHECKPOINT_MAGIC
+    uint32_t magic;
+
+    /// @brief incremented for each checkpoint, the valid checkpoint with the highest sequence number is used
+    uint32_t sequence;
+
+    /// @brief sequence number of the head segment when the checkpoint was written
+    uint32_t headSequence;
+
+    /// @brief head offset when the checkpoint was written
+    uint32_t headOffset;
+
+    /// @brief head segment when the checkpoint was written
+    uint16_t headSegment;
+
+    /// @brief unused
+    uint16_t reserved;
+
+    /// @brief number of entries
+    uint32_t count;
+
+    /// @brief CRC32 of the header, with this field set to 0, and all entries
+    uint32_t crc;
+};
+
+/// @brief location of a record listed in a checkpoint and of its metadata record
+struct CheckpointEntry {
+    uint16_t segment;
+
+    /// @brief NO_METADATA if the metadata of the bundle was never committed
+    uint16_t metaSegment;
+    uint32_t offset;
+    uint32_t metaOffset;
+};
+
+/// @brief returns the size a record occupies in flash, records are aligned to 4 bytes
+static inline uint32_t recordSize(uint16_t idLength, uint16_t keysLength,
+                                  uint32_t length) {
+    return (sizeof(RecordHeader) + idLength + keysLength + length + 3) & ~3u;
+}
+
+/// @brief returns the size a record occupies in flash
+static inline uint32_t recordSize(const RecordHeader& header) {
+    return recordSize(header.idLength, header.keysLength, header.length);
+}
+
+/// @brief returns the offset of the serialized bundle info or metadata within a record
+static inline uint32_t dataOffset(const RecordHeader& header) {
+    return sizeof(RecordHeader) + header.idLength + header.keysLength;
+}
+
+/// @brief encodes the query keys of a bundle, so they can be restored on boot without reading the bundle.
+///        Bundle records contain all keys, metadata records only the hashes of the nodes the bundle was forwarded to, as the other keys do not change
+/// @return expiry time (8 bytes), destination length (2 bytes), number of hashes (2 bytes), destination, hashes (4 bytes each)
+static std::vector<uint8_t> encodeKeys(const BundleKeys& keys) {
+    uint16_t destinationLength = keys.destination.size();
+    uint16_t hashCount = keys.forwardedTo.size();
+    std::vector<uint8_t> result(12 + destinationLength + 4 * hashCount);
+    memcpy(result.data(), &keys.expiresAt, 8);
+    memcpy(result.data() + 8, &destinationLength, 2);
+    memcpy(result.data() + 10, &hashCount, 2);
+    memcpy(result.data() + 12, keys.destination.data(), destinationLength);
+    memcpy(result.data() + 12 + destinationLength, keys.forwardedTo.data(),
+           4 * hashCount);
+    return result;
+}
+
+/// @brief decodes query keys encoded by encodeKeys
+/// @return false if the encoded keys are truncated
+static bool decodeKeys(const uint8_t* data, size_t length, BundleKeys& keys) {
+    uint16_t destinationLength, hashCount;
+    if (length < 12)
+        return false;
+    memcpy(&keys.expiresAt, data, 8);
+    memcpy(&destinationLength, data + 8, 2);
+    memcpy(&hashCount, data + 10, 2);
+    if (length < 12 + destinationLength + 4 * (size_t)hashCount)
+        return false;
+    keys.destination.assign((const char*)data + 12, destinationLength);
+    keys.forwardedTo.resize(hashCount);
+    memcpy(keys.forwardedTo.data(), data + 12 + destinationLength,
+           4 * hashCount);
+    return true;
+}
+
+/// @brief checks whether a memory area is erased, i.e. all bits are set
+static bool isErased(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0xFF)
+            return false;
+    }
+    return true;
+}
+
+PartitionStorage::PartitionStorage() {
+    ESP_LOGI("PartitionStorage Setup", "Setup PartitionStorage");
+    bundlesMutex = xSemaphoreCreateMutex();
+
+    // find the data partition used for the bundles, it has to be added to the custom partition table
+    partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+        CONFIG_PartitionStorageLabel);
+    if (partition == nullptr) {
+        ESP_LOGE("PartitionStorage Setup",
+                 "no data partition labeled \"%s\" found, add it to the "
+                 "partition table",
+                 CONFIG_PartitionStorageLabel);
+        ESP_ERROR_CHECK(ESP_ERR_NOT_FOUND);
+    }
+
+    // the partition starts with two checkpoint slots, the rest is divided into segments
+    checkpointSize = CONFIG_PartitionStorageCheckpointSectors * SECTOR_SIZE;
+    segmentSize = CONFIG_PartitionStorageSegmentSectors * SECTOR_SIZE;
+    segmentCount = std::min<uint32_t>(
+        (partition->size - 2 * checkpointSize) / segmentSize, UINT16_MAX);
+    if (partition->size < 2 * checkpointSize || segmentCount < 2) {
+        ESP_LOGE("PartitionStorage Setup",
+                 "partition too small, at least two segments are required");
+        ESP_ERROR_CHECK(ESP_ERR_INVALID_SIZE);
+    }
+    headSegment = segmentCount;
+
+    // map the whole partition, records are read directly from the mapped flash
+    ESP_ERROR_CHECK(esp_partition_mmap(partition, 0, partition->size,
+                                       ESP_PARTITION_MMAP_DATA,
+                                       (const void**)&mapped, &mapHandle));
+
+#if CONFIG_PartitionStorageKeepBetweenRestart
+    mount();
+#else
+    format();
+#endif
+    ESP_LOGI("PartitionStorage Setup",
+             "%u segments of %lu bytes, %u free, %u stored bundles",
+             segmentCount, segmentSize, freeSegments, records.size());
+}
+
+PartitionStorage::~PartitionStorage() {
+    esp_partition_munmap(mapHandle);
+    vSemaphoreDelete(bundlesMutex);
+}
+
+const uint8_t* PartitionStorage::at(uint16_t segment, uint32_t offset) const {
+    return mapped + segmentAddress(segment) + offset;
+}
+
+uint32_t PartitionStorage::segmentAddress(uint16_t segment) const {
+    return 2 * checkpointSize + (uint32_t)segment * segmentSize;
+}
+
+void PartitionStorage::format() {
+    // erasing the checkpoints and the first sector of each used segment is enough, segments are erased completely before they are opened
+    esp_partition_erase_range(partition, 0, 2 * checkpointSize);
+    for (uint16_t segment = 0; segment < segmentCount; segment++) {
+        SegmentHeader header;
+        memcpy(&header, at(segment, 0), sizeof(header));
+        if (header.magic != 0xFFFFFFFF)
+            esp_partition_erase_range(partition, segmentAddress(segment),
+                                      SECTOR_SIZE);
+    }
+    segmentSequence.assign(segmentCount, SEGMENT_FREE);
+    liveBytes.assign(segmentCount, 0);
+    freeSegments = segmentCount;
+}
+
+void PartitionStorage::mount() {
+    segmentSequence.assign(segmentCount, SEGMENT_FREE);
+    liveBytes.assign(segmentCount, 0);
+    freeSegments = 0;
+
+    // read the segment headers, the used segment with the highest sequence number is the head
+    uint32_t highestSequence = 0;
+    for (uint16_t segment = 0; segment < segmentCount; segment++) {
+        SegmentHeader header;
+        memcpy(&header, at(segment, 0), sizeof(header));
+        if (header.magic == SEGMENT_MAGIC && header.sequence != SEGMENT_FREE) {
+            segmentSequence[segment] = header.sequence;
+            if (header.sequence >= highestSequence) {
+                highestSequence = header.sequence;
+                headSegment = segment;
+            }
+        }
+        else
+            freeSegments++;
+    }
+
+    // restore the records listed in the newest checkpoint, only the records written after it have to be read from the segments
+    uint16_t checkpointHead = segmentCount;
+    uint32_t checkpointHeadSequence = 0;
+    uint32_t checkpointHeadOffset = 0;
+    bool hasCheckpoint = loadCheckpoint(checkpointHead, checkpointHeadSequence,
+                                        checkpointHeadOffset);
+    size_t fromCheckpoint = records.size();
+
+    // all segments opened after the checkpoint, or all segments if there is none, in the order they were written
+    std::vector<uint16_t> toScan;
+    for (uint16_t segment = 0; segment < segmentCount; segment++) {
+        if (segmentSequence[segment] != SEGMENT_FREE &&
+            (!hasCheckpoint ||
+             segmentSequence[segment] > checkpointHeadSequence))
+            toScan.push_back(segment);
+    }
+    std::sort(toScan.begin(), toScan.end(), [this](uint16_t a, uint16_t b) {
+        return segmentSequence[a] < segmentSequence[b];
+    });
+
+    // a metadata record can precede its bundle record in the log, if the bundle was moved by compaction. Therefore all bundle records are read first, then the metadata records in the order they were written, so the newest metadata of each bundle is used
+    for (uint8_t type : {RECORD_BUNDLE, RECORD_METADATA}) {
+        // the rest of the head segment at the time of the checkpoint
+        if (hasCheckpoint && checkpointHead < segmentCount &&
+            segmentSequence[checkpointHead] == checkpointHeadSequence) {
+            uint32_t end =
+                scanSegment(checkpointHead, checkpointHeadOffset, type);
+            if (checkpointHead == headSegment)
+                headOffset = end;
+        }
+        for (uint16_t segment : toScan) {
+            uint32_t end = scanSegment(segment, sizeof(SegmentHeader), type);
+            if (segment == headSegment)
+                headOffset = end;
+        }
+    }
+
+    nextSequence = std::max(highestSequence, checkpointHeadSequence) + 1;
+    ESP_LOGI("PartitionStorage mount",
+             "restored %u bundles from checkpoint, %u from %u scanned segments",
+             fromCheckpoint, records.size() - fromCheckpoint, toScan.size());
+
+    // write a new checkpoint, so the scanned records do not have to be read again on the next boot
+    if (!hasCheckpoint || records.size() != fromCheckpoint)
+        writeCheckpoint();
+}
+
+bool PartitionStorage::loadCheckpoint(uint16_t& headSegment,
+                                      uint32_t& headSequence,
+                                      uint32_t& headOffset) {
+    // find the valid checkpoint with the highest sequence number
+    int newest = -1;
+    CheckpointHeader newestHeader;
+    for (int slot = 0; slot < 2; slot++) {
+        const uint8_t* start = mapped + slot * checkpointSize;
+        CheckpointHeader header;
+        memcpy(&header, start, sizeof(header));
+        if (header.magic != CHECKPOINT_MAGIC ||
+            header.count > (checkpointSize - sizeof(header)) /
+                               sizeof(CheckpointEntry))
+            continue;
+
+        // verify the CRC, a checkpoint interrupted by a reset is ignored
+        uint32_t crc = header.crc;
+        header.crc = 0;
+        uint32_t computed =
+            esp_rom_crc32_le(0, (const uint8_t*)&header, sizeof(header));
+        computed = esp_rom_crc32_le(computed, start + sizeof(header),
+                                    header.count * sizeof(CheckpointEntry));
+        if (computed != crc)
+            continue;
+
+        if (newest < 0 || header.sequence > newestHeader.sequence) {
+            newest = slot;
+            newestHeader = header;
+        }
+    }
+    if (newest < 0)
+        return false;
+
+    checkpointSequence = newestHeader.sequence;
+    headSegment = newestHeader.headSegment;
+    headSequence = newestHeader.headSequence;
+    headOffset = newestHeader.headOffset;
+
+    // records in segments which were erased or reopened after the checkpoint are not valid anymore, removed records are skipped by indexRecord
+    const uint8_t* entries =
+        mapped + newest * checkpointSize + sizeof(CheckpointHeader);
+    for (uint32_t i = 0; i < newestHeader.count; i++) {
+        CheckpointEntry entry;
+        memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+        if (entry.segment < segmentCount &&
+            segmentSequence[entry.segment] != SEGMENT_FREE &&
+            segmentSequence[entry.segment] <= headSequence &&
+            indexRecord(entry.segment, entry.offset) &&
+            entry.metaSegment < segmentCount &&
+            segmentSequence[entry.metaSegment] != SEGMENT_FREE &&
+            segmentSequence[entry.metaSegment] <= headSequence)
+            indexMetadata(entry.metaSegment, entry.metaOffset);
+    }
+    return true;
+}
+
+uint32_t PartitionStorage::scanSegment(uint16_t segment, uint32_t offset,
+                                       uint8_t type) {
+    while (offset + sizeof(RecordHeader) <= segmentSize) {
+        RecordHeader header;
+        memcpy(&header, at(segment, offset), sizeof(header));
+
+        // erased flash, this is the end of the written records
+        if (isErased(at(segment, offset), sizeof(header)))
+            return offset;
+
+        // a header which was not completely written, nothing more can be written to this segment
+        uint32_t size = recordSize(header);
+        if (header.magic != RECORD_MAGIC || offset + size > segmentSize)
+            return segmentSize;
+
+        if (header.state == RECORD_LIVE && header.type == type) {
+            if (type == RECORD_BUNDLE)
+                indexRecord(segment, offset);
+            else
+                indexMetadata(segment, offset);
+        }
+        offset += size;
+    }
+    return offset;
+}
+
+bool PartitionStorage::indexRecord(uint16_t segment, uint32_t offset) {
+    if (offset + sizeof(RecordHeader) > segmentSize)
+        return false;
+    RecordHeader header;
+    memcpy(&header, at(segment, offset), sizeof(header));
+    uint32_t size = recordSize(header);
+    if (header.magic != RECORD_MAGIC || header.state != RECORD_LIVE ||
+        header.type != RECORD_BUNDLE || offset + size > segmentSize)
+        return false;
+
+    // the query keys are stored next to the ID, the bundle itself is not read
+    std::string id((const char*)at(segment, offset) + sizeof(header),
+                   header.idLength);
+    BundleKeys keys;
+    if (!decodeKeys(at(segment, offset) + sizeof(header) + header.idLength,
+                    header.keysLength, keys))
+        return false;
+
+    // a bundle can be stored twice if a reset happened during compaction, the later copy is kept together with the metadata of the earlier one
+    RecordLocation location = {segment, offset, size};
+    auto existing = records.find(id);
+    if (existing != records.end()) {
+        clearRecord(existing->segment, existing->offset, existing->size);
+        location.metaSegment = existing->metaSegment;
+        location.metaOffset = existing->metaOffset;
+        location.metaSize = existing->metaSize;
+        if (location.metaSegment != NO_METADATA)
+            keys.forwardedTo = existing.keys().forwardedTo;
+    }
+
+    records.push_back(id, location, header.receivedAt, header.rank, 0,
+                      std::move(keys));
+    liveBytes[segment] += size;
+    return true;
+}
+
+bool PartitionStorage::indexMetadata(uint16_t segment, uint32_t offset) {
+    if (offset + sizeof(RecordHeader) > segmentSize)
+        return false;
+    RecordHeader header;
+    memcpy(&header, at(segment, offset), sizeof(header));
+    uint32_t size = recordSize(header);
+    if (header.magic != RECORD_MAGIC || header.state != RECORD_LIVE ||
+        header.type != RECORD_METADATA || offset + size > segmentSize)
+        return false;
+
+    // metadata records of removed bundles are removed with them, unless a reset happened in between. Such records are not referenced and dropped by compaction
+    std::string id((const char*)at(segment, offset) + sizeof(header),
+                   header.idLength);
+    auto it = records.find(id);
+    BundleKeys committed;
+    if (it == records.end() ||
+        !decodeKeys(at(segment, offset) + sizeof(header) + header.idLength,
+                    header.keysLength, committed))
+        return false;
+
+    // a newer metadata record replaces the older one, which is only left live if a reset happened while committing
+    if (it->metaSegment != NO_METADATA)
+        clearRecord(it->metaSegment, it->metaOffset, it->metaSize);
+    it->metaSegment = segment;
+    it->metaOffset = offset;
+    it->metaSize = size;
+    liveBytes[segment] += size;
+
+    // the forwarded to list is part of the metadata, the other keys stay the same
+    BundleKeys keys = it.keys();
+    keys.forwardedTo = std::move(committed.forwardedTo);
+    records.updateKeys(it, std::move(keys));
+    return true;
+}
+
+void PartitionStorage::openSegment() {
+    // use the next free segment after the current head, so all segments are used evenly
+    uint16_t segment = headSegment;
+    for (uint16_t i = 0; i < segmentCount; i++) {
+        segment = (segment + 1) % segmentCount;
+        if (segmentSequence[segment] == SEGMENT_FREE)
+            break;
+    }
+
+    esp_partition_erase_range(partition, segmentAddress(segment),
+                              segmentSize);
+    SegmentHeader header = {SEGMENT_MAGIC, nextSequence};
+    esp_partition_write(partition, segmentAddress(segment), &header,
+                        sizeof(header));
+
+    segmentSequence[segment] = nextSequence++;
+    liveBytes[segment] = 0;
+    freeSegments--;
+    headSegment = segment;
+    headOffset = sizeof(SegmentHeader);
+}
+
+bool PartitionStorage::makeSpace(uint32_t size, uint64_t rank,
+                                 std::vector<BundleInfo>& removed) {
+    uint32_t capacity = segmentSize - sizeof(SegmentHeader);
+    if (size > capacity) {
+        ESP_LOGE("PartitionStorage::makeSpace",
+                 "record of %lu bytes does not fit into a segment", size);
+        return false;
+    }
+
+    while (true) {
+        if (headSegment < segmentCount && headOffset + size <= segmentSize)
+            return true;
+
+        // one free segment is kept in reserve, so that compaction always has a place to copy records to
+        if (freeSegments > 1) {
+            openSegment();
+            continue;
+        }
+
+        // otherwise compact the segment with the least live data, if this frees enough space
+        uint16_t victim = segmentCount;
+        for (uint16_t segment = 0; segment < segmentCount; segment++) {
+            if (segment != headSegment &&
+                segmentSequence[segment] != SEGMENT_FREE &&
+                (victim == segmentCount ||
+                 liveBytes[segment] < liveBytes[victim]))
+                victim = segment;
+        }
+        if (victim < segmentCount &&
+            (liveBytes[victim] == 0 ||
+             (freeSegments > 0 && liveBytes[victim] + size <= capacity))) {
+            compact(victim);
+            continue;
+        }
+
+        // all segments are mostly filled with live records, remove a bundle according to the eviction policy, unless the new bundle would be the next to be evicted
+        if (records.empty())
+            return false;
+        if (records.nextEvictedRank() > rank) {
+            ESP_LOGW("PartitionStorage::makeSpace",
+                     "storage is full, new bundle has the lowest rank");
+            return false;
+        }
+        RecordLocation evicted = records.nextEvicted();
+        removed.push_back(readBundle(evicted));
+        markRemoved(evicted);
+        records.pop_evicted();
+        changed();
+    }
+}
+
+void PartitionStorage::compact(uint16_t segment) {
+    ESP_LOGI("PartitionStorage::compact",
+             "compacting segment %u, live bytes: %lu", segment,
+             liveBytes[segment]);
+    uint32_t offset = sizeof(SegmentHeader);
+    while (offset + sizeof(RecordHeader) <= segmentSize) {
+        RecordHeader header;
+        memcpy(&header, at(segment, offset), sizeof(header));
+        uint32_t size = recordSize(header);
+        if (header.magic != RECORD_MAGIC || offset + size > segmentSize)
+            break;
+
+        if (header.state == RECORD_LIVE) {
+            // only copy records that are still referenced by the index, bundle and metadata records are copied unchanged
+            std::string id((const char*)at(segment, offset) + sizeof(header),
+                           header.idLength);
+            auto it = records.find(id);
+            bool isBundle = header.type == RECORD_BUNDLE && it != records.end() &&
+                            it->segment == segment && it->offset == offset;
+            bool isMetadata = header.type == RECORD_METADATA &&
+                              it != records.end() &&
+                              it->metaSegment == segment &&
+                              it->metaOffset == offset;
+            if (isBundle || isMetadata) {
+                // flash can not be written from memory mapped flash, therefore the record is copied to RAM first
+                const uint8_t* keys =
+                    at(segment, offset) + sizeof(header) + header.idLength;
+                std::vector<uint8_t> payload(keys,
+                                             keys + header.keysLength +
+                                                 header.length);
+                std::vector<uint8_t> encodedKeys(
+                    payload.begin(), payload.begin() + header.keysLength);
+                if (headOffset + size > segmentSize)
+                    openSegment();
+                RecordLocation copy = appendRecord(
+                    id, encodedKeys, payload.data() + header.keysLength,
+                    header.length, header.receivedAt, header.rank,
+                    header.type);
+                if (isBundle) {
+                    it->segment = copy.segment;
+                    it->offset = copy.offset;
+                }
+                else {
+                    it->metaSegment = copy.segment;
+                    it->metaOffset = copy.offset;
+                }
+            }
+        }
+        offset += size;
+    }
+
+    // all live records were moved, the segment can be reused
+    esp_partition_erase_range(partition, segmentAddress(segment), segmentSize);
+    segmentSequence[segment] = SEGMENT_FREE;
+    liveBytes[segment] = 0;
+    freeSegments++;
+    changed();
+}
+
+PartitionStorage::RecordLocation PartitionStorage::appendRecord(
+    const std::string& id, const std::vector<uint8_t>& keys,
+    const uint8_t* data, uint32_t length, uint64_t receivedAt, uint64_t rank,
+    uint8_t type) {
+    RecordHeader header = {receivedAt,          rank,
+                           length,              RECORD_MAGIC,
+                           RECORD_PENDING,      type,
+                           (uint16_t)id.size(), (uint16_t)keys.size(),
+                           0xFFFFFFFF};
+    uint32_t size = recordSize(header);
+    uint32_t address = segmentAddress(headSegment) + headOffset;
+
+    // write the record as pending, then mark it live. A record interrupted by a reset stays pending and is ignored
+    esp_partition_write(partition, address, &header, sizeof(header));
+    esp_partition_write(partition, address + sizeof(header), id.data(),
+                        id.size());
+    esp_partition_write(partition, address + sizeof(header) + id.size(),
+                        keys.data(), keys.size());
+    esp_partition_write(partition, address + dataOffset(header), data,
+                        length);
+    uint8_t state = RECORD_LIVE;
+    esp_partition_write(partition, address + offsetof(RecordHeader, state),
+                        &state, 1);
+
+    RecordLocation location = {headSegment, headOffset, size};
+    liveBytes[headSegment] += size;
+    headOffset += size;
+    return location;
+}
+
+void PartitionStorage::clearRecord(uint16_t segment, uint32_t offset,
+                                   uint32_t size) {
+    // clearing the state does not require an erase, the space is reclaimed when the segment is compacted
+    uint8_t state = RECORD_REMOVED;
+    esp_partition_write(partition,
+                        segmentAddress(segment) + offset +
+                            offsetof(RecordHeader, state),
+                        &state, 1);
+    liveBytes[segment] -= size;
+}
+
+void PartitionStorage::markRemoved(const RecordLocation& location) {
+    // the metadata record is removed first, if a reset happens in between the bundle is kept with its older metadata
+    if (location.metaSegment != NO_METADATA)
+        clearRecord(location.metaSegment, location.metaOffset,
+                    location.metaSize);
+    clearRecord(location.segment, location.offset, location.size);
+}
+
+BundleInfo PartitionStorage::readBundle(const RecordLocation& location) const {
+    RecordHeader header;
+    memcpy(&header, at(location.segment, location.offset), sizeof(header));
+    const uint8_t* data =
+        at(location.segment, location.offset) + dataOffset(header);
+    BundleInfo result(data, header.length);
+
+    // metadata committed after the bundle was written replaces the metadata stored with it
+    if (location.metaSegment != NO_METADATA) {
+        memcpy(&header, at(location.metaSegment, location.metaOffset),
+               sizeof(header));
+        result.updateMetadata(
+            at(location.metaSegment, location.metaOffset) + dataOffset(header),
+            header.length);
+    }
+    return result;
+}
+
+void PartitionStorage::changed() {
+    if (++changesSinceCheckpoint >= CONFIG_PartitionStorageCheckpointInterval)
+        writeCheckpoint();
+}
+
+void PartitionStorage::writeCheckpoint() {
+    changesSinceCheckpoint = 0;
+    size_t size =
+        sizeof(CheckpointHeader) + records.size() * sizeof(CheckpointEntry);
+    if (size > checkpointSize) {
+        // the previous checkpoint stays valid, it only leads to more records being read on boot
+        ESP_LOGW("PartitionStorage::writeCheckpoint",
+                 "too many bundles for a checkpoint, increase the checkpoint "
+                 "size");
+        return;
+    }
+
+    std::vector<uint8_t> buffer(size);
+    CheckpointHeader header = {
+        CHECKPOINT_MAGIC,
+        checkpointSequence + 1,
+        headSegment < segmentCount ? segmentSequence[headSegment] : 0,
+        headOffset,
+        headSegment,
+        0xFFFF,
+        (uint32_t)records.size(),
+        0};
+    uint8_t* entries = buffer.data() + sizeof(header);
+    for (auto it = records.begin(); it != records.end(); ++it) {
+        CheckpointEntry entry = {it->segment, it->metaSegment, it->offset,
+                                 it->metaOffset};
+        memcpy(entries, &entry, sizeof(entry));
+        entries += sizeof(entry);
+    }
+    header.crc = esp_rom_crc32_le(0, (const uint8_t*)&header, sizeof(header));
+    header.crc = esp_rom_crc32_le(header.crc, buffer.data() + sizeof(header),
+                                  size - sizeof(header));
+    memcpy(buffer.data(), &header, sizeof(header));
+
+    // alternate between the two slots, so a valid checkpoint remains if a reset happens while writing
+    uint32_t slot = (checkpointSequence + 1) % 2;
+    esp_partition_erase_range(partition, slot * checkpointSize,
+                              checkpointSize);
+    esp_partition_write(partition, slot * checkpointSize, buffer.data(), size);
+    checkpointSequence++;
+}
+
+bool PartitionStorage::checkSeen(std::string bundleID) {
+    return seenIds.contains(bundleID);
+}
+
+void PartitionStorage::storeSeen(std::string bundleID) {
+    seenIds.insert(bundleID);
+}
+
+bool PartitionStorage::checkAndStoreSeen(std::string bundleID) {
+    return seenIds.checkAndInsert(bundleID);
+}
+
+bool PartitionStorage::removeBundle(std::string bundleID) {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    auto it = records.find(bundleID);
+    bool result = it != records.end();
+    if (result) {
+        markRemoved(*it);
+        records.erase(it);
+        changed();
+    }
+
+    // removing a leased bundle ends its lease
+    leases.erase(bundleID);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+bool PartitionStorage::containsBundle(std::string bundleID) {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bool result = records.contains(bundleID);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+BundleInfo PartitionStorage::getBundle(std::string bundleID) {
+    BundleInfo result;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    auto it = records.find(bundleID);
+    if (it != records.end())
+        result = readBundle(*it);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+std::vector<std::string> PartitionStorage::findBundlesTo(
+    const std::string& destination, size_t limit) {
+    std::vector<std::string> result;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    records.findByDestination(destination, result, limit);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+std::vector<std::string> PartitionStorage::findBundlesNotForwardedTo(
+    const std::string& nodeURI, size_t limit) {
+    std::vector<std::string> result;
+    uint32_t nodeHash = BundleKeys::nodeHash(nodeURI);
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    records.findNotForwardedTo(nodeHash, result, limit);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+std::vector<std::string> PartitionStorage::findBundlesMissingFrom(
+    const BundleSummary& summary, size_t limit) {
+    std::vector<std::string> result;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    records.findMissingFrom(summary, result, limit);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+void PartitionStorage::summarizeBundles(BundleSummary& summary) {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    records.summarize(summary);
+    xSemaphoreGive(bundlesMutex);
+}
+
+std::vector<std::string> PartitionStorage::findBundlesExpiringBefore(uint64_t time,
+                                                          size_t limit) {
+    std::vector<std::string> result;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    records.findExpiringBefore(time, result, limit);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+std::vector<BundleInfo> PartitionStorage::delayBundle(BundleInfo* bundle) {
+    std::vector<uint8_t> serialized = bundle->serialize();
+    std::string id = bundle->bundle.getID();
+    BundleKeys keys(*bundle);
+    std::vector<uint8_t> encodedKeys = encodeKeys(keys);
+    uint32_t size =
+        recordSize(id.size(), encodedKeys.size(), serialized.size());
+    uint64_t rank = evictionPolicy->rank(BundleMetadata(*bundle, size));
+    std::vector<BundleInfo> result;
+
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+
+    // an older copy of the same bundle is replaced
+    auto existing = records.find(id);
+    if (existing != records.end()) {
+        markRemoved(*existing);
+        records.erase(existing);
+        changed();
+    }
+
+    if (!makeSpace(size, rank, result)) {
+        xSemaphoreGive(bundlesMutex);
+        result.push_back(*bundle);
+        return result;
+    }
+
+    RecordLocation location =
+        appendRecord(id, encodedKeys, serialized.data(), serialized.size(),
+                     bundle->bundle.receivedAt, rank, RECORD_BUNDLE);
+    records.push_back(id, location, bundle->bundle.receivedAt, rank, 0,
+                      std::move(keys));
+    changed();
+    ESP_LOGI("PartitionStorage::delayBundle",
+             "stored bundle in segment %u at %lu, stored bundles: %u, free "
+             "segments: %u",
+             location.segment, location.offset, records.size(), freeSegments);
+
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+std::vector<BundleInfo> PartitionStorage::getBundlesRetry() {
+    std::vector<BundleInfo> result;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_RetryBatchSize; i++) {
+        if (bundlesToReturn == 0)
+            break;
+
+        // bundles can be removed during a retry cycle, the cycle ends early if none are left
+        if (records.empty()) {
+            bundlesToReturn = 0;
+            break;
+        }
+
+        // the bundle is removed from the log, it is appended again if it is delayed again
+        RecordLocation location = records.front();
+        result.push_back(readBundle(location));
+        markRemoved(location);
+        records.pop_front();
+        changed();
+        bundlesToReturn--;
+    }
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+std::vector<BundleInfo> PartitionStorage::leaseBatch(size_t n) {
+    std::vector<BundleInfo> result;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    while (result.size() < n && bundlesToReturn != 0) {
+        // bundles removed during the retry cycle are not returned, the cycle ends early if none are left
+        if (records.empty()) {
+            bundlesToReturn = 0;
+            break;
+        }
+        bundlesToReturn--;
+
+        // the bundle stays in its record, it is only moved to the end of the retry order in RAM
+        auto it = records.begin();
+        std::string bundleID = it.id();
+        records.move_to_back(it);
+
+        // bundles leased in the last cycle are still being forwarded
+        if (leases.find(bundleID) != leases.end())
+            continue;
+
+        // only the metadata is kept, to detect changes on commit
+        BundleInfo bundle = readBundle(*it);
+        bundle.leased = true;
+        leases[bundleID] = bundle.serializeMetadata();
+        result.push_back(bundle);
+    }
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+bool PartitionStorage::leaseBundle(const std::string& bundleID,
+                                   BundleInfo& bundle) {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    auto it = records.find(bundleID);
+    bool result = it != records.end() && leases.find(bundleID) == leases.end();
+    if (result) {
+        // the bundle keeps its position in the retry order, only the metadata is kept to detect changes on commit
+        bundle = readBundle(*it);
+        bundle.leased = true;
+        leases[bundleID] = bundle.serializeMetadata();
+    }
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+bool PartitionStorage::commit(const std::string& bundleID,
+                              BundleInfo& updated) {
+    std::vector<uint8_t> metadata = updated.serializeMetadata();
+    BundleKeys keys(updated);
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+
+    // the lease ends in any case, a bundle which was removed meanwhile is not stored again
+    auto lease = leases.find(bundleID);
+    auto it = records.find(bundleID);
+    if (lease == leases.end() || it == records.end()) {
+        if (lease != leases.end())
+            leases.erase(lease);
+        xSemaphoreGive(bundlesMutex);
+        return false;
+    }
+    bool unchanged = metadata == lease->second;
+    leases.erase(lease);
+
+    // a bundle whose metadata did not change is not written at all
+    if (unchanged) {
+        xSemaphoreGive(bundlesMutex);
+        return true;
+    }
+
+    // otherwise a metadata record is appended, the bundle record stays where it is
+    RecordHeader header;
+    memcpy(&header, at(it->segment, it->offset), sizeof(header));
+    BundleKeys forwarded;
+    forwarded.forwardedTo = keys.forwardedTo;
+    std::vector<uint8_t> encodedKeys = encodeKeys(forwarded);
+    uint32_t size =
+        recordSize(bundleID.size(), encodedKeys.size(), metadata.size());
+    std::vector<BundleInfo> removed;
+    bool fits = makeSpace(size, header.rank, removed);
+    if (removed.size() != 0)
+        ESP_LOGW("PartitionStorage::commit",
+                 "removed %u bundles to make space for metadata",
+                 removed.size());
+
+    // making space may have moved or evicted the bundle, if there is no space the bundle keeps its previous metadata
+    it = records.find(bundleID);
+    if (!fits || it == records.end()) {
+        if (!fits)
+            ESP_LOGW("PartitionStorage::commit",
+                     "no space for the metadata of %s", bundleID.c_str());
+        xSemaphoreGive(bundlesMutex);
+        return it != records.end();
+    }
+
+    RecordLocation location =
+        appendRecord(bundleID, encodedKeys, metadata.data(), metadata.size(),
+                     header.receivedAt, header.rank, RECORD_METADATA);
+    if (it->metaSegment != NO_METADATA)
+        clearRecord(it->metaSegment, it->metaOffset, it->metaSize);
+    it->metaSegment = location.segment;
+    it->metaOffset = location.offset;
+    it->metaSize = location.size;
+    records.updateKeys(it, std::move(keys));
+    changed();
+    ESP_LOGD("PartitionStorage::commit",
+             "committed metadata of %s in segment %u at %lu", bundleID.c_str(),
+             location.segment, location.offset);
+
+    xSemaphoreGive(bundlesMutex);
+    return true;
+}
+
+void PartitionStorage::release(const std::string& bundleID) {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    leases.erase(bundleID);
+    xSemaphoreGive(bundlesMutex);
+}
+
+BundleInfo PartitionStorage::deleteOldest() {
+    BundleInfo result;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    if (!records.empty()) {
+        RecordLocation oldest = records.oldest();
+        result = readBundle(oldest);
+        markRemoved(oldest);
+        records.pop_oldest();
+        changed();
+    }
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+void PartitionStorage::beginRetryCycle() {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bundlesToReturn = records.size();
+    xSemaphoreGive(bundlesMutex);
+}
+
+bool PartitionStorage::hasBundlesToRetry() {
+    return (bundlesToReturn != 0);
+}
@@ -0,0 +1,150 @@
+#include "SeenFilter.hpp"
+#include <math.h>
+#include <algorithm>
+#include "Clock.hpp"
+#include "esp_log.h"
+
+SeenFilter::SeenFilter(uint32_t capacity, uint32_t falsePositivePPM,
+                       uint8_t generations, uint64_t horizonMs) {
+    // at least two generations are required, otherwise the rotation would clear all remembered IDs at once
+    this->generations = std::max<uint8_t>(generations, 2);
+
+    // an ID inserted at the end of a rotation period is remembered for (generations - 1) periods, therefore each generation covers this fraction of the horizon and the expected IDs
+    generationCapacity = std::max<uint32_t>(
+        (capacity + this->generations - 2) / (this->generations - 1), 1);
+    rotationPeriod = std::max<uint64_t>(horizonMs / (this->generations - 1), 1);
+
+    // a lookup checks all generations, the false positive rates of the generations add up
+    double fpRate = std::clamp((double)falsePositivePPM / 1000000.0, 1e-9, 0.5);
+    double generationFpRate = fpRate / this->generations;
+
+    // standard Bloom filter dimensioning: m = -n * ln(p) / ln(2)^2, k = m / n * ln(2)
+    double optimalBits = -(double)generationCapacity * log(generationFpRate) /
+                         (M_LN2 * M_LN2);
+    wordsPerGeneration = std::max<uint32_t>((uint32_t)ceil(optimalBits / 32), 1);
+    bitsPerGeneration = wordsPerGeneration * 32;
+    numHashes = (uint8_t)std::clamp(
+        (int)round((double)bitsPerGeneration / generationCapacity * M_LN2), 1,
+        16);
+
+    size_t words = (size_t)wordsPerGeneration * this->generations;
+    bits.reset(new std::atomic<uint32_t>[words]);
+    for (size_t i = 0; i < words; i++)
+        bits[i].store(0, std::memory_order_relaxed);
+    generationStart = DTN7::nowMs();
+
+    ESP_LOGI("SeenFilter",
+             "%u generations of %u bits, %u hashes, rotation every %llu ms, "
+             "memory: %u bytes",
+             this->generations, bitsPerGeneration, numHashes, rotationPeriod,
+             memoryUsage());
+}
+
+void SeenFilter::baseHashes(const std::string& id, uint32_t& h1,
+                            uint32_t& h2) {
+    // 64 bit FNV-1a, split into two 32 bit hashes for double hashing
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : id) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    h1 = (uint32_t)hash;
+    h2 = (uint32_t)(hash >> 32) | 1;  // odd step, so the probed bits do not repeat early
+}
+
+bool SeenFilter::containedIn(uint8_t generation, uint32_t h1,
+                             uint32_t h2) const {
+    const std::atomic<uint32_t>* words =
+        &bits[(size_t)generation * wordsPerGeneration];
+    for (uint8_t i = 0; i < numHashes; i++) {
+        uint32_t bit = (h1 + i * h2) % bitsPerGeneration;
+        if ((words[bit / 32].load(std::memory_order_relaxed) &
+             (1u << (bit % 32))) == 0)
+            return false;
+    }
+    return true;
+}
+
+void SeenFilter::setBits(uint32_t h1, uint32_t h2) {
+    uint8_t generation = current.load(std::memory_order_acquire);
+    std::atomic<uint32_t>* words =
+        &bits[(size_t)generation * wordsPerGeneration];
+    for (uint8_t i = 0; i < numHashes; i++) {
+        uint32_t bit = (h1 + i * h2) % bitsPerGeneration;
+        words[bit / 32].fetch_or(1u << (bit % 32), std::memory_order_relaxed);
+    }
+    currentCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SeenFilter::rotate() {
+    // the oldest generation is the one following the current one in the ring, it is cleared before it becomes the current one, so no insert is lost
+    uint8_t next = (current.load(std::memory_order_relaxed) + 1) % generations;
+    for (size_t i = (size_t)next * wordsPerGeneration;
+         i < (size_t)(next + 1) * wordsPerGeneration; i++)
+        bits[i].store(0, std::memory_order_relaxed);
+    currentCount.store(0, std::memory_order_relaxed);
+    current.store(next, std::memory_order_release);
+}
+
+void SeenFilter::rotateIfNeeded() {
+    // only one caller checks the rotation, the others continue with the current generation
+    if (rotating.test_and_set(std::memory_order_acquire))
+        return;
+    uint64_t now = DTN7::nowMs();
+
+    // rotate once per elapsed period, if all generations expired everything is cleared and the period restarts now
+    uint8_t rotations = 0;
+    while (now - generationStart >= rotationPeriod) {
+        if (++rotations > generations) {
+            generationStart = now;
+            break;
+        }
+        rotate();
+        generationStart += rotationPeriod;
+    }
+
+    // rotate early if the current generation is full, to keep the false positive rate bounded
+    if (currentCount.load(std::memory_order_relaxed) >= generationCapacity) {
+        ESP_LOGW("SeenFilter",
+                 "generation full before rotation period ended, rotating "
+                 "early; consider increasing the filter capacity");
+        rotate();
+        generationStart = now;
+    }
+    rotating.clear(std::memory_order_release);
+}
+
+bool SeenFilter::contains(const std::string& id) {
+    rotateIfNeeded();
+    uint32_t h1, h2;
+    baseHashes(id, h1, h2);
+    for (uint8_t g = 0; g < generations; g++) {
+        if (containedIn(g, h1, h2))
+            return true;
+    }
+    return false;
+}
+
+void SeenFilter::insert(const std::string& id) {
+    rotateIfNeeded();
+    uint32_t h1, h2;
+    baseHashes(id, h1, h2);
+    setBits(h1, h2);
+}
+
+bool SeenFilter::checkAndInsert(const std::string& id) {
+    rotateIfNeeded();
+    uint32_t h1, h2;
+    baseHashes(id, h1, h2);
+
+    for (uint8_t g = 0; g < generations; g++) {
+        if (containedIn(g, h1, h2))
+            return true;
+    }
+    setBits(h1, h2);
+    return false;
+}
+
+size_t SeenFilter::memoryUsage() const {
+    return (size_t)wordsPerGeneration * generations * sizeof(uint32_t);
+}
@@ -0,0 +1,214 @@
+#include "SlabStore.hpp"
+#include <string.h>
+#include <algorithm>
+#include "BundleAllocator.hpp"
+#include "esp_log.h"
+
+// a chunk handle consists of the size class (upper 2 bits), the slab index (16 bits) and the chunk index within the slab (lower 14 bits)
+#define SLAB_HANDLE(sizeClass, slab, index) \
+    (((uint32_t)(sizeClass) << 30) | ((uint32_t)(slab) << 14) | (index))
+#define SLAB_HANDLE_CLASS(handle) ((handle) >> 30)
+#define SLAB_HANDLE_SLAB(handle) (((handle) >> 14) & 0xFFFF)
+#define SLAB_HANDLE_INDEX(handle) ((handle) & 0x3FFF)
+
+/// @brief chunk sizes of the size classes, each chunk starts with the handle of the next chunk of its chain
+static const uint16_t chunkSizes[SLAB_SIZE_CLASSES] = {64, 256, 1024};
+
+/// @brief reads the next field of a chunk
+static uint32_t getNext(const uint8_t* chunk) {
+    uint32_t next;
+    memcpy(&next, chunk, sizeof(next));
+    return next;
+}
+
+/// @brief writes the next field of a chunk
+static void setNext(uint8_t* chunk, uint32_t next) {
+    memcpy(chunk, &next, sizeof(next));
+}
+
+SlabStore::SlabStore(uint16_t chunksPerSlab) {
+    // the chunk index has to fit into the handle
+    this->chunksPerSlab = std::max<uint16_t>(1, std::min<uint16_t>(chunksPerSlab, 0x3FFF));
+    for (int i = 0; i < SLAB_SIZE_CLASSES; i++)
+        classes[i].chunkSize = chunkSizes[i];
+}
+
+SlabStore::~SlabStore() {
+    for (SizeClass& sizeClass : classes)
+        for (Slab& slab : sizeClass.slabs)
+            if (slab.memory != nullptr)
+                BundleAllocator::instance().deallocate(
+                    slab.memory, sizeClass.chunkSize * chunksPerSlab);
+}
+
+uint8_t SlabStore::nextClass(size_t remaining) const {
+    for (uint8_t i = 0; i < SLAB_SIZE_CLASSES; i++) {
+        if (payload(i) < remaining)
+            continue;
+        // a chunk less than half filled wastes more than chaining chunks of the next smaller class
+        if (i > 0 && remaining < classes[i].chunkSize / 2)
+            return i - 1;
+        return i;
+    }
+    return SLAB_SIZE_CLASSES - 1;
+}
+
+uint8_t* SlabStore::chunk(uint32_t handle) {
+    SizeClass& sizeClass = classes[SLAB_HANDLE_CLASS(handle)];
+    return sizeClass.slabs[SLAB_HANDLE_SLAB(handle)].memory +
+           (size_t)SLAB_HANDLE_INDEX(handle) * sizeClass.chunkSize;
+}
+
+uint32_t SlabStore::allocateChunk(uint8_t classIndex) {
+    SizeClass& sizeClass = classes[classIndex];
+
+    // take the chunk from the fullest slab, so that the emptier slabs can drain and be released
+    size_t chosen = SIZE_MAX;
+    for (size_t i = 0; i < sizeClass.slabs.size(); i++) {
+        const Slab& slab = sizeClass.slabs[i];
+        if (slab.memory == nullptr || slab.freeCount == 0)
+            continue;
+        if (chosen == SIZE_MAX ||
+            slab.freeCount < sizeClass.slabs[chosen].freeCount)
+            chosen = i;
+    }
+
+    if (chosen == SIZE_MAX) {
+        // no free chunk left, allocate a new slab, reusing the slot of a released one
+        for (size_t i = 0; i < sizeClass.slabs.size(); i++)
+            if (sizeClass.slabs[i].memory == nullptr) {
+                chosen = i;
+                break;
+            }
+        if (chosen == SIZE_MAX) {
+            chosen = sizeClass.slabs.size();
+            sizeClass.slabs.push_back(Slab());
+        }
+        Slab& slab = sizeClass.slabs[chosen];
+        size_t slabSize = (size_t)sizeClass.chunkSize * chunksPerSlab;
+        slab.memory = (uint8_t*)BundleAllocator::instance().allocate(slabSize);
+
+        // no memory is left, the slot stays free and can be used by a later slab
+        if (slab.memory == nullptr)
+            return SLAB_NO_CHUNK;
+        // link all chunks into the free list of the slab
+        for (uint16_t i = 0; i < chunksPerSlab; i++)
+            setNext(slab.memory + (size_t)i * sizeClass.chunkSize,
+                    i + 1 < chunksPerSlab ? i + 1 : SLAB_NO_CHUNK);
+        slab.freeHead = 0;
+        slab.freeCount = chunksPerSlab;
+        sizeClass.freeChunks += chunksPerSlab;
+        reservedBytes += slabSize;
+        ESP_LOGD("SlabStore", "allocated slab of %u bytes for chunk size %u",
+                 slabSize, sizeClass.chunkSize);
+    }
+
+    Slab& slab = sizeClass.slabs[chosen];
+    uint32_t index = slab.freeHead;
+    slab.freeHead =
+        getNext(slab.memory + (size_t)index * sizeClass.chunkSize);
+    slab.freeCount--;
+    sizeClass.freeChunks--;
+    usedBytes += sizeClass.chunkSize;
+    return SLAB_HANDLE(classIndex, chosen, index);
+}
+
+void SlabStore::freeChunk(uint32_t handle) {
+    SizeClass& sizeClass = classes[SLAB_HANDLE_CLASS(handle)];
+    Slab& slab = sizeClass.slabs[SLAB_HANDLE_SLAB(handle)];
+    setNext(chunk(handle), slab.freeHead);
+    slab.freeHead = SLAB_HANDLE_INDEX(handle);
+    slab.freeCount++;
+    sizeClass.freeChunks++;
+    usedBytes -= sizeClass.chunkSize;
+
+    // an empty slab is released, unless it holds the only free chunks of its class, which avoids allocating it again right away. While a pool exceeds its limit, it is released anyway
+    if (slab.freeCount == chunksPerSlab &&
+        (sizeClass.freeChunks > chunksPerSlab ||
+         !BundleAllocator::instance().withinLimits()))
+        releaseSlab(sizeClass, slab);
+}
+
+void SlabStore::releaseSlab(SizeClass& sizeClass, Slab& slab) {
+    size_t slabSize = (size_t)sizeClass.chunkSize * chunksPerSlab;
+    BundleAllocator::instance().deallocate(slab.memory, slabSize);
+    slab.memory = nullptr;
+    slab.freeCount = 0;
+    slab.freeHead = SLAB_NO_CHUNK;
+    sizeClass.freeChunks -= chunksPerSlab;
+    reservedBytes -= slabSize;
+}
+
+void SlabStore::releaseEmptySlabs() {
+    for (SizeClass& sizeClass : classes)
+        for (Slab& slab : sizeClass.slabs)
+            if (slab.memory != nullptr && slab.freeCount == chunksPerSlab)
+                releaseSlab(sizeClass, slab);
+}
+
+bool SlabStore::store(const uint8_t* data, size_t length, SlabRef& ref) {
+    ref = SlabRef();
+    uint8_t* previous = nullptr;
+    size_t offset = 0;
+    while (offset < length) {
+        uint8_t sizeClass = nextClass(length - offset);
+        uint32_t handle = allocateChunk(sizeClass);
+
+        // no memory for a new slab is left, the chunks taken so far are returned
+        if (handle == SLAB_NO_CHUNK) {
+            free(ref);
+            return false;
+        }
+        uint8_t* current = chunk(handle);
+        size_t count = std::min(payload(sizeClass), length - offset);
+        memcpy(current + sizeof(uint32_t), data + offset, count);
+        setNext(current, SLAB_NO_CHUNK);
+        // link the chunk to its predecessor, the handle stays valid as slabs are never moved
+        if (previous == nullptr)
+            ref.first = handle;
+        else
+            setNext(previous, handle);
+        previous = current;
+        offset += count;
+    }
+    ref.length = length;
+    storedBytes += length;
+    return true;
+}
+
+std::vector<uint8_t> SlabStore::read(const SlabRef& ref) {
+    std::vector<uint8_t> result(ref.length);
+    size_t offset = 0;
+    for (uint32_t handle = ref.first; handle != SLAB_NO_CHUNK;) {
+        const uint8_t* current = chunk(handle);
+        size_t count =
+            std::min(payload(SLAB_HANDLE_CLASS(handle)), ref.length - offset);
+        memcpy(result.data() + offset, current + sizeof(uint32_t), count);
+        offset += count;
+        handle = getNext(current);
+    }
+    return result;
+}
+
+void SlabStore::free(SlabRef& ref) {
+    uint32_t handle = ref.first;
+    while (handle != SLAB_NO_CHUNK) {
+        // the next field is overwritten when the chunk is freed
+        uint32_t next = getNext(chunk(handle));
+        freeChunk(handle);
+        handle = next;
+    }
+    storedBytes -= ref.length;
+    ref = SlabRef();
+}
+
+size_t SlabStore::chunkMemory(size_t length) const {
+    size_t result = 0;
+    size_t offset = 0;
+    while (offset < length) {
+        uint8_t sizeClass = nextClass(length - offset);
+        result += classes[sizeClass].chunkSize;
+        offset += std::min(payload(sizeClass), length - offset);
+    }
+    return result;
+}
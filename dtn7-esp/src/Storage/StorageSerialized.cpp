@@ -8,116 +8,242 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
-void InMemoryStorageSerialized::addNode(Node node) {
-    xSemaphoreTake(nodesMutex, portMAX_DELAY);
-    nodes[node.URI] = node.serialize();
-    xSemaphoreGive(nodesMutex);
-    return;
+/// @brief checks whether a bundle with a given ID was seen Before
+/// @param bundleID
+/// @return true if the bundle was seen before
+bool InMemoryStorageSerialized::checkSeen(std::string bundleID) {
+    ESP_LOGD("check Seen", "checking bundle ID: %s", bundleID.c_str());
+    return seenIds.contains(bundleID);
 }
 
-void InMemoryStorageSerialized::removeNode(std::string address) {
-    xSemaphoreTake(nodesMutex, portMAX_DELAY);
-    // nodes.insert( {node.identifier ,node});
-    nodes.erase(address);
-    xSemaphoreGive(nodesMutex);
+void InMemoryStorageSerialized::storeSeen(std::string bundleID) {
+    ESP_LOGD("store Seen", "storing bundle ID: %s", bundleID.c_str());
+    seenIds.insert(bundleID);
+    ESP_LOGI("store Seen",
+             "stored bundle ID: %s ,number of Ids in current generation: %u, "
+             "size of seen filter:%u",
+             bundleID.c_str(), seenIds.currentGenerationCount(),
+             seenIds.memoryUsage());
+    return;
 }
 
-/// @brief gets the node object for a given address, if it was seen before. Otherwise returns an empty node object.
-/// @param address address(unique identifier) to look up
-/// @return
-Node InMemoryStorageSerialized::getNode(std::string address) {
-    Node result;
-    xSemaphoreTake(nodesMutex, portMAX_DELAY);
-    if (nodes.find(address) != nodes.end())
-        result = Node(nodes.at(address));
-    xSemaphoreGive(nodesMutex);
+bool InMemoryStorageSerialized::checkAndStoreSeen(std::string bundleID) {
+    bool result = seenIds.checkAndInsert(bundleID);
+    ESP_LOGD("check and store Seen", "bundle ID: %s, seen: %d",
+             bundleID.c_str(), result);
     return result;
 }
 
-std::vector<Node> InMemoryStorageSerialized::getNodes() {
-    xSemaphoreTake(nodesMutex, portMAX_DELAY);
-    std::vector<Node> result;
-    for (std::unordered_map<std::string, std::vector<uint8_t>>::iterator it =
-             nodes.begin();
-         it != nodes.end(); ++it) {
-        result.push_back(Node(it->second));
+BundleInfo InMemoryStorageSerialized::restore(const uint8_t* data,
+                                              size_t length) {
+    if (!compressor.isEnabled())
+        return BundleInfo(data, length);
+    std::vector<uint8_t> serialized = compressor.decompress(data, length);
+    return BundleInfo(serialized.data(), serialized.size());
+}
+
+std::vector<uint8_t> InMemoryStorageSerialized::release(SlabRef ref) {
+    std::vector<uint8_t> serialized = slabs.read(ref);
+    slabs.free(ref);
+    return serialized;
+}
+
+bool InMemoryStorageSerialized::removeBundle(std::string bundleID) {
+    // the bundle is found using the ID index, no search is needed
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    auto it = bundles.find(bundleID);
+    bool result = it != bundles.end();
+    if (result) {
+        slabs.free(*it);
+        bundles.erase(it);
     }
-    xSemaphoreGive(nodesMutex);
+    xSemaphoreGive(bundlesMutex);
     return result;
 }
 
-/// @brief checks whether a bundle with a given ID was seen Before
-/// @param bundleID
-/// @return true if the bundle was seen before
-bool InMemoryStorageSerialized::checkSeen(std::string bundleID) {
-    ESP_LOGD("check Seen", "checking bundle ID: %s", bundleID.c_str());
-    bool result = false;
-    xSemaphoreTake(bundleIdMutex, portMAX_DELAY);
-    result = !(
-        bundle_ids.find(bundleID) ==
-        bundle_ids
-            .end());  // if the bundle id is found, i.e., the result of find is not a bundle's end, the bundle id is already contained
-    xSemaphoreGive(bundleIdMutex);
+bool InMemoryStorageSerialized::containsBundle(std::string bundleID) {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bool result = bundles.contains(bundleID);
+    xSemaphoreGive(bundlesMutex);
     return result;
 }
 
-void InMemoryStorageSerialized::storeSeen(std::string bundleID) {
-    ESP_LOGD("store Seen", "storing bundle ID: %s", bundleID.c_str());
-    size_t estimatedSize = sizeof(std::string);
-    xSemaphoreTake(bundleIdMutex, portMAX_DELAY);
-    bundle_ids.insert(bundleID);
-    ESP_LOGI("store Seen",
-             "stored bundle ID: %s ,number of stored Ids: %u, estimated size "
-             "of this Storage entry:%u",
-             bundleID.c_str(), bundle_ids.size(), estimatedSize);
-    xSemaphoreGive(bundleIdMutex);
-    return;
+BundleInfo InMemoryStorageSerialized::getBundle(std::string bundleID) {
+    std::vector<uint8_t> serialized;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    auto it = bundles.find(bundleID);
+    if (it != bundles.end())
+        serialized = slabs.read(*it);
+    xSemaphoreGive(bundlesMutex);
+
+    // decompress and de-serialize after releasing the mutex
+    if (serialized.empty())
+        return BundleInfo();
+    return restore(serialized.data(), serialized.size());
 }
 
-bool InMemoryStorageSerialized::removeBundle(std::string bundleID) {
+std::vector<std::string> InMemoryStorageSerialized::findBundlesTo(
+    const std::string& destination, size_t limit) {
+    std::vector<std::string> result;
     xSemaphoreTake(bundlesMutex, portMAX_DELAY);
-    for (auto it = bundles.begin(); it != bundles.end();) {
-        if (it->first == bundleID) {
-            it = bundles.erase(it);
-            break;
-        }
-        it++;
-    }
+    bundles.findByDestination(destination, result, limit);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+std::vector<std::string> InMemoryStorageSerialized::findBundlesNotForwardedTo(
+    const std::string& nodeURI, size_t limit) {
+    std::vector<std::string> result;
+    uint32_t nodeHash = BundleKeys::nodeHash(nodeURI);
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bundles.findNotForwardedTo(nodeHash, result, limit);
     xSemaphoreGive(bundlesMutex);
-    return false;
+    return result;
 }
 
-/// @brief Stores a bundle. If there is insufficient space, the oldest stored bundle is removed from storage, and returned in a vector.
+std::vector<std::string> InMemoryStorageSerialized::findBundlesMissingFrom(
+    const BundleSummary& summary, size_t limit) {
+    std::vector<std::string> result;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bundles.findMissingFrom(summary, result, limit);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+void InMemoryStorageSerialized::summarizeBundles(BundleSummary& summary) {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bundles.summarize(summary);
+    xSemaphoreGive(bundlesMutex);
+}
+
+std::vector<std::string> InMemoryStorageSerialized::findBundlesExpiringBefore(uint64_t time,
+                                                          size_t limit) {
+    std::vector<std::string> result;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bundles.findExpiringBefore(time, result, limit);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+/// @brief Stores a bundle. If there is insufficient space, bundles are removed from storage according to the eviction policy, and returned in a vector.
 /// @param bundle the bundle to be stored
-/// @return a vector containing the bundle which was deleted to make space for the new bundle
+/// @return a vector containing the bundles which were deleted to make space for the new bundle
 std::vector<BundleInfo> InMemoryStorageSerialized::delayBundle(
     BundleInfo* bundle) {
+    std::vector<uint8_t> serialized =
+        bundle->serialize();  // serialize the bundle to be stored
+    // compress the bundle before taking the mutex, it is only decompressed when it is read again
+    if (compressor.isEnabled())
+        serialized = compressor.compress(serialized.data(), serialized.size());
+    std::string id = bundle->bundle.getID();
+    // the bundle uses whole chunks of the slab store
+    size_t bundleMemory = slabs.chunkMemory(serialized.size());
+    BundleKeys keys(*bundle);
+    size_t needed = bundleMemory + bundles.entryMemory(id, keys);
+    uint64_t rank =
+        evictionPolicy->rank(BundleMetadata(*bundle, bundleMemory));
+
+    // if the budget is exceeded or not enough heap is free: remove bundles according to the eviction policy and add removed bundles to the result vector
+    bool rejected = false;
+    std::vector<BundleInfo> result = evict(needed, rank, rejected);
+    if (rejected) {
+        ESP_LOGW("delay Bundle", "bundle not stored, storage is full");
+        result.push_back(*bundle);
+        return result;
+    }
+
     size_t freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
-    std::vector<uint8_t> serialized = bundle->serialize();
-    size_t estimatedSize =
-        serialized.size() +
-        sizeof(std::pair<std::string, std::vector<uint8_t>>) +
-        bundle->bundle.getID()
-            .size();  // rough estimate of additional storage size needed for the given bundle
-    std::vector<BundleInfo> result;
+    xSemaphoreTake(bundlesMutex,
+                   portMAX_DELAY);  // bundles are modified, mutex needed
+    // a bundle stored again replaces the previous copy, whose chunks have to be freed first
+    auto previous = bundles.find(id);
+    if (previous != bundles.end()) {
+        slabs.free(*previous);
+        bundles.erase(previous);
+    }
+    // then copy it into the slab store. If no memory for its chunks is left, bundles are removed according to the eviction policy, unless the new bundle would be the next to be evicted
+    SlabRef stored;
+    std::vector<std::vector<uint8_t>> removed;
+    bool fits;
+    while (!(fits = slabs.store(serialized.data(), serialized.size(),
+                                stored)) &&
+           !bundles.empty() && bundles.nextEvictedRank() <= rank)
+        removed.push_back(release(bundles.pop_evicted()));
 
-    int i = 0;  // used to keep track of number of removed bundles
-    while ((freeHeap - estimatedSize <= CONFIG_TargetFreeHeap) &&
-           i < maxRemovedBundles) {
-        freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
-        result.push_back(deleteOldest());
-        i++;
+    // insert it into the list, the time this bundle was received, its eviction rank and its query keys are kept unserialized in the indexes
+    if (fits)
+        bundles.push_back(id, stored, bundle->bundle.receivedAt, rank,
+                          bundleMemory, std::move(keys));
+    ESP_LOGI("delay Bundle",
+             "free Heap:%u, used memory: %u of %u, num of Stored: %u, slab "
+             "fragmentation: %.2f",
+             freeHeap, bundles.memoryUsage(), memoryBudget, bundles.size(),
+             slabs.fragmentation());
+    xSemaphoreGive(bundlesMutex);
+
+    // de-serialize the removed bundles after releasing the mutex, the new bundle is returned as well if it could not be stored
+    for (const std::vector<uint8_t>& data : removed)
+        result.push_back(restore(data.data(), data.size()));
+    if (!fits) {
+        ESP_LOGW("delay Bundle", "bundle not stored, out of memory");
+        result.push_back(*bundle);
     }
-    freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    return result;
+}
+
+std::vector<BundleInfo> InMemoryStorageSerialized::evict(size_t needed, uint64_t rank,
+                                        bool& rejected) {
+    std::vector<std::vector<uint8_t>> removed;
+    size_t removedForHeap = 0;
+    rejected = false;
+
     xSemaphoreTake(bundlesMutex, portMAX_DELAY);
-    bundles.insert(bundles.end(), std::pair<std::string, std::vector<uint8_t>>(
-                                      bundle->bundle.getID(), serialized));
-    ESP_LOGI("delay Bundle",
-             "free Heap:%u, estimate of bundles with this size that could "
-             "still be stored: %u, num of Stored: %u",
-             freeHeap, (freeHeap - CONFIG_TargetFreeHeap) / (estimatedSize + 4),
-             bundles.size());
+    // empty slabs kept for later bundles are released first if a pool exceeds its limit, before any bundle is removed
+    if (!BundleAllocator::instance().withinLimits())
+        slabs.releaseEmptySlabs();
+
+    // a bundle which would not fit even if all bundles were removed is rejected without removing any
+    if ((memoryBudget != 0 && needed > memoryBudget) ||
+        heap_caps_get_free_size(MALLOC_CAP_8BIT) + bundles.memoryUsage() <
+            needed + CONFIG_TargetFreeHeap)
+        rejected = true;
+    while (!rejected && !bundles.empty()) {
+        bool overBudget = (memoryBudget != 0 &&
+                           bundles.memoryUsage() + needed > memoryBudget) ||
+                          !BundleAllocator::instance().withinLimits();
+        bool lowHeap = removedForHeap < maxRemovedBundles &&
+                       heap_caps_get_free_size(MALLOC_CAP_8BIT) <=
+                           needed + CONFIG_TargetFreeHeap;
+
+        // a started batch is completed, so that the following bundles can be stored without removing bundles again
+        if (!overBudget && !lowHeap &&
+            (removed.size() % evictionBatchSize == 0 ||
+             removed.size() >= maxRemovedBundles))
+            break;
+
+        // the new bundle would be the next to be evicted, so it is not stored
+        if ((overBudget || lowHeap) && bundles.nextEvictedRank() > rank) {
+            rejected = true;
+            break;
+        }
+        // the chunks are freed right away, empty slabs are returned to the allocator
+        removed.push_back(release(bundles.pop_evicted()));
+        if (!overBudget)
+            removedForHeap++;
+    }
+    if ((memoryBudget != 0 && bundles.memoryUsage() + needed > memoryBudget) ||
+        !BundleAllocator::instance().withinLimits())
+        rejected = true;
     xSemaphoreGive(bundlesMutex);
+
+    // de-serialize the removed bundles after releasing the mutex
+    std::vector<BundleInfo> result;
+    result.reserve(removed.size());
+    for (const std::vector<uint8_t>& serialized : removed)
+        result.push_back(restore(serialized.data(), serialized.size()));
+    if (!result.empty())
+        ESP_LOGW("InMemoryStorageSerialized::evict()", "removed %u bundles",
+                 result.size());
     return result;
 }
 
@@ -128,8 +254,14 @@ std::vector<BundleInfo> InMemoryStorageSerialized::getBundlesRetry() {
     for (int i = 0; i < CONFIG_RetryBatchSize; i++) {
         if (bundlesToReturn == 0)
             break;
-        result.push_back(BundleInfo(bundles.front().second));
-        bundles.pop_front();
+
+        // bundles can be removed during a retry cycle, the cycle ends early if none are left
+        if (bundles.empty()) {
+            bundlesToReturn = 0;
+            break;
+        }
+        std::vector<uint8_t> serialized = release(bundles.pop_front());
+        result.push_back(restore(serialized.data(), serialized.size()));
         bundlesToReturn--;
     }
 
@@ -138,28 +270,20 @@ std::vector<BundleInfo> InMemoryStorageSerialized::getBundlesRetry() {
 }
 
 BundleInfo InMemoryStorageSerialized::deleteOldest() {
-    ESP_LOGW("InMemoryStorageSerialized::deleteOldest()",
-             "searching oldest bundle");
     xSemaphoreTake(bundlesMutex, portMAX_DELAY);
-    auto oldest = bundles.begin();
-    uint64_t oldestTime = BundleInfo(oldest->second).bundle.receivedAt;
-    for (auto it = bundles.begin(); it != bundles.end(); it++) {
-        uint64_t currentAge = BundleInfo(it->second).bundle.receivedAt;
-        if (currentAge < oldestTime) {
-            oldest = it;
-            oldestTime = currentAge;
-        }
-        vTaskDelay(1);  // avoid watchdog
+    if (bundles.empty()) {
+        xSemaphoreGive(bundlesMutex);
+        return BundleInfo();
     }
 
-    BundleInfo result(oldest->second);
-    bundles.erase(oldest);
+    // the age index directly yields the oldest bundle, it does not need to be de-serialized to find it
+    std::vector<uint8_t> oldest = release(bundles.pop_oldest());
     ESP_LOGW("InMemoryStorageSerialized::deleteOldest()",
              "removed oldest bundle, num of StoredBundles:%u", bundles.size());
-    xSemaphoreGive(
-        bundlesMutex);  // give bundles mutex before calling remove bundle, as it is needed by remove bundle
+    xSemaphoreGive(bundlesMutex);
 
-    return result;
+    // de-serialize after releasing the mutex
+    return restore(oldest.data(), oldest.size());
 }
 void InMemoryStorageSerialized::beginRetryCycle() {
     xSemaphoreTake(bundlesMutex, portMAX_DELAY);
@@ -172,65 +296,190 @@ bool InMemoryStorageSerialized::hasBundlesToRetry() {
     return (bundlesToReturn != 0);
 }
 
-inline bool isXolder(uint64_t xTime, uint64_t xNum, uint64_t yTime,
-                     uint64_t yNum) {
-    if (xTime == 0) {
-        if (yTime == 0)
-            return xNum < yNum;
-        else
-            return false;  // if x has no accurate clock it is preferred
-    }
-    else if (yTime == 0)
-        return true;  // if y has no accurate clock it is preferred
-    else if (xTime == yTime)
-        return xNum < yNum;
-    else
-        return xTime < yTime;
+size_t InMemoryStorageSerialized::memoryUsage() {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    // the list counts the used chunks, the free chunks of the allocated slabs are added
+    size_t result = bundles.memoryUsage() - slabs.used() + slabs.reserved();
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+
+BundleInfo InMemoryStorageSerializedIA::restore(const uint8_t* data,
+                                                size_t length) {
+    if (!compressor.isEnabled())
+        return BundleInfo(data, length);
+    std::vector<uint8_t> serialized = compressor.decompress(data, length);
+    return BundleInfo(serialized.data(), serialized.size());
+}
+
+bool InMemoryStorageSerializedIA::removeBundle(std::string bundleID) {
+    // the bundle is found using the ID index, no search is needed
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bool result = bundles.erase(bundleID);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+bool InMemoryStorageSerializedIA::containsBundle(std::string bundleID) {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bool result = bundles.contains(bundleID);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+BundleInfo InMemoryStorageSerializedIA::getBundle(std::string bundleID) {
+    BundleBuffer serialized;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    auto it = bundles.find(bundleID);
+    if (it != bundles.end())
+        serialized = *it;
+    xSemaphoreGive(bundlesMutex);
+
+    // decompress and de-serialize after releasing the mutex
+    if (serialized.empty())
+        return BundleInfo();
+    return restore(serialized.data(), serialized.size());
+}
+
+std::vector<std::string> InMemoryStorageSerializedIA::findBundlesTo(
+    const std::string& destination, size_t limit) {
+    std::vector<std::string> result;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bundles.findByDestination(destination, result, limit);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+std::vector<std::string> InMemoryStorageSerializedIA::findBundlesNotForwardedTo(
+    const std::string& nodeURI, size_t limit) {
+    std::vector<std::string> result;
+    uint32_t nodeHash = BundleKeys::nodeHash(nodeURI);
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bundles.findNotForwardedTo(nodeHash, result, limit);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+std::vector<std::string> InMemoryStorageSerializedIA::findBundlesMissingFrom(
+    const BundleSummary& summary, size_t limit) {
+    std::vector<std::string> result;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bundles.findMissingFrom(summary, result, limit);
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
+
+void InMemoryStorageSerializedIA::summarizeBundles(BundleSummary& summary) {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bundles.summarize(summary);
+    xSemaphoreGive(bundlesMutex);
+}
+
+std::vector<std::string> InMemoryStorageSerializedIA::findBundlesExpiringBefore(uint64_t time,
+                                                          size_t limit) {
+    std::vector<std::string> result;
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    bundles.findExpiringBefore(time, result, limit);
+    xSemaphoreGive(bundlesMutex);
+    return result;
 }
 
 std::vector<BundleInfo> InMemoryStorageSerializedIA::delayBundle(
     BundleInfo* bundle) {
-    size_t freeHeap =
-        heap_caps_get_free_size(MALLOC_CAP_8BIT);  // get current free heap
-    std::vector<uint8_t> serialized =
-        bundle->serialize();  // serialize the bundle to be stored
-    size_t estimatedSize =
-        serialized.size() +
-        sizeof(
-            std::pair<std::string, std::pair<std::vector<uint8_t>, uint64_t>>) +
-        bundle->bundle.getID().size() +
-        sizeof(
-            uint64_t);  // rough estimate of additional storage size needed for the given bundle
-    std::vector<BundleInfo>
-        result;  // create a vector for old bundles which are potentially removed
-    int i = 0;   // used to keep track of number of removed bundles
-
-    // if still not enough heap is free: remove the oldest n (always maxRemovedBundles) from storage and add removed bundles to the result vector
-    while ((freeHeap - estimatedSize <= CONFIG_TargetFreeHeap) &&
-           i < maxRemovedBundles) {
-        freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
-        result.push_back(deleteOldest());
-        i++;
+    BundleBuffer serialized =
+        bundle->serializeToBuffer();  // serialize the bundle to be stored, the buffer is placed by the BundleAllocator
+    // compress the bundle before taking the mutex, it is only decompressed when it is read again
+    if (compressor.isEnabled()) {
+        std::vector<uint8_t> compressed =
+            compressor.compress(serialized.data(), serialized.size());
+        serialized = BundleBuffer(compressed.begin(), compressed.end());
     }
-    freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    std::string id = bundle->bundle.getID();
+    size_t bundleMemory = serialized.capacity();
+    BundleKeys keys(*bundle);
+    size_t needed = bundleMemory + bundles.entryMemory(id, keys);
+    uint64_t rank =
+        evictionPolicy->rank(BundleMetadata(*bundle, bundleMemory));
+
+    // if the budget is exceeded or not enough heap is free: remove bundles according to the eviction policy and add removed bundles to the result vector
+    bool rejected = false;
+    std::vector<BundleInfo> result = evict(needed, rank, rejected);
+    if (rejected) {
+        ESP_LOGW("delay Bundle", "bundle not stored, storage is full");
+        result.push_back(*bundle);
+        return result;
+    }
+
+    size_t freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
     xSemaphoreTake(bundlesMutex,
                    portMAX_DELAY);  // bundles are modified, mutex needed
-    // then insert it into the map, remember, in this case the bundles list stores a pair consisting of the bundle id and a pair consisting of the serialized bundleInfo and the time this bundle was received
-    bundles.insert(
-        bundles.end(),
-        std::pair<std::string, std::pair<std::vector<uint8_t>, uint64_t>>(
-            bundle->bundle.getID(),
-            std::pair<std::vector<uint8_t>, uint64_t>(
-                serialized, bundle->bundle.receivedAt)));
+    // then insert it into the list, the time this bundle was received, its eviction rank and its query keys are kept unserialized in the indexes
+    bundles.push_back(id, std::move(serialized), bundle->bundle.receivedAt,
+                      rank, bundleMemory, std::move(keys));
     ESP_LOGI("delay Bundle",
-             "free Heap:%u, estimate of bundles with this size that could "
-             "still be stored: %u, num of Stored: %u",
-             freeHeap, (freeHeap - CONFIG_TargetFreeHeap) / (estimatedSize + 4),
-             bundles.size());
+             "free Heap:%u, used memory: %u of %u, num of Stored: %u",
+             freeHeap, bundles.memoryUsage(), memoryBudget, bundles.size());
     xSemaphoreGive(bundlesMutex);
     return result;
 }
 
+std::vector<BundleInfo> InMemoryStorageSerializedIA::evict(size_t needed, uint64_t rank,
+                                        bool& rejected) {
+    std::vector<BundleBuffer> removed;
+    size_t removedForHeap = 0;
+    // the removed buffers are only freed after releasing the mutex, so they are subtracted from the pool usage
+    BundleAllocator& allocator = BundleAllocator::instance();
+    size_t released[2] = {0, 0};
+    rejected = false;
+
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    // a bundle which would not fit even if all bundles were removed is rejected without removing any
+    if ((memoryBudget != 0 && needed > memoryBudget) ||
+        heap_caps_get_free_size(MALLOC_CAP_8BIT) + bundles.memoryUsage() <
+            needed + CONFIG_TargetFreeHeap)
+        rejected = true;
+    while (!rejected && !bundles.empty()) {
+        bool overBudget = (memoryBudget != 0 &&
+                           bundles.memoryUsage() + needed > memoryBudget) ||
+                          !allocator.withinLimits(released);
+        bool lowHeap = removedForHeap < maxRemovedBundles &&
+                       heap_caps_get_free_size(MALLOC_CAP_8BIT) <=
+                           needed + CONFIG_TargetFreeHeap;
+
+        // a started batch is completed, so that the following bundles can be stored without removing bundles again
+        if (!overBudget && !lowHeap &&
+            (removed.size() % evictionBatchSize == 0 ||
+             removed.size() >= maxRemovedBundles))
+            break;
+
+        // the new bundle would be the next to be evicted, so it is not stored
+        if ((overBudget || lowHeap) && bundles.nextEvictedRank() > rank) {
+            rejected = true;
+            break;
+        }
+        removed.push_back(bundles.pop_evicted());
+        released[(int)allocator.poolOf(removed.back().data())] +=
+            removed.back().capacity();
+        if (!overBudget)
+            removedForHeap++;
+    }
+    if ((memoryBudget != 0 && bundles.memoryUsage() + needed > memoryBudget) ||
+        !allocator.withinLimits(released))
+        rejected = true;
+    xSemaphoreGive(bundlesMutex);
+
+    // de-serialize the removed bundles after releasing the mutex
+    std::vector<BundleInfo> result;
+    result.reserve(removed.size());
+    for (const BundleBuffer& serialized : removed)
+        result.push_back(restore(serialized.data(), serialized.size()));
+    if (!result.empty())
+        ESP_LOGW("InMemoryStorageSerializedIA::evict()", "removed %u bundles",
+                 result.size());
+    return result;
+}
+
 std::vector<BundleInfo> InMemoryStorageSerializedIA::getBundlesRetry() {
     ESP_LOGI("getBundlesRetry", "getting Bundles From Storage");
     std::vector<BundleInfo> result;
@@ -238,8 +487,14 @@ std::vector<BundleInfo> InMemoryStorageSerializedIA::getBundlesRetry() {
     for (int i = 0; i < CONFIG_RetryBatchSize; i++) {
         if (bundlesToReturn == 0)
             break;
-        result.push_back(BundleInfo(bundles.front().second.first));
-        bundles.pop_front();
+
+        // bundles can be removed during a retry cycle, the cycle ends early if none are left
+        if (bundles.empty()) {
+            bundlesToReturn = 0;
+            break;
+        }
+        BundleBuffer serialized = bundles.pop_front();
+        result.push_back(restore(serialized.data(), serialized.size()));
         bundlesToReturn--;
     }
     xSemaphoreGive(bundlesMutex);
@@ -247,27 +502,20 @@ std::vector<BundleInfo> InMemoryStorageSerializedIA::getBundlesRetry() {
 }
 
 BundleInfo InMemoryStorageSerializedIA::deleteOldest() {
-    ESP_LOGW("InMemoryStorageSerializedIA::deleteOldest()",
-             "searching oldest bundle");
     xSemaphoreTake(bundlesMutex, portMAX_DELAY);
-    auto oldest = bundles.begin();
-    uint64_t oldestTime = oldest->second.second;
-    for (auto it = bundles.begin(); it != bundles.end(); it++) {
-        uint64_t currentAge = it->second.second;
-        if (currentAge < oldestTime) {
-            oldest = it;
-            oldestTime = currentAge;
-        }
-        vTaskDelay(1);  // needed to avoid watchdog
+    if (bundles.empty()) {
+        xSemaphoreGive(bundlesMutex);
+        return BundleInfo();
     }
 
-    BundleInfo result(oldest->second.first);
-    bundles.erase(oldest);
-    ESP_LOGI("InMemoryStorageSerialized::deleteOldest()",
+    // the age index directly yields the oldest bundle
+    BundleBuffer oldest = bundles.pop_oldest();
+    ESP_LOGI("InMemoryStorageSerializedIA::deleteOldest()",
              "removed oldest bundle, num of StoredBundles:%u", bundles.size());
-    xSemaphoreGive(
-        bundlesMutex);  // give bundles mutex before calling remove bundle, as it is needed by remove bundle
-    return result;
+    xSemaphoreGive(bundlesMutex);
+
+    // de-serialize after releasing the mutex
+    return restore(oldest.data(), oldest.size());
 }
 
 void InMemoryStorageSerializedIA::beginRetryCycle() {
@@ -280,3 +528,10 @@ void InMemoryStorageSerializedIA::beginRetryCycle() {
 bool InMemoryStorageSerializedIA::hasBundlesToRetry() {
     return (bundlesToReturn != 0);
 }
+
+size_t InMemoryStorageSerializedIA::memoryUsage() {
+    xSemaphoreTake(bundlesMutex, portMAX_DELAY);
+    size_t result = bundles.memoryUsage();
+    xSemaphoreGive(bundlesMutex);
+    return result;
+}
@@ -4,24 +4,33 @@
  */
 #include "dtn7-esp.hpp"
 #include <stdio.h>
+#include <algorithm>
 #include "esp_log.h"
 
 #include "BLE_CLA.hpp"
 #include "BroadcastRouter.hpp"
+#include "BundleAllocator.hpp"
 #include "BundleProtocolAgent.hpp"
+#include "Clock.hpp"
+#include "ContactPlanRouter.hpp"
 #include "Data.hpp"
 #include "Endpoint.hpp"
 #include "EpidemicRouter.hpp"
 #include "FlashStorage.hpp"
+#include "GeoRouter.hpp"
 #include "InMemoryStorage.hpp"
 #include "LoRaCLA.hpp"
+#include "PartitionStorage.hpp"
+#include "ProphetRouter.hpp"
 #include "Router.hpp"
+#include "SprayAndWaitRouter.hpp"
 #include "Storage.hpp"
 #include "esp_mac.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "gps.h"
 #include "helpers.h"
+#include "statusReportCodes.hpp"
 
 BundleProtocolAgent* DTN7::BPA = nullptr;
 TaskHandle_t DTN7::bundleReceiverHandle = NULL;
@@ -44,6 +53,7 @@ bool DTN7::clockSynced = false;
 #endif
 
 HashWrapper* DTN7::hasher = NULL;
+LocalBundleSummary* DTN7::receivedSummary = NULL;
 int32_t DTN7::maxPeerAge = CONFIG_MaxPeerAge;
 
 /// @brief local node object of this node, including node identifier and EID list
@@ -104,9 +114,15 @@ static inline void setupClas() {
 /// @param URI the URI used for the BundleProtocolAgent
 static inline void setupClasses(std::string URI) {
     std::vector<CLA*> clas;
+    // block data, e.g. payloads, is placed by the BundleAllocator like the buffers of stored bundles
+    BundleAllocator::useForBlockData();
+
     // setup the Storage class as configured in menuconfig
 #if CONFIG_StorageType_Flash
     Storage* storage = new FlashStorage();
+#elif CONFIG_StorageType_Partition
+    ESP_LOGI("BundleProtocolAgent Setup", "Setting up PartitionStorage...");
+    Storage* storage = new PartitionStorage();
 #elif CONFIG_StorageType_InMemory
     ESP_LOGI("BundleProtocolAgent Setup", "Setting up InMemoryStorage...");
     Storage* storage = new InMemoryStorage();
@@ -132,14 +148,25 @@ static inline void setupClasses(std::string URI) {
     Router* router = new SimpleBroadcastRouter(clas, storage);
 #elif CONFIG_RouterType_SimpleEpidemic
     Router* router = new EpidemicRouter(clas, storage);
+#elif CONFIG_RouterType_SprayAndWait
+    Router* router = new SprayAndWaitRouter(clas, storage);
+#elif CONFIG_RouterType_Prophet
+    Router* router = new ProphetRouter(clas, storage);
+#elif CONFIG_RouterType_ContactPlan
+    Router* router = new ContactPlanRouter(clas, storage);
+#elif CONFIG_RouterType_Geographic
+    Router* router = new GeoRouter(clas, storage);
 #else
     ESP_LOGE("BundleProtocolAgent Setup",
              "Failed, unknown Router Type Configured");
     abort();
 #endif
-    // create the hasher class instance, only used if usage of BundleID hashes for reception confirmation is used
+    // create the hasher class instance
     DTN7::hasher = new StdHasher();
 
+    // create the summary of received bundles, only advertised if usage of bundle summaries for reception confirmation is enabled
+    DTN7::receivedSummary = new LocalBundleSummary();
+
     // create BPA instance
     DTN7::BPA = new BundleProtocolAgent(URI, storage, router);
     return;
@@ -212,6 +239,15 @@ Endpoint* DTN7::registerEndpoint(std::string URI,
     return result;
 }
 
+Endpoint* DTN7::registerEndpoint(std::string URI, DeliveryCallback onDeliver) {
+    Endpoint* result = new Endpoint(URI, onDeliver);
+
+    // register Endpoint with BPA
+    DTN7::BPA->registerEndpoint(result);
+
+    return result;
+}
+
 Endpoint* DTN7::unregisterEndpoint(std::string URI) {
     // find Pointer to endpoint to be unregistered
     std::vector<Endpoint*> endpoints = DTN7::BPA->registeredEndpoints;
@@ -238,34 +274,11 @@ Endpoint* DTN7::unregisterEndpoint(Endpoint* endpoint) {
 void DTN7::clearOldPeers() {
     ESP_LOGI("clearOldPeers", "checking peer age");
 
-    // get all known peers
-    std::vector<Node> nodes = BPA->storage->getNodes();
-
-    // create timeval struct
-    struct timeval tv_now;
-
-    // compare current time with maximum age for all peers
-    for (Node n : nodes) {
-        // get current time
-        gettimeofday(&tv_now, NULL);
-
-        // convert current time to milliseconds
-        uint64_t now =
-            ((int64_t)tv_now.tv_sec * 1000L + (int64_t)tv_now.tv_usec / 1000);
-
-        // check whether node is added staticly and not remove it
-        if (n.lastSeen == UINT64_MAX)
-            continue;
-
-        // calculate node age
-        uint64_t age =
-            (now - n.lastSeen) /
-            1000;  // last seen is always less or equal than the current time (except for staticly added nodes, but these do not get checked here), therfore a unsigned int can be used for the result
-        ESP_LOGI("clearOldPeers", "Node: %s, age:%llu, limit:%i", n.URI.c_str(),
-                 age, CONFIG_MaxPeerAge);
-        if (age > maxPeerAge)
-            BPA->storage->removeNode(n.URI);
-    }
+    // the storage keeps the nodes ordered by their age, only nodes which are older than the limit are looked at and removed. Staticly added nodes are never removed
+    size_t removed =
+        BPA->storage->expireNodes(nowMs(), (uint64_t)maxPeerAge * 1000);
+    ESP_LOGI("clearOldPeers", "removed %u nodes, limit:%lis", removed,
+             maxPeerAge);
     return;
 }
 
@@ -287,42 +300,43 @@ void DTN7::bundleReceiver(void* param) {
             // copy bundle pointer and from node from received bundle and delete received bundle
             Bundle* bundle = recBundle->bundle;
             std::string fromNode = recBundle->fromAddr;
+            uint8_t priority = recBundle->priority;
             delete recBundle;
+
+            // the bundle library sets the reception time from the system time when decoding, it is replaced by the time of the BPA's time source, which expiry, eviction and storage queries compare it to
+            bundle->receivedAt = DTN7::nowMs();
             ESP_LOGI("bundleReceiver", "receiving Bundle..., fromNode: %s",
                      fromNode.c_str());
 
             // get bundleID
             std::string bundleId = bundle->getID();
 #if CONFIG_useReceivedSet
-            // if enabled add hash of bundleID to set of revived bundleIDs of this node
-            DTN7::localNode->receivedHashes.insert(
-                DTN7::hasher->hash(bundleId));
+            // if enabled add the bundleID to the summary of received bundles of this node
+            DTN7::receivedSummary->insert(bundleId);
 #endif
             // check if the sender of node is known, i.e. the from field in the received bundle is not none and ensure to not add local node as peer
             if (fromNode != "none" && fromNode != DTN7::localNode->URI) {
-                Node stored = DTN7::BPA->storage->getNode(
-                    fromNode);  // this partially handles discovery, if a unknown node is the sender of a bundle it will be added to the nodes List
-
-                // check if node was not known
-                if (stored.URI == "none") {
+                // if the node is known, update its last seen time in place without copying it
+                NodeId storedId = DTN7::BPA->storage->findNode(fromNode);
+                if (storedId == INVALID_NODE_ID ||
+                    !DTN7::BPA->storage->touchNode(storedId, DTN7::nowMs())) {
+                    // this partially handles discovery, if a unknown node is the sender of a bundle it will be added to the nodes List
+                    Node stored;
                     stored.URI =
                         fromNode;  // now the node is known by its identifier, but not what EIDs it has
                     stored.identifier = fromNode;
+                    stored.setLastSeen();
+                    DTN7::BPA->storage->addNode(stored);
                     ESP_LOGI("bundleReceiver",
                              "Node was previously unknown, now it is stored");
+                    // forward the stored bundles the new peer has not received yet
+                    contactStarted(fromNode);
                 }
-
-                // update last seen of node to now
-                stored.setLastSeen();
-
-                // give updated node back to storage
-                DTN7::BPA->storage->addNode(stored);
             }
 
             // check if bundle with the same ID was already received and if yes, discard bundle as duplicate
-            if (!DTN7::BPA->storage->checkSeen(bundleId)) {
-                DTN7::BPA->storage->storeSeen(bundleId);
-                BPA->bundleReception(bundle, fromNode);
+            if (!DTN7::BPA->storage->checkAndStoreSeen(bundleId)) {
+                BPA->bundleReception(bundle, fromNode, priority);
                 ESP_LOGI("bundleReceiver", "finished reception");
             }
             else {
@@ -367,25 +381,30 @@ void DTN7::bundleForwarder(void* param) {
     vTaskDelete(NULL);  // delete this task safely if we get here
 }
 
+/// @brief returns the number of ticks until the router wants the stored bundles to be retried, by default the time between retries set in menuconfig
+static TickType_t retryDelay() {
+    uint64_t now = DTN7::nowMs();
+    uint64_t next = DTN7::BPA->router->nextRetry(now);
+
+    // wait at least one tick, and at most a day, so the number of ticks can not overflow. The delay is rounded up to whole ticks, so the task does not wake up before the next retry is due
+    uint64_t delay = next > now ? next - now : 0;
+    delay = std::min<uint64_t>(delay, 24ULL * 3600 * 1000);
+    return std::max<TickType_t>(
+        (delay + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS, 1);
+}
+
 void DTN7::retryBundles(void* param) {
     ESP_LOGI("bundleRetrier", "Task started");
 
     while (true) {
-#if CONFIG_NOTIFY_RETRY_TASK  // if the experimental feature to allow the retry task to be triggered externally is enabled, we need to wait for notification instead of just sleeping
-        // wait for notification to wake up retry task. If this notification does not appear, the original behavior is kept by the timeout
-        uint32_t numOfNotifies =
-            ulTaskNotifyTake(pdTRUE, (CONFIG_TimeBetweenStorageRetry * 1000) /
-                                         portTICK_PERIOD_MS);
+        // begin by waiting until the router wants stored bundles to be retried, by default the time between retries as configured in menuconfig. This is done in the beginning of the Loop in order to not start by retrying directly after setup of the task
+        // the task can be woken up earlier by a notification, e.g. when a new contact plan is loaded or, if the experimental feature is enabled, when the BLE CLA discovers a peer
+        uint32_t numOfNotifies = ulTaskNotifyTake(pdTRUE, retryDelay());
         if (numOfNotifies > 0)
             ESP_LOGI("bundleRetrier", "woken up by notification");
         else {
             ESP_LOGI("bundleRetrier", "woken up by timeout");
         }
-#else
-        // begin by waiting the time between retries as configured in menuconfig. This is done in the beginning of the Loop in order to not start by retrying directly after setup of the task
-        vTaskDelay((CONFIG_TimeBetweenStorageRetry * 1000) /
-                   portTICK_PERIOD_MS);
-#endif
 
         // log heap and stack usage for debuging
         ESP_LOGD("bundleRetrier",
@@ -403,9 +422,9 @@ void DTN7::retryBundles(void* param) {
 
         // now we retry bundles as long as ones which are to be retryted in this cycle are available. This iteration allows us to only return small batches of the stored bundles and means that at no point all bundles must be kept in memory at the same time, only the number of bundles in one batch.
         while (DTN7::BPA->storage->hasBundlesToRetry()) {
-            // we get a batch of bundles, the size of which  is determined by the storage implementation.
+            // we lease a batch of bundles, storages supporting leases keep them stored and only update their metadata afterwards, others return bundles removed from storage
             std::vector<BundleInfo> toRetry =
-                DTN7::BPA->storage->getBundlesRetry();
+                DTN7::BPA->storage->leaseBatch(CONFIG_RetryBatchSize);
 
             ESP_LOGI("bundleRetrier",
                      "Retrying Batch of Bundles, batch size:%u",
@@ -420,6 +439,10 @@ void DTN7::retryBundles(void* param) {
                     xQueueSend(DTN7::BPA->forwardQueue, (void*)&bundleHeap,
                                portMAX_DELAY);
                 }
+                else if (bundle.leased) {
+                    // an expired leased bundle is still stored and has to be removed
+                    DTN7::BPA->storage->removeBundle(bundle.bundle.getID());
+                }
                 vTaskDelay(
                     100);  // needed to avoid watchdog and to space out potentially occurring transmissions to decrease the risk of missing them due to the receiver not beeing done decoding the previous transmission
             }
@@ -457,6 +480,71 @@ void DTN7::pollClas(void* param) {
     }
 }
 
+void DTN7::contactStarted(std::string nodeURI) {
+    // routers learning from encounters are notified of every new contact
+    DTN7::BPA->router->contactStarted(nodeURI);
+
+#if CONFIG_ForwardOnContact
+    // never fill the forward queue completely, so the caller is not blocked
+    size_t limit = std::min<size_t>(
+        CONFIG_ContactBatchSize,
+        uxQueueSpacesAvailable(DTN7::BPA->forwardQueue));
+    if (limit == 0)
+        return;
+
+    // bundles destined to the peer are forwarded first, then the bundles it has not received yet
+    std::vector<std::string> ids =
+        DTN7::BPA->storage->findBundlesTo(nodeURI, limit);
+    if (ids.size() < limit) {
+        std::vector<std::string> notForwarded;
+#if CONFIG_useReceivedSet
+        // if the peer advertised a summary of the bundles it received or stores, only the bundles missing from it are forwarded
+        Node peer = DTN7::BPA->storage->getNode(nodeURI);
+        if (!peer.receivedSummary.empty())
+            notForwarded = DTN7::BPA->storage->findBundlesMissingFrom(
+                peer.receivedSummary, limit);
+        else
+#endif
+            notForwarded =
+                DTN7::BPA->storage->findBundlesNotForwardedTo(nodeURI, limit);
+        for (std::string& id : notForwarded)
+            if (ids.size() < limit &&
+                std::find(ids.begin(), ids.end(), id) == ids.end())
+                ids.push_back(std::move(id));
+    }
+    ESP_LOGI("contactStarted", "new contact: %s, bundles to forward: %u",
+             nodeURI.c_str(), ids.size());
+
+    for (const std::string& id : ids) {
+        // the bundle is leased like retried bundles, or removed if the storage does not support leases. If it was taken by the retry task in the meantime, it is already being forwarded
+        BundleInfo bundle;
+        if (!DTN7::BPA->storage->leaseBundle(id, bundle))
+            continue;
+        // as for retried bundles, expired bundles are discarded, a leased bundle is still stored and has to be removed
+        if (!checkExpiration(&bundle)) {
+            if (bundle.leased)
+                DTN7::BPA->storage->removeBundle(id);
+            continue;
+        }
+        BundleInfo* bundleHeap = new BundleInfo(bundle);
+        if (xQueueSend(DTN7::BPA->forwardQueue, (void*)&bundleHeap, 0) !=
+            pdTRUE) {
+            // the queue was filled by another task, a leased bundle stays stored, others are stored again and retried later
+            delete bundleHeap;
+            if (bundle.leased) {
+                DTN7::BPA->storage->release(id);
+                continue;
+            }
+            std::vector<BundleInfo> removed =
+                DTN7::BPA->storage->delayBundle(&bundle);
+            for (BundleInfo& b : removed)
+                DTN7::BPA->bundleDeletion(
+                    &b, BundleStatusReportReasonCodes::DEPLETED_STORAGE);
+        }
+    }
+#endif
+}
+
 bool DTN7::checkExpiration(BundleInfo* bundle) {
     // to check whether a bundle has surpassed its age limit, we first retrieve said limit from the primary block of the bundle
     uint64_t ageLimit = bundle->bundle.primaryBlock.lifetime;
@@ -469,13 +557,8 @@ bool DTN7::checkExpiration(BundleInfo* bundle) {
 #endif
     // if the bundle has a bundle age block, use this to determine the age of the bundle
     if (bundle->bundle.hasBundleAge) {
-        // the current time in order to calculate the time the bundle spent at this node
-        struct timeval tv_now;
-        gettimeofday(&tv_now, NULL);
-
-        // convert current time to miliseconds
-        uint64_t currentTime =
-            ((int64_t)tv_now.tv_sec * 1000L + (int64_t)tv_now.tv_usec / 1000);
+        // the current time in miliseconds, in order to calculate the time the bundle spent at this node
+        uint64_t currentTime = nowMs();
 
         // calculate the current age of the bundle with the following formula: current age = (time spent at this node) + age from age block
         // the time spent at this node is calculated by subtracting the time the bundle was received from the current time
@@ -507,13 +590,8 @@ bool DTN7::checkExpiration(BundleInfo* bundle) {
             uint64_t expirationTime =
                 bundle->bundle.primaryBlock.timestamp.creationTime + ageLimit;
 
-            // the current time in order to calculate the time the bundle spent at this node
-            struct timeval tv_now;
-            gettimeofday(&tv_now, NULL);
-
-            // convert current time to miliseconds
-            uint64_t currentTime = ((int64_t)tv_now.tv_sec * 1000L +
-                                    (int64_t)tv_now.tv_usec / 1000);
+            // the current time in miliseconds, in order to calculate the time the bundle spent at this node
+            uint64_t currentTime = nowMs();
 
             // check whether the expiration time has be surpassed, if yes delete the bundle with the appropriate reason code
             if (expirationTime < currentTime) {
@@ -564,6 +642,75 @@ std::string DTN7::uriFromMac() {
     return std::string("dtn://").append(macString).append("/");
 }
 
+bool DTN7::setCopyBudget(std::string destination, uint16_t copies) {
+#if CONFIG_RouterType_SprayAndWait
+    // the configured router type guarantees the type of the router
+    static_cast<SprayAndWaitRouter*>(DTN7::BPA->router)
+        ->setCopyBudget(destination, copies);
+    return true;
+#else
+    ESP_LOGW("setCopyBudget", "copy budgets are only used by the Spray and Wait "
+                              "Router");
+    return false;
+#endif
+}
+
+bool DTN7::addStaticRoute(std::string pattern, std::string nextHop,
+                          std::string cla) {
+    return DTN7::BPA->router->staticRoutes.addRoute(pattern, nextHop, cla);
+}
+
+bool DTN7::removeStaticRoute(std::string pattern) {
+    return DTN7::BPA->router->staticRoutes.removeRoute(pattern);
+}
+
+int DTN7::loadContactPlan(std::string plan) {
+#if CONFIG_RouterType_ContactPlan
+    // the configured router type guarantees the type of the router
+    size_t added = static_cast<ContactPlanRouter*>(DTN7::BPA->router)
+                       ->loadContactPlan(plan);
+
+    // the retry task recomputes when to retry the stored bundles
+    if (DTN7::storageRetryHandle != NULL)
+        xTaskNotifyGive(DTN7::storageRetryHandle);
+    return added;
+#else
+    ESP_LOGW("loadContactPlan",
+             "contact plans are only used by the Contact Plan Router");
+    return -1;
+#endif
+}
+
+bool DTN7::addContact(std::string from, std::string to, uint64_t start,
+                      uint64_t end, uint32_t rate) {
+#if CONFIG_RouterType_ContactPlan
+    // the configured router type guarantees the type of the router
+    bool added = static_cast<ContactPlanRouter*>(DTN7::BPA->router)
+                     ->addContact(from, to, start, end, rate);
+
+    // the retry task recomputes when to retry the stored bundles
+    if (added && DTN7::storageRetryHandle != NULL)
+        xTaskNotifyGive(DTN7::storageRetryHandle);
+    return added;
+#else
+    ESP_LOGW("addContact",
+             "contact plans are only used by the Contact Plan Router");
+    return false;
+#endif
+}
+
+bool DTN7::setNodePosition(std::string nodeURI, float lat, float lng) {
+#if CONFIG_RouterType_Geographic
+    // the configured router type guarantees the type of the router
+    return static_cast<GeoRouter*>(DTN7::BPA->router)
+        ->setPosition(nodeURI, lat, lng);
+#else
+    ESP_LOGW("setNodePosition",
+             "node positions are only used by the Geographic Router");
+    return false;
+#endif
+}
+
 void DTN7::addStaticPeer(Node node) {
     // the node gets the largest possible value for last seen, this value would normally only be reached after ~600 Million Years
     node.lastSeen = UINT64_MAX;